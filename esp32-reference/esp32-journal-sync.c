@@ -8,6 +8,7 @@
 #include "esp_log.h"
 #include "nvs_flash.h"
 #include "cJSON.h"
+#include "lwip/sockets.h"
 #include <string.h>
 #include "esp32-service-types.h"
 
@@ -97,22 +98,26 @@ void handle_journal_sync_message(const uint8_t *data, size_t len, struct sockadd
     char *response_str = cJSON_PrintUnformatted(response);
     if (response_str) {
         size_t msg_len = strlen(response_str);
-        uint8_t *packet = malloc(msg_len + 2);
+        uint8_t service_type = SERVICE_TYPE_JOURNAL_SYNC; // Service type 5
         
-        if (packet) {
-            packet[0] = SERVICE_TYPE_JOURNAL_SYNC; // Service type 5
-            memcpy(packet + 1, response_str, msg_len + 1);
-            
-            int sent = sendto(udp_socket, packet, msg_len + 2, 0,
-                            (struct sockaddr*)source, sizeof(struct sockaddr_in));
-                            
-            if (sent < 0) {
-                ESP_LOGE(TAG, "Failed to send journal sync response");
-            } else {
-                ESP_LOGI(TAG, "Sent %d journal entries", cJSON_GetArraySize(entries));
-            }
-            
-            free(packet);
+        // Gather the type byte and the JSON (with its terminator) in one
+        // datagram; the entries blob is not copied into a packet buffer
+        struct iovec iov[2] = {
+            { .iov_base = &service_type, .iov_len = 1 },
+            { .iov_base = response_str, .iov_len = msg_len + 1 },
+        };
+        struct msghdr msg = {
+            .msg_name = (struct sockaddr*)source,
+            .msg_namelen = sizeof(struct sockaddr_in),
+            .msg_iov = iov,
+            .msg_iovlen = 2,
+        };
+        
+        int sent = sendmsg(udp_socket, &msg, 0);
+        if (sent < 0) {
+            ESP_LOGE(TAG, "Failed to send journal sync response");
+        } else {
+            ESP_LOGI(TAG, "Sent %d journal entries", cJSON_GetArraySize(entries));
         }
         free(response_str);
     }
@@ -2,258 +2,633 @@
 // Adds proper encryption to the minimal QUICVC implementation
 
 #include "mbedtls/aes.h"
-#include "mbedtls/gcm.h"
 #include "mbedtls/entropy.h"
 #include "mbedtls/ctr_drbg.h"
+#include "mbedtls/hkdf.h"
+#include "mbedtls/md.h"
+#include "esp_cpu.h"
+#if CONFIG_MBEDTLS_HARDWARE_AES
+#include "aes/esp_aes.h"
+#endif
+#include "quicvc_protocol.h"
+#include "quicvc_aead_mbedtls.h"
 
-// Crypto context for QUICVC
-typedef struct {
-    mbedtls_gcm_context gcm;
-    uint8_t send_key[32];
+// Crypto context of one connection (quicvc_connection_t.crypto)
+// Packet protection goes through an AEAD backend whose states hold the
+// expanded key for each direction; they are keyed once and reused for
+// every packet. There is one per key phase (RFC 9001 Section 6): the
+// slot for the current phase is in use, the other holds the previous
+// generation for late packets until the next generation is precomputed
+// into it. Each connection has its own, so a handshake with one
+// controller never re-keys or resets the replay window of another
+struct quicvc_crypto {
+    const quicvc_aead_backend_t *aead;
+    void *aead_send[2];             // Indexed by key phase bit
+    void *aead_recv[2];
+    mbedtls_aes_context hp_send;    // Header protection (AES-ECB) keys,
+    mbedtls_aes_context hp_recv;    // also expanded once per connection
+    uint8_t send_key[32];           // Current generation
     uint8_t recv_key[32];
-    uint8_t send_iv[12];
-    uint8_t recv_iv[12];
+    uint8_t next_send_key[32];      // Next generation, once prepared
+    uint8_t next_recv_key[32];
+    uint8_t key_phase;              // Key phase bit of the current generation
+    bool next_keys_ready;           // Slot !key_phase holds the next generation
+    int64_t key_phase_started_us;
+    uint64_t key_phase_first_pn;    // First packet number sent in this phase
+    uint8_t send_iv[QUICVC_AEAD_NONCE_LENGTH];
+    uint8_t recv_iv[QUICVC_AEAD_NONCE_LENGTH];
     uint64_t send_counter;
     uint64_t recv_counter;
-} quicvc_crypto_t;
+    uint64_t auth_failures;         // Packets that failed to open
+    quicvc_replay_window_t replay;  // Packet numbers opened, checked before the AEAD
+    quicvc_packet_builder_t tx;     // Coalesces outgoing frames per datagram
+};
 
-static quicvc_crypto_t *crypto_ctx = NULL;
+// Longest a queued frame waits for others to share its datagram
+#define QUICVC_TX_COALESCE_US 20000
 
-// Initialize crypto context
+// How long the previous generation stays available for reordered
+// packets before its slot is reused for the next one
+#define QUICVC_KEY_RETAIN_US         (2 * 1000 * 1000)
+// Keys are updated on this schedule, or sooner after
+// QUICVC_KEY_UPDATE_PACKETS packets, well inside AES-GCM's usage limit
+#define QUICVC_KEY_UPDATE_INTERVAL_US (60LL * 60 * 1000 * 1000)
+#define QUICVC_KEY_UPDATE_PACKETS    (1u << 20)
+
+// Datagrams of a large stream send that are sealed, header-protected in
+// one batch and then sent
+#define QUICVC_TX_BATCH 4
+static uint8_t tx_batch[QUICVC_TX_BATCH][QUICVC_MAX_PACKET_SIZE];
+
+// Latency of key derivation, seal and open in CPU cycles, logged by
+// quicvc_crypto_print_stats and sent in answer to a VC_PERF query
+#ifdef CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+#define QUICVC_CPU_MHZ CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+#else
+#define QUICVC_CPU_MHZ 240
+#endif
+static quicvc_perf_histogram_t crypto_perf[QUICVC_PERF_OP_COUNT];
+
+// Record the cycles since 'start' as one sample; CCOUNT wraps at 2^32,
+// which the unsigned subtraction absorbs
+static void quicvc_crypto_perf_record(quicvc_perf_op_t op, uint32_t start) {
+    quicvc_perf_record(&crypto_perf[op], (uint32_t)(esp_cpu_get_cycle_count() - start));
+}
+
+static void quicvc_send_coalesced(const uint8_t *payload, size_t payload_len, void *ctx);
+esp_err_t quicvc_prepare_key_update(quicvc_connection_t *conn);
+esp_err_t quicvc_send_data(quicvc_connection_t *conn, uint64_t stream_id, const char *data);
+void handle_command(quicvc_connection_t *conn, uint64_t stream_id, const char *data, size_t len);
+
+// Free a connection's crypto context; the minimal layer calls this
+// before a connection's slot is reused
+static void quicvc_crypto_release(quicvc_connection_t *conn) {
+    quicvc_crypto_t *crypto = conn->crypto;
+    if (!crypto) {
+        return;
+    }
+    for (int phase = 0; phase < 2; phase++) {
+        crypto->aead->destroy(crypto->aead_send[phase]);
+        crypto->aead->destroy(crypto->aead_recv[phase]);
+    }
+    mbedtls_aes_free(&crypto->hp_send);
+    mbedtls_aes_free(&crypto->hp_recv);
+    memset(crypto, 0, sizeof(*crypto));
+    free(crypto);
+    conn->crypto = NULL;
+}
+
+// Initialize the crypto layer; contexts are created per connection by
+// quicvc_derive_keys
 esp_err_t quicvc_crypto_init(void) {
-    if (crypto_ctx) {
-        quicvc_crypto_cleanup();
+    connection_release_hook = quicvc_crypto_release;
+    return ESP_OK;
+}
+
+// Crypto context for a connection about to be keyed
+static quicvc_crypto_t *quicvc_crypto_create(quicvc_connection_t *conn) {
+    quicvc_crypto_release(conn);
+    quicvc_crypto_t *crypto = calloc(1, sizeof(quicvc_crypto_t));
+    if (!crypto) {
+        return NULL;
     }
     
-    crypto_ctx = calloc(1, sizeof(quicvc_crypto_t));
-    if (!crypto_ctx) {
-        return ESP_ERR_NO_MEM;
+    // The AES peripheral when mbedtls is configured for it
+#if CONFIG_MBEDTLS_HARDWARE_AES
+    crypto->aead = &quicvc_aead_esp32_hw;
+#else
+    crypto->aead = &quicvc_aead_mbedtls;
+#endif
+    mbedtls_aes_init(&crypto->hp_send);
+    mbedtls_aes_init(&crypto->hp_recv);
+    quicvc_packet_builder_init(&crypto->tx,
+                               QUICVC_MAX_PACKET_SIZE - QUICVC_MAX_SHORT_HEADER_SIZE - QUICVC_AEAD_TAG_LENGTH,
+                               QUICVC_TX_COALESCE_US, quicvc_send_coalesced, conn);
+    conn->crypto = crypto;
+    return crypto;
+}
+
+// (Re)key the backend states of one key phase slot
+static esp_err_t quicvc_key_slot(quicvc_crypto_t *crypto, uint8_t phase,
+                                 const uint8_t *send_key, const uint8_t *recv_key) {
+    const quicvc_aead_backend_t *aead = crypto->aead;
+    aead->destroy(crypto->aead_send[phase]);
+    aead->destroy(crypto->aead_recv[phase]);
+    crypto->aead_send[phase] = aead->create(send_key, crypto->send_iv);
+    crypto->aead_recv[phase] = aead->create(recv_key, crypto->recv_iv);
+    if (!crypto->aead_send[phase] || !crypto->aead_recv[phase]) {
+        ESP_LOGE(TAG, "Failed to key %s backend for phase %u", aead->name, phase);
+        return ESP_FAIL;
     }
-    
-    mbedtls_gcm_init(&crypto_ctx->gcm);
     return ESP_OK;
 }
 
-// Derive encryption keys from session key
-esp_err_t quicvc_derive_keys(const uint8_t *session_key, int is_server) {
-    if (!crypto_ctx) {
-        return ESP_ERR_INVALID_STATE;
+// Key a freshly created context from the session key
+static esp_err_t quicvc_key_crypto(quicvc_crypto_t *crypto, const uint8_t *session_key,
+                                   int is_server) {
+    uint32_t start = esp_cpu_get_cycle_count();
+    
+    // Separate key and IV per direction, named by the sender
+    int ret = quicvc_mbedtls_aead_derive(session_key, is_server ? "server" : "client",
+                                         crypto->send_key, crypto->send_iv);
+    if (ret == 0) {
+        ret = quicvc_mbedtls_aead_derive(session_key, is_server ? "client" : "server",
+                                         crypto->recv_key, crypto->recv_iv);
+    }
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Key derivation failed: %d", ret);
+        return ESP_FAIL;
     }
     
-    // Derive separate keys for send/receive
+    // Header protection keys
     mbedtls_sha256_context sha;
     mbedtls_sha256_init(&sha);
-    
-    // Send key
-    mbedtls_sha256_starts(&sha, 0);
-    mbedtls_sha256_update(&sha, session_key, 32);
-    mbedtls_sha256_update(&sha, (uint8_t*)(is_server ? "server-send" : "client-send"), 11);
-    mbedtls_sha256_finish(&sha, crypto_ctx->send_key);
-    
-    // Receive key
+    uint8_t hp_send_key[32];
+    uint8_t hp_recv_key[32];
     mbedtls_sha256_starts(&sha, 0);
     mbedtls_sha256_update(&sha, session_key, 32);
-    mbedtls_sha256_update(&sha, (uint8_t*)(is_server ? "client-send" : "server-send"), 11);
-    mbedtls_sha256_finish(&sha, crypto_ctx->recv_key);
+    mbedtls_sha256_update(&sha, (uint8_t*)(is_server ? "server-hp" : "client-hp"), 9);
+    mbedtls_sha256_finish(&sha, hp_send_key);
     
-    // IVs
     mbedtls_sha256_starts(&sha, 0);
     mbedtls_sha256_update(&sha, session_key, 32);
-    mbedtls_sha256_update(&sha, (uint8_t*)"iv-material", 11);
-    uint8_t iv_material[32];
-    mbedtls_sha256_finish(&sha, iv_material);
-    
-    memcpy(crypto_ctx->send_iv, iv_material, 12);
-    memcpy(crypto_ctx->recv_iv, &iv_material[12], 12);
+    mbedtls_sha256_update(&sha, (uint8_t*)(is_server ? "client-hp" : "server-hp"), 9);
+    mbedtls_sha256_finish(&sha, hp_recv_key);
     
     mbedtls_sha256_free(&sha);
-    
-    // Setup GCM for sending
-    int ret = mbedtls_gcm_setkey(&crypto_ctx->gcm, MBEDTLS_CIPHER_ID_AES, 
-                                crypto_ctx->send_key, 256);
+    quicvc_replay_window_init(&crypto->replay);
+    crypto->key_phase = 0;
+    crypto->next_keys_ready = false;
+    crypto->key_phase_started_us = esp_timer_get_time();
+    crypto->key_phase_first_pn = 0;
+    
+    // Key both directions of phase 0
+    ret = quicvc_key_slot(crypto, 0, crypto->send_key, crypto->recv_key) == ESP_OK ? 0 : -1;
+    if (ret == 0) {
+        ret = mbedtls_aes_setkey_enc(&crypto->hp_send, hp_send_key, 256);
+    }
+    if (ret == 0) {
+        ret = mbedtls_aes_setkey_enc(&crypto->hp_recv, hp_recv_key, 256);
+    }
+    memset(hp_send_key, 0, sizeof(hp_send_key));
+    memset(hp_recv_key, 0, sizeof(hp_recv_key));
     if (ret != 0) {
-        ESP_LOGE(TAG, "Failed to set GCM key: %d", ret);
+        ESP_LOGE(TAG, "Failed to set header protection key: %d", ret);
         return ESP_FAIL;
     }
     
+    quicvc_crypto_perf_record(QUICVC_PERF_KEY_DERIVATION, start);
     return ESP_OK;
 }
 
-// Encrypt packet payload
-esp_err_t quicvc_encrypt_packet(const uint8_t *plaintext, size_t plain_len,
-                               uint8_t *ciphertext, size_t *cipher_len,
-                               uint64_t packet_number) {
-    if (!crypto_ctx) {
+// Derive a connection's encryption keys from its session key. On failure
+// the connection is left with no crypto context rather than a half-keyed
+// one
+esp_err_t quicvc_derive_keys(quicvc_connection_t *conn, const uint8_t *session_key, int is_server) {
+    if (!conn) {
         return ESP_ERR_INVALID_STATE;
     }
+    quicvc_crypto_t *crypto = quicvc_crypto_create(conn);
+    if (!crypto) {
+        return ESP_ERR_NO_MEM;
+    }
     
-    // Prepare nonce (IV + packet number)
-    uint8_t nonce[12];
-    memcpy(nonce, crypto_ctx->send_iv, 12);
-    for (int i = 0; i < 8; i++) {
-        nonce[11 - i] ^= (packet_number >> (i * 8)) & 0xFF;
+    // Nothing is retained at the start, so phase 1 can be keyed now
+    // (timed as a derivation of its own)
+    esp_err_t err = quicvc_key_crypto(crypto, session_key, is_server);
+    if (err == ESP_OK) {
+        err = quicvc_prepare_key_update(conn);
+    }
+    if (err != ESP_OK) {
+        quicvc_crypto_release(conn);
+    }
+    return err;
+}
+
+// Key update (RFC 9001 Section 6)
+// Each generation's keys are HKDF-Expand of the previous ones; the IVs
+// and header protection keys stay the same. The next generation is
+// expanded ahead of time into the idle slot, so switching phase is a bit
+// flip with no key setup on the packet path.
+
+static int quicvc_next_key(const uint8_t *key, uint8_t *next_key) {
+    static const uint8_t label[] = "quicvc ku";
+    return mbedtls_hkdf_expand(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256),
+                               key, 32, label, sizeof(label) - 1, next_key, 32);
+}
+
+// Precompute the next generation into slot !key_phase
+esp_err_t quicvc_prepare_key_update(quicvc_connection_t *conn) {
+    quicvc_crypto_t *crypto = conn ? conn->crypto : NULL;
+    if (!crypto) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (crypto->next_keys_ready) {
+        return ESP_OK;
     }
     
-    // Encrypt with AES-GCM
-    uint8_t tag[16];
-    int ret = mbedtls_gcm_crypt_and_tag(&crypto_ctx->gcm,
-                                        MBEDTLS_GCM_ENCRYPT,
-                                        plain_len,
-                                        nonce, 12,
-                                        NULL, 0,  // No additional data
-                                        plaintext,
-                                        ciphertext,
-                                        16, tag);
+    uint32_t start = esp_cpu_get_cycle_count();
+    uint8_t next = crypto->key_phase ^ 1;
+    int ret = quicvc_next_key(crypto->send_key, crypto->next_send_key);
+    if (ret == 0) {
+        ret = quicvc_next_key(crypto->recv_key, crypto->next_recv_key);
+    }
+    if (ret == 0 && quicvc_key_slot(crypto, next, crypto->next_send_key,
+                                    crypto->next_recv_key) != ESP_OK) {
+        ret = -1;
+    }
     if (ret != 0) {
-        ESP_LOGE(TAG, "Encryption failed: %d", ret);
+        ESP_LOGE(TAG, "Failed to prepare next keys: %d", ret);
         return ESP_FAIL;
     }
     
-    // Append tag to ciphertext
-    memcpy(ciphertext + plain_len, tag, 16);
-    *cipher_len = plain_len + 16;
+    crypto->next_keys_ready = true;
+    quicvc_crypto_perf_record(QUICVC_PERF_KEY_DERIVATION, start);
+    return ESP_OK;
+}
+
+// Switch both directions to the prepared generation
+static void quicvc_commit_key_update(quicvc_crypto_t *crypto, uint64_t next_pn) {
+    crypto->key_phase ^= 1;
+    memcpy(crypto->send_key, crypto->next_send_key, 32);
+    memcpy(crypto->recv_key, crypto->next_recv_key, 32);
+    memset(crypto->next_send_key, 0, 32);
+    memset(crypto->next_recv_key, 0, 32);
+    crypto->next_keys_ready = false;
+    crypto->key_phase_started_us = esp_timer_get_time();
+    crypto->key_phase_first_pn = next_pn;
+    ESP_LOGI(TAG, "Key update: now in phase %u", crypto->key_phase);
+}
+
+// Start a key update; allowed once the peer has acknowledged a packet
+// sent in the current phase and the next generation is ready
+esp_err_t quicvc_initiate_key_update(quicvc_connection_t *conn) {
+    quicvc_crypto_t *crypto = conn ? conn->crypto : NULL;
+    if (!crypto || !crypto->next_keys_ready ||
+        conn->largest_acked == QUICVC_PACKET_NUMBER_NONE ||
+        conn->largest_acked < crypto->key_phase_first_pn) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    quicvc_commit_key_update(crypto, conn->packet_number);
+    return ESP_OK;
+}
+
+// Run a batch through the backend state of each packet's key phase;
+// consecutive packets of one phase go to the backend as one batch
+static size_t quicvc_run_batch(quicvc_crypto_t *crypto, bool seal,
+                               quicvc_aead_packet_t *packets, size_t count) {
+    const quicvc_aead_backend_t *aead = crypto->aead;
+    size_t done = 0;
+    for (size_t start = 0; start < count; ) {
+        bool phase = packets[start].packet[0] & QUICVC_KEY_PHASE_BIT;
+        size_t end = start + 1;
+        while (end < count && (bool)(packets[end].packet[0] & QUICVC_KEY_PHASE_BIT) == phase) {
+            end++;
+        }
+        
+        void *state = seal ? crypto->aead_send[phase] : crypto->aead_recv[phase];
+        if (state) {
+            done += seal ? aead->seal_batch(state, &packets[start], end - start)
+                         : aead->open_batch(state, &packets[start], end - start);
+        } else {
+            for (size_t i = start; i < end; i++) {
+                packets[i].ok = false;
+            }
+        }
+        start = end;
+    }
+    return done;
+}
+
+// Seal 'count' datagrams; each packet's 'ok' records its result and the
+// header's key phase bit picks the generation. Returns the number sealed
+size_t quicvc_seal_batch(quicvc_connection_t *conn, quicvc_aead_packet_t *packets, size_t count) {
+    quicvc_crypto_t *crypto = conn ? conn->crypto : NULL;
+    if (!crypto) {
+        return 0;
+    }
+    uint32_t start = esp_cpu_get_cycle_count();
+    size_t sealed = quicvc_run_batch(crypto, true, packets, count);
+    quicvc_crypto_perf_record(count > 1 ? QUICVC_PERF_SEAL_BATCH : QUICVC_PERF_SEAL, start);
+    crypto->send_counter += sealed;
+    return sealed;
+}
+
+// Open 'count' datagrams. A packet that fails authentication only clears
+// its own 'ok'. Returns the number that authenticated
+size_t quicvc_open_batch(quicvc_connection_t *conn, quicvc_aead_packet_t *packets, size_t count) {
+    quicvc_crypto_t *crypto = conn ? conn->crypto : NULL;
+    if (!crypto) {
+        return 0;
+    }
+    uint32_t start = esp_cpu_get_cycle_count();
+    size_t opened = quicvc_run_batch(crypto, false, packets, count);
+    quicvc_crypto_perf_record(count > 1 ? QUICVC_PERF_OPEN_BATCH : QUICVC_PERF_OPEN, start);
+    crypto->recv_counter += opened;
+    return opened;
+}
+
+// Seal a datagram whose header is already at packet[0..header_len):
+// the payload gathered from 'iov' is encrypted to packet[header_len],
+// the header is authenticated as AAD and the tag lands right after the
+// ciphertext. An iovec may point at packet[header_len] itself to
+// encrypt in place
+esp_err_t quicvc_seal_packet_iov(quicvc_connection_t *conn,
+                                 uint8_t *packet, size_t header_len, size_t packet_size,
+                                 const quicvc_iovec_t *iov, size_t iov_count,
+                                 uint64_t packet_number, size_t *packet_len) {
+    if (!conn || !conn->crypto || header_len == 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    quicvc_aead_packet_t p = {
+        .packet = packet,
+        .header_len = header_len,
+        .packet_size = packet_size,
+        .iov = iov,
+        .iov_count = iov_count,
+        .packet_number = packet_number,
+    };
+    if (quicvc_seal_batch(conn, &p, 1) != 1) {
+        ESP_LOGE(TAG, "Encryption failed");
+        return ESP_FAIL;
+    }
     
-    crypto_ctx->send_counter++;
+    *packet_len = p.packet_len;
     return ESP_OK;
 }
 
-// Decrypt packet payload
-esp_err_t quicvc_decrypt_packet(const uint8_t *ciphertext, size_t cipher_len,
-                               uint8_t *plaintext, size_t *plain_len,
-                               uint64_t packet_number) {
-    if (!crypto_ctx || cipher_len < 16) {
+// Seal a datagram in place: header at packet[0..header_len), plaintext
+// payload right behind it
+esp_err_t quicvc_seal_packet(quicvc_connection_t *conn,
+                             uint8_t *packet, size_t header_len, size_t payload_len,
+                             size_t packet_size, uint64_t packet_number, size_t *packet_len) {
+    if (header_len > packet_size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    quicvc_iovec_t iov = { &packet[header_len], payload_len };
+    return quicvc_seal_packet_iov(conn, packet, header_len, packet_size, &iov, 1,
+                                  packet_number, packet_len);
+}
+
+// Open a datagram in place: the header is checked as AAD and the payload
+// at packet[header_len] is replaced by its plaintext. Keys are chosen by
+// the (unprotected) key phase bit
+esp_err_t quicvc_open_packet(quicvc_connection_t *conn,
+                             uint8_t *packet, size_t header_len, size_t packet_len,
+                             uint64_t packet_number, size_t *payload_len) {
+    if (!conn || !conn->crypto || header_len == 0) {
         return ESP_ERR_INVALID_ARG;
     }
     
-    // Setup GCM for receiving
-    mbedtls_gcm_context recv_gcm;
-    mbedtls_gcm_init(&recv_gcm);
-    int ret = mbedtls_gcm_setkey(&recv_gcm, MBEDTLS_CIPHER_ID_AES,
-                                crypto_ctx->recv_key, 256);
-    if (ret != 0) {
-        mbedtls_gcm_free(&recv_gcm);
+    quicvc_aead_packet_t p = {
+        .packet = packet,
+        .header_len = header_len,
+        .packet_len = packet_len,
+        .packet_number = packet_number,
+    };
+    if (quicvc_open_batch(conn, &p, 1) != 1) {
+        ESP_LOGE(TAG, "Decryption failed");
         return ESP_FAIL;
     }
     
-    // Prepare nonce
-    uint8_t nonce[12];
-    memcpy(nonce, crypto_ctx->recv_iv, 12);
-    for (int i = 0; i < 8; i++) {
-        nonce[11 - i] ^= (packet_number >> (i * 8)) & 0xFF;
+    *payload_len = p.payload_len;
+    return ESP_OK;
+}
+
+// Header protection masks for 'count' samples in one pass over an
+// already expanded key
+static esp_err_t quicvc_hp_masks(mbedtls_aes_context *hp, const uint8_t *const *samples,
+                                 size_t count, uint8_t (*masks)[QUICVC_HP_MASK_LENGTH]) {
+    esp_err_t err = ESP_OK;
+    // Hold the AES peripheral across the batch, as the AEAD backend does,
+    // so each block re-enters its lock instead of acquiring it
+#if CONFIG_MBEDTLS_HARDWARE_AES
+    esp_aes_acquire_hardware();
+#endif
+    for (size_t i = 0; err == ESP_OK && i < count; i++) {
+        uint8_t block[16];
+        if (mbedtls_aes_crypt_ecb(hp, MBEDTLS_AES_ENCRYPT, samples[i], block) != 0) {
+            err = ESP_FAIL;
+        } else {
+            memcpy(masks[i], block, QUICVC_HP_MASK_LENGTH);
+        }
+    }
+#if CONFIG_MBEDTLS_HARDWARE_AES
+    esp_aes_release_hardware();
+#endif
+    return err;
+}
+
+// Apply header protection to up to QUICVC_TX_BATCH sealed datagrams:
+// all samples are gathered first so the masks come from one batch
+esp_err_t quicvc_protect_headers(quicvc_connection_t *conn,
+                                 uint8_t *const *packets, const size_t *packet_lens,
+                                 const size_t *pn_offsets, size_t count) {
+    if (!conn || !conn->crypto || count > QUICVC_TX_BATCH) {
+        return ESP_ERR_INVALID_ARG;
     }
     
-    // Decrypt
-    size_t data_len = cipher_len - 16;
-    ret = mbedtls_gcm_auth_decrypt(&recv_gcm,
-                                   data_len,
-                                   nonce, 12,
-                                   NULL, 0,  // No additional data
-                                   ciphertext + data_len, 16,  // Tag at end
-                                   ciphertext,
-                                   plaintext);
-    
-    mbedtls_gcm_free(&recv_gcm);
+    const uint8_t *samples[QUICVC_TX_BATCH];
+    uint8_t masks[QUICVC_TX_BATCH][QUICVC_HP_MASK_LENGTH];
+    for (size_t i = 0; i < count; i++) {
+        samples[i] = quicvc_header_protection_sample(packets[i], packet_lens[i], pn_offsets[i]);
+        if (!samples[i]) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
     
-    if (ret != 0) {
-        ESP_LOGE(TAG, "Decryption failed: %d", ret);
+    if (quicvc_hp_masks(&conn->crypto->hp_send, samples, count, masks) != ESP_OK) {
         return ESP_FAIL;
     }
-    
-    *plain_len = data_len;
-    crypto_ctx->recv_counter++;
+    for (size_t i = 0; i < count; i++) {
+        quicvc_protect_header(packets[i], packet_lens[i], pn_offsets[i], masks[i]);
+    }
     return ESP_OK;
 }
 
+// PADDING needed so the header protection sample lies inside the
+// ciphertext: packet number plus payload must be at least 4 bytes
+static size_t quicvc_hp_padding(size_t payload_len, uint8_t pn_len) {
+    size_t covered = payload_len + pn_len;
+    return covered < QUICVC_HP_SAMPLE_OFFSET ? QUICVC_HP_SAMPLE_OFFSET - covered : 0;
+}
+
+static const uint8_t hp_padding[QUICVC_HP_SAMPLE_OFFSET] = { 0 };
+
 // Build encrypted QUICVC packet
 esp_err_t quicvc_build_encrypted_packet(quicvc_connection_t *conn,
                                        const uint8_t *payload, size_t payload_len,
                                        uint8_t *packet, size_t *packet_len) {
-    if (!conn || conn->state != 2) {
+    if (!conn || conn->state != 2 || !conn->crypto) {
         return ESP_ERR_INVALID_STATE;
     }
     
-    size_t offset = 0;
-    
-    // Header
-    packet[offset++] = QUICVC_PROTECTED;
-    
-    // Version
-    uint32_t version = htonl(QUICVC_VERSION);
-    memcpy(&packet[offset], &version, 4);
-    offset += 4;
-    
-    // Connection IDs
-    packet[offset++] = CONNECTION_ID_LEN;
-    packet[offset++] = CONNECTION_ID_LEN;
-    memcpy(&packet[offset], conn->dcid, CONNECTION_ID_LEN);
-    offset += CONNECTION_ID_LEN;
-    memcpy(&packet[offset], conn->scid, CONNECTION_ID_LEN);
-    offset += CONNECTION_ID_LEN;
-    
-    // Packet number
+    // Short header: flags, peer's CID, packet number
     uint64_t pkt_num = conn->packet_number++;
-    memcpy(&packet[offset], &pkt_num, 8);
-    offset += 8;
-    
-    // Encrypt payload
-    size_t encrypted_len;
-    esp_err_t err = quicvc_encrypt_packet(payload, payload_len,
-                                         &packet[offset], &encrypted_len,
-                                         pkt_num);
+    quicvc_header_t hdr = {
+        .dcid = conn->dcid,
+        .dcid_len = conn->dcid_len,
+        .packet_number = pkt_num,
+        .packet_number_len = quicvc_packet_number_length(pkt_num, conn->largest_acked),
+        .key_phase = conn->crypto->key_phase,
+    };
+    size_t offset = quicvc_write_short_header(&hdr, packet, QUICVC_MAX_PACKET_SIZE);
+    if (offset == 0) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    
+    // Encrypt the payload straight into the datagram behind its header
+    quicvc_iovec_t iov[2] = {
+        { payload, payload_len },
+        { hp_padding, quicvc_hp_padding(payload_len, hdr.packet_number_len) },
+    };
+    esp_err_t err = quicvc_seal_packet_iov(conn, packet, offset, QUICVC_MAX_PACKET_SIZE, iov, 2,
+                                           pkt_num, packet_len);
     if (err != ESP_OK) {
         return err;
     }
     
-    *packet_len = offset + encrypted_len;
-    return ESP_OK;
+    size_t pn_offset = offset - hdr.packet_number_len;
+    return quicvc_protect_headers(conn, &packet, packet_len, &pn_offset, 1);
 }
 
-// Handle encrypted packet
+// Handle encrypted packet; 'packet' is the whole short-header datagram
+// as received. Header protection is removed and the payload decrypted in
+// place, so frames point into the receive buffer
 esp_err_t quicvc_handle_encrypted_packet(quicvc_connection_t *conn,
-                                        const uint8_t *packet, size_t packet_len,
-                                        uint64_t packet_number) {
-    if (!conn || conn->state != 2) {
+                                        uint8_t *packet, size_t packet_len) {
+    quicvc_crypto_t *crypto = conn ? conn->crypto : NULL;
+    if (!crypto || conn->state != 2) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    // The packet number offset is known before the header is unmasked
+    quicvc_header_parse_result_t parsed = quicvc_parse_header(packet, packet_len, CONNECTION_ID_LEN);
+    if (parsed.bytes_consumed == 0 || parsed.header.is_long) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t pn_offset = parsed.header.packet_number_offset;
+    const uint8_t *sample = quicvc_header_protection_sample(packet, packet_len, pn_offset);
+    uint8_t mask[1][QUICVC_HP_MASK_LENGTH];
+    if (!sample || quicvc_hp_masks(&crypto->hp_recv, &sample, 1, mask) != ESP_OK ||
+        quicvc_unprotect_header(packet, packet_len, pn_offset, mask[0]) == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    // Now the PN length bits are real
+    parsed = quicvc_parse_header(packet, packet_len, CONNECTION_ID_LEN);
+    uint64_t packet_number = quicvc_decode_packet_number(quicvc_replay_expected_pn(&crypto->replay),
+                                                         parsed.header.packet_number,
+                                                         parsed.header.packet_number_len);
+    
+    // Retransmitted and stale packets are dropped before any AEAD work
+    quicvc_replay_status_t replay = quicvc_replay_check(&crypto->replay, packet_number);
+    if (replay != QUICVC_REPLAY_OK) {
+        ESP_LOGD(TAG, "Dropped %s packet %llu",
+                 replay == QUICVC_REPLAY_DUPLICATE ? "duplicate" : "stale",
+                 (unsigned long long)packet_number);
         return ESP_ERR_INVALID_STATE;
     }
     
     // Decrypt payload
-    uint8_t plaintext[1024];
+    size_t header_len = parsed.header.header_len;
     size_t plain_len;
-    esp_err_t err = quicvc_decrypt_packet(packet, packet_len,
-                                         plaintext, &plain_len,
-                                         packet_number);
+    esp_err_t err = quicvc_open_packet(conn, packet, header_len, packet_len,
+                                       packet_number, &plain_len);
     if (err != ESP_OK) {
+        crypto->auth_failures++;
         ESP_LOGE(TAG, "Failed to decrypt packet");
         return err;
     }
+    quicvc_replay_update(&crypto->replay, packet_number);
     
-    // Process decrypted frames
-    if (plain_len > 0) {
-        uint8_t frame_type = plaintext[0];
-        const uint8_t *frame_data = &plaintext[1];
-        size_t frame_len = plain_len - 1;
-        
-        switch (frame_type) {
-            case FRAME_HEARTBEAT:
+    // A packet in the other phase that opened with the prepared keys
+    // means the peer updated; follow it. With nothing prepared, the other
+    // slot holds the previous generation and this was a late packet
+    if (parsed.header.key_phase != crypto->key_phase && crypto->next_keys_ready) {
+        quicvc_commit_key_update(crypto, conn->packet_number);
+    }
+    
+    // Process decrypted frames in one pass
+    quicvc_frame_iter_t iter;
+    quicvc_frame_t frame;
+    quicvc_frame_iter_init(&iter, &packet[header_len], plain_len);
+
+    while (quicvc_frame_iter_next(&iter, &frame)) {
+        switch (frame.type) {
+            case QUICVC_FRAME_HEARTBEAT:
                 ESP_LOGD(TAG, "Decrypted heartbeat");
                 break;
-                
-            case FRAME_DATA:
-                ESP_LOGI(TAG, "Decrypted data: %.*s", (int)frame_len, frame_data);
-                // Handle commands here
-                handle_command((const char*)frame_data, frame_len);
+
+            case QUICVC_FRAME_PADDING:
+            case QUICVC_FRAME_PING:
                 break;
-                
+
+            case QUICVC_FRAME_ACK:
+            case QUICVC_FRAME_ACK_ECN:
+                // Gates scheduled key updates and shortens packet numbers
+                if (conn->largest_acked == QUICVC_PACKET_NUMBER_NONE ||
+                    frame.u.ack.largest_acknowledged > conn->largest_acked) {
+                    conn->largest_acked = frame.u.ack.largest_acknowledged;
+                }
+                break;
+
+            case QUICVC_FRAME_VC_PERF:
+                // An empty body asks for our report; it leaves with the flush below
+                if (frame.u.vc.body_len == 0) {
+                    uint8_t report[QUICVC_PERF_FRAME_SIZE];
+                    size_t report_len = quicvc_perf_write_frame(crypto_perf, QUICVC_CPU_MHZ,
+                                                                report, sizeof(report));
+                    quicvc_packet_builder_add(&crypto->tx, report, report_len,
+                                              esp_timer_get_time());
+                }
+                break;
+
             default:
-                ESP_LOGW(TAG, "Unknown frame type: 0x%02x", frame_type);
+                if ((frame.type & 0xF8) == QUICVC_FRAME_STREAM) {
+                    ESP_LOGI(TAG, "Decrypted data: %.*s",
+                             (int)frame.u.stream.data_len, frame.u.stream.data);
+                    // Handle commands here
+                    handle_command(conn, frame.u.stream.stream_id,
+                                   (const char*)frame.u.stream.data, frame.u.stream.data_len);
+                } else {
+                    ESP_LOGW(TAG, "Unhandled frame type: 0x%02x", frame.type);
+                }
         }
     }
+
+    if (iter.error) {
+        ESP_LOGW(TAG, "Malformed frame at offset %u", (unsigned)iter.offset);
+    }
     
+    // Responses to every command in this packet leave in one datagram
+    quicvc_packet_builder_flush(&crypto->tx);
     return ESP_OK;
 }
 
-// Example command handler
-void handle_command(const char *data, size_t len) {
+// Example command handler; replies go out on the command's stream
+void handle_command(quicvc_connection_t *conn, uint64_t stream_id, const char *data, size_t len) {
     cJSON *cmd = cJSON_ParseWithLength(data, len);
     if (!cmd) {
         ESP_LOGE(TAG, "Failed to parse command");
@@ -274,7 +649,7 @@ void handle_command(const char *data, size_t len) {
                 snprintf(response, sizeof(response), 
                         "{\"type\":\"led_response\",\"state\":\"%s\"}", 
                         led_on ? "on" : "off");
-                quicvc_send_data(response);
+                quicvc_send_data(conn, stream_id, response);
             }
         }
     }
@@ -282,42 +657,202 @@ void handle_command(const char *data, size_t len) {
     cJSON_Delete(cmd);
 }
 
-// Send encrypted data
-esp_err_t quicvc_send_data(const char *data) {
-    if (!active_connection || active_connection->state != 2) {
-        return ESP_ERR_INVALID_STATE;
+// Encrypt and send one coalesced payload of the connection 'ctx'
+// (packet builder flush callback)
+static void quicvc_send_coalesced(const uint8_t *payload, size_t payload_len, void *ctx) {
+    quicvc_connection_t *conn = ctx;
+    if (conn->state != 2) {
+        return;
     }
     
-    // Build data frame
-    uint8_t frame[512];
-    frame[0] = FRAME_DATA;
-    size_t data_len = strlen(data);
-    memcpy(&frame[1], data, data_len);
-    
-    // Build and send encrypted packet
-    uint8_t packet[1024];
+    uint8_t packet[QUICVC_MAX_PACKET_SIZE];
     size_t packet_len;
-    esp_err_t err = quicvc_build_encrypted_packet(active_connection,
-                                                 frame, data_len + 1,
+    esp_err_t err = quicvc_build_encrypted_packet(conn, payload, payload_len,
                                                  packet, &packet_len);
     if (err != ESP_OK) {
-        return err;
+        ESP_LOGE(TAG, "Failed to build packet: %d", err);
+        return;
     }
     
-    // Send to peer
-    struct sockaddr_in peer_addr;
-    // Note: You'll need to store peer address from initial connection
+    sendto(quicvc_socket, packet, packet_len, 0,
+           (struct sockaddr*)&conn->peer_addr, sizeof(struct sockaddr_in));
+}
+
+// Queue encrypted data; it is sent with other frames on flush or after
+// QUICVC_TX_COALESCE_US (see quicvc_crypto_poll)
+esp_err_t quicvc_send_data(quicvc_connection_t *conn, uint64_t stream_id, const char *data) {
+    if (!conn || conn->state != 2 || !conn->crypto) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    quicvc_stream_frame_t frame = {
+        .stream_id = stream_id,
+        .data = (const uint8_t*)data,
+        .data_len = strlen(data),
+    };
+    if (!quicvc_packet_builder_add_stream(&conn->crypto->tx, &frame, esp_timer_get_time())) {
+        return ESP_ERR_INVALID_SIZE;
+    }
     
-    ESP_LOGI(TAG, "Sent encrypted data: %s", data);
+    ESP_LOGI(TAG, "Queued encrypted data: %s", data);
     return ESP_OK;
 }
 
+// Send a large payload (journal blobs, VC microdata) on 'stream_id'
+// Each datagram is [short header][STREAM header][data chunk]; the chunk
+// is encrypted from 'data' in place of a copy into a frame buffer, and
+// the header is authenticated as AAD and then header-protected
+esp_err_t quicvc_send_stream(quicvc_connection_t *conn, uint64_t stream_id,
+                             const uint8_t *data, size_t len, bool fin) {
+    if (!conn || conn->state != 2 || !conn->crypto) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    // Keep stream order: anything queued goes first
+    quicvc_packet_builder_flush(&conn->crypto->tx);
+    
+    size_t sent = 0;
+    do {
+        // Lay out up to QUICVC_TX_BATCH datagrams, seal them and protect
+        // their headers in one batch each, then send them
+        quicvc_aead_packet_t batch[QUICVC_TX_BATCH];
+        uint8_t frame_headers[QUICVC_TX_BATCH][QUICVC_MAX_STREAM_HEADER_SIZE];
+        quicvc_iovec_t iovs[QUICVC_TX_BATCH][3];
+        uint8_t *packets[QUICVC_TX_BATCH];
+        size_t packet_lens[QUICVC_TX_BATCH];
+        size_t pn_offsets[QUICVC_TX_BATCH];
+        size_t count = 0;
+        
+        for (; count < QUICVC_TX_BATCH && (count == 0 || sent < len); count++) {
+            uint8_t *packet = tx_batch[count];
+            uint64_t pkt_num = conn->packet_number++;
+            quicvc_header_t hdr = {
+                .dcid = conn->dcid,
+                .dcid_len = conn->dcid_len,
+                .packet_number = pkt_num,
+                .packet_number_len = quicvc_packet_number_length(pkt_num, conn->largest_acked),
+                .key_phase = conn->crypto->key_phase,
+            };
+            size_t offset = quicvc_write_short_header(&hdr, packet, QUICVC_MAX_PACKET_SIZE);
+            
+            // Whatever the header and tag leave is data for this datagram
+            size_t room = QUICVC_MAX_PACKET_SIZE - offset - QUICVC_MAX_STREAM_HEADER_SIZE - QUICVC_AEAD_TAG_LENGTH;
+            size_t chunk = len - sent < room ? len - sent : room;
+            
+            quicvc_stream_frame_t frame = {
+                .stream_id = stream_id,
+                .offset = sent,
+                .data = &data[sent],
+                .data_len = chunk,
+                .has_off = sent > 0,
+                .has_fin = fin && sent + chunk == len,
+            };
+            quicvc_iovec_t *iov = iovs[count];
+            size_t iov_count = quicvc_serialize_stream_frame_iov(&frame, frame_headers[count],
+                                                                 QUICVC_MAX_STREAM_HEADER_SIZE, iov, 2);
+            
+            if (offset == 0 || iov_count == 0) {
+                return ESP_FAIL;
+            }
+            
+            // A bare FIN can be too short to sample
+            size_t frame_len = iov[0].iov_len + (iov_count > 1 ? iov[1].iov_len : 0);
+            iov[iov_count++] = (quicvc_iovec_t){ hp_padding, quicvc_hp_padding(frame_len, hdr.packet_number_len) };
+            
+            batch[count] = (quicvc_aead_packet_t){
+                .packet = packet,
+                .header_len = offset,
+                .packet_size = QUICVC_MAX_PACKET_SIZE,
+                .iov = iov,
+                .iov_count = iov_count,
+                .packet_number = pkt_num,
+            };
+            pn_offsets[count] = offset - hdr.packet_number_len;
+            sent += chunk;
+        }
+        
+        if (quicvc_seal_batch(conn, batch, count) != count) {
+            return ESP_FAIL;
+        }
+        for (size_t i = 0; i < count; i++) {
+            packets[i] = batch[i].packet;
+            packet_lens[i] = batch[i].packet_len;
+        }
+        
+        esp_err_t err = quicvc_protect_headers(conn, packets, packet_lens, pn_offsets, count);
+        if (err != ESP_OK) {
+            return err;
+        }
+        for (size_t i = 0; i < count; i++) {
+            sendto(quicvc_socket, packets[i], packet_lens[i], 0,
+                   (struct sockaddr*)&conn->peer_addr, sizeof(struct sockaddr_in));
+        }
+    } while (sent < len);
+    
+    ESP_LOGI(TAG, "Sent %u bytes on stream %llu", (unsigned)len, (unsigned long long)stream_id);
+    return ESP_OK;
+}
+
+// Send queued frames whose coalescing delay has expired and run key
+// update housekeeping on every keyed connection; call from the main loop
+void quicvc_crypto_poll(void) {
+    int64_t now = esp_timer_get_time();
+    for (int i = 0; i < QUICVC_MAX_CONNECTIONS; i++) {
+        quicvc_connection_t *conn = &connections[i];
+        quicvc_crypto_t *crypto = conn->crypto;
+        if (!connection_entries[i].in_use || !crypto) {
+            continue;
+        }
+        quicvc_packet_builder_poll(&crypto->tx, now);
+        
+        // Once late packets of the previous phase have had time to arrive,
+        // expand the next generation into its slot in the background
+        int64_t in_phase = now - crypto->key_phase_started_us;
+        if (!crypto->next_keys_ready && in_phase >= QUICVC_KEY_RETAIN_US) {
+            quicvc_prepare_key_update(conn);
+        }
+        
+        // Scheduled update; refused until the current phase is acknowledged
+        if (conn->state == 2 &&
+            (in_phase >= QUICVC_KEY_UPDATE_INTERVAL_US ||
+             conn->packet_number - crypto->key_phase_first_pn >= QUICVC_KEY_UPDATE_PACKETS)) {
+            quicvc_initiate_key_update(conn);
+        }
+    }
+}
+
+// Packet protection stats of every keyed connection
+void quicvc_crypto_print_stats(void) {
+    for (int i = 0; i < QUICVC_MAX_CONNECTIONS; i++) {
+        const quicvc_crypto_t *crypto = connections[i].crypto;
+        if (!connection_entries[i].in_use || !crypto) {
+            continue;
+        }
+        ESP_LOGI(TAG, "Crypto stats of %s (%s):",
+                 inet_ntoa(connections[i].peer_addr.sin_addr), crypto->aead->name);
+        ESP_LOGI(TAG, "  Packets sealed: %llu", (unsigned long long)crypto->send_counter);
+        ESP_LOGI(TAG, "  Packets opened: %llu", (unsigned long long)crypto->recv_counter);
+        ESP_LOGI(TAG, "  Dropped as duplicate: %llu",
+                 (unsigned long long)crypto->replay.dropped_duplicate);
+        ESP_LOGI(TAG, "  Dropped as too old: %llu",
+                 (unsigned long long)crypto->replay.dropped_too_old);
+        ESP_LOGI(TAG, "  Failed authentication: %llu", (unsigned long long)crypto->auth_failures);
+        ESP_LOGI(TAG, "  Key phase: %u", crypto->key_phase);
+    }
+    
+    char line[QUICVC_PERF_LINE_SIZE];
+    ESP_LOGI(TAG, "Latency in cycles (%d MHz):", QUICVC_CPU_MHZ);
+    for (size_t op = 0; op < QUICVC_PERF_OP_COUNT; op++) {
+        if (quicvc_perf_format(&crypto_perf[op], op, QUICVC_CPU_MHZ, line, sizeof(line))) {
+            ESP_LOGI(TAG, "  %s", line);
+        }
+    }
+}
+
 // Cleanup
 void quicvc_crypto_cleanup(void) {
-    if (crypto_ctx) {
-        mbedtls_gcm_free(&crypto_ctx->gcm);
-        memset(crypto_ctx, 0, sizeof(quicvc_crypto_t));
-        free(crypto_ctx);
-        crypto_ctx = NULL;
+    for (int i = 0; i < QUICVC_MAX_CONNECTIONS; i++) {
+        quicvc_crypto_release(&connections[i]);
     }
-}
\ No newline at end of file
+    connection_release_hook = NULL;
+}
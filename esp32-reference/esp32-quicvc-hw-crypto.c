@@ -4,25 +4,31 @@
 #include "esp_log.h"
 #include "esp_system.h"
 #include "esp_random.h"
-#include "mbedtls/aes.h"
-#include "mbedtls/sha256.h"
-#include "mbedtls/gcm.h"
-#include "esp_crypto_lock.h"  // For hardware peripheral locking
-#include "hal/aes_hal.h"      // Hardware AES
-#include "hal/sha_hal.h"      // Hardware SHA
+#include "esp_timer.h"
+#include "esp_cpu.h"
+#include "quicvc_protocol.h"
+#include "quicvc_aead_mbedtls.h"
+#include "quicvc_aead_bench.h"
 
 #define TAG "QUICVC_HW"
 
+#ifdef CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+#define QUICVC_HW_CPU_MHZ CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+#else
+#define QUICVC_HW_CPU_MHZ 240
+#endif
+
 // When hardware crypto is enabled, mbedtls automatically uses it
 // No need to explicitly call hardware functions - mbedtls does it for us
 
 // Enhanced crypto context with hardware optimization hints
+// One backend state per direction, keyed once in quicvc_hw_derive_keys, so
+// packets never pay for the AES key schedule and GHASH table setup. The
+// esp32-hw backend keeps its state in DMA-capable memory
 typedef struct {
-    mbedtls_gcm_context gcm;
-    uint8_t send_key[32] __attribute__((aligned(4)));    // Aligned for DMA
-    uint8_t recv_key[32] __attribute__((aligned(4)));
-    uint8_t send_iv[16] __attribute__((aligned(4)));     // Use 16 bytes for alignment
-    uint8_t recv_iv[16] __attribute__((aligned(4)));
+    const quicvc_aead_backend_t *aead;
+    void *aead_send;
+    void *aead_recv;
     uint64_t send_counter;
     uint64_t recv_counter;
     bool hw_initialized;
@@ -30,6 +36,23 @@ typedef struct {
 
 static quicvc_hw_crypto_t *hw_crypto = NULL;
 
+// Latency of each operation in CPU cycles; kept out of the DMA-capable
+// context, which only the backend states need
+static quicvc_perf_histogram_t hw_perf[QUICVC_PERF_OP_COUNT];
+
+// Start timing an operation
+uint32_t quicvc_hw_perf_start(void) {
+    return esp_cpu_get_cycle_count();
+}
+
+// Record the cycles since 'start'; CCOUNT wraps at 2^32 (about 18 s at
+// 240 MHz), which the unsigned subtraction absorbs
+void quicvc_hw_perf_record(quicvc_perf_op_t op, uint32_t start) {
+    if (op < QUICVC_PERF_OP_COUNT) {
+        quicvc_perf_record(&hw_perf[op], (uint32_t)(esp_cpu_get_cycle_count() - start));
+    }
+}
+
 // Generate truly random bytes using ESP32 hardware RNG
 void quicvc_hw_random(uint8_t *buf, size_t len) {
     // esp_random() uses hardware RNG
@@ -51,11 +74,18 @@ esp_err_t quicvc_hw_crypto_init(void) {
     }
     
     memset(hw_crypto, 0, sizeof(quicvc_hw_crypto_t));
-    mbedtls_gcm_init(&hw_crypto->gcm);
+    for (size_t op = 0; op < QUICVC_PERF_OP_COUNT; op++) {
+        quicvc_perf_init(&hw_perf[op]);
+    }
+#if CONFIG_MBEDTLS_HARDWARE_AES
+    hw_crypto->aead = &quicvc_aead_esp32_hw;
+#else
+    hw_crypto->aead = &quicvc_aead_mbedtls;
+#endif
     
     hw_crypto->hw_initialized = true;
-    ESP_LOGI(TAG, "Hardware crypto initialized (AES=%d, SHA=%d)", 
-             CONFIG_MBEDTLS_HARDWARE_AES, CONFIG_MBEDTLS_HARDWARE_SHA);
+    ESP_LOGI(TAG, "Hardware crypto initialized (AES=%d, SHA=%d, backend %s)", 
+             CONFIG_MBEDTLS_HARDWARE_AES, CONFIG_MBEDTLS_HARDWARE_SHA, hw_crypto->aead->name);
     
     return ESP_OK;
 }
@@ -65,132 +95,93 @@ esp_err_t quicvc_hw_derive_keys(const uint8_t *session_key, int is_server) {
     if (!hw_crypto || !hw_crypto->hw_initialized) {
         return ESP_ERR_INVALID_STATE;
     }
+    uint32_t start = quicvc_hw_perf_start();
+    
+    // mbedtls_sha256 automatically uses hardware when CONFIG_MBEDTLS_HARDWARE_SHA=y.
+    // Key and IV per direction, named by the sender, so they match the
+    // peer's (the IV used to come from the RNG, which no peer could match)
+    uint8_t send_key[QUICVC_AEAD_KEY_LENGTH], recv_key[QUICVC_AEAD_KEY_LENGTH];
+    uint8_t send_iv[QUICVC_AEAD_NONCE_LENGTH], recv_iv[QUICVC_AEAD_NONCE_LENGTH];
+    int ret = quicvc_mbedtls_aead_derive(session_key, is_server ? "server" : "client",
+                                         send_key, send_iv);
+    if (ret == 0) {
+        ret = quicvc_mbedtls_aead_derive(session_key, is_server ? "client" : "server",
+                                         recv_key, recv_iv);
+    }
     
-    // mbedtls_sha256 automatically uses hardware when CONFIG_MBEDTLS_HARDWARE_SHA=y
-    mbedtls_sha256_context sha;
-    mbedtls_sha256_init(&sha);
-    
-    // Derive send key
-    mbedtls_sha256_starts(&sha, 0);
-    mbedtls_sha256_update(&sha, session_key, 32);
-    mbedtls_sha256_update(&sha, (uint8_t*)(is_server ? "server-send" : "client-send"), 11);
-    mbedtls_sha256_finish(&sha, hw_crypto->send_key);
-    
-    // Derive receive key
-    mbedtls_sha256_starts(&sha, 0);
-    mbedtls_sha256_update(&sha, session_key, 32);
-    mbedtls_sha256_update(&sha, (uint8_t*)(is_server ? "client-send" : "server-send"), 11);
-    mbedtls_sha256_finish(&sha, hw_crypto->recv_key);
-    
-    // Generate IVs using hardware RNG
-    quicvc_hw_random(hw_crypto->send_iv, 16);
-    quicvc_hw_random(hw_crypto->recv_iv, 16);
-    
-    mbedtls_sha256_free(&sha);
-    
-    // Setup GCM with hardware AES
     // mbedtls_gcm automatically uses hardware AES when CONFIG_MBEDTLS_HARDWARE_AES=y
-    int ret = mbedtls_gcm_setkey(&hw_crypto->gcm, MBEDTLS_CIPHER_ID_AES,
-                                hw_crypto->send_key, 256);
-    if (ret != 0) {
-        ESP_LOGE(TAG, "Failed to set GCM key: %d", ret);
+    const quicvc_aead_backend_t *aead = hw_crypto->aead;
+    aead->destroy(hw_crypto->aead_send);
+    aead->destroy(hw_crypto->aead_recv);
+    hw_crypto->aead_send = ret == 0 ? aead->create(send_key, send_iv) : NULL;
+    hw_crypto->aead_recv = ret == 0 ? aead->create(recv_key, recv_iv) : NULL;
+    memset(send_key, 0, sizeof(send_key));
+    memset(recv_key, 0, sizeof(recv_key));
+    if (!hw_crypto->aead_send || !hw_crypto->aead_recv) {
+        ESP_LOGE(TAG, "Failed to key %s backend: %d", aead->name, ret);
         return ESP_FAIL;
     }
     
+    quicvc_hw_perf_record(QUICVC_PERF_KEY_DERIVATION, start);
     ESP_LOGI(TAG, "Keys derived using hardware acceleration");
     return ESP_OK;
 }
 
-// Hardware-accelerated packet encryption
-esp_err_t quicvc_hw_encrypt_packet(const uint8_t *plaintext, size_t plain_len,
-                                  uint8_t *ciphertext, size_t *cipher_len,
-                                  uint64_t packet_number) {
-    if (!hw_crypto || !hw_crypto->hw_initialized) {
+// Hardware-accelerated in-place seal: the payload at packet[header_len]
+// is encrypted where it lies, the header bytes are authenticated as AAD
+// and the tag is written right after the ciphertext
+esp_err_t quicvc_hw_seal_packet(uint8_t *packet, size_t header_len, size_t payload_len,
+                                size_t packet_size, uint64_t packet_number, size_t *packet_len) {
+    if (!hw_crypto || !hw_crypto->aead_send) {
         return ESP_ERR_INVALID_STATE;
     }
     
     // Ensure alignment for hardware operations
-    if ((uintptr_t)plaintext & 3 || (uintptr_t)ciphertext & 3) {
-        ESP_LOGW(TAG, "Unaligned buffers, hardware may be slower");
+    if ((uintptr_t)&packet[header_len] & 3) {
+        ESP_LOGW(TAG, "Unaligned payload, hardware may be slower");
     }
     
-    // Prepare nonce
-    uint8_t nonce[16] __attribute__((aligned(4)));
-    memcpy(nonce, hw_crypto->send_iv, 16);
-    
-    // XOR packet number into nonce
-    for (int i = 0; i < 8; i++) {
-        nonce[15 - i] ^= (packet_number >> (i * 8)) & 0xFF;
-    }
-    
-    // Hardware-accelerated AES-GCM encryption
-    uint8_t tag[16] __attribute__((aligned(4)));
-    int ret = mbedtls_gcm_crypt_and_tag(&hw_crypto->gcm,
-                                        MBEDTLS_GCM_ENCRYPT,
-                                        plain_len,
-                                        nonce, 12,  // Use 12 bytes of nonce
-                                        NULL, 0,    // No additional data
-                                        plaintext,
-                                        ciphertext,
-                                        16, tag);
-    if (ret != 0) {
-        ESP_LOGE(TAG, "Hardware encryption failed: %d", ret);
+    quicvc_aead_packet_t p = {
+        .packet = packet,
+        .header_len = header_len,
+        .payload_len = payload_len,
+        .packet_size = packet_size,
+        .packet_number = packet_number,
+    };
+    uint32_t start = quicvc_hw_perf_start();
+    if (hw_crypto->aead->seal_batch(hw_crypto->aead_send, &p, 1) != 1) {
+        ESP_LOGE(TAG, "Hardware encryption failed");
         return ESP_FAIL;
     }
     
-    // Append tag
-    memcpy(ciphertext + plain_len, tag, 16);
-    *cipher_len = plain_len + 16;
-    
+    quicvc_hw_perf_record(QUICVC_PERF_SEAL, start);
+    *packet_len = p.packet_len;
     hw_crypto->send_counter++;
     return ESP_OK;
 }
 
-// Hardware-accelerated packet decryption
-esp_err_t quicvc_hw_decrypt_packet(const uint8_t *ciphertext, size_t cipher_len,
-                                  uint8_t *plaintext, size_t *plain_len,
-                                  uint64_t packet_number) {
-    if (!hw_crypto || !hw_crypto->hw_initialized || cipher_len < 16) {
+// Hardware-accelerated in-place open: checks the header as AAD and
+// leaves the plaintext at packet[header_len]
+esp_err_t quicvc_hw_open_packet(uint8_t *packet, size_t header_len, size_t packet_len,
+                                uint64_t packet_number, size_t *payload_len) {
+    if (!hw_crypto || !hw_crypto->aead_recv) {
         return ESP_ERR_INVALID_ARG;
     }
     
-    // Setup receive GCM context
-    mbedtls_gcm_context recv_gcm;
-    mbedtls_gcm_init(&recv_gcm);
-    int ret = mbedtls_gcm_setkey(&recv_gcm, MBEDTLS_CIPHER_ID_AES,
-                                hw_crypto->recv_key, 256);
-    if (ret != 0) {
-        mbedtls_gcm_free(&recv_gcm);
+    quicvc_aead_packet_t p = {
+        .packet = packet,
+        .header_len = header_len,
+        .packet_len = packet_len,
+        .packet_number = packet_number,
+    };
+    uint32_t start = quicvc_hw_perf_start();
+    if (hw_crypto->aead->open_batch(hw_crypto->aead_recv, &p, 1) != 1) {
+        ESP_LOGE(TAG, "Hardware decryption failed");
         return ESP_FAIL;
     }
     
-    // Prepare nonce
-    uint8_t nonce[16] __attribute__((aligned(4)));
-    memcpy(nonce, hw_crypto->recv_iv, 16);
-    
-    // XOR packet number into nonce
-    for (int i = 0; i < 8; i++) {
-        nonce[15 - i] ^= (packet_number >> (i * 8)) & 0xFF;
-    }
-    
-    // Hardware-accelerated decryption
-    size_t data_len = cipher_len - 16;
-    ret = mbedtls_gcm_auth_decrypt(&recv_gcm,
-                                   data_len,
-                                   nonce, 12,
-                                   NULL, 0,
-                                   ciphertext + data_len, 16,  // Tag at end
-                                   ciphertext,
-                                   plaintext);
-    
-    mbedtls_gcm_free(&recv_gcm);
-    
-    if (ret != 0) {
-        ESP_LOGE(TAG, "Hardware decryption failed: %d", ret);
-        return ESP_FAIL;
-    }
-    
-    *plain_len = data_len;
+    quicvc_hw_perf_record(QUICVC_PERF_OPEN, start);
+    *payload_len = p.payload_len;
     hw_crypto->recv_counter++;
     return ESP_OK;
 }
@@ -201,6 +192,23 @@ void quicvc_hw_generate_connection_ids(uint8_t *dcid, uint8_t *scid, size_t len)
     quicvc_hw_random(scid, len);
 }
 
+// Latency per operation; set seal and open against the per-byte rows of
+// quicvc_hw_benchmark_backends to see which backend packets really take
+void quicvc_hw_print_perf(void) {
+    char line[QUICVC_PERF_LINE_SIZE];
+    ESP_LOGI(TAG, "Latency in cycles (%d MHz):", QUICVC_HW_CPU_MHZ);
+    for (size_t op = 0; op < QUICVC_PERF_OP_COUNT; op++) {
+        if (quicvc_perf_format(&hw_perf[op], op, QUICVC_HW_CPU_MHZ, line, sizeof(line))) {
+            ESP_LOGI(TAG, "  %s", line);
+        }
+    }
+}
+
+// VC_PERF frame with the same numbers, for a peer's query
+size_t quicvc_hw_perf_frame(uint8_t *out, size_t out_size) {
+    return quicvc_perf_write_frame(hw_perf, QUICVC_HW_CPU_MHZ, out, out_size);
+}
+
 // Performance monitoring
 void quicvc_hw_print_stats(void) {
     if (!hw_crypto) return;
@@ -216,12 +224,58 @@ void quicvc_hw_print_stats(void) {
     size_t largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_DMA);
     ESP_LOGI(TAG, "  Free heap: %u bytes", free_heap);
     ESP_LOGI(TAG, "  Largest DMA block: %u bytes", largest_block);
+    quicvc_hw_print_perf();
+}
+
+static uint64_t quicvc_hw_cycles(void) {
+    return esp_cpu_get_cycle_count();
+}
+
+// Seal and open cost of every compiled backend in cycles per payload
+// byte, for command-sized and full packets, one at a time and batched,
+// with the state kept keyed and with a state keyed per packet (the
+// setkey-per-packet cost this file had before contexts were kept).
+// The host prints the same table with `npm run bench:crypto`; CCOUNT is
+// 32 bits, so each timed batch must stay under 2^32 cycles
+void quicvc_hw_benchmark_backends(void) {
+    static const quicvc_aead_backend_t *const backends[] = {
+        &quicvc_aead_mbedtls,
+#if CONFIG_MBEDTLS_HARDWARE_AES
+        &quicvc_aead_esp32_hw,
+#endif
+    };
+    static const quicvc_aead_bench_mode_t modes[] = {
+        QUICVC_AEAD_BENCH_KEYED, QUICVC_AEAD_BENCH_PER_PACKET
+    };
+    static const char *const mode_names[] = { "kept", "per-packet" };
+    static const size_t payload_sizes[] = { 64, 256, 1024, 1173 };
+    static const size_t batch_sizes[] = { 1, 16 };
+    
+    for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+        for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+            for (size_t p = 0; p < sizeof(payload_sizes) / sizeof(payload_sizes[0]); p++) {
+                for (size_t n = 0; n < sizeof(batch_sizes) / sizeof(batch_sizes[0]); n++) {
+                    quicvc_aead_bench_result_t result;
+                    if (!quicvc_aead_bench(backends[b], modes[m], payload_sizes[p], batch_sizes[n],
+                                           101, quicvc_hw_cycles, &result)) {
+                        ESP_LOGE(TAG, "%s: benchmark failed", backends[b]->name);
+                        continue;
+                    }
+                    ESP_LOGI(TAG, "%-8s %-10s %4u-byte payload x%-2u: seal %.2f, open %.2f cycles/B",
+                             backends[b]->name, mode_names[m], (unsigned)payload_sizes[p],
+                             (unsigned)batch_sizes[n],
+                             result.seal_cycles_per_byte, result.open_cycles_per_byte);
+                }
+            }
+        }
+    }
 }
 
 // Cleanup
 void quicvc_hw_crypto_cleanup(void) {
     if (hw_crypto) {
-        mbedtls_gcm_free(&hw_crypto->gcm);
+        hw_crypto->aead->destroy(hw_crypto->aead_send);
+        hw_crypto->aead->destroy(hw_crypto->aead_recv);
         
         // Clear sensitive data
         memset(hw_crypto, 0, sizeof(quicvc_hw_crypto_t));
@@ -249,26 +303,27 @@ void quicvc_hw_example_usage(void) {
     // Derive keys using hardware SHA
     quicvc_hw_derive_keys(session_key, 1);  // Server mode
     
-    // Example data
+    // Example datagram: an 11-byte short header followed by the payload
     const char *data = "Hello QUICVC with hardware crypto!";
     size_t data_len = strlen(data);
+    size_t header_len = 11;
+    uint8_t packet[256] __attribute__((aligned(4))) = { 0x41 };
+    memcpy(&packet[header_len], data, data_len);
     
-    // Encrypt using hardware AES-GCM
-    uint8_t encrypted[256];
-    size_t encrypted_len;
-    quicvc_hw_encrypt_packet((uint8_t*)data, data_len, 
-                            encrypted, &encrypted_len, 1);
+    // Encrypt in place using hardware AES-GCM
+    size_t packet_len;
+    quicvc_hw_seal_packet(packet, header_len, data_len, sizeof(packet), 1, &packet_len);
     
-    ESP_LOGI(TAG, "Encrypted %u bytes -> %u bytes", data_len, encrypted_len);
+    ESP_LOGI(TAG, "Sealed %u bytes -> %u byte datagram", data_len, packet_len);
     
-    // Decrypt to verify
-    uint8_t decrypted[256];
+    // Decrypt in place to verify
     size_t decrypted_len;
-    quicvc_hw_decrypt_packet(encrypted, encrypted_len,
-                            decrypted, &decrypted_len, 1);
+    if (quicvc_hw_open_packet(packet, header_len, packet_len, 1, &decrypted_len) == ESP_OK) {
+        ESP_LOGI(TAG, "Decrypted: %.*s", (int)decrypted_len, &packet[header_len]);
+    }
     
-    decrypted[decrypted_len] = '\0';
-    ESP_LOGI(TAG, "Decrypted: %s", decrypted);
+    // Seal/open cycles per byte of each backend
+    quicvc_hw_benchmark_backends();
     
     // Print performance stats
     quicvc_hw_print_stats();
@@ -43,10 +43,10 @@ void app_main(void) {
 // {"type": "led_control", "state": "on"}
 // These would arrive as FRAME_DATA packets in quicvc_handle_packet()
 
-// Example: Sending data over QUICVC
-void send_quicvc_data(const char *data) {
-    if (!active_connection || active_connection->state != 2) {
-        ESP_LOGW(TAG, "No active QUICVC connection");
+// Example: Sending data over QUICVC on one connection
+void send_quicvc_data(quicvc_connection_t *conn, const char *data) {
+    if (!conn || conn->state != 2) {
+        ESP_LOGW(TAG, "No established QUICVC connection");
         return;
     }
     
@@ -61,7 +61,7 @@ void send_quicvc_data(const char *data) {
 }
 
 // Key differences from full QUICVC:
-// 1. Single connection support (not multiple)
+// 1. A few connections (QUICVC_MAX_CONNECTIONS), each with its own keys
 // 2. No stream multiplexing
 // 3. Simplified encryption (just key derivation, no AEAD yet)
 // 4. No congestion control or flow control
@@ -9,19 +9,17 @@
 #include "mbedtls/sha256.h"
 #include "mbedtls/base64.h"
 #include "esp_random.h"
+#include "quicvc_protocol.h"
 #include <string.h>
 
 #define TAG "QUICVC"
 
 // QUICVC Configuration
 #define QUICVC_PORT 49498          // Different from discovery port
-#define QUICVC_VERSION 0x00000001  // Version 1
-#define CONNECTION_ID_LEN 16       // Connection ID length
+#define CONNECTION_ID_LEN QUICVC_DEFAULT_CONNECTION_ID_LENGTH
 
-// Simplified packet types
-#define QUICVC_INITIAL 0x00
-#define QUICVC_HANDSHAKE 0x01
-#define QUICVC_PROTECTED 0x02
+// Packets use the RFC 9000 long/short headers from quicvc_protocol.h:
+// INITIAL/HANDSHAKE are long headers, protected packets are short headers
 
 // Frame types
 #define FRAME_VC_INIT 0x10
@@ -29,19 +27,42 @@
 #define FRAME_HEARTBEAT 0x20
 #define FRAME_DATA 0x30
 
+// Packet protection of one connection (esp32-quicvc-crypto.c)
+typedef struct quicvc_crypto quicvc_crypto_t;
+
 // Connection state
 typedef struct {
-    uint8_t dcid[CONNECTION_ID_LEN];  // Destination connection ID
+    uint8_t dcid[QUICVC_MAX_CONNECTION_ID_LENGTH];  // Destination connection ID (peer's SCID)
+    uint8_t dcid_len;
     uint8_t scid[CONNECTION_ID_LEN];  // Source connection ID
     uint8_t state;                    // 0=initial, 1=handshake, 2=established
     uint8_t session_key[32];          // Simplified: single session key
     uint64_t packet_number;
+    uint64_t largest_acked;           // QUICVC_PACKET_NUMBER_NONE until the peer ACKs
     uint32_t last_activity;
+    struct sockaddr_in peer_addr;
+    quicvc_crypto_t *crypto;          // Keys, replay window, key phase; NULL until keyed
 } quicvc_connection_t;
 
+// Connections by the CID we gave them, the DCID of their short headers,
+// so a phone and a laptop taking turns each keep their session. A new
+// one beyond QUICVC_MAX_CONNECTIONS takes the least recently used slot
+// that is not an active session; with every slot active it is refused
+#define QUICVC_MAX_CONNECTIONS 4
+#define QUICVC_CONN_INDEX_SIZE 8
+static quicvc_connection_t connections[QUICVC_MAX_CONNECTIONS];
+static quicvc_conn_entry_t connection_entries[QUICVC_MAX_CONNECTIONS];
+static uint16_t connection_index[QUICVC_CONN_INDEX_SIZE];
+static quicvc_conn_table_t connection_table;
+
+// A connection with no activity for this long is closed
+#define QUICVC_IDLE_TIMEOUT_S 60
+
 // Global state
 static int quicvc_socket = -1;
-static quicvc_connection_t *active_connection = NULL;
+// Frees a connection's state in the layers above (the crypto layer's
+// keys) before its slot is reused; set by them at init
+static void (*connection_release_hook)(quicvc_connection_t *conn) = NULL;
 extern device_identity_credential_t device_credential;  // From main code
 extern char device_id[65];
 
@@ -69,10 +90,78 @@ esp_err_t quicvc_init(void) {
         return ESP_FAIL;
     }
     
+    quicvc_conn_table_init(&connection_table, connection_entries, QUICVC_MAX_CONNECTIONS,
+                           connection_index, QUICVC_CONN_INDEX_SIZE);
     ESP_LOGI(TAG, "QUICVC listening on port %d", QUICVC_PORT);
     return ESP_OK;
 }
 
+// Free a connection's state, leaving its slot zeroed for reuse
+static void release_connection(quicvc_connection_t *conn) {
+    if (connection_release_hook) {
+        connection_release_hook(conn);
+    }
+    memset(conn, 0, sizeof(*conn));
+}
+
+static void close_connection(quicvc_connection_t *conn) {
+    quicvc_conn_table_remove(&connection_table, (uint16_t)(conn - connections));
+    release_connection(conn);
+}
+
+// An established session within its idle timeout; never displaced by a
+// new peer
+static bool connection_active(const quicvc_connection_t *conn) {
+    uint32_t now = esp_timer_get_time() / 1000000;
+    return conn->state == 2 && now - conn->last_activity <= QUICVC_IDLE_TIMEOUT_S;
+}
+
+static bool connection_evictable(uint16_t slot, void *ctx) {
+    (void)ctx;
+    return !connection_active(&connections[slot]);
+}
+
+// A slot for a new connection from 'client_addr' under a fresh random
+// CID. The same host and port reconnecting replaces its old connection
+// once that has gone idle, since nothing here validates the address;
+// with every slot taken, the least recently used inactive one is dropped.
+// Returns NULL if every slot holds an active session
+static quicvc_connection_t *new_connection(const struct sockaddr_in *client_addr) {
+    for (uint16_t i = 0; i < QUICVC_MAX_CONNECTIONS; i++) {
+        if (connection_entries[i].in_use &&
+            connections[i].peer_addr.sin_addr.s_addr == client_addr->sin_addr.s_addr &&
+            connections[i].peer_addr.sin_port == client_addr->sin_port) {
+            if (connection_active(&connections[i])) {
+                ESP_LOGW(TAG, "VC_INIT for the active session of %s, ignored",
+                         inet_ntoa(client_addr->sin_addr));
+                return NULL;
+            }
+            close_connection(&connections[i]);
+        }
+    }
+    
+    uint8_t scid[CONNECTION_ID_LEN];
+    do {
+        esp_fill_random(scid, CONNECTION_ID_LEN);
+    } while (quicvc_conn_table_find(&connection_table, scid, CONNECTION_ID_LEN) != QUICVC_CONN_NONE);
+    
+    uint16_t evicted;
+    uint16_t slot = quicvc_conn_table_insert_evictable(&connection_table, scid, CONNECTION_ID_LEN,
+                                                       connection_evictable, NULL, &evicted);
+    if (slot == QUICVC_CONN_NONE) {
+        ESP_LOGW(TAG, "All %d sessions active, refusing %s",
+                 QUICVC_MAX_CONNECTIONS, inet_ntoa(client_addr->sin_addr));
+        return NULL;
+    }
+    quicvc_connection_t *conn = &connections[slot];
+    if (evicted != QUICVC_CONN_NONE) {
+        ESP_LOGW(TAG, "Connection table full, dropping inactive connection");
+        release_connection(conn);
+    }
+    memcpy(conn->scid, scid, CONNECTION_ID_LEN);
+    return conn;
+}
+
 // Simple key derivation from credentials
 static void derive_session_key(const char *local_cred_id, const char *remote_cred_id, 
                               const char *challenge, uint8_t *out_key) {
@@ -93,42 +182,12 @@ static void derive_session_key(const char *local_cred_id, const char *remote_cre
     mbedtls_sha256_free(&ctx);
 }
 
-// Parse packet header (simplified)
-static int parse_packet_header(const uint8_t *data, size_t len, 
-                              uint8_t *packet_type, uint8_t *dcid, uint8_t *scid) {
-    if (len < 1 + 4 + 1 + 1 + 2*CONNECTION_ID_LEN + 8) {
-        return -1;
-    }
-    
-    size_t offset = 0;
-    *packet_type = data[offset++];
-    
-    // Skip version (4 bytes)
-    offset += 4;
-    
-    // Connection ID lengths
-    uint8_t dcid_len = data[offset++];
-    uint8_t scid_len = data[offset++];
-    
-    if (dcid_len != CONNECTION_ID_LEN || scid_len != CONNECTION_ID_LEN) {
-        return -1;
-    }
-    
-    // Copy connection IDs
-    memcpy(dcid, &data[offset], CONNECTION_ID_LEN);
-    offset += CONNECTION_ID_LEN;
-    memcpy(scid, &data[offset], CONNECTION_ID_LEN);
-    offset += CONNECTION_ID_LEN;
-    
-    // Skip packet number (8 bytes)
-    offset += 8;
-    
-    return offset;  // Return header size
-}
-
 // Handle VC_INIT frame
-static void handle_vc_init(const uint8_t *payload, size_t len, 
+static void handle_vc_init(const quicvc_header_t *hdr,
                           struct sockaddr_in *client_addr, socklen_t addr_len) {
+    const uint8_t *payload = hdr->payload;
+    size_t len = hdr->payload_len;
+
     ESP_LOGI(TAG, "Received VC_INIT from %s:%d", 
              inet_ntoa(client_addr->sin_addr), ntohs(client_addr->sin_port));
     
@@ -158,21 +217,24 @@ static void handle_vc_init(const uint8_t *payload, size_t len,
     }
     
     // Create connection
-    if (active_connection) {
-        free(active_connection);
+    quicvc_connection_t *conn = new_connection(client_addr);
+    if (!conn) {
+        cJSON_Delete(json);
+        return;
     }
-    active_connection = calloc(1, sizeof(quicvc_connection_t));
+    conn->largest_acked = QUICVC_PACKET_NUMBER_NONE;
     
-    // Generate connection IDs (swap for server)
-    esp_fill_random(active_connection->scid, CONNECTION_ID_LEN);
-    memcpy(active_connection->dcid, active_connection->scid, CONNECTION_ID_LEN);
+    // Our CID is random; the peer's SCID becomes the DCID of our packets
+    memcpy(conn->dcid, hdr->scid, hdr->scid_len);
+    conn->dcid_len = hdr->scid_len;
+    memcpy(&conn->peer_addr, client_addr, sizeof(struct sockaddr_in));
     
     // Derive session key
     derive_session_key(device_id, issuer->valuestring, 
-                      challenge->valuestring, active_connection->session_key);
+                      challenge->valuestring, conn->session_key);
     
-    active_connection->state = 1;  // Handshake
-    active_connection->last_activity = esp_timer_get_time() / 1000000;
+    conn->state = 1;  // Handshake
+    conn->last_activity = esp_timer_get_time() / 1000000;
     
     // Send VC_RESPONSE
     cJSON *response = cJSON_CreateObject();
@@ -200,32 +262,29 @@ static void handle_vc_init(const uint8_t *payload, size_t len,
     char *response_str = cJSON_PrintUnformatted(response);
     size_t response_len = strlen(response_str);
     
-    // Build packet (simplified header)
-    uint8_t packet[1024];
-    size_t offset = 0;
-    
-    // Packet type
-    packet[offset++] = QUICVC_HANDSHAKE;
-    
-    // Version
-    uint32_t version = htonl(QUICVC_VERSION);
-    memcpy(&packet[offset], &version, 4);
-    offset += 4;
-    
-    // Connection ID lengths
-    packet[offset++] = CONNECTION_ID_LEN;
-    packet[offset++] = CONNECTION_ID_LEN;
-    
-    // Connection IDs
-    memcpy(&packet[offset], active_connection->dcid, CONNECTION_ID_LEN);
-    offset += CONNECTION_ID_LEN;
-    memcpy(&packet[offset], active_connection->scid, CONNECTION_ID_LEN);
-    offset += CONNECTION_ID_LEN;
-    
-    // Packet number
-    uint64_t pkt_num = active_connection->packet_number++;
-    memcpy(&packet[offset], &pkt_num, 8);
-    offset += 8;
+    // Build HANDSHAKE packet (long header)
+    uint8_t packet[QUICVC_MAX_PACKET_SIZE];
+    quicvc_header_t out_hdr = {
+        .packet_type = QUICVC_PACKET_TYPE_HANDSHAKE,
+        .version = QUICVC_VERSION,
+        .dcid = conn->dcid,
+        .dcid_len = conn->dcid_len,
+        .scid = conn->scid,
+        .scid_len = CONNECTION_ID_LEN,
+        .packet_number = conn->packet_number,
+        .packet_number_len = quicvc_packet_number_length(conn->packet_number,
+                                                         conn->largest_acked),
+    };
+    conn->packet_number++;
+    
+    size_t offset = quicvc_write_long_header(&out_hdr, response_len, packet, sizeof(packet));
+    if (offset == 0 || response_len > sizeof(packet) - offset) {
+        ESP_LOGE(TAG, "VC_RESPONSE too large (%u bytes)", (unsigned)response_len);
+        free(response_str);
+        cJSON_Delete(response);
+        cJSON_Delete(json);
+        return;
+    }
     
     // Payload
     memcpy(&packet[offset], response_str, response_len);
@@ -236,7 +295,7 @@ static void handle_vc_init(const uint8_t *payload, size_t len,
            (struct sockaddr*)client_addr, addr_len);
     
     ESP_LOGI(TAG, "Sent VC_RESPONSE, connection established");
-    active_connection->state = 2;  // Established
+    conn->state = 2;  // Established
     
     free(response_str);
     cJSON_Delete(response);
@@ -245,7 +304,7 @@ static void handle_vc_init(const uint8_t *payload, size_t len,
 
 // Handle incoming QUICVC packets
 void quicvc_handle_packet(void) {
-    uint8_t buffer[1024];
+    uint8_t buffer[QUICVC_MAX_PACKET_SIZE];
     struct sockaddr_in client_addr;
     socklen_t addr_len = sizeof(client_addr);
     
@@ -254,32 +313,32 @@ void quicvc_handle_packet(void) {
     
     if (len <= 0) return;
     
-    // Parse header
-    uint8_t packet_type, dcid[CONNECTION_ID_LEN], scid[CONNECTION_ID_LEN];
-    int header_size = parse_packet_header(buffer, len, &packet_type, dcid, scid);
-    
-    if (header_size < 0) {
+    // Parse header (short headers carry our CONNECTION_ID_LEN-byte CID)
+    quicvc_header_parse_result_t parsed = quicvc_parse_header(buffer, len, CONNECTION_ID_LEN);
+    if (parsed.bytes_consumed == 0) {
         ESP_LOGW(TAG, "Invalid packet header");
         return;
     }
     
-    // Get payload
-    uint8_t *payload = &buffer[header_size];
-    size_t payload_len = len - header_size;
+    const quicvc_header_t *hdr = &parsed.header;
+    const uint8_t *payload = hdr->payload;
+    size_t payload_len = hdr->payload_len;
     
-    switch (packet_type) {
-        case QUICVC_INITIAL:
+    switch (hdr->packet_type) {
+        case QUICVC_PACKET_TYPE_INITIAL:
             // Check for VC_INIT frame
-            if (payload_len > 0 && payload[0] == FRAME_VC_INIT) {
-                handle_vc_init(payload, payload_len, &client_addr, addr_len);
+            if (hdr->is_long && payload_len > 0 && payload[0] == FRAME_VC_INIT) {
+                handle_vc_init(hdr, &client_addr, addr_len);
             }
             break;
             
-        case QUICVC_PROTECTED:
+        case QUICVC_PACKET_TYPE_ONE_RTT: {
             // Handle encrypted packets (simplified - no actual encryption yet)
-            if (active_connection && active_connection->state == 2) {
+            uint16_t slot = quicvc_conn_table_find(&connection_table, hdr->dcid, hdr->dcid_len);
+            if (slot != QUICVC_CONN_NONE && connections[slot].state == 2) {
+                quicvc_connection_t *conn = &connections[slot];
                 // Update activity
-                active_connection->last_activity = esp_timer_get_time() / 1000000;
+                conn->last_activity = esp_timer_get_time() / 1000000;
                 
                 // Handle heartbeat
                 if (payload_len > 0 && payload[0] == FRAME_HEARTBEAT) {
@@ -293,31 +352,19 @@ void quicvc_handle_packet(void) {
                 }
             }
             break;
+        }
     }
 }
 
-// Send heartbeat (if connected)
-void quicvc_send_heartbeat(void) {
-    if (!active_connection || active_connection->state != 2) {
-        return;
-    }
-    
-    // Check for timeout (60 seconds)
-    uint32_t now = esp_timer_get_time() / 1000000;
-    if (now - active_connection->last_activity > 60) {
-        ESP_LOGW(TAG, "QUICVC connection timeout");
-        free(active_connection);
-        active_connection = NULL;
-        return;
-    }
-    
+// Build one connection's heartbeat frame
+static void quicvc_heartbeat(quicvc_connection_t *conn, uint32_t now) {
     // Build heartbeat frame
     uint8_t heartbeat[64];
     heartbeat[0] = FRAME_HEARTBEAT;
     
     cJSON *hb = cJSON_CreateObject();
     cJSON_AddNumberToObject(hb, "timestamp", now);
-    cJSON_AddNumberToObject(hb, "sequence", active_connection->packet_number);
+    cJSON_AddNumberToObject(hb, "sequence", conn->packet_number);
     
     char *hb_str = cJSON_PrintUnformatted(hb);
     memcpy(&heartbeat[1], hb_str, strlen(hb_str));
@@ -329,14 +376,36 @@ void quicvc_send_heartbeat(void) {
     cJSON_Delete(hb);
 }
 
+// Send heartbeat on every established connection
+void quicvc_send_heartbeat(void) {
+    uint32_t now = esp_timer_get_time() / 1000000;
+    for (int i = 0; i < QUICVC_MAX_CONNECTIONS; i++) {
+        quicvc_connection_t *conn = &connections[i];
+        if (!connection_entries[i].in_use) {
+            continue;
+        }
+        
+        // Check for timeout
+        if (now - conn->last_activity > QUICVC_IDLE_TIMEOUT_S) {
+            ESP_LOGW(TAG, "QUICVC connection timeout");
+            close_connection(conn);
+            continue;
+        }
+        if (conn->state == 2) {
+            quicvc_heartbeat(conn, now);
+        }
+    }
+}
+
 // Cleanup
 void quicvc_cleanup(void) {
     if (quicvc_socket >= 0) {
         close(quicvc_socket);
         quicvc_socket = -1;
     }
-    if (active_connection) {
-        free(active_connection);
-        active_connection = NULL;
+    for (int i = 0; i < QUICVC_MAX_CONNECTIONS; i++) {
+        if (connection_entries[i].in_use) {
+            close_connection(&connections[i]);
+        }
     }
 }
\ No newline at end of file
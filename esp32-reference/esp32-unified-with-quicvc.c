@@ -5,14 +5,19 @@
 #include "esp_wifi.h"
 #include "esp_system.h"
 #include "esp_random.h"
+#include "esp_cpu.h"
 #include "lwip/sockets.h"
 #include "cJSON.h"
 #include "esp_task_wdt.h"
+#include "mbedtls/ecdh.h"
 #include "mbedtls/gcm.h"
+#include "mbedtls/md.h"
 #include "mbedtls/sha256.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "driver/gpio.h"
+#include "quicvc_protocol.h"
+#include "quicvc_aead_mbedtls.h"
 
 #define TAG "ESP32_QUICVC"
 
@@ -30,10 +35,8 @@
 #define SERVICE_VC_EXCHANGE 7
 #define SERVICE_HEARTBEAT 8
 
-// QUICVC packet types
-#define QUICVC_INITIAL 0x00
-#define QUICVC_HANDSHAKE 0x01
-#define QUICVC_PROTECTED 0x02
+// QUICVC packets use the RFC 9000 long/short headers from quicvc_protocol.h
+#define QUICVC_CID_LEN QUICVC_DEFAULT_CONNECTION_ID_LENGTH
 
 // Frame types
 #define FRAME_VC_INIT 0x10
@@ -60,57 +63,589 @@ static device_credential_t device_credential = {0};
 
 // QUICVC connection state
 typedef struct {
-    uint8_t dcid[16];
-    uint8_t scid[16];
+    uint8_t dcid[QUICVC_MAX_CONNECTION_ID_LENGTH];  // Peer's CID (from its SCID)
+    uint8_t dcid_len;
+    uint8_t scid[QUICVC_CID_LEN];                   // Our CID, DCID of short headers we receive
     uint8_t state;  // 0=initial, 1=handshake, 2=established
     uint8_t session_key[32];
     uint64_t packet_number;
-    uint32_t last_activity;
+    uint64_t largest_acked;     // QUICVC_PACKET_NUMBER_NONE until the peer ACKs
+    quicvc_ack_tracker_t ack_tracker;  // Received packet numbers, source of ACK frames
+    int64_t largest_received_at;       // esp_timer_get_time() of ack_tracker.largest
     struct sockaddr_in peer_addr;
-    mbedtls_gcm_context gcm_send;
-    mbedtls_gcm_context gcm_recv;
+    quicvc_packet_builder_t tx;        // Coalesces outgoing frames per datagram
+    quicvc_timer_t idle_timer;         // Closes the connection
+    int64_t idle_deadline;             // esp_timer_get_time() idle_timer fires at
+    quicvc_timer_t heartbeat_timer;
+    quicvc_timer_t flush_timer;        // Coalescing deadline of tx
+    void *aead_send;                   // session_aead states, keyed "server"
+    void *aead_recv;                   // and "client" from session_key
 } quicvc_connection_t;
 
-static quicvc_connection_t *active_connection = NULL;
+// 1-RTT packet protection: the AES peripheral held across each packet
+// when mbedtls is configured for it
+#if defined(ESP_PLATFORM) && CONFIG_MBEDTLS_HARDWARE_AES
+static const quicvc_aead_backend_t *const session_aead = &quicvc_aead_esp32_hw;
+#else
+static const quicvc_aead_backend_t *const session_aead = &quicvc_aead_mbedtls;
+#endif
+
+// Connections by the CID we gave them, the DCID of their short headers,
+// so controllers taking turns each keep their session. A new one beyond
+// QUICVC_MAX_CONNECTIONS takes the slot of the least recently used that
+// is not an active session; with every slot active it is refused
+#define QUICVC_MAX_CONNECTIONS 4
+#define QUICVC_CONN_INDEX_SIZE 8
+static quicvc_connection_t connections[QUICVC_MAX_CONNECTIONS];
+static quicvc_conn_entry_t connection_entries[QUICVC_MAX_CONNECTIONS];
+static uint16_t connection_index[QUICVC_CONN_INDEX_SIZE];
+static quicvc_conn_table_t connection_table;
+
+// 0-RTT resumption: a ticket issued after a full handshake lets a client
+// reconnecting after the idle timeout send its first commands at once
+#define QUICVC_MAX_TICKETS 4
+#define QUICVC_TICKET_LIFETIME_S (24 * 60 * 60)
+#define QUICVC_TICKET_FRAME_SIZE (3 + QUICVC_TICKET_ID_LENGTH + 4)
+
+typedef struct {
+    uint8_t id[QUICVC_TICKET_ID_LENGTH];  // DCID of the client's 0-RTT packet
+    uint8_t resumption_secret[32];
+    uint32_t expires_at;                  // Seconds since boot
+    bool in_use;
+} quicvc_ticket_t;
+
+static quicvc_ticket_t tickets[QUICVC_MAX_TICKETS];
+
+// A connection with no activity for this long is closed
+#define QUICVC_IDLE_TIMEOUT_S 60
+
+// Idle timeouts, heartbeats and coalescing deadlines of every connection,
+// run by quicvc_handler_task, which sleeps in select() until the next one
+#define QUICVC_TIMER_TICK_US 1000
+#define QUICVC_HEARTBEAT_INTERVAL_US 20000000
+static quicvc_timer_wheel_t quicvc_timers;
+
+// Stateless Retry (RFC 9000 Section 8.1): once INITIALs arrive faster
+// than QUICVC_RETRY_THRESHOLD per second, one without a token is answered
+// with a Retry whose token is an HMAC over the client's address, so a
+// flood costs one MAC per packet and no JSON parsing, allocation or key
+// derivation. Below the threshold INITIALs are served directly, as
+// before, but only into a free or inactive slot: an unvalidated INITIAL
+// that would need an active session's slot gets a Retry instead, so the
+// compatibility path never touches established state. Token:
+// issued_at_s(4) || HMAC-SHA256(retry_secret, ip || port || retry SCID ||
+// issued_at_s)[0..16)
+//
+// The threshold is a per-device knob (override with -D at build time).
+// It counts every source together, so a single flooder also sends
+// legitimate controllers through a Retry round trip while it lasts;
+// that costs them one RTT, never their session. 0 validates every
+// address; a device serving many controllers that reconnect together
+// wants it above their number
+#ifndef QUICVC_RETRY_THRESHOLD
+#define QUICVC_RETRY_THRESHOLD 4
+#endif
+#define QUICVC_RETRY_TOKEN_LIFETIME_S 10
+#define QUICVC_RETRY_MAC_LENGTH 16
+#define QUICVC_RETRY_TOKEN_LENGTH (4 + QUICVC_RETRY_MAC_LENGTH)
+
+static uint8_t retry_secret[32];   // Random per boot; tokens do not outlive it
+static uint32_t initial_second;    // Second the INITIAL count applies to
+static uint32_t initial_count;
+
+// RFC 9001 Section 5.8 Retry integrity key and nonce
+static const uint8_t retry_integrity_key[16] = {
+    0xbe, 0x0c, 0x69, 0x0b, 0x9f, 0x66, 0x57, 0x5a,
+    0x1d, 0x76, 0x6b, 0x54, 0xe3, 0x68, 0xc8, 0x4e,
+};
+static const uint8_t retry_integrity_nonce[12] = {
+    0x46, 0x15, 0x99, 0xd3, 0x5d, 0x63, 0x2b, 0xf2, 0x23, 0x98, 0x25, 0xbb,
+};
+
+// Latency of key derivation, 0-RTT open and the full handshake in CPU
+// cycles (zeroed statics are empty histograms), recorded and logged only
+// by quicvc_handler_task: every QUICVC_PERF_LOG_INTERVAL_US from a timer,
+// and sent to VC_PERF queries
+#ifdef CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+#define QUICVC_CPU_MHZ CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+#else
+#define QUICVC_CPU_MHZ 240
+#endif
+#define QUICVC_PERF_LOG_INTERVAL_US 300000000
+static quicvc_perf_histogram_t quicvc_perf[QUICVC_PERF_OP_COUNT];
+static quicvc_timer_t perf_log_timer;
+
+// Record the cycles since 'start'; CCOUNT wraps at 2^32, which the
+// unsigned subtraction absorbs
+static void perf_record(quicvc_perf_op_t op, uint32_t start) {
+    quicvc_perf_record(&quicvc_perf[op], (uint32_t)(esp_cpu_get_cycle_count() - start));
+}
+
+static void on_perf_log(quicvc_timer_t *timer, void *ctx) {
+    (void)ctx;
+    char line[QUICVC_PERF_LINE_SIZE];
+    ESP_LOGI(TAG, "QUICVC latency in cycles (%d MHz):", QUICVC_CPU_MHZ);
+    for (size_t op = 0; op < QUICVC_PERF_OP_COUNT; op++) {
+        if (quicvc_perf_format(&quicvc_perf[op], op, QUICVC_CPU_MHZ, line, sizeof(line))) {
+            ESP_LOGI(TAG, "  %s", line);
+        }
+    }
+    quicvc_timer_schedule(&quicvc_timers, timer, esp_timer_get_time() + QUICVC_PERF_LOG_INTERVAL_US);
+}
 
 // Hardware crypto functions
 static void generate_random_bytes(uint8_t *buf, size_t len) {
     esp_fill_random(buf, len);
 }
 
-static esp_err_t derive_session_keys(quicvc_connection_t *conn, const char *challenge) {
+// mbedtls RNG callback on the hardware RNG
+static int fill_random(void *ctx, unsigned char *buf, size_t len) {
+    (void)ctx;
+    esp_fill_random(buf, len);
+    return 0;
+}
+
+// Assign the next packet number, truncated to what the peer can reconstruct
+static void assign_packet_number(quicvc_connection_t *conn, quicvc_header_t *hdr) {
+    hdr->packet_number = conn->packet_number++;
+    hdr->packet_number_len = quicvc_packet_number_length(hdr->packet_number, conn->largest_acked);
+}
+
+// Longest a queued frame waits for others to share its datagram
+#define QUICVC_TX_COALESCE_US 20000
+
+// Seal 'payload' behind the 'header_len' bytes of header at 'packet',
+// the header as AAD. Returns the packet length, or 0 if it does not fit
+static size_t seal_packet(quicvc_connection_t *conn, uint8_t *packet, size_t header_len,
+                          uint64_t packet_number, const uint8_t *payload, size_t payload_len) {
+    uint32_t start = esp_cpu_get_cycle_count();
+    quicvc_iovec_t plaintext = { payload, payload_len };
+    quicvc_aead_packet_t sealed = {
+        .packet = packet,
+        .header_len = header_len,
+        .packet_size = QUICVC_MAX_PACKET_SIZE,
+        .iov = &plaintext,
+        .iov_count = 1,
+        .packet_number = packet_number,
+    };
+    if (header_len == 0 || session_aead->seal_batch(conn->aead_send, &sealed, 1) != 1) {
+        return 0;
+    }
+    perf_record(QUICVC_PERF_SEAL, start);
+    return sealed.packet_len;
+}
+
+// Open 'packet' in place under 'aead', the header as AAD; false if it
+// does not authenticate
+static bool open_packet(void *aead, uint8_t *packet, const quicvc_header_t *hdr,
+                        uint64_t packet_number, size_t *payload_len) {
+    uint32_t start = esp_cpu_get_cycle_count();
+    size_t header_len = hdr->payload - packet;
+    quicvc_aead_packet_t opened = {
+        .packet = packet,
+        .header_len = header_len,
+        .packet_len = header_len + hdr->payload_len,
+        .packet_number = packet_number,
+    };
+    if (session_aead->open_batch(aead, &opened, 1) != 1) {
+        return false;
+    }
+    perf_record(QUICVC_PERF_OPEN, start);
+    *payload_len = opened.payload_len;
+    return true;
+}
+
+// Seal one coalesced payload under a short header (packet builder flush callback)
+static void send_quicvc_packet(const uint8_t *payload, size_t payload_len, void *ctx) {
+    quicvc_connection_t *conn = ctx;
+    uint8_t packet[QUICVC_MAX_PACKET_SIZE];
+    
+    quicvc_header_t hdr = {
+        .dcid = conn->dcid,
+        .dcid_len = conn->dcid_len,
+    };
+    assign_packet_number(conn, &hdr);
+    size_t len = seal_packet(conn, packet, quicvc_write_short_header(&hdr, packet, sizeof(packet)),
+                             hdr.packet_number, payload, payload_len);
+    if (len == 0) {
+        ESP_LOGE(TAG, "QUICVC: Coalesced payload too large (%u bytes)", (unsigned)payload_len);
+        return;
+    }
+    
+    sendto(quicvc_socket, packet, len, 0,
+           (struct sockaddr*)&conn->peer_addr, sizeof(struct sockaddr_in));
+    quicvc_timer_cancel(&quicvc_timers, &conn->flush_timer);
+}
+
+// Queue an ACK for everything received and send it with any pending frames
+static void send_quicvc_ack(quicvc_connection_t *conn) {
+    int64_t now = esp_timer_get_time();
+    quicvc_packet_builder_add_ack(&conn->tx, &conn->ack_tracker,
+                                  now - conn->largest_received_at, now);
+    quicvc_packet_builder_flush(&conn->tx);
+}
+
+// Send a long header HANDSHAKE packet; it carries our CID to the peer.
+// The VC_RESPONSE of a full handshake goes in the clear, the answer to a
+// 0-RTT packet 'sealed' under the resumed keys
+static void send_quicvc_handshake(quicvc_connection_t *conn, const uint8_t *payload,
+                                  size_t payload_len, bool sealed) {
+    uint8_t packet[QUICVC_MAX_PACKET_SIZE];
+    quicvc_header_t hdr = {
+        .packet_type = QUICVC_PACKET_TYPE_HANDSHAKE,
+        .version = QUICVC_VERSION,
+        .dcid = conn->dcid,
+        .dcid_len = conn->dcid_len,
+        .scid = conn->scid,
+        .scid_len = QUICVC_CID_LEN,
+    };
+    assign_packet_number(conn, &hdr);
+    
+    size_t length = payload_len + (sealed ? QUICVC_AEAD_TAG_LENGTH : 0);
+    size_t offset = quicvc_write_long_header(&hdr, length, packet, sizeof(packet));
+    if (offset == 0 || length > sizeof(packet) - offset) {
+        ESP_LOGE(TAG, "QUICVC: Handshake response too large (%u bytes)", (unsigned)payload_len);
+        return;
+    }
+    if (sealed) {
+        offset = seal_packet(conn, packet, offset, hdr.packet_number, payload, payload_len);
+    } else {
+        memcpy(&packet[offset], payload, payload_len);
+        offset += payload_len;
+    }
+    
+    sendto(quicvc_socket, packet, offset, 0,
+           (struct sockaddr*)&conn->peer_addr, sizeof(struct sockaddr_in));
+}
+
+// Free a connection's state, leaving its slot zeroed for reuse
+static void release_connection(quicvc_connection_t *conn) {
+    quicvc_timer_cancel(&quicvc_timers, &conn->idle_timer);
+    quicvc_timer_cancel(&quicvc_timers, &conn->heartbeat_timer);
+    quicvc_timer_cancel(&quicvc_timers, &conn->flush_timer);
+    session_aead->destroy(conn->aead_send);
+    session_aead->destroy(conn->aead_recv);
+    memset(conn, 0, sizeof(*conn));
+}
+
+static void close_connection(quicvc_connection_t *conn) {
+    quicvc_conn_table_remove(&connection_table, (uint16_t)(conn - connections));
+    release_connection(conn);
+}
+
+static void on_idle_timeout(quicvc_timer_t *timer, void *ctx) {
+    ESP_LOGW(TAG, "QUICVC: Connection timeout");
+    close_connection(ctx);
+}
+
+// Heartbeat frame: [type][length(2)][json], plus any ACK owed, in one
+// datagram with whatever else is queued
+static void on_heartbeat(quicvc_timer_t *timer, void *ctx) {
+    quicvc_connection_t *conn = ctx;
+    cJSON *hb = cJSON_CreateObject();
+    cJSON_AddNumberToObject(hb, "timestamp", esp_timer_get_time() / 1000000);
+    cJSON_AddNumberToObject(hb, "free_heap", esp_get_free_heap_size());
+    
+    char *hb_str = cJSON_PrintUnformatted(hb);
+    quicvc_packet_builder_add_vc_frame(&conn->tx, QUICVC_FRAME_HEARTBEAT,
+                                       (const uint8_t*)hb_str, strlen(hb_str),
+                                       esp_timer_get_time());
+    if (conn->ack_tracker.ack_pending) {
+        send_quicvc_ack(conn);
+    } else {
+        quicvc_packet_builder_flush(&conn->tx);
+    }
+    ESP_LOGD(TAG, "QUICVC: Heartbeat sent");
+    
+    free(hb_str);
+    cJSON_Delete(hb);
+    quicvc_timer_schedule(&quicvc_timers, timer, esp_timer_get_time() + QUICVC_HEARTBEAT_INTERVAL_US);
+}
+
+static void on_flush_deadline(quicvc_timer_t *timer, void *ctx) {
+    quicvc_connection_t *conn = ctx;
+    quicvc_packet_builder_flush(&conn->tx);
+}
+
+// Connection of a short header packet, by its DCID
+static quicvc_connection_t *find_connection(const quicvc_header_t *hdr) {
+    if (hdr->dcid_len != QUICVC_CID_LEN) {
+        return NULL;
+    }
+    uint16_t slot = quicvc_conn_table_find(&connection_table, hdr->dcid, hdr->dcid_len);
+    return slot == QUICVC_CONN_NONE ? NULL : &connections[slot];
+}
+
+// An established session within its idle timeout; never displaced by a
+// new peer
+static bool connection_active(const quicvc_connection_t *conn) {
+    return conn->state == 2 && esp_timer_get_time() < conn->idle_deadline;
+}
+
+static bool connection_evictable(uint16_t slot, void *ctx) {
+    (void)ctx;
+    return !connection_active(&connections[slot]);
+}
+
+// Whether new_connection() could serve an unvalidated address without
+// touching an active session: no active one of its own for a spoofed
+// packet to replace, and a free or inactive slot
+static bool connection_room_for(const struct sockaddr_in *peer_addr) {
+    bool room = connection_table.count < QUICVC_MAX_CONNECTIONS;
+    for (uint16_t i = 0; i < QUICVC_MAX_CONNECTIONS; i++) {
+        if (!connection_entries[i].in_use) {
+            continue;
+        }
+        bool active = connection_active(&connections[i]);
+        if (active && connections[i].peer_addr.sin_addr.s_addr == peer_addr->sin_addr.s_addr &&
+            connections[i].peer_addr.sin_port == peer_addr->sin_port) {
+            return false;
+        }
+        room |= !active;
+    }
+    return room;
+}
+
+// A fresh connection for the peer that sent 'hdr'. The same host and port
+// reconnecting replaces its old connection, an active one only once the
+// address is validated (Retry token or 0-RTT ticket); otherwise, with
+// every slot taken, the least recently used inactive connection is closed.
+// Returns NULL if every slot holds an active session
+static quicvc_connection_t *new_connection(const quicvc_header_t *hdr,
+                                           struct sockaddr_in *peer_addr,
+                                           bool address_validated) {
+    for (uint16_t i = 0; i < QUICVC_MAX_CONNECTIONS; i++) {
+        if (connection_entries[i].in_use &&
+            connections[i].peer_addr.sin_addr.s_addr == peer_addr->sin_addr.s_addr &&
+            connections[i].peer_addr.sin_port == peer_addr->sin_port) {
+            if (!address_validated && connection_active(&connections[i])) {
+                ESP_LOGW(TAG, "QUICVC: Unvalidated INITIAL for the active session of %s",
+                         inet_ntoa(peer_addr->sin_addr));
+                return NULL;
+            }
+            close_connection(&connections[i]);
+        }
+    }
+    
+    uint8_t scid[QUICVC_CID_LEN];
+    do {
+        generate_random_bytes(scid, QUICVC_CID_LEN);
+    } while (quicvc_conn_table_find(&connection_table, scid, QUICVC_CID_LEN) != QUICVC_CONN_NONE);
+    
+    uint16_t evicted;
+    uint16_t slot = quicvc_conn_table_insert_evictable(&connection_table, scid, QUICVC_CID_LEN,
+                                                       connection_evictable, NULL, &evicted);
+    if (slot == QUICVC_CONN_NONE) {
+        ESP_LOGW(TAG, "QUICVC: All %d sessions active, refusing %s",
+                 QUICVC_MAX_CONNECTIONS, inet_ntoa(peer_addr->sin_addr));
+        return NULL;
+    }
+    if (evicted != QUICVC_CONN_NONE) {
+        ESP_LOGW(TAG, "QUICVC: Table full, closing inactive connection from %s",
+                 inet_ntoa(connections[evicted].peer_addr.sin_addr));
+        release_connection(&connections[evicted]);
+    }
+    
+    quicvc_connection_t *conn = &connections[slot];
+    memcpy(conn->scid, scid, QUICVC_CID_LEN);
+    conn->largest_acked = QUICVC_PACKET_NUMBER_NONE;
+    quicvc_ack_tracker_init(&conn->ack_tracker);
+    quicvc_packet_builder_init(&conn->tx,
+                               QUICVC_MAX_PACKET_SIZE - QUICVC_MAX_SHORT_HEADER_SIZE - QUICVC_AEAD_TAG_LENGTH,
+                               QUICVC_TX_COALESCE_US, send_quicvc_packet, conn);
+    memcpy(conn->dcid, hdr->scid, hdr->scid_len);
+    conn->dcid_len = hdr->scid_len;
+    memcpy(&conn->peer_addr, peer_addr, sizeof(struct sockaddr_in));
+    quicvc_timer_init(&conn->idle_timer, on_idle_timeout, conn);
+    quicvc_timer_init(&conn->heartbeat_timer, on_heartbeat, conn);
+    quicvc_timer_init(&conn->flush_timer, on_flush_deadline, conn);
+    return conn;
+}
+
+// Push the idle timeout back after activity on the connection
+static void touch_connection(quicvc_connection_t *conn) {
+    conn->idle_deadline = esp_timer_get_time() + QUICVC_IDLE_TIMEOUT_S * 1000000LL;
+    quicvc_timer_schedule(&quicvc_timers, &conn->idle_timer, conn->idle_deadline);
+}
+
+// Once established: idle timeout and heartbeats
+static void start_connection_timers(quicvc_connection_t *conn) {
+    touch_connection(conn);
+    quicvc_timer_schedule(&quicvc_timers, &conn->heartbeat_timer,
+                          esp_timer_get_time() + QUICVC_HEARTBEAT_INTERVAL_US);
+}
+
+// SHA-256(secret || label || context), the resumption key schedule
+static void derive_labelled(const uint8_t secret[32], const char *label,
+                            const uint8_t *context, size_t context_len, uint8_t out[32]) {
     mbedtls_sha256_context sha;
     mbedtls_sha256_init(&sha);
-    
-    // Derive session key from credentials and challenge
     mbedtls_sha256_starts(&sha, 0);
-    mbedtls_sha256_update(&sha, (uint8_t*)device_credential.id, strlen(device_credential.id));
-    mbedtls_sha256_update(&sha, (uint8_t*)device_credential.issuer, strlen(device_credential.issuer));
-    mbedtls_sha256_update(&sha, (uint8_t*)challenge, strlen(challenge));
-    mbedtls_sha256_finish(&sha, conn->session_key);
-    
+    mbedtls_sha256_update(&sha, secret, 32);
+    mbedtls_sha256_update(&sha, (const uint8_t*)label, strlen(label));
+    if (context_len > 0) {
+        mbedtls_sha256_update(&sha, context, context_len);
+    }
+    mbedtls_sha256_finish(&sha, out);
     mbedtls_sha256_free(&sha);
+}
+
+// Key the connection's AEAD states from its session key; we send as
+// "server", the controller as "client"
+static esp_err_t init_session_ciphers(quicvc_connection_t *conn) {
+    uint8_t key[QUICVC_AEAD_KEY_LENGTH];
+    uint8_t iv[QUICVC_AEAD_NONCE_LENGTH];
     
-    // Initialize GCM contexts (hardware accelerated)
-    mbedtls_gcm_init(&conn->gcm_send);
-    mbedtls_gcm_init(&conn->gcm_recv);
-    
-    int ret = mbedtls_gcm_setkey(&conn->gcm_send, MBEDTLS_CIPHER_ID_AES, 
-                                conn->session_key, 256);
+    int ret = quicvc_mbedtls_aead_derive(conn->session_key, "server", key, iv);
+    if (ret == 0 && (conn->aead_send = session_aead->create(key, iv)) == NULL) {
+        ret = -1;
+    }
+    if (ret == 0) {
+        ret = quicvc_mbedtls_aead_derive(conn->session_key, "client", key, iv);
+    }
+    if (ret == 0 && (conn->aead_recv = session_aead->create(key, iv)) == NULL) {
+        ret = -1;
+    }
+    memset(key, 0, sizeof(key));
+    memset(iv, 0, sizeof(iv));
     if (ret != 0) {
-        ESP_LOGE(TAG, "Failed to set send key: %d", ret);
+        ESP_LOGE(TAG, "Failed to key %s: %d", session_aead->name, ret);
         return ESP_FAIL;
     }
     
-    ret = mbedtls_gcm_setkey(&conn->gcm_recv, MBEDTLS_CIPHER_ID_AES,
-                            conn->session_key, 256);
-    if (ret != 0) {
-        ESP_LOGE(TAG, "Failed to set recv key: %d", ret);
+    ESP_LOGI(TAG, "Session keys derived (%s)", session_aead->name);
+    return ESP_OK;
+}
+
+// X25519 against the controller's key share: our share goes to
+// 'public_key' and the shared secret to 'shared'. Both shares are raw
+// RFC 7748 little-endian u-coordinates; mbedtls frames them with a
+// length byte. Fails on an invalid or low-order peer key
+static bool key_exchange(const uint8_t peer_key[QUICVC_KEY_SHARE_LENGTH],
+                         uint8_t public_key[QUICVC_KEY_SHARE_LENGTH],
+                         uint8_t shared[QUICVC_KEY_SHARE_LENGTH]) {
+    uint8_t point[1 + QUICVC_KEY_SHARE_LENGTH];
+    size_t len = 0;
+    mbedtls_ecdh_context ecdh;
+    mbedtls_ecdh_init(&ecdh);
+    
+    int ret = mbedtls_ecdh_setup(&ecdh, MBEDTLS_ECP_DP_CURVE25519);
+    if (ret == 0) {
+        ret = mbedtls_ecdh_make_public(&ecdh, &len, point, sizeof(point), fill_random, NULL);
+    }
+    if (ret == 0 && len == sizeof(point)) {
+        memcpy(public_key, &point[1], QUICVC_KEY_SHARE_LENGTH);
+        point[0] = QUICVC_KEY_SHARE_LENGTH;
+        memcpy(&point[1], peer_key, QUICVC_KEY_SHARE_LENGTH);
+        ret = mbedtls_ecdh_read_public(&ecdh, point, sizeof(point));
+    } else if (ret == 0) {
+        ret = -1;
+    }
+    if (ret == 0) {
+        ret = mbedtls_ecdh_calc_secret(&ecdh, &len, shared, QUICVC_KEY_SHARE_LENGTH,
+                                       fill_random, NULL);
+    }
+    mbedtls_ecdh_free(&ecdh);
+    
+    // An all-zero secret means a low-order peer key (RFC 7748 Section 6.1)
+    uint8_t any = 0;
+    for (int i = 0; i < QUICVC_KEY_SHARE_LENGTH; i++) {
+        any |= shared[i];
+    }
+    if (ret != 0 || len != QUICVC_KEY_SHARE_LENGTH || any == 0) {
+        ESP_LOGW(TAG, "QUICVC: Key exchange failed: %d", ret);
+        return false;
+    }
+    return true;
+}
+
+// Session key from the controller's key share ("key", 64 hex digits) and
+// the challenge: SHA-256(X25519 secret || "quicvc session" || challenge).
+// Our share goes to 'public_hex' for the VC_RESPONSE
+static esp_err_t derive_session_keys(quicvc_connection_t *conn, const char *peer_key_hex,
+                                     const char *challenge, char *public_hex) {
+    uint32_t start = esp_cpu_get_cycle_count();
+    uint8_t peer_key[QUICVC_KEY_SHARE_LENGTH];
+    uint8_t public_key[QUICVC_KEY_SHARE_LENGTH];
+    uint8_t shared[QUICVC_KEY_SHARE_LENGTH];
+    
+    if (strlen(peer_key_hex) != 2 * QUICVC_KEY_SHARE_LENGTH) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int i = 0; i < QUICVC_KEY_SHARE_LENGTH; i++) {
+        unsigned byte;
+        if (sscanf(&peer_key_hex[2 * i], "%2x", &byte) != 1) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        peer_key[i] = (uint8_t)byte;
+    }
+    if (!key_exchange(peer_key, public_key, shared)) {
         return ESP_FAIL;
     }
+    derive_labelled(shared, "quicvc session", (const uint8_t*)challenge, strlen(challenge),
+                    conn->session_key);
+    memset(shared, 0, sizeof(shared));
+    for (int i = 0; i < QUICVC_KEY_SHARE_LENGTH; i++) {
+        snprintf(&public_hex[2 * i], 3, "%02x", public_key[i]);
+    }
     
-    ESP_LOGI(TAG, "Session keys derived with hardware acceleration");
-    return ESP_OK;
+    esp_err_t err = init_session_ciphers(conn);
+    perf_record(QUICVC_PERF_KEY_DERIVATION, start);
+    return err;
+}
+
+// Issue a resumption ticket bound to the connection's session key and
+// write its VC_TICKET frame to 'out'. The oldest ticket makes room when
+// the table is full. Returns the frame length, or 0 if 'out' is too small.
+static size_t issue_ticket(const quicvc_connection_t *conn, uint8_t *out, size_t out_size) {
+    if (out_size < QUICVC_TICKET_FRAME_SIZE) {
+        return 0;
+    }
+    
+    uint32_t now = esp_timer_get_time() / 1000000;
+    quicvc_ticket_t *slot = &tickets[0];
+    for (int i = 0; i < QUICVC_MAX_TICKETS; i++) {
+        if (!tickets[i].in_use || tickets[i].expires_at <= now) {
+            slot = &tickets[i];
+            break;
+        }
+        if (tickets[i].expires_at < slot->expires_at) {
+            slot = &tickets[i];
+        }
+    }
+    
+    generate_random_bytes(slot->id, QUICVC_TICKET_ID_LENGTH);
+    derive_labelled(conn->session_key, "quicvc resumption",
+                    slot->id, QUICVC_TICKET_ID_LENGTH, slot->resumption_secret);
+    slot->expires_at = now + QUICVC_TICKET_LIFETIME_S;
+    slot->in_use = true;
+    
+    // [type][length(2)][ticket_id][lifetime_s(4)]
+    out[0] = QUICVC_FRAME_VC_TICKET;
+    out[1] = 0;
+    out[2] = QUICVC_TICKET_ID_LENGTH + 4;
+    memcpy(&out[3], slot->id, QUICVC_TICKET_ID_LENGTH);
+    for (int i = 0; i < 4; i++) {
+        out[3 + QUICVC_TICKET_ID_LENGTH + i] = (uint8_t)(QUICVC_TICKET_LIFETIME_S >> (24 - 8 * i));
+    }
+    return QUICVC_TICKET_FRAME_SIZE;
+}
+
+// Open a 0-RTT packet in place under a key and IV derived from the
+// ticket; the header is the AAD as for 1-RTT packets
+static bool open_zero_rtt(const quicvc_ticket_t *ticket, uint8_t *packet, const quicvc_header_t *hdr,
+                          uint64_t packet_number, size_t *payload_len) {
+    uint8_t key[32];
+    uint8_t iv[32];
+    derive_labelled(ticket->resumption_secret, "quicvc 0rtt key", NULL, 0, key);
+    derive_labelled(ticket->resumption_secret, "quicvc 0rtt iv", NULL, 0, iv);
+    void *aead = session_aead->create(key, iv);
+    memset(key, 0, sizeof(key));
+    memset(iv, 0, sizeof(iv));
+    
+    bool opened = aead && open_packet(aead, packet, hdr, packet_number, payload_len);
+    session_aead->destroy(aead);
+    return opened;
 }
 
 // Initialize all services
@@ -159,6 +694,13 @@ esp_err_t init_all_services(void) {
     }
     
     ESP_LOGI(TAG, "✅ QUICVC on port %d", QUICVC_PORT);
+    generate_random_bytes(retry_secret, sizeof(retry_secret));
+    quicvc_conn_table_init(&connection_table, connection_entries, QUICVC_MAX_CONNECTIONS,
+                           connection_index, QUICVC_CONN_INDEX_SIZE);
+    quicvc_timer_wheel_init(&quicvc_timers, esp_timer_get_time(), QUICVC_TIMER_TICK_US);
+    quicvc_timer_init(&perf_log_timer, on_perf_log, NULL);
+    quicvc_timer_schedule(&quicvc_timers, &perf_log_timer,
+                          esp_timer_get_time() + QUICVC_PERF_LOG_INTERVAL_US);
     
     // Generate device ID if not set
     if (strlen(device_id) == 0) {
@@ -171,9 +713,123 @@ esp_err_t init_all_services(void) {
     return ESP_OK;
 }
 
+// MAC binding a Retry token to the client's address, the SCID the Retry
+// sent it to and the time it was issued
+static void retry_token_mac(const struct sockaddr_in *peer_addr, const uint8_t *retry_scid,
+                            uint32_t issued_at, uint8_t mac[32]) {
+    uint8_t input[4 + 2 + QUICVC_CID_LEN + 4];
+    memcpy(&input[0], &peer_addr->sin_addr.s_addr, 4);
+    memcpy(&input[4], &peer_addr->sin_port, 2);
+    memcpy(&input[6], retry_scid, QUICVC_CID_LEN);
+    for (int i = 0; i < 4; i++) {
+        input[6 + QUICVC_CID_LEN + i] = (uint8_t)(issued_at >> (24 - 8 * i));
+    }
+    mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), retry_secret,
+                    sizeof(retry_secret), input, sizeof(input), mac);
+}
+
+// A token is valid if it came from a Retry we sent to this address and
+// the INITIAL is addressed to that Retry's SCID
+static bool validate_retry_token(const quicvc_header_t *hdr, const struct sockaddr_in *peer_addr) {
+    if (hdr->token_len != QUICVC_RETRY_TOKEN_LENGTH || hdr->dcid_len != QUICVC_CID_LEN) {
+        return false;
+    }
+    uint32_t issued_at = ((uint32_t)hdr->token[0] << 24) | ((uint32_t)hdr->token[1] << 16) |
+                         ((uint32_t)hdr->token[2] << 8) | hdr->token[3];
+    uint32_t now = esp_timer_get_time() / 1000000;
+    if (issued_at > now || now - issued_at > QUICVC_RETRY_TOKEN_LIFETIME_S) {
+        return false;
+    }
+    
+    uint8_t mac[32];
+    retry_token_mac(peer_addr, hdr->dcid, issued_at, mac);
+    uint8_t diff = 0;
+    for (int i = 0; i < QUICVC_RETRY_MAC_LENGTH; i++) {
+        diff |= mac[i] ^ hdr->token[4 + i];
+    }
+    return diff == 0;
+}
+
+// Count an INITIAL; true once this second's count is over the threshold
+static bool initial_over_threshold(void) {
+    uint32_t now = esp_timer_get_time() / 1000000;
+    if (now != initial_second) {
+        initial_second = now;
+        initial_count = 0;
+    }
+    return ++initial_count > QUICVC_RETRY_THRESHOLD;
+}
+
+// Answer an INITIAL with a Retry; nothing is kept about the client
+static void send_quicvc_retry(const quicvc_header_t *hdr, struct sockaddr_in *peer_addr) {
+    // The pseudo-packet the integrity tag covers is the original DCID,
+    // length-prefixed, followed by the Retry itself
+    uint8_t pseudo[1 + QUICVC_MAX_CONNECTION_ID_LENGTH + 128];
+    size_t prefix = 1 + hdr->dcid_len;
+    pseudo[0] = hdr->dcid_len;
+    memcpy(&pseudo[1], hdr->dcid, hdr->dcid_len);
+    
+    uint8_t retry_scid[QUICVC_CID_LEN];
+    generate_random_bytes(retry_scid, sizeof(retry_scid));
+    uint32_t issued_at = esp_timer_get_time() / 1000000;
+    uint8_t token[QUICVC_RETRY_TOKEN_LENGTH];
+    uint8_t mac[32];
+    for (int i = 0; i < 4; i++) {
+        token[i] = (uint8_t)(issued_at >> (24 - 8 * i));
+    }
+    retry_token_mac(peer_addr, retry_scid, issued_at, mac);
+    memcpy(&token[4], mac, QUICVC_RETRY_MAC_LENGTH);
+    
+    quicvc_header_t retry = {
+        .version = QUICVC_VERSION,
+        .dcid = hdr->scid,
+        .dcid_len = hdr->scid_len,
+        .scid = retry_scid,
+        .scid_len = sizeof(retry_scid),
+    };
+    uint8_t *packet = &pseudo[prefix];
+    size_t len = quicvc_write_retry(&retry, token, sizeof(token), packet, sizeof(pseudo) - prefix);
+    if (len == 0) {
+        return;
+    }
+    
+    mbedtls_gcm_context gcm;
+    mbedtls_gcm_init(&gcm);
+    int ret = mbedtls_gcm_setkey(&gcm, MBEDTLS_CIPHER_ID_AES, retry_integrity_key, 128);
+    if (ret == 0) {
+        ret = mbedtls_gcm_crypt_and_tag(&gcm, MBEDTLS_GCM_ENCRYPT, 0,
+                                        retry_integrity_nonce, sizeof(retry_integrity_nonce),
+                                        pseudo, prefix + len, NULL, NULL,
+                                        QUICVC_RETRY_INTEGRITY_TAG_LENGTH, &packet[len]);
+    }
+    mbedtls_gcm_free(&gcm);
+    if (ret != 0) {
+        return;
+    }
+    
+    sendto(quicvc_socket, packet, len + QUICVC_RETRY_INTEGRITY_TAG_LENGTH, 0,
+           (struct sockaddr*)peer_addr, sizeof(struct sockaddr_in));
+}
+
 // Handle QUICVC initial packet
-static void handle_quicvc_initial(const uint8_t *payload, size_t len, 
+static void handle_quicvc_initial(const quicvc_header_t *hdr,
                                  struct sockaddr_in *peer_addr) {
+    uint32_t start = esp_cpu_get_cycle_count();
+    const uint8_t *payload = hdr->payload;
+    size_t len = hdr->payload_len;
+
+    // Address validation before any per-client work
+    bool over_threshold = initial_over_threshold();
+    if (hdr->token_len > 0) {
+        if (!validate_retry_token(hdr, peer_addr)) {
+            ESP_LOGD(TAG, "QUICVC: Dropped INITIAL with invalid token");
+            return;
+        }
+    } else if (over_threshold || !connection_room_for(peer_addr)) {
+        send_quicvc_retry(hdr, peer_addr);
+        return;
+    }
+    
     ESP_LOGI(TAG, "QUICVC: Initial packet from %s:%d",
              inet_ntoa(peer_addr->sin_addr), ntohs(peer_addr->sin_port));
     
@@ -186,9 +842,10 @@ static void handle_quicvc_initial(const uint8_t *payload, size_t len,
     
     cJSON *cred = cJSON_GetObjectItem(json, "credential");
     cJSON *challenge = cJSON_GetObjectItem(json, "challenge");
+    cJSON *peer_key = cJSON_GetObjectItem(json, "key");
     
-    if (!cred || !challenge) {
-        ESP_LOGE(TAG, "Missing credential or challenge");
+    if (!cred || !cJSON_IsString(challenge) || !cJSON_IsString(peer_key)) {
+        ESP_LOGE(TAG, "Missing credential, challenge or key share");
         cJSON_Delete(json);
         return;
     }
@@ -202,20 +859,21 @@ static void handle_quicvc_initial(const uint8_t *payload, size_t len,
     }
     
     // Create connection
-    if (active_connection) {
-        mbedtls_gcm_free(&active_connection->gcm_send);
-        mbedtls_gcm_free(&active_connection->gcm_recv);
-        free(active_connection);
+    quicvc_connection_t *conn = new_connection(hdr, peer_addr, hdr->token_len > 0);
+    if (!conn) {
+        cJSON_Delete(json);
+        return;
     }
     
-    active_connection = calloc(1, sizeof(quicvc_connection_t));
-    generate_random_bytes(active_connection->scid, 16);
-    generate_random_bytes(active_connection->dcid, 16);
-    memcpy(&active_connection->peer_addr, peer_addr, sizeof(struct sockaddr_in));
-    
-    // Derive keys
-    derive_session_keys(active_connection, challenge->valuestring);
-    active_connection->state = 1;
+    // Key agreement with the controller's share
+    char public_key[2 * QUICVC_KEY_SHARE_LENGTH + 1];
+    if (derive_session_keys(conn, peer_key->valuestring, challenge->valuestring,
+                            public_key) != ESP_OK) {
+        close_connection(conn);
+        cJSON_Delete(json);
+        return;
+    }
+    conn->state = 1;
     
     // Send VC_RESPONSE
     cJSON *response = cJSON_CreateObject();
@@ -235,43 +893,22 @@ static void handle_quicvc_initial(const uint8_t *payload, size_t len,
     
     cJSON_AddItemToObject(response, "credential", our_cred);
     cJSON_AddStringToObject(response, "challenge", challenge->valuestring);
+    cJSON_AddStringToObject(response, "key", public_key);
     
     char *response_str = cJSON_PrintUnformatted(response);
-    
-    // Build HANDSHAKE packet
-    uint8_t packet[1024];
-    size_t offset = 0;
-    packet[offset++] = QUICVC_HANDSHAKE;
-    
-    // Simple header (version, CIDs, packet number)
-    uint32_t version = htonl(0x00000001);
-    memcpy(&packet[offset], &version, 4);
-    offset += 4;
-    
-    packet[offset++] = 16;  // DCID length
-    packet[offset++] = 16;  // SCID length
-    
-    memcpy(&packet[offset], active_connection->dcid, 16);
-    offset += 16;
-    memcpy(&packet[offset], active_connection->scid, 16);
-    offset += 16;
-    
-    uint64_t pkt_num = active_connection->packet_number++;
-    memcpy(&packet[offset], &pkt_num, 8);
-    offset += 8;
-    
-    // Payload
-    size_t resp_len = strlen(response_str);
-    memcpy(&packet[offset], response_str, resp_len);
-    offset += resp_len;
-    
-    // Send response
-    sendto(quicvc_socket, packet, offset, 0,
-           (struct sockaddr*)peer_addr, sizeof(struct sockaddr_in));
+    send_quicvc_handshake(conn, (const uint8_t*)response_str, strlen(response_str), false);
+    perf_record(QUICVC_PERF_HANDSHAKE, start);
     
     ESP_LOGI(TAG, "QUICVC: Sent handshake response");
-    active_connection->state = 2;  // Established
-    active_connection->last_activity = esp_timer_get_time() / 1000000;
+    conn->state = 2;  // Established
+    start_connection_timers(conn);
+    
+    // Ticket for the client's next reconnect, in the first 1-RTT packet:
+    // never in the clear, where anyone could replay it
+    uint8_t ticket_frame[QUICVC_TICKET_FRAME_SIZE];
+    size_t ticket_len = issue_ticket(conn, ticket_frame, sizeof(ticket_frame));
+    quicvc_packet_builder_add(&conn->tx, ticket_frame, ticket_len, esp_timer_get_time());
+    quicvc_packet_builder_flush(&conn->tx);
     
     free(response_str);
     cJSON_Delete(response);
@@ -279,29 +916,67 @@ static void handle_quicvc_initial(const uint8_t *payload, size_t len,
 }
 
 // Handle QUICVC protected packet
-static void handle_quicvc_protected(const uint8_t *payload, size_t len,
-                                   uint64_t packet_number) {
-    if (!active_connection || active_connection->state != 2) {
-        ESP_LOGW(TAG, "No active connection for protected packet");
-        return;
+// Returns true if the packet needs an ACK (anything but ACK, PADDING, CLOSE)
+static bool handle_quicvc_protected(quicvc_connection_t *conn, const uint8_t *payload,
+                                   size_t len, uint64_t packet_number) {
+    bool ack_eliciting = false;
+    
+    if (conn->state != 2) {
+        ESP_LOGW(TAG, "Protected packet before the handshake completed");
+        return false;
     }
     
-    // Update activity
-    active_connection->last_activity = esp_timer_get_time() / 1000000;
+    touch_connection(conn);
     
-    // For now, handle unencrypted frames (encryption can be added)
-    if (len > 0) {
-        uint8_t frame_type = payload[0];
+    // The payload arrives opened; single pass over the payload; coalesced frames need no re-parse
+    quicvc_frame_iter_t iter;
+    quicvc_frame_t frame;
+    quicvc_frame_iter_init(&iter, payload, len);
+
+    while (quicvc_frame_iter_next(&iter, &frame)) {
+        if (frame.type != QUICVC_FRAME_ACK && frame.type != QUICVC_FRAME_ACK_ECN &&
+            frame.type != QUICVC_FRAME_PADDING) {
+            ack_eliciting = true;
+        }
         
-        switch (frame_type) {
-            case FRAME_HEARTBEAT:
+        switch (frame.type) {
+            case QUICVC_FRAME_HEARTBEAT:
                 ESP_LOGD(TAG, "QUICVC: Heartbeat received");
                 break;
-                
-            case FRAME_DATA:
-                // Handle data frame
-                if (len > 1) {
-                    cJSON *cmd = cJSON_ParseWithLength((const char*)&payload[1], len - 1);
+
+            case QUICVC_FRAME_ACK:
+            case QUICVC_FRAME_ACK_ECN:
+                // Shorter packet number encodings once the peer has caught up
+                if (conn->largest_acked == QUICVC_PACKET_NUMBER_NONE ||
+                    frame.u.ack.largest_acknowledged > conn->largest_acked) {
+                    conn->largest_acked = frame.u.ack.largest_acknowledged;
+                }
+                break;
+
+            case QUICVC_FRAME_VC_PERF:
+                // An empty body asks for our report; it leaves with the ACK
+                if (frame.u.vc.body_len == 0) {
+                    uint8_t report[QUICVC_PERF_FRAME_SIZE];
+                    size_t report_len = quicvc_perf_write_frame(quicvc_perf, QUICVC_CPU_MHZ,
+                                                                report, sizeof(report));
+                    quicvc_packet_builder_add(&conn->tx, report, report_len,
+                                              esp_timer_get_time());
+                }
+                break;
+
+            case QUICVC_FRAME_CONNECTION_CLOSE:
+            case QUICVC_FRAME_CONNECTION_CLOSE_APP:
+                ESP_LOGI(TAG, "QUICVC: Peer closed connection (error 0x%llx)",
+                         (unsigned long long)frame.u.close.error_code);
+                // Closed on the next tick, once the caller is done with it
+                quicvc_timer_schedule(&quicvc_timers, &conn->idle_timer, 0);
+                return false;
+
+            default:
+                if ((frame.type & 0xF8) == QUICVC_FRAME_STREAM && frame.u.stream.data_len > 0) {
+                    // Commands arrive as JSON in STREAM frames
+                    cJSON *cmd = cJSON_ParseWithLength((const char*)frame.u.stream.data,
+                                                       frame.u.stream.data_len);
                     if (cmd) {
                         cJSON *type = cJSON_GetObjectItem(cmd, "type");
                         if (type && strcmp(type->valuestring, "led_control") == 0) {
@@ -318,62 +993,158 @@ static void handle_quicvc_protected(const uint8_t *payload, size_t len,
                 break;
         }
     }
+
+    if (iter.error) {
+        ESP_LOGW(TAG, "QUICVC: Malformed frame at offset %u", (unsigned)iter.offset);
+    }
+    // Frames left queued go out by their coalescing deadline at the latest
+    if (conn->tx.len > 0) {
+        quicvc_timer_schedule(&quicvc_timers, &conn->flush_timer, conn->tx.deadline_us);
+    }
+    return ack_eliciting;
+}
+
+// Handle a 0-RTT packet: the DCID names a ticket from an earlier
+// connection and the payload carries the client's first commands, run
+// before any reply. Tickets are single use and consumed only once the
+// packet authenticates, so a replayed first flight finds nothing to open.
+static void handle_quicvc_zero_rtt(const quicvc_header_t *hdr, uint8_t *packet,
+                                   struct sockaddr_in *peer_addr) {
+    uint32_t now = esp_timer_get_time() / 1000000;
+    quicvc_ticket_t *ticket = NULL;
+    for (int i = 0; i < QUICVC_MAX_TICKETS && hdr->dcid_len == QUICVC_TICKET_ID_LENGTH; i++) {
+        if (tickets[i].in_use && tickets[i].expires_at > now &&
+            memcmp(tickets[i].id, hdr->dcid, QUICVC_TICKET_ID_LENGTH) == 0) {
+            ticket = &tickets[i];
+            break;
+        }
+    }
+    if (!ticket) {
+        ESP_LOGW(TAG, "QUICVC: 0-RTT packet with unknown or used ticket");
+        return;
+    }
+    
+    uint64_t packet_number = quicvc_decode_packet_number(0, hdr->packet_number,
+                                                         hdr->packet_number_len);
+    size_t payload_len;
+    if (!open_zero_rtt(ticket, packet, hdr, packet_number, &payload_len)) {
+        ESP_LOGW(TAG, "QUICVC: 0-RTT packet failed authentication");
+        return;
+    }
+    
+    uint8_t secret[32];
+    memcpy(secret, ticket->resumption_secret, sizeof(secret));
+    memset(ticket, 0, sizeof(*ticket));
+    
+    quicvc_connection_t *conn = new_connection(hdr, peer_addr, true);
+    if (!conn) {
+        memset(secret, 0, sizeof(secret));
+        return;
+    }
+    uint32_t start = esp_cpu_get_cycle_count();
+    derive_labelled(secret, "quicvc resumed", NULL, 0, conn->session_key);
+    memset(secret, 0, sizeof(secret));
+    if (init_session_ciphers(conn) != ESP_OK) {
+        close_connection(conn);
+        return;
+    }
+    perf_record(QUICVC_PERF_KEY_DERIVATION, start);
+    conn->state = 2;  // Established
+    start_connection_timers(conn);
+    
+    quicvc_ack_tracker_record(&conn->ack_tracker, packet_number);
+    conn->largest_received_at = esp_timer_get_time();
+    handle_quicvc_protected(conn, hdr->payload, payload_len, packet_number);
+    ESP_LOGI(TAG, "QUICVC: Resumed connection with 0-RTT (%u bytes)", (unsigned)payload_len);
+    
+    // Reply, sealed under the resumed keys: ACK for the early data and a
+    // fresh ticket to replace the used one
+    uint8_t frames[64];
+    size_t frames_len = quicvc_ack_tracker_write_frame(&conn->ack_tracker, 0,
+                                                       frames, sizeof(frames));
+    frames_len += issue_ticket(conn, &frames[frames_len], sizeof(frames) - frames_len);
+    send_quicvc_handshake(conn, frames, frames_len, true);
 }
 
 // QUICVC handler task
 void quicvc_handler_task(void *param) {
-    uint8_t buffer[1024];
+    uint8_t buffer[QUICVC_MAX_PACKET_SIZE];
     struct sockaddr_in peer_addr;
     socklen_t addr_len;
     
     while (1) {
-        addr_len = sizeof(peer_addr);
-        ssize_t len = recvfrom(quicvc_socket, buffer, sizeof(buffer), 0,
-                              (struct sockaddr*)&peer_addr, &addr_len);
+        // Sleep until a datagram arrives or the next timer is due
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(quicvc_socket, &readable);
+        struct timeval timeout;
+        struct timeval *wait = NULL;
+        uint64_t next = quicvc_timer_wheel_next_deadline(&quicvc_timers);
+        if (next != QUICVC_TIMER_NONE) {
+            uint64_t now = esp_timer_get_time();
+            uint64_t delay = next > now ? next - now : 0;
+            timeout.tv_sec = delay / 1000000;
+            timeout.tv_usec = delay % 1000000;
+            wait = &timeout;
+        }
         
-        if (len > 0) {
-            // Parse packet header
-            if (len < 15) continue;  // Minimum header size
-            
-            uint8_t packet_type = buffer[0];
-            size_t offset = 1;
-            
-            // Skip version (4 bytes)
-            offset += 4;
-            
-            // Skip CID lengths and CIDs
-            uint8_t dcid_len = buffer[offset++];
-            uint8_t scid_len = buffer[offset++];
-            offset += dcid_len + scid_len;
-            
-            // Get packet number
-            uint64_t packet_number;
-            memcpy(&packet_number, &buffer[offset], 8);
-            offset += 8;
-            
-            // Handle based on packet type
-            switch (packet_type) {
-                case QUICVC_INITIAL:
-                    handle_quicvc_initial(&buffer[offset], len - offset, &peer_addr);
-                    break;
-                    
-                case QUICVC_PROTECTED:
-                    handle_quicvc_protected(&buffer[offset], len - offset, packet_number);
-                    break;
-            }
+        ssize_t len = 0;
+        if (select(quicvc_socket + 1, &readable, NULL, NULL, wait) > 0) {
+            addr_len = sizeof(peer_addr);
+            len = recvfrom(quicvc_socket, buffer, sizeof(buffer), MSG_DONTWAIT,
+                           (struct sockaddr*)&peer_addr, &addr_len);
         }
         
-        // Check for timeout
-        if (active_connection && 
-            (esp_timer_get_time() / 1000000 - active_connection->last_activity) > 60) {
-            ESP_LOGW(TAG, "QUICVC: Connection timeout");
-            mbedtls_gcm_free(&active_connection->gcm_send);
-            mbedtls_gcm_free(&active_connection->gcm_recv);
-            free(active_connection);
-            active_connection = NULL;
+        // A datagram may carry several coalesced long header packets
+        size_t offset = 0;
+        while (len > 0 && offset < (size_t)len) {
+            uint8_t *packet = &buffer[offset];
+            quicvc_header_parse_result_t parsed =
+                quicvc_parse_header(&buffer[offset], len - offset, QUICVC_CID_LEN);
+            if (parsed.bytes_consumed == 0) {
+                ESP_LOGW(TAG, "QUICVC: Invalid packet header");
+                break;
+            }
+            offset += parsed.bytes_consumed;
+            
+            const quicvc_header_t *hdr = &parsed.header;
+            quicvc_connection_t *conn;
+            if (hdr->is_long) {
+                if (hdr->packet_type == QUICVC_PACKET_TYPE_INITIAL) {
+                    handle_quicvc_initial(hdr, &peer_addr);
+                } else if (hdr->packet_type == QUICVC_PACKET_TYPE_ZERO_RTT) {
+                    handle_quicvc_zero_rtt(hdr, packet, &peer_addr);
+                }
+            } else if ((conn = find_connection(hdr)) != NULL) {
+                quicvc_ack_tracker_t *tracker = &conn->ack_tracker;
+                uint64_t packet_number = quicvc_decode_packet_number(
+                    tracker->has_packets ? tracker->largest + 1 : 0,
+                    hdr->packet_number, hdr->packet_number_len);
+                // Duplicates are dropped before the AEAD, and only packets
+                // that open are recorded
+                size_t payload_len;
+                if (quicvc_ack_tracker_contains(tracker, packet_number)) {
+                    ESP_LOGD(TAG, "QUICVC: Duplicate packet %llu", (unsigned long long)packet_number);
+                    continue;
+                }
+                if (conn->state != 2 ||
+                    !open_packet(conn->aead_recv, packet, hdr, packet_number, &payload_len)) {
+                    ESP_LOGD(TAG, "QUICVC: Packet %llu failed authentication",
+                             (unsigned long long)packet_number);
+                    continue;
+                }
+                quicvc_ack_tracker_record(tracker, packet_number);
+                if (packet_number == tracker->largest) {
+                    conn->largest_received_at = esp_timer_get_time();
+                }
+                if (handle_quicvc_protected(conn, hdr->payload, payload_len, packet_number)) {
+                    send_quicvc_ack(conn);
+                }
+            }
         }
         
-        vTaskDelay(pdMS_TO_TICKS(10));
+        // Idle timeouts, heartbeats and coalescing deadlines now due
+        quicvc_timer_wheel_advance(&quicvc_timers, esp_timer_get_time());
     }
 }
 
@@ -403,53 +1174,8 @@ void heartbeat_task(void *param) {
         // Send regular heartbeat on service port
         // ... existing heartbeat code ...
         
-        // Send QUICVC heartbeat if connected
-        if (active_connection && active_connection->state == 2) {
-            uint8_t packet[128];
-            size_t offset = 0;
-            
-            // Build protected packet header
-            packet[offset++] = QUICVC_PROTECTED;
-            
-            // Version
-            uint32_t version = htonl(0x00000001);
-            memcpy(&packet[offset], &version, 4);
-            offset += 4;
-            
-            // CIDs
-            packet[offset++] = 16;
-            packet[offset++] = 16;
-            memcpy(&packet[offset], active_connection->dcid, 16);
-            offset += 16;
-            memcpy(&packet[offset], active_connection->scid, 16);
-            offset += 16;
-            
-            // Packet number
-            uint64_t pkt_num = active_connection->packet_number++;
-            memcpy(&packet[offset], &pkt_num, 8);
-            offset += 8;
-            
-            // Heartbeat frame
-            packet[offset++] = FRAME_HEARTBEAT;
-            
-            cJSON *hb = cJSON_CreateObject();
-            cJSON_AddNumberToObject(hb, "timestamp", esp_timer_get_time() / 1000000);
-            cJSON_AddNumberToObject(hb, "free_heap", esp_get_free_heap_size());
-            
-            char *hb_str = cJSON_PrintUnformatted(hb);
-            memcpy(&packet[offset], hb_str, strlen(hb_str));
-            offset += strlen(hb_str);
-            
-            // Send heartbeat
-            sendto(quicvc_socket, packet, offset, 0,
-                   (struct sockaddr*)&active_connection->peer_addr,
-                   sizeof(struct sockaddr_in));
-            
-            free(hb_str);
-            cJSON_Delete(hb);
-            
-            ESP_LOGD(TAG, "QUICVC: Heartbeat sent");
-        }
+        // QUICVC heartbeats and the latency log run from timers in
+        // quicvc_handler_task
         
         vTaskDelay(pdMS_TO_TICKS(20000));  // Every 20 seconds
     }
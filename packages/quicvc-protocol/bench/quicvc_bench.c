@@ -0,0 +1,429 @@
+/**
+ * Host benchmark suite for the QUIC-VC codec
+ * Compile with: cc -O2 -Ic-headers bench/quicvc_bench.c c-headers/quicvc_protocol.c -o quicvc-bench
+ *
+ * Usage: quicvc-bench [--baseline FILE] [--write-baseline FILE] [--threshold PERCENT]
+ *
+ * Each benchmark runs over a corpus shaped like real traffic (varint mix
+ * resembling ACK ranges and headers, STREAM payloads from small JSON
+ * commands up to full packets, mostly short headers) and reports the best
+ * of several rounds as ns/op and MB/s. With --baseline, any benchmark
+ * slower than the stored ns/op by more than the threshold (default 25%,
+ * above run-to-run noise on shared hosts) is re-measured, then flagged,
+ * and the exit status is 1. Baselines are machine-specific; refresh
+ * bench/baseline.txt with --write-baseline after intended changes.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "quicvc_protocol.h"
+
+// Large enough that the branch predictor cannot learn the length sequence
+#define VARINT_COUNT  65536
+#define FRAME_COUNT   4096
+#define PACKET_COUNT  4096
+#define ROUNDS        51
+#define MIN_ROUND_NS  2000000ull    // Repeat a pass until a round takes 2 ms
+#define RETRIES       3             // Re-measure before reporting a regression
+
+#define DEFAULT_THRESHOLD_PERCENT 25.0
+
+static volatile uint64_t sink;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// xorshift PRNG so runs are reproducible
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// Mostly small gaps/lengths, some stream offsets, rare 62-bit values
+static uint64_t random_varint_value(void) {
+    uint64_t r = rng_next();
+    switch (r % 16) {
+        case 0:  return (r >> 8) & 0x3FFFFFFFFFFFFFFFull;
+        case 1:
+        case 2:  return (r >> 8) % (QUICVC_VARINT_4_BYTE_MAX + 1ull);
+        case 3:
+        case 4:
+        case 5:  return (r >> 8) % (QUICVC_VARINT_2_BYTE_MAX + 1ull);
+        default: return (r >> 8) % (QUICVC_VARINT_1_BYTE_MAX + 1ull);
+    }
+}
+
+// STREAM payload sizes: JSON commands, journal chunks, full packets
+static size_t random_stream_len(void) {
+    uint64_t r = rng_next();
+    switch (r % 10) {
+        case 0:  return 1100 + (r >> 8) % 50;
+        case 1:
+        case 2:
+        case 3:  return 400 + (r >> 8) % 600;
+        default: return 40 + (r >> 8) % 160;
+    }
+}
+
+/**
+ * Corpora, built once in main()
+ */
+
+static uint64_t values[VARINT_COUNT];
+static uint64_t decoded[VARINT_COUNT];
+static uint8_t varints[VARINT_COUNT * 8];
+static size_t varints_len;
+
+static uint8_t stream_source[QUICVC_MAX_PACKET_SIZE];
+static quicvc_stream_frame_t frames[FRAME_COUNT];
+static uint8_t frame_bytes[FRAME_COUNT * QUICVC_MAX_PACKET_SIZE];
+static size_t frame_offsets[FRAME_COUNT + 1];
+static uint8_t serialize_out[QUICVC_MAX_PACKET_SIZE + QUICVC_MAX_STREAM_HEADER_SIZE];
+
+typedef struct {
+    size_t offset;
+    size_t len;
+    size_t header_len;
+} packet_ref_t;
+
+static uint8_t packet_bytes[PACKET_COUNT * 256];
+static packet_ref_t short_packets[PACKET_COUNT];
+static packet_ref_t long_packets[PACKET_COUNT];
+
+/**
+ * Benchmarks: one pass over a corpus, returning the bytes processed
+ */
+
+static size_t bench_varint_encode(void) {
+    size_t offset = 0;
+    for (size_t i = 0; i < VARINT_COUNT; i++) {
+        offset += quicvc_encode_varint(values[i], &varints[offset], sizeof(varints) - offset);
+    }
+    return offset;
+}
+
+static size_t bench_varint_decode(void) {
+    size_t offset = 0;
+    for (size_t i = 0; i < VARINT_COUNT; i++) {
+        quicvc_varint_result_t r = quicvc_decode_varint(&varints[offset], varints_len - offset);
+        decoded[i] = r.value;
+        offset += r.bytes_read;
+    }
+    sink += decoded[VARINT_COUNT - 1];
+    return offset;
+}
+
+static size_t bench_varint_decode_batch(void) {
+    size_t read = quicvc_decode_varints(varints, varints_len, decoded, VARINT_COUNT);
+    sink += decoded[VARINT_COUNT - 1];
+    return read;
+}
+
+static size_t bench_stream_parse(void) {
+    size_t bytes = 0;
+    for (size_t i = 0; i < FRAME_COUNT; i++) {
+        size_t len = frame_offsets[i + 1] - frame_offsets[i];
+        quicvc_stream_parse_result_t r = quicvc_parse_stream_frame(&frame_bytes[frame_offsets[i]], len);
+        sink += r.frame.data_len;
+        bytes += r.bytes_consumed;
+    }
+    return bytes;
+}
+
+static size_t bench_stream_serialize(void) {
+    size_t bytes = 0;
+    for (size_t i = 0; i < FRAME_COUNT; i++) {
+        bytes += quicvc_serialize_stream_frame(&frames[i], serialize_out, sizeof(serialize_out));
+    }
+    sink += serialize_out[0];
+    return bytes;
+}
+
+static size_t bench_frame_iter(void) {
+    quicvc_frame_iter_t iter;
+    quicvc_frame_t frame;
+    quicvc_frame_iter_init(&iter, frame_bytes, frame_offsets[FRAME_COUNT]);
+    while (quicvc_frame_iter_next(&iter, &frame)) {
+        sink += frame.raw_len;
+    }
+    return iter.offset;
+}
+
+static size_t bench_header_parse(const packet_ref_t *packets) {
+    size_t bytes = 0;
+    for (size_t i = 0; i < PACKET_COUNT; i++) {
+        quicvc_header_parse_result_t r = quicvc_parse_header(
+            &packet_bytes[packets[i].offset], packets[i].len, QUICVC_DEFAULT_CONNECTION_ID_LENGTH);
+        bytes += r.header.header_len;
+    }
+    sink += bytes;
+    return bytes;
+}
+
+static size_t bench_header_parse_short(void) {
+    return bench_header_parse(short_packets);
+}
+
+static size_t bench_header_parse_long(void) {
+    return bench_header_parse(long_packets);
+}
+
+typedef struct {
+    const char *name;
+    size_t (*run)(void);
+    size_t ops;                 // Operations per pass
+    double ns_per_op;
+    double mb_per_s;
+    double baseline_ns;         // 0 if not in the baseline
+} bench_t;
+
+static bench_t benches[] = {
+    { "varint_encode",        bench_varint_encode,        VARINT_COUNT, 0, 0, 0 },
+    { "varint_decode",        bench_varint_decode,        VARINT_COUNT, 0, 0, 0 },
+    { "varint_decode_batch",  bench_varint_decode_batch,  VARINT_COUNT, 0, 0, 0 },
+    { "stream_parse",         bench_stream_parse,         FRAME_COUNT,  0, 0, 0 },
+    { "stream_serialize",     bench_stream_serialize,     FRAME_COUNT,  0, 0, 0 },
+    { "frame_iter",           bench_frame_iter,           FRAME_COUNT,  0, 0, 0 },
+    { "header_parse_short",   bench_header_parse_short,   PACKET_COUNT, 0, 0, 0 },
+    { "header_parse_long",    bench_header_parse_long,    PACKET_COUNT, 0, 0, 0 },
+};
+
+#define BENCH_COUNT (sizeof(benches) / sizeof(benches[0]))
+
+static void build_corpora(void) {
+    for (size_t i = 0; i < VARINT_COUNT; i++) {
+        values[i] = random_varint_value();
+        varints_len += quicvc_encode_varint(values[i], &varints[varints_len], sizeof(varints) - varints_len);
+    }
+
+    for (size_t i = 0; i < sizeof(stream_source); i++) {
+        stream_source[i] = (uint8_t)rng_next();
+    }
+    for (size_t i = 0; i < FRAME_COUNT; i++) {
+        uint64_t r = rng_next();
+        frames[i] = (quicvc_stream_frame_t){
+            .stream_id = r % 8,
+            .offset = (r >> 8) % 100000,
+            .data = stream_source,
+            .data_len = random_stream_len(),
+            .has_len = true,
+            .has_off = (r >> 4) & 1,
+        };
+        frame_offsets[i + 1] = frame_offsets[i] + quicvc_serialize_stream_frame(
+            &frames[i], &frame_bytes[frame_offsets[i]], sizeof(frame_bytes) - frame_offsets[i]);
+    }
+
+    // Short headers with an 8-byte DCID and 1-4 byte packet numbers, and
+    // INITIAL long headers with a token; only the header is parsed, so
+    // each packet carries a short payload
+    uint8_t dcid[QUICVC_DEFAULT_CONNECTION_ID_LENGTH];
+    uint8_t scid[QUICVC_DEFAULT_CONNECTION_ID_LENGTH];
+    uint8_t token[32];
+    for (size_t i = 0; i < sizeof(dcid); i++) dcid[i] = (uint8_t)rng_next();
+    for (size_t i = 0; i < sizeof(scid); i++) scid[i] = (uint8_t)rng_next();
+    for (size_t i = 0; i < sizeof(token); i++) token[i] = (uint8_t)rng_next();
+
+    size_t offset = 0;
+    for (size_t i = 0; i < PACKET_COUNT; i++) {
+        quicvc_header_t hdr = {
+            .dcid = dcid,
+            .dcid_len = sizeof(dcid),
+            .packet_number = rng_next() & 0xFFFF,
+            .packet_number_len = (uint8_t)(1 + rng_next() % 4),
+        };
+        size_t len = quicvc_write_short_header(&hdr, &packet_bytes[offset], sizeof(packet_bytes) - offset);
+        short_packets[i] = (packet_ref_t){ offset, len + 48, len };
+        offset += len + 48;
+    }
+    for (size_t i = 0; i < PACKET_COUNT; i++) {
+        quicvc_header_t hdr = {
+            .packet_type = QUICVC_PACKET_TYPE_INITIAL,
+            .version = QUICVC_VERSION,
+            .dcid = dcid,
+            .dcid_len = sizeof(dcid),
+            .scid = scid,
+            .scid_len = sizeof(scid),
+            .token = token,
+            .token_len = (i % 4 == 0) ? sizeof(token) : 0,
+            .packet_number = i,
+            .packet_number_len = 2,
+        };
+        size_t len = quicvc_write_long_header(&hdr, 16 + QUICVC_AEAD_TAG_LENGTH,
+                                              &packet_bytes[offset], sizeof(packet_bytes) - offset);
+        long_packets[i] = (packet_ref_t){ offset, len + 16 + QUICVC_AEAD_TAG_LENGTH, len };
+        offset += len + 16 + QUICVC_AEAD_TAG_LENGTH;
+    }
+}
+
+// Check the corpora parse back before timing anything
+static int verify_corpora(void) {
+    if (quicvc_decode_varints(varints, varints_len, decoded, VARINT_COUNT) != varints_len ||
+        memcmp(decoded, values, sizeof(values)) != 0) {
+        fprintf(stderr, "varint corpus does not round-trip\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < FRAME_COUNT; i++) {
+        size_t len = frame_offsets[i + 1] - frame_offsets[i];
+        quicvc_stream_parse_result_t r = quicvc_parse_stream_frame(&frame_bytes[frame_offsets[i]], len);
+        if (len == 0 || r.bytes_consumed != len || r.frame.data_len != frames[i].data_len) {
+            fprintf(stderr, "STREAM corpus frame %zu does not round-trip\n", i);
+            return 1;
+        }
+    }
+
+    for (size_t i = 0; i < PACKET_COUNT; i++) {
+        const packet_ref_t *refs[2] = { &short_packets[i], &long_packets[i] };
+        for (int k = 0; k < 2; k++) {
+            quicvc_header_parse_result_t r = quicvc_parse_header(
+                &packet_bytes[refs[k]->offset], refs[k]->len, QUICVC_DEFAULT_CONNECTION_ID_LENGTH);
+            if (refs[k]->header_len == 0 || r.bytes_consumed != refs[k]->len ||
+                r.header.header_len != refs[k]->header_len) {
+                fprintf(stderr, "header corpus packet %zu does not parse\n", i);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void run_bench(bench_t *b) {
+    // Size a round so timer resolution does not matter
+    size_t passes = 1;
+    uint64_t start = now_ns();
+    b->run();
+    uint64_t one = now_ns() - start;
+    if (one > 0 && one < MIN_ROUND_NS) {
+        passes = (size_t)(MIN_ROUND_NS / one);
+    }
+
+    // Best of several rounds to keep scheduler noise out of the numbers
+    double best_ns = 0;
+    size_t bytes = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        bytes = 0;
+        start = now_ns();
+        for (size_t p = 0; p < passes; p++) {
+            bytes += b->run();
+        }
+        double ns = (double)(now_ns() - start);
+        if (round == 0 || ns < best_ns) best_ns = ns;
+    }
+
+    // Repeated calls keep the best result seen so far
+    double ns_per_op = best_ns / ((double)passes * (double)b->ops);
+    if (b->ns_per_op == 0 || ns_per_op < b->ns_per_op) {
+        b->ns_per_op = ns_per_op;
+        b->mb_per_s = ((double)bytes / 1e6) / (best_ns / 1e9);
+    }
+}
+
+static bench_t *find_bench(const char *name) {
+    for (size_t i = 0; i < BENCH_COUNT; i++) {
+        if (strcmp(benches[i].name, name) == 0) return &benches[i];
+    }
+    return NULL;
+}
+
+// Baseline format: one "name ns_per_op" per line, '#' starts a comment
+static int read_baseline(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "cannot read baseline %s\n", path);
+        return 1;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        char name[64];
+        double ns;
+        if (line[0] == '#' || sscanf(line, "%63s %lf", name, &ns) != 2) continue;
+        bench_t *b = find_bench(name);
+        if (b) b->baseline_ns = ns;
+    }
+    fclose(f);
+    return 0;
+}
+
+static int write_baseline(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "cannot write baseline %s\n", path);
+        return 1;
+    }
+
+    fprintf(f, "# quicvc_bench baseline (ns/op); machine-specific, refresh with --write-baseline\n");
+    for (size_t i = 0; i < BENCH_COUNT; i++) {
+        fprintf(f, "%s %.3f\n", benches[i].name, benches[i].ns_per_op);
+    }
+    fclose(f);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *baseline_path = NULL;
+    const char *write_path = NULL;
+    double threshold = DEFAULT_THRESHOLD_PERCENT;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baseline_path = argv[++i];
+        } else if (strcmp(argv[i], "--write-baseline") == 0 && i + 1 < argc) {
+            write_path = argv[++i];
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            threshold = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--baseline FILE] [--write-baseline FILE] [--threshold PERCENT]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    build_corpora();
+    if (verify_corpora() != 0) {
+        return 1;
+    }
+    if (baseline_path && read_baseline(baseline_path) != 0) {
+        return 1;
+    }
+
+    int regressions = 0;
+    printf("%-22s %10s %10s %10s\n", "benchmark", "ns/op", "MB/s", "baseline");
+    for (size_t i = 0; i < BENCH_COUNT; i++) {
+        bench_t *b = &benches[i];
+        run_bench(b);
+        for (int retry = 0; retry < RETRIES && b->baseline_ns > 0 &&
+                            b->ns_per_op > b->baseline_ns * (1.0 + threshold / 100.0); retry++) {
+            run_bench(b);
+        }
+
+        printf("%-22s %10.2f %10.1f", b->name, b->ns_per_op, b->mb_per_s);
+        if (b->baseline_ns > 0) {
+            double change = (b->ns_per_op / b->baseline_ns - 1.0) * 100.0;
+            bool regressed = change > threshold;
+            printf(" %+9.1f%%%s", change, regressed ? "  REGRESSION" : "");
+            regressions += regressed;
+        }
+        printf("\n");
+    }
+
+    if (write_path && write_baseline(write_path) != 0) {
+        return 1;
+    }
+    if (regressions > 0) {
+        printf("%d benchmark(s) more than %.0f%% slower than %s\n", regressions, threshold, baseline_path);
+        return 1;
+    }
+    return 0;
+}
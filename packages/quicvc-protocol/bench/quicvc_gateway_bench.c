@@ -0,0 +1,623 @@
+/**
+ * Loopback benchmark for the QUIC-VC gateway
+ * Compile with: cc -O2 -pthread -Ic-headers -Ihost -Igateway bench/quicvc_gateway_bench.c gateway/quicvc_gateway.c host/quicvc_aead_host.c c-headers/quicvc_protocol.c -lcrypto -o quicvc-gateway-bench
+ *
+ * A thread plays DEVICES devices on one socket, answering INITIALs with
+ * the VC_RESPONSE HANDSHAKE and ACKing every command packet, with
+ * recvmmsg/sendmmsg so the peer is never the bottleneck. Both ends do
+ * the X25519 exchange and seal every 1-RTT packet, so the handshake
+ * and command rates include the key agreement and AEAD cost; the peer
+ * opens what it reads except in the download test, where it only
+ * counts packets. The gateway connects to all of them at once, then
+ * sends one command per device per round and waits for the ACKs. Each test runs with one datagram per
+ * system call (sendto/recvfrom behaviour) and with full batches; the
+ * table has the rate, the handshake latency and the datagrams moved per
+ * system call. The devices share one address here, so UDP GSO would
+ * merge datagrams meant for different devices: the command tests run
+ * without offload.
+ *
+ * The bulk tests move full-sized packets to BULK_DEVICES devices
+ * (BULK_BYTES per device per round, on a stream) and from them (runs of
+ * UPLOAD_RUN packets sent with UDP_SEGMENT, as a device journal upload),
+ * with and without GSO/GRO in the gateway. The peer reads with UDP_GRO.
+ * The rates are per second of wall time and per second of the gateway
+ * thread's CPU time; on loopback the peer shares the machine.
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+
+#include "quicvc_protocol.h"
+#include "quicvc_aead_host.h"
+#include "quicvc_gateway.h"
+
+#define DEVICES        256
+#define ROUNDS         400
+#define PEER_BATCH     64
+#define PEER_RX_SIZE   65535        // A GRO run
+#define BULK_DEVICES   32
+#define BULK_BYTES     32768
+#define BULK_ROUNDS    200
+#define UPLOAD_RUN     32
+#define UPLOAD_STREAM  5
+#define CREDENTIAL     "{\"id\":\"bench-gateway\",\"issuer\":\"owner-1\",\"subject\":\"gateway\"}"
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+static const size_t payload_sizes[] = { 64, 1024 };  // A command, a journal chunk
+static const size_t batch_sizes[] = { 1, QUICVC_GATEWAY_BATCH };
+
+// Device side, owned by the peer thread
+typedef struct {
+    uint8_t gateway_cid[QUICVC_DEFAULT_CONNECTION_ID_LENGTH];
+    void *aead_send;            // "server"
+    void *aead_recv;            // "client"
+    uint64_t packet_number;
+    quicvc_ack_tracker_t ack_tracker;
+    uint64_t upload_offset;
+} peer_device_t;
+
+typedef enum {
+    PEER_ACK,           // ACK every command packet
+    PEER_COUNT,         // Only count the packets: bulk sends from the gateway
+    PEER_UPLOAD,        // Answer a command with UPLOAD_RUN stream packets
+} peer_mode_t;
+
+static peer_device_t peers[DEVICES];
+static int peer_fd;
+static struct sockaddr_in peer_addr;
+static volatile int peer_stop;
+static volatile peer_mode_t peer_mode;
+static uint64_t peer_received;      // Short header packets, for PEER_COUNT
+static uint32_t next_device;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// The device's CID carries its index
+static void device_cid(uint32_t index, uint8_t *cid) {
+    memset(cid, 0xd0, QUICVC_DEFAULT_CONNECTION_ID_LENGTH);
+    memcpy(cid, &index, sizeof(index));
+}
+
+// Key the device from the gateway's key share; its own goes to 'public_hex'
+static bool agree(peer_device_t *d, const char *gateway_key, const char *challenge, char *public_hex) {
+    uint8_t peer[QUICVC_KEY_SHARE_LENGTH], private_key[QUICVC_KEY_SHARE_LENGTH];
+    uint8_t public_key[QUICVC_KEY_SHARE_LENGTH] = {0}, shared[QUICVC_KEY_SHARE_LENGTH];
+    uint8_t session_key[32], key[QUICVC_AEAD_KEY_LENGTH], iv[QUICVC_AEAD_NONCE_LENGTH];
+    for (size_t i = 0; i < sizeof(peer); i++) {
+        unsigned byte;
+        if (sscanf(&gateway_key[2 * i], "%2x", &byte) != 1) return false;
+        peer[i] = (uint8_t)byte;
+    }
+    quicvc_aead_openssl.destroy(d->aead_send);
+    quicvc_aead_openssl.destroy(d->aead_recv);
+    d->aead_send = d->aead_recv = NULL;
+    bool ok = quicvc_host_key_share(private_key, public_key) &&
+              quicvc_host_key_exchange(private_key, peer, shared) &&
+              quicvc_host_derive(shared, "quicvc session", (const uint8_t *)challenge, 32, session_key) &&
+              quicvc_host_aead_derive(session_key, "server", key, iv) &&
+              (d->aead_send = quicvc_aead_openssl.create(key, iv)) != NULL &&
+              quicvc_host_aead_derive(session_key, "client", key, iv) &&
+              (d->aead_recv = quicvc_aead_openssl.create(key, iv)) != NULL;
+    for (size_t i = 0; i < sizeof(public_key); i++) {
+        snprintf(&public_hex[2 * i], 3, "%02x", public_key[i]);
+    }
+    return ok;
+}
+
+// Seal 'frames' behind the 'header_len' bytes of header at 'out'
+static size_t seal(peer_device_t *d, uint8_t *out, size_t header_len, uint64_t packet_number,
+                   const uint8_t *frames, size_t frames_len) {
+    quicvc_iovec_t iov = { frames, frames_len };
+    quicvc_aead_packet_t p = {
+        .packet = out,
+        .header_len = header_len,
+        .packet_size = QUICVC_MAX_PACKET_SIZE,
+        .iov = &iov,
+        .iov_count = 1,
+        .packet_number = packet_number,
+    };
+    return quicvc_aead_openssl.seal_batch(d->aead_send, &p, 1) == 1 ? p.packet_len : 0;
+}
+
+// The device a short header packet is for, with the packet opened in
+// place and recorded; NULL if it does not open
+static peer_device_t *open_command(uint8_t *packet, quicvc_header_t *hdr) {
+    uint32_t index;
+    memcpy(&index, hdr->dcid, sizeof(index));
+    if (index >= next_device) {
+        return NULL;
+    }
+    peer_device_t *d = &peers[index];
+    quicvc_ack_tracker_t *tracker = &d->ack_tracker;
+    uint64_t packet_number = quicvc_decode_packet_number(
+        tracker->has_packets ? tracker->largest + 1 : 0, hdr->packet_number, hdr->packet_number_len);
+    quicvc_aead_packet_t p = {
+        .packet = packet,
+        .header_len = (size_t)(hdr->payload - packet),
+        .packet_len = (size_t)(hdr->payload - packet) + hdr->payload_len,
+        .packet_number = packet_number,
+    };
+    if (quicvc_aead_openssl.open_batch(d->aead_recv, &p, 1) != 1) {
+        return NULL;
+    }
+    hdr->payload_len = p.payload_len;
+    quicvc_ack_tracker_record(tracker, packet_number);
+    return d;
+}
+
+static size_t answer_initial(const quicvc_header_t *hdr, uint8_t *out) {
+    const uint8_t *challenge = memmem(hdr->payload, hdr->payload_len, "\"challenge\":\"", 13);
+    const uint8_t *key = memmem(hdr->payload, hdr->payload_len, "\"key\":\"", 7);
+    if (!challenge || !key || hdr->scid_len != QUICVC_DEFAULT_CONNECTION_ID_LENGTH ||
+        next_device == DEVICES) {
+        return 0;
+    }
+    uint32_t index = next_device;
+    peer_device_t *d = &peers[index];
+    char public_key[2 * QUICVC_KEY_SHARE_LENGTH + 1];
+    if (!agree(d, (const char *)key + 7, (const char *)challenge + 13, public_key)) {
+        return 0;
+    }
+    next_device++;
+    memcpy(d->gateway_cid, hdr->scid, hdr->scid_len);
+    d->packet_number = 0;
+    d->upload_offset = 0;
+    quicvc_ack_tracker_init(&d->ack_tracker);
+
+    char json[256];
+    int json_len = snprintf(json, sizeof(json),
+                            "{\"type\":\"VC_RESPONSE\",\"credential\":{\"id\":\"esp32-%u\","
+                            "\"issuer\":\"owner-1\"},\"challenge\":\"%.32s\",\"key\":\"%s\"}",
+                            index, challenge + 13, public_key);
+    uint8_t cid[QUICVC_DEFAULT_CONNECTION_ID_LENGTH];
+    device_cid(index, cid);
+    quicvc_header_t reply = {
+        .packet_type = QUICVC_PACKET_TYPE_HANDSHAKE,
+        .version = QUICVC_VERSION,
+        .dcid = d->gateway_cid,
+        .dcid_len = sizeof(d->gateway_cid),
+        .scid = cid,
+        .scid_len = sizeof(cid),
+        .packet_number = d->packet_number++,
+        .packet_number_len = 1,
+    };
+    size_t len = quicvc_write_long_header(&reply, (size_t)json_len, out, QUICVC_MAX_PACKET_SIZE);
+    memcpy(&out[len], json, (size_t)json_len);
+    return len + (size_t)json_len;
+}
+
+static size_t answer_command(uint8_t *packet, quicvc_header_t *hdr, uint8_t *out) {
+    peer_device_t *d = open_command(packet, hdr);
+    if (!d) {
+        return 0;
+    }
+    quicvc_header_t reply = {
+        .dcid = d->gateway_cid,
+        .dcid_len = sizeof(d->gateway_cid),
+        .packet_number = d->packet_number++,
+        .packet_number_len = 4,
+    };
+    uint8_t ack[64];
+    size_t ack_len = quicvc_ack_tracker_write_frame(&d->ack_tracker, 0, ack, sizeof(ack));
+    return seal(d, out, quicvc_write_short_header(&reply, out, QUICVC_MAX_PACKET_SIZE),
+                reply.packet_number, ack, ack_len);
+}
+
+static bool has_stream(const quicvc_header_t *hdr) {
+    quicvc_frame_iter_t iter;
+    quicvc_frame_t frame;
+    quicvc_frame_iter_init(&iter, hdr->payload, hdr->payload_len);
+    while (quicvc_frame_iter_next(&iter, &frame)) {
+        if ((frame.type & 0xF8) == QUICVC_FRAME_STREAM) return true;
+    }
+    return false;
+}
+
+// UPLOAD_RUN full-sized sealed STREAM packets in one UDP_SEGMENT send.
+// Offset and length are fixed-width varints so every packet is the same
+// size.
+static void upload(peer_device_t *d, const struct sockaddr_in *to) {
+    static uint8_t run[UPLOAD_RUN * QUICVC_MAX_PACKET_SIZE];
+    uint8_t frame[QUICVC_MAX_PACKET_SIZE];
+    for (size_t k = 0; k < UPLOAD_RUN; k++) {
+        uint8_t *p = &run[k * QUICVC_MAX_PACKET_SIZE];
+        quicvc_header_t packet = {
+            .dcid = d->gateway_cid,
+            .dcid_len = sizeof(d->gateway_cid),
+            .packet_number = d->packet_number++,
+            .packet_number_len = 4,
+        };
+        size_t header_len = quicvc_write_short_header(&packet, p, QUICVC_MAX_PACKET_SIZE);
+        size_t data_len = QUICVC_MAX_PACKET_SIZE - header_len - QUICVC_AEAD_TAG_LENGTH - 8;
+        uint32_t offset = (uint32_t)d->upload_offset;
+        size_t len = 0;
+        frame[len++] = QUICVC_FRAME_STREAM | QUICVC_STREAM_OFF_BIT | QUICVC_STREAM_LEN_BIT;
+        frame[len++] = UPLOAD_STREAM;
+        frame[len++] = (uint8_t)(0x80 | (offset >> 24));
+        frame[len++] = (uint8_t)(offset >> 16);
+        frame[len++] = (uint8_t)(offset >> 8);
+        frame[len++] = (uint8_t)offset;
+        frame[len++] = (uint8_t)(0x40 | (data_len >> 8));
+        frame[len++] = (uint8_t)data_len;
+        memset(&frame[len], 'j', data_len);
+        seal(d, p, header_len, packet.packet_number, frame, len + data_len);
+        d->upload_offset += data_len;
+    }
+
+    uint16_t segment = QUICVC_MAX_PACKET_SIZE;
+    union {
+        char buf[CMSG_SPACE(sizeof(uint16_t))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = { run, sizeof(run) };
+    struct msghdr msg = {
+        .msg_name = (void *)to,
+        .msg_namelen = sizeof(*to),
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(segment));
+    memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+    if (sendmsg(peer_fd, &msg, 0) < 0) {
+        for (size_t k = 0; k < UPLOAD_RUN; k++) {
+            sendto(peer_fd, &run[k * QUICVC_MAX_PACKET_SIZE], QUICVC_MAX_PACKET_SIZE, 0,
+                   (const struct sockaddr *)to, sizeof(*to));
+        }
+    }
+}
+
+static size_t gro_size(struct msghdr *hdr, size_t len) {
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            int size;
+            memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+            return size > 0 ? (size_t)size : len;
+        }
+    }
+    return len;
+}
+
+static void send_replies(struct mmsghdr *msgs, int replies) {
+    for (int sent = 0; sent < replies;) {
+        int m = sendmmsg(peer_fd, &msgs[sent], (unsigned)(replies - sent), 0);
+        if (m <= 0) break;
+        sent += m;
+    }
+}
+
+static void *peer_thread(void *arg) {
+    (void)arg;
+    static uint8_t rx[PEER_BATCH][PEER_RX_SIZE], tx[PEER_BATCH][QUICVC_MAX_PACKET_SIZE];
+    static union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control[PEER_BATCH];
+    struct mmsghdr rx_msgs[PEER_BATCH], tx_msgs[PEER_BATCH];
+    struct iovec rx_iov[PEER_BATCH], tx_iov[PEER_BATCH];
+    struct sockaddr_in from[PEER_BATCH];
+    memset(rx_msgs, 0, sizeof(rx_msgs));
+    memset(tx_msgs, 0, sizeof(tx_msgs));
+    for (int i = 0; i < PEER_BATCH; i++) {
+        rx_iov[i] = (struct iovec){ rx[i], sizeof(rx[i]) };
+        rx_msgs[i].msg_hdr.msg_iov = &rx_iov[i];
+        rx_msgs[i].msg_hdr.msg_iovlen = 1;
+        rx_msgs[i].msg_hdr.msg_name = &from[i];
+        rx_msgs[i].msg_hdr.msg_control = control[i].buf;
+        tx_msgs[i].msg_hdr.msg_iov = &tx_iov[i];
+        tx_msgs[i].msg_hdr.msg_iovlen = 1;
+        tx_msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+    }
+
+    while (!peer_stop) {
+        for (int i = 0; i < PEER_BATCH; i++) {
+            rx_msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+            rx_msgs[i].msg_hdr.msg_controllen = sizeof(control[i].buf);
+        }
+        int n = recvmmsg(peer_fd, rx_msgs, PEER_BATCH, MSG_WAITFORONE, NULL);
+        int replies = 0;
+        uint64_t counted = 0;
+        for (int i = 0; i < n; i++) {
+            size_t left = rx_msgs[i].msg_len;
+            size_t segment = gro_size(&rx_msgs[i].msg_hdr, left);
+            for (uint8_t *packet = rx[i]; left > 0; packet += segment, left -= segment) {
+                if (segment > left) segment = left;
+                quicvc_header_parse_result_t parsed =
+                    quicvc_parse_header(packet, segment, QUICVC_DEFAULT_CONNECTION_ID_LENGTH);
+                if (parsed.bytes_consumed == 0) continue;
+                size_t len = 0;
+                peer_device_t *d;
+                if (parsed.header.is_long) {
+                    if (parsed.header.packet_type == QUICVC_PACKET_TYPE_INITIAL) {
+                        len = answer_initial(&parsed.header, tx[replies]);
+                    }
+                } else if (peer_mode == PEER_COUNT) {
+                    counted++;
+                } else if (peer_mode == PEER_UPLOAD) {
+                    if ((d = open_command(packet, &parsed.header)) && has_stream(&parsed.header)) {
+                        upload(d, &from[i]);
+                    }
+                } else {
+                    len = answer_command(packet, &parsed.header, tx[replies]);
+                }
+                if (len == 0) continue;
+                tx_iov[replies] = (struct iovec){ tx[replies], len };
+                tx_msgs[replies].msg_hdr.msg_name = &from[i];
+                if (++replies == PEER_BATCH) {
+                    send_replies(tx_msgs, replies);
+                    replies = 0;
+                }
+            }
+        }
+        __atomic_add_fetch(&peer_received, counted, __ATOMIC_RELEASE);
+        send_replies(tx_msgs, replies);
+    }
+    return NULL;
+}
+
+typedef struct {
+    double handshakes_per_s;
+    uint64_t handshake_p50_us;
+    uint64_t handshake_p99_us;
+    double commands_per_s;
+    double datagrams_per_call;
+} gateway_result_t;
+
+typedef struct {
+    double datagrams_per_s;
+    double datagrams_per_cpu_s;     // Gateway thread only
+    double megabytes_per_s;
+    double datagrams_per_call;
+    double offloaded;               // Share of datagrams in GSO/GRO runs
+} bulk_result_t;
+
+static uint64_t thread_cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Start the peer thread and a gateway, and connect 'devices' devices.
+// '*gateway' is NULL if that fails; false if the thread did not start.
+static bool start(pthread_t *thread, size_t batch, bool no_offload, int devices,
+                  quicvc_gateway_t **gateway) {
+    next_device = 0;
+    peer_stop = 0;
+    peer_mode = PEER_ACK;
+    *gateway = NULL;
+    if (pthread_create(thread, NULL, peer_thread, NULL) != 0) {
+        return false;
+    }
+    quicvc_gateway_config_t config = {
+        .credential_json = CREDENTIAL,
+        .max_devices = DEVICES,
+        .batch = batch,
+        .no_offload = no_offload,
+        .handshake_timeout_us = 200000,
+    };
+    config.bind_addr.s_addr = htonl(INADDR_LOOPBACK);
+    quicvc_gateway_t *gw = quicvc_gateway_new(&config);
+    bool ok = gw != NULL;
+
+    uint64_t start_ns = now_ns();
+    for (int i = 0; ok && i < devices; i++) {
+        ok = quicvc_gateway_connect(gw, &peer_addr) != QUICVC_GATEWAY_NONE;
+    }
+    while (ok && quicvc_gateway_established(gw) < (size_t)devices && now_ns() - start_ns < 5000000000ull) {
+        quicvc_gateway_poll(gw, 10);
+    }
+    if (gw && (!ok || quicvc_gateway_established(gw) != (size_t)devices)) {
+        quicvc_gateway_free(gw);
+        gw = NULL;
+    }
+    *gateway = gw;
+    return true;
+}
+
+static void stop(pthread_t thread, quicvc_gateway_t *gw) {
+    peer_stop = 1;
+    // Wake the peer thread out of recvmmsg
+    sendto(peer_fd, "", 1, 0, (struct sockaddr *)&peer_addr, sizeof(peer_addr));
+    pthread_join(thread, NULL);
+    quicvc_gateway_free(gw);
+    for (int i = 0; i < DEVICES; i++) {
+        quicvc_aead_openssl.destroy(peers[i].aead_send);
+        quicvc_aead_openssl.destroy(peers[i].aead_recv);
+        peers[i].aead_send = peers[i].aead_recv = NULL;
+    }
+}
+
+static bool run(size_t batch, size_t payload_len, gateway_result_t *result) {
+    pthread_t thread;
+    quicvc_gateway_t *gw;
+    uint64_t start_ns = now_ns();
+    if (!start(&thread, batch, true, DEVICES, &gw)) {
+        return false;
+    }
+    bool ok = gw != NULL;
+    if (ok) {
+        const quicvc_gateway_stats_t *s = quicvc_gateway_stats(gw);
+        result->handshakes_per_s = DEVICES * 1e9 / (double)(now_ns() - start_ns);
+        result->handshake_p50_us = quicvc_perf_percentile(&s->handshake_ns, 50) / 1000;
+        result->handshake_p99_us = quicvc_perf_percentile(&s->handshake_ns, 99) / 1000;
+    }
+
+    // Commands: one per device per round, then wait for every ACK
+    uint8_t payload[1024];
+    memset(payload, 'x', sizeof(payload));
+    uint64_t received = ok ? quicvc_gateway_stats(gw)->datagrams_received : 0;
+    uint64_t calls = ok ? quicvc_gateway_stats(gw)->send_calls + quicvc_gateway_stats(gw)->recv_calls : 0;
+    uint64_t moved = ok ? quicvc_gateway_stats(gw)->datagrams_sent + received : 0;
+    start_ns = now_ns();
+    for (int round = 0; ok && round < ROUNDS; round++) {
+        for (int d = 0; d < DEVICES; d++) {
+            quicvc_gateway_send(gw, d, 3, payload, payload_len);
+        }
+        received += DEVICES;
+        uint64_t round_start = now_ns();
+        while (quicvc_gateway_stats(gw)->datagrams_received < received) {
+            quicvc_gateway_poll(gw, 10);
+            if (now_ns() - round_start > 1000000000ull) {
+                ok = false;     // ACKs lost
+                break;
+            }
+        }
+    }
+    if (ok) {
+        const quicvc_gateway_stats_t *s = quicvc_gateway_stats(gw);
+        result->commands_per_s = (double)ROUNDS * DEVICES * 1e9 / (double)(now_ns() - start_ns);
+        result->datagrams_per_call = (double)(s->datagrams_sent + s->datagrams_received - moved) /
+                                     (double)(s->send_calls + s->recv_calls - calls);
+    }
+    stop(thread, gw);
+    return ok;
+}
+
+// Bulk: BULK_BYTES to each device per round and wait until the peer has
+// every packet, or ask each device for an upload run and wait for all of it
+static bool run_bulk(bool uploads, bool no_offload, bulk_result_t *result) {
+    pthread_t thread;
+    quicvc_gateway_t *gw;
+    if (!start(&thread, QUICVC_GATEWAY_BATCH, no_offload, BULK_DEVICES, &gw)) {
+        return false;
+    }
+    if (!gw) {
+        stop(thread, NULL);
+        return false;
+    }
+    static uint8_t data[BULK_BYTES];
+    static const char request[] = "{\"type\":\"journal_upload\"}";
+    memset(data, 'b', sizeof(data));
+    peer_mode = uploads ? PEER_UPLOAD : PEER_COUNT;
+
+    const quicvc_gateway_stats_t *s = quicvc_gateway_stats(gw);
+    quicvc_gateway_stats_t before = *s;
+    uint64_t counted = __atomic_load_n(&peer_received, __ATOMIC_ACQUIRE);
+    uint64_t received = s->datagrams_received;
+    uint64_t start_ns = now_ns();
+    uint64_t start_cpu = thread_cpu_ns();
+    bool ok = true;
+    for (int round = 0; ok && round < BULK_ROUNDS; round++) {
+        uint64_t sent = s->datagrams_sent;
+        for (int d = 0; d < BULK_DEVICES; d++) {
+            if (uploads) {
+                quicvc_gateway_send(gw, d, 3, (const uint8_t *)request, sizeof(request) - 1);
+            } else {
+                quicvc_gateway_send(gw, d, UPLOAD_STREAM, data, sizeof(data));
+            }
+        }
+        quicvc_gateway_flush(gw);
+        if (uploads) {
+            received += BULK_DEVICES * UPLOAD_RUN;
+        } else {
+            counted += s->datagrams_sent - sent;
+        }
+        uint64_t round_start = now_ns();
+        while (uploads ? s->datagrams_received < received
+                       : __atomic_load_n(&peer_received, __ATOMIC_ACQUIRE) < counted) {
+            quicvc_gateway_poll(gw, 1);
+            if (now_ns() - round_start > 1000000000ull) {
+                ok = false;     // Datagrams lost
+                break;
+            }
+        }
+    }
+    if (ok) {
+        double wall_s = (double)(now_ns() - start_ns) / 1e9;
+        double cpu_s = (double)(thread_cpu_ns() - start_cpu) / 1e9;
+        uint64_t moved = uploads ? s->datagrams_received - before.datagrams_received
+                                 : s->datagrams_sent - before.datagrams_sent;
+        uint64_t bytes = uploads ? s->bytes_received - before.bytes_received
+                                 : s->bytes_sent - before.bytes_sent;
+        uint64_t offloaded = uploads ? s->gro_datagrams - before.gro_datagrams
+                                     : s->gso_datagrams - before.gso_datagrams;
+        uint64_t calls = uploads ? s->recv_calls - before.recv_calls : s->send_calls - before.send_calls;
+        result->datagrams_per_s = (double)moved / wall_s;
+        result->datagrams_per_cpu_s = (double)moved / cpu_s;
+        result->megabytes_per_s = (double)bytes / wall_s / 1e6;
+        result->datagrams_per_call = (double)moved / (double)calls;
+        result->offloaded = (double)offloaded / (double)moved;
+    }
+    stop(thread, gw);
+    return ok;
+}
+
+int main(void) {
+    peer_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int buffer = 4 * 1024 * 1024;
+    int one = 1;
+    setsockopt(peer_fd, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+    setsockopt(peer_fd, SOL_SOCKET, SO_SNDBUF, &buffer, sizeof(buffer));
+    setsockopt(peer_fd, SOL_UDP, UDP_GRO, &one, sizeof(one));
+    peer_addr = (struct sockaddr_in){ .sin_family = AF_INET };
+    peer_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(peer_addr);
+    if (bind(peer_fd, (struct sockaddr *)&peer_addr, sizeof(peer_addr)) < 0 ||
+        getsockname(peer_fd, (struct sockaddr *)&peer_addr, &len) < 0) {
+        fprintf(stderr, "cannot bind the device socket\n");
+        return 1;
+    }
+
+    printf("%d devices, %d command rounds\n", DEVICES, ROUNDS);
+    printf("%8s %6s %12s %10s %10s %12s %10s\n", "payload", "batch", "handshakes/s",
+           "p50 us", "p99 us", "commands/s", "dgram/call");
+    int failures = 0;
+    for (size_t p = 0; p < sizeof(payload_sizes) / sizeof(payload_sizes[0]); p++) {
+        for (size_t b = 0; b < sizeof(batch_sizes) / sizeof(batch_sizes[0]); b++) {
+            gateway_result_t r;
+            if (!run(batch_sizes[b], payload_sizes[p], &r)) {
+                printf("%8zu %6zu FAILED\n", payload_sizes[p], batch_sizes[b]);
+                failures++;
+                continue;
+            }
+            printf("%8zu %6zu %12.0f %10llu %10llu %12.0f %10.1f\n", payload_sizes[p], batch_sizes[b],
+                   r.handshakes_per_s, (unsigned long long)r.handshake_p50_us,
+                   (unsigned long long)r.handshake_p99_us, r.commands_per_s, r.datagrams_per_call);
+        }
+    }
+
+    printf("\nbulk: %d devices, %d rounds of %d bytes down or %d packets up per device\n",
+           BULK_DEVICES, BULK_ROUNDS, BULK_BYTES, UPLOAD_RUN);
+    printf("%8s %8s %12s %12s %10s %10s %10s\n", "transfer", "offload", "dgram/s",
+           "dgram/cpu-s", "MB/s", "dgram/call", "offloaded");
+    for (int uploads = 0; uploads < 2; uploads++) {
+        for (int offload = 0; offload < 2; offload++) {
+            bulk_result_t r;
+            const char *transfer = uploads ? "up" : "down";
+            if (!run_bulk(uploads, !offload, &r)) {
+                printf("%8s %8s FAILED\n", transfer, offload ? "on" : "off");
+                failures++;
+                continue;
+            }
+            printf("%8s %8s %12.0f %12.0f %10.1f %10.1f %9.0f%%\n", transfer, offload ? "on" : "off",
+                   r.datagrams_per_s, r.datagrams_per_cpu_s, r.megabytes_per_s, r.datagrams_per_call,
+                   r.offloaded * 100);
+        }
+    }
+    close(peer_fd);
+    return failures ? 1 : 0;
+}
@@ -5,6 +5,7 @@
  */
 
 #include "quicvc_protocol.h"
+#include <stdio.h>
 #include <string.h>
 
 uint8_t quicvc_encode_varint(uint64_t value, uint8_t *out, size_t out_size) {
@@ -93,6 +94,59 @@ uint8_t quicvc_get_varint_size(uint64_t value) {
     return 8;
 }
 
+// Load 8 bytes as a big-endian word without alignment requirements
+static inline uint64_t quicvc_load_be64(const uint8_t *p) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return word;
+#elif defined(__GNUC__) || defined(__clang__)
+    return __builtin_bswap64(word);
+#else
+    return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) |
+           ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+           ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) |
+           ((uint64_t)p[6] << 8) | (uint64_t)p[7];
+#endif
+}
+
+size_t quicvc_decode_varints(
+    const uint8_t *data,
+    size_t data_len,
+    uint64_t *out,
+    size_t count
+) {
+    if (!data || !out) {
+        return 0;
+    }
+
+    size_t offset = 0;
+    size_t i = 0;
+
+    // Fast path: a full word is readable, so length and value come from
+    // shifts on the prefix instead of a switch
+    while (i < count && data_len - offset >= 8) {
+        uint64_t word = quicvc_load_be64(&data[offset]);
+        unsigned prefix = (unsigned)(word >> 62);
+        unsigned shift = 64 - (8u << prefix);   // 56, 48, 32 or 0
+
+        out[i++] = (word >> shift) & (UINT64_MAX >> (shift + 2));
+        offset += (size_t)1 << prefix;
+    }
+
+    // Tail: fewer than 8 bytes left, decode bounds-checked
+    while (i < count) {
+        quicvc_varint_result_t r = quicvc_decode_varint(&data[offset], data_len - offset);
+        if (r.bytes_read == 0) {
+            return 0;
+        }
+        out[i++] = r.value;
+        offset += r.bytes_read;
+    }
+
+    return offset;
+}
+
 quicvc_stream_parse_result_t quicvc_parse_stream_frame(
     const uint8_t *data,
     size_t data_len
@@ -164,7 +218,7 @@ quicvc_stream_parse_result_t quicvc_parse_stream_frame(
     return result;
 }
 
-size_t quicvc_serialize_stream_frame(
+size_t quicvc_write_stream_frame_header(
     const quicvc_stream_frame_t *frame,
     uint8_t *out,
     size_t out_size
@@ -202,6 +256,19 @@ size_t quicvc_serialize_stream_frame(
         offset += written;
     }
 
+    return offset;
+}
+
+size_t quicvc_serialize_stream_frame(
+    const quicvc_stream_frame_t *frame,
+    uint8_t *out,
+    size_t out_size
+) {
+    size_t offset = quicvc_write_stream_frame_header(frame, out, out_size);
+    if (offset == 0) {
+        return 0;
+    }
+
     // Copy stream data
     if (frame->data && frame->data_len > 0) {
         if (offset + frame->data_len > out_size) {
@@ -213,3 +280,1695 @@ size_t quicvc_serialize_stream_frame(
 
     return offset;
 }
+
+size_t quicvc_serialize_stream_frame_iov(
+    const quicvc_stream_frame_t *frame,
+    uint8_t *header_out,
+    size_t header_size,
+    quicvc_iovec_t *iov,
+    size_t iov_count
+) {
+    bool has_data = frame && frame->data && frame->data_len > 0;
+    if (!iov || iov_count < (has_data ? 2u : 1u)) {
+        return 0;
+    }
+
+    size_t header_len = quicvc_write_stream_frame_header(frame, header_out, header_size);
+    if (header_len == 0) {
+        return 0;
+    }
+
+    iov[0].iov_base = header_out;
+    iov[0].iov_len = header_len;
+    if (!has_data) {
+        return 1;
+    }
+
+    iov[1].iov_base = frame->data;
+    iov[1].iov_len = frame->data_len;
+    return 2;
+}
+
+void quicvc_reassembly_init(
+    quicvc_reassembly_t *reassembly,
+    uint8_t *buffer,
+    size_t capacity,
+    quicvc_stream_deliver_fn deliver,
+    void *deliver_ctx
+) {
+    memset(reassembly, 0, sizeof(*reassembly));
+    reassembly->buffer = buffer;
+    reassembly->capacity = capacity;
+    reassembly->final_size = QUICVC_STREAM_SIZE_UNKNOWN;
+    reassembly->deliver = deliver;
+    reassembly->deliver_ctx = deliver_ctx;
+}
+
+bool quicvc_reassembly_is_complete(const quicvc_reassembly_t *reassembly) {
+    return reassembly->fin_delivered;
+}
+
+// Copy stream bytes [offset, offset + len) into the ring
+static void quicvc_reassembly_copy_in(
+    quicvc_reassembly_t *r, uint64_t offset, const uint8_t *data, size_t len
+) {
+    size_t pos = (size_t)(offset % r->capacity);
+    size_t first = len < r->capacity - pos ? len : r->capacity - pos;
+
+    memcpy(&r->buffer[pos], data, first);
+    if (len > first) {
+        memcpy(r->buffer, data + first, len - first);
+    }
+}
+
+// Deliver the leading range if it starts at the delivery point
+static void quicvc_reassembly_drain(quicvc_reassembly_t *r) {
+    if (r->range_count == 0 || r->ranges[0].start != r->delivered) {
+        return;
+    }
+
+    uint64_t end = r->ranges[0].end;
+    bool fin = end == r->final_size;
+    size_t len = (size_t)(end - r->delivered);
+    size_t pos = (size_t)(r->delivered % r->capacity);
+    size_t first = len < r->capacity - pos ? len : r->capacity - pos;
+
+    r->delivered = end;
+    r->fin_delivered = fin;
+    r->range_count--;
+    memmove(&r->ranges[0], &r->ranges[1], r->range_count * sizeof(r->ranges[0]));
+
+    r->deliver(&r->buffer[pos], first, fin && len == first, r->deliver_ctx);
+    if (len > first) {
+        r->deliver(r->buffer, len - first, fin, r->deliver_ctx);
+    }
+}
+
+quicvc_reassembly_status_t quicvc_reassembly_insert(
+    quicvc_reassembly_t *reassembly,
+    uint64_t offset,
+    const uint8_t *data,
+    size_t len,
+    bool fin
+) {
+    quicvc_reassembly_t *r = reassembly;
+    uint64_t end = offset + len;
+
+    // Final size rules (RFC 9000 Section 4.5)
+    if (fin) {
+        if ((r->final_size != QUICVC_STREAM_SIZE_UNKNOWN && r->final_size != end) || end < r->highest) {
+            return QUICVC_REASSEMBLY_FINAL_SIZE_ERROR;
+        }
+        r->final_size = end;
+    } else if (end > r->final_size) {
+        return QUICVC_REASSEMBLY_FINAL_SIZE_ERROR;
+    }
+
+    if (end <= r->delivered) {
+        // A FIN with no new data still completes the stream
+        if (end == r->final_size && end == r->delivered && !r->fin_delivered) {
+            r->fin_delivered = true;
+            r->deliver(NULL, 0, true, r->deliver_ctx);
+            return QUICVC_REASSEMBLY_OK;
+        }
+        return QUICVC_REASSEMBLY_DUPLICATE;
+    }
+
+    // Drop the part already delivered
+    if (offset < r->delivered) {
+        data += r->delivered - offset;
+        offset = r->delivered;
+    }
+    if (end - r->delivered > r->capacity) {
+        return QUICVC_REASSEMBLY_OVER_BUDGET;
+    }
+    if (end > r->highest) {
+        r->highest = end;
+    }
+
+    // In order with nothing buffered: deliver straight from the frame
+    if (offset == r->delivered && r->range_count == 0) {
+        r->delivered = end;
+        r->fin_delivered = end == r->final_size;
+        r->deliver(data, (size_t)(end - offset), r->fin_delivered, r->deliver_ctx);
+        return QUICVC_REASSEMBLY_OK;
+    }
+
+    // ranges[lo..hi) touch [offset, end) and merge into one
+    size_t lo = 0;
+    while (lo < r->range_count && r->ranges[lo].end < offset) {
+        lo++;
+    }
+    size_t hi = lo;
+    while (hi < r->range_count && r->ranges[hi].start <= end) {
+        hi++;
+    }
+    if (lo == hi && r->range_count == QUICVC_REASSEMBLY_MAX_RANGES) {
+        return QUICVC_REASSEMBLY_TOO_FRAGMENTED;
+    }
+
+    // Copy only the holes; overlapping bytes are already in the ring
+    uint64_t pos = offset;
+    bool filled = false;
+    for (size_t i = lo; i < hi && pos < end; i++) {
+        if (r->ranges[i].start > pos) {
+            quicvc_reassembly_copy_in(r, pos, data + (pos - offset), (size_t)(r->ranges[i].start - pos));
+            filled = true;
+        }
+        if (r->ranges[i].end > pos) {
+            pos = r->ranges[i].end;
+        }
+    }
+    if (pos < end) {
+        quicvc_reassembly_copy_in(r, pos, data + (pos - offset), (size_t)(end - pos));
+        filled = true;
+    }
+    if (!filled) {
+        return QUICVC_REASSEMBLY_DUPLICATE;
+    }
+
+    if (lo < hi) {
+        if (r->ranges[lo].start < offset) offset = r->ranges[lo].start;
+        if (r->ranges[hi - 1].end > end) end = r->ranges[hi - 1].end;
+        memmove(&r->ranges[lo + 1], &r->ranges[hi], (r->range_count - hi) * sizeof(r->ranges[0]));
+        r->range_count -= (uint8_t)(hi - lo - 1);
+    } else {
+        memmove(&r->ranges[lo + 1], &r->ranges[lo], (r->range_count - lo) * sizeof(r->ranges[0]));
+        r->range_count++;
+    }
+    r->ranges[lo].start = offset;
+    r->ranges[lo].end = end;
+
+    quicvc_reassembly_drain(r);
+    return QUICVC_REASSEMBLY_OK;
+}
+
+// Read a 1-4 byte big-endian packet number
+static inline uint64_t quicvc_read_pn(const uint8_t *p, uint8_t len) {
+    uint64_t pn = 0;
+    for (uint8_t i = 0; i < len; i++) {
+        pn = (pn << 8) | p[i];
+    }
+    return pn;
+}
+
+// Write the low 'len' bytes of a packet number, big-endian
+static inline void quicvc_write_pn(uint64_t pn, uint8_t len, uint8_t *out) {
+    for (uint8_t i = 0; i < len; i++) {
+        out[len - 1 - i] = (uint8_t)(pn >> (i * 8));
+    }
+}
+
+static quicvc_header_parse_result_t quicvc_parse_long_header(
+    const uint8_t *data,
+    size_t data_len
+) {
+    quicvc_header_parse_result_t result = {{0}, 0};
+    quicvc_header_t *hdr = &result.header;
+    size_t offset = 1;
+
+    hdr->is_long = true;
+    hdr->packet_type = (data[0] & QUICVC_PACKET_TYPE_MASK) >> 4;
+    hdr->packet_number_len = (data[0] & QUICVC_PACKET_NUMBER_LEN_MASK) + 1;
+
+    // Version + DCID length
+    if (data_len < offset + 5) return result;
+    hdr->version = ((uint32_t)data[1] << 24) | ((uint32_t)data[2] << 16) |
+                   ((uint32_t)data[3] << 8) | data[4];
+    offset += 4;
+
+    hdr->dcid_len = data[offset++];
+    if (hdr->dcid_len > QUICVC_MAX_CONNECTION_ID_LENGTH || data_len - offset < hdr->dcid_len + 1u) {
+        return result;
+    }
+    hdr->dcid = &data[offset];
+    offset += hdr->dcid_len;
+
+    hdr->scid_len = data[offset++];
+    if (hdr->scid_len > QUICVC_MAX_CONNECTION_ID_LENGTH || data_len - offset < hdr->scid_len) {
+        return result;
+    }
+    hdr->scid = &data[offset];
+    offset += hdr->scid_len;
+
+    // Retry: the token runs to the integrity tag; no Length or packet number
+    if (hdr->packet_type == QUICVC_PACKET_TYPE_RETRY) {
+        if (data_len - offset < QUICVC_RETRY_INTEGRITY_TAG_LENGTH) return result;
+        hdr->packet_number_len = 0;
+        hdr->token_len = data_len - offset - QUICVC_RETRY_INTEGRITY_TAG_LENGTH;
+        hdr->token = hdr->token_len > 0 ? &data[offset] : NULL;
+        hdr->header_len = offset + hdr->token_len;
+        hdr->payload = &data[hdr->header_len];
+        hdr->payload_len = QUICVC_RETRY_INTEGRITY_TAG_LENGTH;
+        result.bytes_consumed = data_len;
+        return result;
+    }
+
+    // Token (INITIAL packets only)
+    if (hdr->packet_type == QUICVC_PACKET_TYPE_INITIAL) {
+        quicvc_varint_result_t token_len = quicvc_decode_varint(&data[offset], data_len - offset);
+        if (token_len.bytes_read == 0) return result;
+        offset += token_len.bytes_read;
+        if (token_len.value > data_len - offset) return result;
+        hdr->token = token_len.value > 0 ? &data[offset] : NULL;
+        hdr->token_len = (size_t)token_len.value;
+        offset += hdr->token_len;
+    }
+
+    // Length covers packet number + protected payload
+    quicvc_varint_result_t length = quicvc_decode_varint(&data[offset], data_len - offset);
+    if (length.bytes_read == 0) return result;
+    offset += length.bytes_read;
+    if (length.value < hdr->packet_number_len || length.value > data_len - offset) {
+        return result;
+    }
+
+    hdr->packet_number_offset = offset;
+    hdr->packet_number = quicvc_read_pn(&data[offset], hdr->packet_number_len);
+    offset += hdr->packet_number_len;
+
+    hdr->header_len = offset;
+    hdr->payload = &data[offset];
+    hdr->payload_len = (size_t)length.value - hdr->packet_number_len;
+
+    result.bytes_consumed = offset + hdr->payload_len;
+    return result;
+}
+
+static quicvc_header_parse_result_t quicvc_parse_short_header(
+    const uint8_t *data,
+    size_t data_len,
+    uint8_t dcid_len
+) {
+    quicvc_header_parse_result_t result = {{0}, 0};
+    quicvc_header_t *hdr = &result.header;
+
+    hdr->packet_type = QUICVC_PACKET_TYPE_ONE_RTT;
+    hdr->packet_number_len = (data[0] & QUICVC_PACKET_NUMBER_LEN_MASK) + 1;
+    hdr->spin_bit = (data[0] & QUICVC_SPIN_BIT) != 0;
+    hdr->key_phase = (data[0] & QUICVC_KEY_PHASE_BIT) != 0;
+
+    if (dcid_len > QUICVC_MAX_CONNECTION_ID_LENGTH ||
+        data_len < 1u + dcid_len + hdr->packet_number_len) {
+        return result;
+    }
+
+    hdr->dcid = &data[1];
+    hdr->dcid_len = dcid_len;
+    hdr->packet_number_offset = 1 + dcid_len;
+    hdr->packet_number = quicvc_read_pn(&data[hdr->packet_number_offset], hdr->packet_number_len);
+
+    hdr->header_len = hdr->packet_number_offset + hdr->packet_number_len;
+    hdr->payload = &data[hdr->header_len];
+    hdr->payload_len = data_len - hdr->header_len;
+
+    // Short header packets always extend to the end of the datagram
+    result.bytes_consumed = data_len;
+    return result;
+}
+
+quicvc_header_parse_result_t quicvc_parse_header(
+    const uint8_t *data,
+    size_t data_len,
+    uint8_t short_dcid_len
+) {
+    quicvc_header_parse_result_t result = {{0}, 0};
+
+    if (!data || data_len < 1 || !(data[0] & QUICVC_FIXED_BIT)) {
+        return result;
+    }
+
+    if (data[0] & QUICVC_LONG_HEADER_BIT) {
+        return quicvc_parse_long_header(data, data_len);
+    }
+    return quicvc_parse_short_header(data, data_len, short_dcid_len);
+}
+
+size_t quicvc_long_header_size(const quicvc_header_t *header) {
+    size_t size = 1 + 4 + 1 + header->dcid_len + 1 + header->scid_len;
+
+    if (header->packet_type == QUICVC_PACKET_TYPE_INITIAL) {
+        size += quicvc_get_varint_size(header->token_len) + header->token_len;
+    }
+
+    // Length is always a 2-byte varint, then the packet number
+    return size + 2 + header->packet_number_len;
+}
+
+size_t quicvc_short_header_size(const quicvc_header_t *header) {
+    return 1 + header->dcid_len + header->packet_number_len;
+}
+
+size_t quicvc_write_long_header(
+    const quicvc_header_t *header,
+    size_t payload_len,
+    uint8_t *out,
+    size_t out_size
+) {
+    if (!header || !out ||
+        header->packet_number_len < 1 || header->packet_number_len > QUICVC_MAX_PACKET_NUMBER_LENGTH ||
+        header->dcid_len > QUICVC_MAX_CONNECTION_ID_LENGTH ||
+        header->scid_len > QUICVC_MAX_CONNECTION_ID_LENGTH ||
+        header->packet_type > QUICVC_PACKET_TYPE_RETRY) {
+        return 0;
+    }
+
+    size_t remaining = header->packet_number_len + payload_len;
+    size_t header_len = quicvc_long_header_size(header);
+    if (remaining > QUICVC_VARINT_2_BYTE_MAX || header_len > out_size) {
+        return 0;
+    }
+
+    size_t offset = 0;
+    out[offset++] = QUICVC_LONG_HEADER_BIT | QUICVC_FIXED_BIT |
+                    (uint8_t)(header->packet_type << 4) |
+                    (uint8_t)(header->packet_number_len - 1);
+
+    out[offset++] = (uint8_t)(header->version >> 24);
+    out[offset++] = (uint8_t)(header->version >> 16);
+    out[offset++] = (uint8_t)(header->version >> 8);
+    out[offset++] = (uint8_t)header->version;
+
+    out[offset++] = header->dcid_len;
+    if (header->dcid_len > 0) {
+        memcpy(&out[offset], header->dcid, header->dcid_len);
+        offset += header->dcid_len;
+    }
+
+    out[offset++] = header->scid_len;
+    if (header->scid_len > 0) {
+        memcpy(&out[offset], header->scid, header->scid_len);
+        offset += header->scid_len;
+    }
+
+    if (header->packet_type == QUICVC_PACKET_TYPE_INITIAL) {
+        offset += quicvc_encode_varint(header->token_len, &out[offset], out_size - offset);
+        if (header->token_len > 0) {
+            memcpy(&out[offset], header->token, header->token_len);
+            offset += header->token_len;
+        }
+    }
+
+    // 2-byte varint Length (RFC 9000 allows non-minimal encodings)
+    out[offset++] = 0x40 | (uint8_t)(remaining >> 8);
+    out[offset++] = (uint8_t)remaining;
+
+    quicvc_write_pn(header->packet_number, header->packet_number_len, &out[offset]);
+    offset += header->packet_number_len;
+
+    return offset;
+}
+
+size_t quicvc_write_retry(
+    const quicvc_header_t *header,
+    const uint8_t *token,
+    size_t token_len,
+    uint8_t *out,
+    size_t out_size
+) {
+    if (!header || !out || (token_len > 0 && !token) ||
+        header->dcid_len > QUICVC_MAX_CONNECTION_ID_LENGTH ||
+        header->scid_len > QUICVC_MAX_CONNECTION_ID_LENGTH) {
+        return 0;
+    }
+
+    size_t len = 1 + 4 + 1 + header->dcid_len + 1 + header->scid_len + token_len;
+    if (len > out_size || out_size - len < QUICVC_RETRY_INTEGRITY_TAG_LENGTH) {
+        return 0;
+    }
+
+    size_t offset = 0;
+    out[offset++] = QUICVC_LONG_HEADER_BIT | QUICVC_FIXED_BIT |
+                    (uint8_t)(QUICVC_PACKET_TYPE_RETRY << 4);
+
+    out[offset++] = (uint8_t)(header->version >> 24);
+    out[offset++] = (uint8_t)(header->version >> 16);
+    out[offset++] = (uint8_t)(header->version >> 8);
+    out[offset++] = (uint8_t)header->version;
+
+    out[offset++] = header->dcid_len;
+    if (header->dcid_len > 0) {
+        memcpy(&out[offset], header->dcid, header->dcid_len);
+        offset += header->dcid_len;
+    }
+
+    out[offset++] = header->scid_len;
+    if (header->scid_len > 0) {
+        memcpy(&out[offset], header->scid, header->scid_len);
+        offset += header->scid_len;
+    }
+
+    if (token_len > 0) {
+        memcpy(&out[offset], token, token_len);
+        offset += token_len;
+    }
+    return offset;
+}
+
+size_t quicvc_write_short_header(
+    const quicvc_header_t *header,
+    uint8_t *out,
+    size_t out_size
+) {
+    if (!header || !out ||
+        header->packet_number_len < 1 || header->packet_number_len > QUICVC_MAX_PACKET_NUMBER_LENGTH ||
+        header->dcid_len > QUICVC_MAX_CONNECTION_ID_LENGTH) {
+        return 0;
+    }
+
+    size_t header_len = quicvc_short_header_size(header);
+    if (header_len > out_size) {
+        return 0;
+    }
+
+    size_t offset = 0;
+    uint8_t first_byte = QUICVC_FIXED_BIT | (uint8_t)(header->packet_number_len - 1);
+    if (header->spin_bit) first_byte |= QUICVC_SPIN_BIT;
+    if (header->key_phase) first_byte |= QUICVC_KEY_PHASE_BIT;
+    out[offset++] = first_byte;
+
+    if (header->dcid_len > 0) {
+        memcpy(&out[offset], header->dcid, header->dcid_len);
+        offset += header->dcid_len;
+    }
+
+    quicvc_write_pn(header->packet_number, header->packet_number_len, &out[offset]);
+    offset += header->packet_number_len;
+
+    return offset;
+}
+
+uint8_t quicvc_packet_number_length(uint64_t packet_number, uint64_t largest_acked) {
+    uint64_t num_unacked;
+    if (largest_acked == QUICVC_PACKET_NUMBER_NONE) {
+        num_unacked = packet_number + 1;
+    } else {
+        num_unacked = packet_number - largest_acked;
+    }
+
+    // The field must represent at least twice the unacknowledged range
+    if (num_unacked <= (1ull << 7))  return 1;
+    if (num_unacked <= (1ull << 15)) return 2;
+    if (num_unacked <= (1ull << 23)) return 3;
+    if (num_unacked <= (1ull << 31)) return 4;
+    return 0;
+}
+
+uint8_t quicvc_encode_packet_number(
+    uint64_t packet_number,
+    uint64_t largest_acked,
+    uint8_t *out,
+    size_t out_size
+) {
+    uint8_t len = quicvc_packet_number_length(packet_number, largest_acked);
+    if (len == 0 || !out || out_size < len) {
+        return 0;
+    }
+    quicvc_write_pn(packet_number, len, out);
+    return len;
+}
+
+uint64_t quicvc_decode_packet_number(
+    uint64_t expected_pn,
+    uint64_t truncated_pn,
+    uint8_t packet_number_len
+) {
+    uint64_t pn_win = 1ull << (packet_number_len * 8);
+    uint64_t pn_hwin = pn_win / 2;
+    uint64_t pn_mask = pn_win - 1;
+
+    // Closest value to expected_pn whose low bits match the truncated value
+    uint64_t candidate = (expected_pn & ~pn_mask) | truncated_pn;
+
+    if (candidate + pn_hwin <= expected_pn && candidate < (1ull << 62) - pn_win) {
+        return candidate + pn_win;
+    }
+    if (candidate > expected_pn + pn_hwin && candidate >= pn_win) {
+        return candidate - pn_win;
+    }
+    return candidate;
+}
+
+const uint8_t *quicvc_header_protection_sample(
+    const uint8_t *packet,
+    size_t packet_len,
+    size_t pn_offset
+) {
+    if (!packet || pn_offset + QUICVC_HP_SAMPLE_OFFSET + QUICVC_HP_SAMPLE_LENGTH > packet_len) {
+        return NULL;
+    }
+    return &packet[pn_offset + QUICVC_HP_SAMPLE_OFFSET];
+}
+
+// Protected first-byte bits: Reserved, Key Phase and PN Length on short
+// headers, Reserved and PN Length on long headers
+static uint8_t quicvc_hp_first_byte_mask(uint8_t first_byte) {
+    return (first_byte & QUICVC_LONG_HEADER_BIT) ? 0x0F : 0x1F;
+}
+
+bool quicvc_protect_header(
+    uint8_t *packet,
+    size_t packet_len,
+    size_t pn_offset,
+    const uint8_t *mask
+) {
+    if (!quicvc_header_protection_sample(packet, packet_len, pn_offset) || !mask) {
+        return false;
+    }
+
+    // PN length comes from the first byte before it is masked
+    uint8_t pn_len = (packet[0] & 0x03) + 1;
+    packet[0] ^= mask[0] & quicvc_hp_first_byte_mask(packet[0]);
+    for (uint8_t i = 0; i < pn_len; i++) {
+        packet[pn_offset + i] ^= mask[1 + i];
+    }
+    return true;
+}
+
+uint8_t quicvc_unprotect_header(
+    uint8_t *packet,
+    size_t packet_len,
+    size_t pn_offset,
+    const uint8_t *mask
+) {
+    if (!quicvc_header_protection_sample(packet, packet_len, pn_offset) || !mask) {
+        return 0;
+    }
+
+    // PN length is only known once the first byte is unmasked
+    packet[0] ^= mask[0] & quicvc_hp_first_byte_mask(packet[0]);
+    uint8_t pn_len = (packet[0] & 0x03) + 1;
+    for (uint8_t i = 0; i < pn_len; i++) {
+        packet[pn_offset + i] ^= mask[1 + i];
+    }
+    return pn_len;
+}
+
+void quicvc_aead_nonce(
+    const uint8_t *iv,
+    uint64_t packet_number,
+    uint8_t *nonce
+) {
+    memcpy(nonce, iv, QUICVC_AEAD_NONCE_LENGTH);
+    for (int i = 0; i < 8; i++) {
+        nonce[QUICVC_AEAD_NONCE_LENGTH - 1 - i] ^= (uint8_t)(packet_number >> (8 * i));
+    }
+}
+
+void quicvc_replay_window_init(quicvc_replay_window_t *window) {
+    memset(window, 0, sizeof(*window));
+}
+
+uint64_t quicvc_replay_expected_pn(const quicvc_replay_window_t *window) {
+    return window->has_packets ? window->largest + 1 : 0;
+}
+
+quicvc_replay_status_t quicvc_replay_check(quicvc_replay_window_t *window, uint64_t packet_number) {
+    if (!window->has_packets || packet_number > window->largest) {
+        return QUICVC_REPLAY_OK;
+    }
+
+    uint64_t distance = window->largest - packet_number;
+    if (distance >= QUICVC_REPLAY_WINDOW_SIZE) {
+        window->dropped_too_old++;
+        return QUICVC_REPLAY_TOO_OLD;
+    }
+    if ((window->window >> distance) & 1) {
+        window->dropped_duplicate++;
+        return QUICVC_REPLAY_DUPLICATE;
+    }
+    return QUICVC_REPLAY_OK;
+}
+
+void quicvc_replay_update(quicvc_replay_window_t *window, uint64_t packet_number) {
+    if (!window->has_packets) {
+        window->largest = packet_number;
+        window->window = 1;
+        window->has_packets = true;
+        return;
+    }
+
+    if (packet_number > window->largest) {
+        uint64_t shift = packet_number - window->largest;
+        window->window = shift >= QUICVC_REPLAY_WINDOW_SIZE ? 1 : (window->window << shift) | 1;
+        window->largest = packet_number;
+        return;
+    }
+
+    uint64_t distance = window->largest - packet_number;
+    if (distance < QUICVC_REPLAY_WINDOW_SIZE) {
+        window->window |= 1ull << distance;
+    }
+}
+
+void quicvc_ack_tracker_init(quicvc_ack_tracker_t *tracker) {
+    memset(tracker, 0, sizeof(*tracker));
+}
+
+// Insert [smallest, largest] into the ascending range list, merging neighbours
+static void quicvc_ack_insert_range(quicvc_ack_tracker_t *t, uint64_t smallest, uint64_t largest) {
+    // ranges[hi..] lie strictly above; ranges[lo..hi) touch or overlap.
+    // Ranges leaving the window are newer than everything listed, so the
+    // scan normally stops at the last entry.
+    size_t hi = t->range_count;
+    while (hi > 0 && t->ranges[hi - 1].smallest > largest + 1) {
+        hi--;
+    }
+    size_t lo = hi;
+    while (lo > 0 && t->ranges[lo - 1].largest + 1 >= smallest) {
+        lo--;
+    }
+
+    if (lo < hi) {
+        if (t->ranges[lo].smallest < smallest) smallest = t->ranges[lo].smallest;
+        if (t->ranges[hi - 1].largest > largest) largest = t->ranges[hi - 1].largest;
+        t->ranges[lo].smallest = smallest;
+        t->ranges[lo].largest = largest;
+        memmove(&t->ranges[lo + 1], &t->ranges[hi], (t->range_count - hi) * sizeof(t->ranges[0]));
+        t->range_count -= (uint8_t)(hi - lo - 1);
+        return;
+    }
+
+    // New range; drop the oldest when full
+    if (t->range_count == QUICVC_ACK_MAX_RANGES) {
+        if (lo == 0) return;    // Older than anything we keep
+        memmove(&t->ranges[0], &t->ranges[1], (lo - 1) * sizeof(t->ranges[0]));
+        lo--;
+        t->range_count--;
+    } else {
+        memmove(&t->ranges[lo + 1], &t->ranges[lo], (t->range_count - lo) * sizeof(t->ranges[0]));
+    }
+    t->ranges[lo].smallest = smallest;
+    t->ranges[lo].largest = largest;
+    t->range_count++;
+}
+
+// Move the set bits of 'bits' (bit j = top - j) into the range list
+static void quicvc_ack_flush_bits(quicvc_ack_tracker_t *t, uint64_t bits, uint64_t top) {
+    while (bits) {
+        unsigned start = (unsigned)__builtin_ctzll(bits);
+        uint64_t run = ~(bits >> start);
+        unsigned len = run ? (unsigned)__builtin_ctzll(run) : 64 - start;
+
+        quicvc_ack_insert_range(t, top - (start + len - 1), top - start);
+        bits &= len + start >= 64 ? 0 : ~0ull << (start + len);
+    }
+}
+
+bool quicvc_ack_tracker_contains(const quicvc_ack_tracker_t *tracker, uint64_t packet_number) {
+    if (!tracker->has_packets || packet_number > tracker->largest) {
+        return false;
+    }
+
+    uint64_t distance = tracker->largest - packet_number;
+    if (distance < QUICVC_ACK_WINDOW_SIZE) {
+        return (tracker->window >> distance) & 1;
+    }
+
+    for (size_t i = tracker->range_count; i > 0; i--) {
+        const quicvc_pn_range_t *r = &tracker->ranges[i - 1];
+        if (packet_number > r->largest) return false;
+        if (packet_number >= r->smallest) return true;
+    }
+    return false;
+}
+
+bool quicvc_ack_tracker_record(quicvc_ack_tracker_t *tracker, uint64_t packet_number) {
+    if (!tracker->has_packets) {
+        tracker->largest = packet_number;
+        tracker->window = 1;
+        tracker->has_packets = true;
+        tracker->ack_pending = true;
+        return true;
+    }
+
+    if (packet_number > tracker->largest) {
+        uint64_t shift = packet_number - tracker->largest;
+
+        // Bits shifted past the window become ranges
+        if (shift >= QUICVC_ACK_WINDOW_SIZE) {
+            quicvc_ack_flush_bits(tracker, tracker->window, tracker->largest);
+            tracker->window = 1;
+        } else {
+            uint64_t leaving = tracker->window >> (QUICVC_ACK_WINDOW_SIZE - shift);
+            quicvc_ack_flush_bits(tracker, leaving,
+                                  tracker->largest - (QUICVC_ACK_WINDOW_SIZE - shift));
+            tracker->window = (tracker->window << shift) | 1;
+        }
+        tracker->largest = packet_number;
+        tracker->ack_pending = true;
+        return true;
+    }
+
+    if (quicvc_ack_tracker_contains(tracker, packet_number)) {
+        return false;
+    }
+
+    uint64_t distance = tracker->largest - packet_number;
+    if (distance < QUICVC_ACK_WINDOW_SIZE) {
+        tracker->window |= 1ull << distance;
+    } else {
+        quicvc_ack_insert_range(tracker, packet_number, packet_number);
+    }
+    tracker->ack_pending = true;
+    return true;
+}
+
+// Append one gap/length pair; returns false if it does not fit
+static bool quicvc_ack_write_range(
+    uint8_t *out, size_t out_size, size_t *offset,
+    uint64_t prev_smallest, const quicvc_pn_range_t *r
+) {
+    uint64_t gap = prev_smallest - r->largest - 2;
+    uint64_t length = r->largest - r->smallest;
+
+    if (quicvc_get_varint_size(gap) + quicvc_get_varint_size(length) > out_size - *offset) {
+        return false;
+    }
+    *offset += quicvc_encode_varint(gap, &out[*offset], out_size - *offset);
+    *offset += quicvc_encode_varint(length, &out[*offset], out_size - *offset);
+    return true;
+}
+
+size_t quicvc_ack_tracker_write_frame(
+    quicvc_ack_tracker_t *tracker,
+    uint64_t ack_delay_us,
+    uint8_t *out,
+    size_t out_size
+) {
+    if (!tracker || !out || !tracker->has_packets) {
+        return 0;
+    }
+
+    quicvc_pn_range_t current = {0, 0};
+    bool have_current = false;
+    uint64_t range_count = 0;
+    size_t offset = 0;
+    size_t count_offset;
+    uint64_t prev_smallest = 0;
+    bool full = false;
+
+    // Type, largest, delay, then a 1-byte range count patched at the end
+    // (at most 32 window runs + QUICVC_ACK_MAX_RANGES, always < 64)
+    uint64_t delay = ack_delay_us >> QUICVC_DEFAULT_ACK_DELAY_EXPONENT;
+    if ((size_t)2 + quicvc_get_varint_size(tracker->largest) + quicvc_get_varint_size(delay) > out_size) {
+        return 0;
+    }
+    out[offset++] = QUICVC_FRAME_ACK;
+    offset += quicvc_encode_varint(tracker->largest, &out[offset], out_size - offset);
+    offset += quicvc_encode_varint(delay, &out[offset], out_size - offset);
+    count_offset = offset++;
+
+    // Ranges newest first: window runs, then the list
+    uint64_t bits = tracker->window;
+    size_t list_index = tracker->range_count;
+
+    while (!full) {
+        quicvc_pn_range_t next;
+
+        if (bits) {
+            unsigned start = (unsigned)__builtin_ctzll(bits);
+            uint64_t run = ~(bits >> start);
+            unsigned len = run ? (unsigned)__builtin_ctzll(run) : 64 - start;
+            next.largest = tracker->largest - start;
+            next.smallest = tracker->largest - (start + len - 1);
+            bits &= len + start >= 64 ? 0 : ~0ull << (start + len);
+        } else if (list_index > 0) {
+            next = tracker->ranges[--list_index];
+        } else {
+            break;
+        }
+
+        // Window and list ranges can touch at the window edge
+        if (have_current && current.smallest == next.largest + 1) {
+            current.smallest = next.smallest;
+            continue;
+        }
+
+        if (have_current) {
+            if (range_count == 0) {
+                // First ACK Range
+                uint64_t first = current.largest - current.smallest;
+                if (quicvc_get_varint_size(first) > out_size - offset) return 0;
+                offset += quicvc_encode_varint(first, &out[offset], out_size - offset);
+            } else if (!quicvc_ack_write_range(out, out_size, &offset, prev_smallest, &current)) {
+                full = true;
+                break;
+            }
+            prev_smallest = current.smallest;
+            range_count++;
+        }
+        current = next;
+        have_current = true;
+    }
+
+    if (have_current && !full) {
+        if (range_count == 0) {
+            uint64_t first = current.largest - current.smallest;
+            if (quicvc_get_varint_size(first) > out_size - offset) return 0;
+            offset += quicvc_encode_varint(first, &out[offset], out_size - offset);
+            range_count++;
+        } else if (quicvc_ack_write_range(out, out_size, &offset, prev_smallest, &current)) {
+            range_count++;
+        }
+    }
+
+    // range_count includes the first range; the field counts the rest
+    out[count_offset] = (uint8_t)(range_count - 1);
+    tracker->ack_pending = false;
+    return offset;
+}
+
+// Skip one varint, returning its size or 0 if it runs past 'end'
+static inline size_t quicvc_skip_varint(const uint8_t *data, size_t data_len) {
+    if (data_len < 1) return 0;
+    size_t len = (size_t)1 << (data[0] >> 6);
+    return len <= data_len ? len : 0;
+}
+
+// Read a [length(2)][bytes] field used by the QUIC-VC frames
+static inline size_t quicvc_read_len16_field(
+    const uint8_t *data,
+    size_t data_len,
+    const uint8_t **field,
+    size_t *field_len
+) {
+    if (data_len < 2) return 0;
+    size_t len = ((size_t)data[0] << 8) | data[1];
+    if (len > data_len - 2) return 0;
+    *field = &data[2];
+    *field_len = len;
+    return 2 + len;
+}
+
+void quicvc_frame_iter_init(
+    quicvc_frame_iter_t *iter,
+    const uint8_t *payload,
+    size_t payload_len
+) {
+    iter->data = payload;
+    iter->data_len = payload_len;
+    iter->offset = 0;
+    iter->error = false;
+}
+
+static size_t quicvc_parse_ack_frame(const uint8_t *data, size_t data_len, quicvc_ack_frame_t *ack) {
+    size_t offset = 1;
+    uint64_t fields[4];
+
+    size_t read = quicvc_decode_varints(&data[offset], data_len - offset, fields, 4);
+    if (read == 0) return 0;
+    offset += read;
+
+    ack->largest_acknowledged = fields[0];
+    ack->ack_delay = fields[1];
+    ack->range_count = fields[2];
+    ack->first_range = fields[3];
+    ack->has_ecn = data[0] == QUICVC_FRAME_ACK_ECN;
+
+    // Each range is at least two bytes; reject counts the payload cannot hold
+    if (ack->range_count > (data_len - offset) / 2) return 0;
+
+    ack->ranges = &data[offset];
+    for (uint64_t i = 0; i < ack->range_count * 2; i++) {
+        size_t len = quicvc_skip_varint(&data[offset], data_len - offset);
+        if (len == 0) return 0;
+        offset += len;
+    }
+    ack->ranges_len = (size_t)(&data[offset] - ack->ranges);
+
+    if (ack->has_ecn) {
+        read = quicvc_decode_varints(&data[offset], data_len - offset, ack->ecn_counts, 3);
+        if (read == 0) return 0;
+        offset += read;
+    }
+
+    return offset;
+}
+
+static size_t quicvc_parse_close_frame(const uint8_t *data, size_t data_len, quicvc_close_frame_t *close) {
+    size_t offset = 1;
+    uint64_t fields[3];
+
+    // Application close (0x1d) has no frame type field
+    close->is_application = data[0] == QUICVC_FRAME_CONNECTION_CLOSE_APP;
+    size_t count = close->is_application ? 2 : 3;
+
+    size_t read = quicvc_decode_varints(&data[offset], data_len - offset, fields, count);
+    if (read == 0) return 0;
+    offset += read;
+
+    close->error_code = fields[0];
+    close->frame_type = close->is_application ? 0 : fields[1];
+    uint64_t reason_len = fields[count - 1];
+
+    if (reason_len > data_len - offset) return 0;
+    close->reason = &data[offset];
+    close->reason_len = (size_t)reason_len;
+
+    return offset + close->reason_len;
+}
+
+bool quicvc_frame_iter_next(quicvc_frame_iter_t *iter, quicvc_frame_t *frame) {
+    if (iter->error || iter->offset >= iter->data_len) {
+        return false;
+    }
+
+    const uint8_t *data = &iter->data[iter->offset];
+    size_t data_len = iter->data_len - iter->offset;
+    size_t consumed = 0;
+
+    memset(frame, 0, sizeof(*frame));
+    frame->type = data[0];
+    frame->raw = data;
+
+    switch (frame->type) {
+        case QUICVC_FRAME_PADDING:
+            while (consumed < data_len && data[consumed] == QUICVC_FRAME_PADDING) {
+                consumed++;
+            }
+            frame->u.padding_len = consumed;
+            break;
+
+        case QUICVC_FRAME_PING:
+            consumed = 1;
+            break;
+
+        case QUICVC_FRAME_ACK:
+        case QUICVC_FRAME_ACK_ECN:
+            consumed = quicvc_parse_ack_frame(data, data_len, &frame->u.ack);
+            break;
+
+        case QUICVC_FRAME_CONNECTION_CLOSE:
+        case QUICVC_FRAME_CONNECTION_CLOSE_APP:
+            consumed = quicvc_parse_close_frame(data, data_len, &frame->u.close);
+            break;
+
+        case QUICVC_FRAME_VC_INIT:
+        case QUICVC_FRAME_VC_ACK:
+        case QUICVC_FRAME_VC_TICKET:
+        case QUICVC_FRAME_VC_PERF:
+        case QUICVC_FRAME_HEARTBEAT:
+            consumed = quicvc_read_len16_field(&data[1], data_len - 1,
+                                               &frame->u.vc.body, &frame->u.vc.body_len);
+            if (consumed > 0) consumed += 1;
+            break;
+
+        case QUICVC_FRAME_VC_RESPONSE: {
+            size_t md = quicvc_read_len16_field(&data[1], data_len - 1,
+                                                &frame->u.vc.body, &frame->u.vc.body_len);
+            if (md == 0) break;
+            size_t resp = quicvc_read_len16_field(&data[1 + md], data_len - 1 - md,
+                                                  &frame->u.vc.response, &frame->u.vc.response_len);
+            if (resp == 0) break;
+            consumed = 1 + md + resp;
+            break;
+        }
+
+        default:
+            if ((frame->type & 0xF8) == QUICVC_FRAME_STREAM) {
+                quicvc_stream_parse_result_t r = quicvc_parse_stream_frame(data, data_len);
+                frame->u.stream = r.frame;
+                consumed = r.bytes_consumed;
+            }
+            break;
+    }
+
+    if (consumed == 0) {
+        iter->error = true;
+        return false;
+    }
+
+    frame->raw_len = consumed;
+    iter->offset += consumed;
+    return true;
+}
+
+size_t quicvc_ack_frame_ranges(
+    const quicvc_ack_frame_t *ack,
+    uint64_t *out,
+    size_t max_pairs
+) {
+    size_t pairs = ack->range_count < max_pairs ? (size_t)ack->range_count : max_pairs;
+    if (pairs == 0) return 0;
+
+    if (quicvc_decode_varints(ack->ranges, ack->ranges_len, out, pairs * 2) == 0) {
+        return 0;
+    }
+    return pairs;
+}
+
+void quicvc_packet_builder_init(
+    quicvc_packet_builder_t *builder,
+    size_t max_payload,
+    uint64_t max_delay_us,
+    quicvc_packet_flush_fn flush,
+    void *flush_ctx
+) {
+    builder->len = 0;
+    builder->max_payload = max_payload < QUICVC_MAX_PACKET_SIZE ? max_payload : QUICVC_MAX_PACKET_SIZE;
+    builder->max_delay_us = max_delay_us;
+    builder->deadline_us = 0;
+    builder->flush = flush;
+    builder->flush_ctx = flush_ctx;
+}
+
+void quicvc_packet_builder_flush(quicvc_packet_builder_t *builder) {
+    if (builder->len == 0) {
+        return;
+    }
+    builder->flush(builder->payload, builder->len, builder->flush_ctx);
+    builder->len = 0;
+}
+
+bool quicvc_packet_builder_poll(quicvc_packet_builder_t *builder, uint64_t now_us) {
+    if (builder->len == 0 || builder->max_delay_us == 0 || now_us < builder->deadline_us) {
+        return false;
+    }
+    quicvc_packet_builder_flush(builder);
+    return true;
+}
+
+// Make room for 'needed' bytes, flushing the current packet if they do not
+// fit. Returns where to write, or NULL if an empty packet is too small.
+static uint8_t *quicvc_packet_builder_reserve(
+    quicvc_packet_builder_t *builder, size_t needed, uint64_t now_us
+) {
+    if (needed > builder->max_payload) {
+        return NULL;
+    }
+
+    quicvc_packet_builder_poll(builder, now_us);
+    if (needed > builder->max_payload - builder->len) {
+        quicvc_packet_builder_flush(builder);
+    }
+    if (builder->len == 0) {
+        builder->deadline_us = now_us + builder->max_delay_us;
+    }
+    return &builder->payload[builder->len];
+}
+
+bool quicvc_packet_builder_add(
+    quicvc_packet_builder_t *builder,
+    const uint8_t *frame,
+    size_t frame_len,
+    uint64_t now_us
+) {
+    uint8_t *out = quicvc_packet_builder_reserve(builder, frame_len, now_us);
+    if (!out) {
+        return false;
+    }
+    memcpy(out, frame, frame_len);
+    builder->len += frame_len;
+    return true;
+}
+
+bool quicvc_packet_builder_add_vc_frame(
+    quicvc_packet_builder_t *builder,
+    uint8_t frame_type,
+    const uint8_t *body,
+    size_t body_len,
+    uint64_t now_us
+) {
+    if (body_len > 0xFFFF) {
+        return false;
+    }
+
+    uint8_t *out = quicvc_packet_builder_reserve(builder, 3 + body_len, now_us);
+    if (!out) {
+        return false;
+    }
+    out[0] = frame_type;
+    out[1] = (uint8_t)(body_len >> 8);
+    out[2] = (uint8_t)body_len;
+    if (body_len > 0) {
+        memcpy(&out[3], body, body_len);
+    }
+    builder->len += 3 + body_len;
+    return true;
+}
+
+bool quicvc_packet_builder_add_ack(
+    quicvc_packet_builder_t *builder,
+    quicvc_ack_tracker_t *tracker,
+    uint64_t ack_delay_us,
+    uint64_t now_us
+) {
+    if (!tracker->has_packets) {
+        return false;
+    }
+
+    // Type, two 8-byte varints, range count and first range always fit;
+    // further ranges are dropped by the tracker if the packet is tight
+    uint8_t *out = quicvc_packet_builder_reserve(builder, 1 + 8 + 8 + 1 + 8, now_us);
+    if (!out) {
+        return false;
+    }
+    size_t written = quicvc_ack_tracker_write_frame(tracker, ack_delay_us, out,
+                                                    builder->max_payload - builder->len);
+    builder->len += written;
+    return written > 0;
+}
+
+bool quicvc_packet_builder_add_stream(
+    quicvc_packet_builder_t *builder,
+    const quicvc_stream_frame_t *frame,
+    uint64_t now_us
+) {
+    quicvc_stream_frame_t piece = *frame;
+    size_t remaining = frame->data_len;
+    size_t id_size = quicvc_get_varint_size(frame->stream_id);
+
+    piece.has_len = true;
+    piece.offset = frame->has_off ? frame->offset : 0;
+
+    do {
+        // Header with a worst-case (2-byte) length field; a packet is
+        // always smaller than 16384 bytes
+        size_t header = 1 + id_size + 2 +
+            (piece.has_off ? quicvc_get_varint_size(piece.offset) : 0);
+
+        // Start a new packet rather than send a piece of a few bytes
+        size_t min_chunk = remaining < 16 ? remaining : 16;
+        uint8_t *out = quicvc_packet_builder_reserve(builder, header + min_chunk, now_us);
+        if (!out) {
+            return false;
+        }
+
+        size_t space = builder->max_payload - builder->len - header;
+        size_t chunk = remaining < space ? remaining : space;
+
+        piece.data = frame->data ? frame->data + (frame->data_len - remaining) : NULL;
+        piece.data_len = chunk;
+        piece.has_fin = frame->has_fin && chunk == remaining;
+
+        size_t written = quicvc_serialize_stream_frame(&piece, out, builder->max_payload - builder->len);
+        if (written == 0) {
+            return false;
+        }
+        builder->len += written;
+        remaining -= chunk;
+
+        piece.offset += chunk;
+        piece.has_off = piece.offset > 0;
+    } while (remaining > 0);
+
+    return true;
+}
+
+void quicvc_perf_init(quicvc_perf_histogram_t *histogram) {
+    memset(histogram, 0, sizeof(*histogram));
+}
+
+// Bucket of 'value': 4 per power of two from 4 up, below that exact
+static size_t quicvc_perf_bucket(uint64_t value) {
+    if (value < 4) {
+        return (size_t)value;
+    }
+    unsigned exponent = 63 - (unsigned)__builtin_clzll(value);
+    if (exponent > 31) {
+        return QUICVC_PERF_BUCKETS - 1;
+    }
+    return 4 + (exponent - 2) * 4 + (size_t)((value >> (exponent - 2)) & 3);
+}
+
+// Largest value that falls in 'bucket'
+static uint64_t quicvc_perf_bucket_limit(size_t bucket) {
+    if (bucket < 4) {
+        return bucket;
+    }
+    if (bucket == QUICVC_PERF_BUCKETS - 1) {
+        return UINT64_MAX;      // Also holds everything past 2^32
+    }
+    unsigned exponent = (unsigned)(bucket - 4) / 4 + 2;
+    uint64_t lower = (uint64_t)(4 + (bucket - 4) % 4) << (exponent - 2);
+    return lower + (1ull << (exponent - 2)) - 1;
+}
+
+void quicvc_perf_record(quicvc_perf_histogram_t *histogram, uint64_t value) {
+    if (histogram->count == 0 || value < histogram->min) histogram->min = value;
+    if (value > histogram->max) histogram->max = value;
+    histogram->count++;
+    histogram->total += value;
+    histogram->buckets[quicvc_perf_bucket(value)]++;
+}
+
+uint64_t quicvc_perf_percentile(const quicvc_perf_histogram_t *histogram, unsigned percentile) {
+    if (histogram->count == 0) {
+        return 0;
+    }
+    if (percentile > 100) percentile = 100;
+
+    // Smallest rank with 'percentile' percent of samples at or below it
+    uint64_t rank = (histogram->count * percentile + 99) / 100;
+    if (rank == 0) rank = 1;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < QUICVC_PERF_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            uint64_t limit = quicvc_perf_bucket_limit(i);
+            return limit < histogram->max ? limit : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+quicvc_perf_summary_t quicvc_perf_summarize(const quicvc_perf_histogram_t *histogram) {
+    quicvc_perf_summary_t summary = {0};
+    if (histogram->count > 0) {
+        summary.count = histogram->count;
+        summary.min = histogram->min;
+        summary.avg = histogram->total / histogram->count;
+        summary.p99 = quicvc_perf_percentile(histogram, 99);
+        summary.max = histogram->max;
+    }
+    return summary;
+}
+
+size_t quicvc_perf_write_frame(
+    const quicvc_perf_histogram_t *histograms,
+    uint32_t cycles_per_us,
+    uint8_t *out,
+    size_t out_size
+) {
+    if (!histograms || !out || out_size < 3) {
+        return 0;
+    }
+
+    size_t offset = 3;
+    size_t written = quicvc_encode_varint(cycles_per_us, &out[offset], out_size - offset);
+    if (written == 0) return 0;
+    offset += written;
+
+    for (size_t op = 0; op < QUICVC_PERF_OP_COUNT; op++) {
+        if (histograms[op].count == 0) continue;
+
+        quicvc_perf_summary_t summary = quicvc_perf_summarize(&histograms[op]);
+        const uint64_t fields[5] = { summary.count, summary.min, summary.avg, summary.p99, summary.max };
+        if (offset >= out_size) return 0;
+        out[offset++] = (uint8_t)op;
+        for (size_t i = 0; i < 5; i++) {
+            written = quicvc_encode_varint(fields[i], &out[offset], out_size - offset);
+            if (written == 0) return 0;
+            offset += written;
+        }
+    }
+
+    size_t body_len = offset - 3;
+    if (body_len > 0xFFFF) return 0;
+    out[0] = QUICVC_FRAME_VC_PERF;
+    out[1] = (uint8_t)(body_len >> 8);
+    out[2] = (uint8_t)body_len;
+    return offset;
+}
+
+const char *quicvc_perf_op_name(quicvc_perf_op_t op) {
+    static const char *const names[QUICVC_PERF_OP_COUNT] = {
+        [QUICVC_PERF_KEY_DERIVATION] = "key derivation",
+        [QUICVC_PERF_SEAL] = "seal",
+        [QUICVC_PERF_OPEN] = "open",
+        [QUICVC_PERF_HANDSHAKE] = "handshake",
+        [QUICVC_PERF_SEAL_BATCH] = "seal batch",
+        [QUICVC_PERF_OPEN_BATCH] = "open batch",
+    };
+    return (size_t)op < QUICVC_PERF_OP_COUNT ? names[op] : "unknown";
+}
+
+size_t quicvc_perf_format(
+    const quicvc_perf_histogram_t *histogram,
+    quicvc_perf_op_t op,
+    uint32_t cycles_per_us,
+    char *out,
+    size_t out_size
+) {
+    if (!histogram || !out || histogram->count == 0) {
+        return 0;
+    }
+
+    quicvc_perf_summary_t s = quicvc_perf_summarize(histogram);
+    int len = snprintf(out, out_size, "%-14s n=%llu min %llu avg %llu p99 %llu max %llu",
+                       quicvc_perf_op_name(op), (unsigned long long)s.count,
+                       (unsigned long long)s.min, (unsigned long long)s.avg,
+                       (unsigned long long)s.p99, (unsigned long long)s.max);
+    if (len > 0 && (size_t)len < out_size && cycles_per_us != 0) {
+        len += snprintf(&out[len], out_size - (size_t)len, " (avg %llu us)",
+                        (unsigned long long)(s.avg / cycles_per_us));
+    }
+    return len > 0 && (size_t)len < out_size ? (size_t)len : 0;
+}
+
+bool quicvc_conn_table_init(
+    quicvc_conn_table_t *table,
+    quicvc_conn_entry_t *entries,
+    size_t capacity,
+    uint16_t *index,
+    size_t index_size
+) {
+    if (!table || !entries || !index || capacity == 0 || capacity >= QUICVC_CONN_NONE ||
+        index_size <= capacity || (index_size & (index_size - 1)) != 0) {
+        return false;
+    }
+
+    memset(table, 0, sizeof(*table));
+    table->entries = entries;
+    table->index = index;
+    table->capacity = capacity;
+    table->index_mask = index_size - 1;
+    table->newest = QUICVC_CONN_NONE;
+    table->oldest = QUICVC_CONN_NONE;
+    for (size_t i = 0; i < index_size; i++) {
+        index[i] = QUICVC_CONN_NONE;
+    }
+
+    // Free slots in ascending order
+    for (size_t i = 0; i < capacity; i++) {
+        memset(&entries[i], 0, sizeof(entries[i]));
+        entries[i].newer = QUICVC_CONN_NONE;
+        entries[i].older = i + 1 < capacity ? (uint16_t)(i + 1) : QUICVC_CONN_NONE;
+    }
+    table->free_slots = 0;
+    return true;
+}
+
+// FNV-1a; our CIDs are random, so this only has to spread them
+static uint32_t quicvc_conn_hash(const uint8_t *cid, size_t cid_len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < cid_len; i++) {
+        hash = (hash ^ cid[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Index position holding 'cid', or the empty position that ends its probe
+static size_t quicvc_conn_probe(
+    const quicvc_conn_table_t *table, const uint8_t *cid, size_t cid_len, uint32_t hash
+) {
+    size_t pos = hash & table->index_mask;
+    for (;;) {
+        uint16_t slot = table->index[pos];
+        if (slot == QUICVC_CONN_NONE) {
+            return pos;
+        }
+        const quicvc_conn_entry_t *e = &table->entries[slot];
+        if (e->hash == hash && e->cid_len == cid_len && memcmp(e->cid, cid, cid_len) == 0) {
+            return pos;
+        }
+        pos = (pos + 1) & table->index_mask;
+    }
+}
+
+static void quicvc_conn_unlink(quicvc_conn_table_t *table, uint16_t slot) {
+    quicvc_conn_entry_t *e = &table->entries[slot];
+    if (e->newer != QUICVC_CONN_NONE) table->entries[e->newer].older = e->older;
+    else table->newest = e->older;
+    if (e->older != QUICVC_CONN_NONE) table->entries[e->older].newer = e->newer;
+    else table->oldest = e->newer;
+}
+
+static void quicvc_conn_push_newest(quicvc_conn_table_t *table, uint16_t slot) {
+    quicvc_conn_entry_t *e = &table->entries[slot];
+    e->newer = QUICVC_CONN_NONE;
+    e->older = table->newest;
+    if (table->newest != QUICVC_CONN_NONE) table->entries[table->newest].newer = slot;
+    else table->oldest = slot;
+    table->newest = slot;
+}
+
+static void quicvc_conn_touch(quicvc_conn_table_t *table, uint16_t slot) {
+    if (table->newest != slot) {
+        quicvc_conn_unlink(table, slot);
+        quicvc_conn_push_newest(table, slot);
+    }
+}
+
+uint16_t quicvc_conn_table_find(quicvc_conn_table_t *table, const uint8_t *cid, size_t cid_len) {
+    if (cid_len == 0 || cid_len > QUICVC_MAX_CONNECTION_ID_LENGTH) {
+        return QUICVC_CONN_NONE;
+    }
+    uint16_t slot = table->index[quicvc_conn_probe(table, cid, cid_len, quicvc_conn_hash(cid, cid_len))];
+    if (slot != QUICVC_CONN_NONE) {
+        quicvc_conn_touch(table, slot);
+    }
+    return slot;
+}
+
+void quicvc_conn_table_remove(quicvc_conn_table_t *table, uint16_t slot) {
+    if (slot >= table->capacity || !table->entries[slot].in_use) {
+        return;
+    }
+    quicvc_conn_entry_t *e = &table->entries[slot];
+    size_t hole = quicvc_conn_probe(table, e->cid, e->cid_len, e->hash);
+
+    // Shift back every later entry of the run whose home is not in
+    // (hole, pos], so no probe crosses an empty position on its way
+    size_t pos = hole;
+    for (;;) {
+        pos = (pos + 1) & table->index_mask;
+        uint16_t moved = table->index[pos];
+        if (moved == QUICVC_CONN_NONE) {
+            break;
+        }
+        size_t home = table->entries[moved].hash & table->index_mask;
+        if (((pos - home) & table->index_mask) >= ((pos - hole) & table->index_mask)) {
+            table->index[hole] = moved;
+            hole = pos;
+        }
+    }
+    table->index[hole] = QUICVC_CONN_NONE;
+
+    quicvc_conn_unlink(table, slot);
+    memset(e, 0, sizeof(*e));
+    e->newer = QUICVC_CONN_NONE;
+    e->older = table->free_slots;
+    table->free_slots = slot;
+    table->count--;
+}
+
+uint16_t quicvc_conn_table_insert(
+    quicvc_conn_table_t *table,
+    const uint8_t *cid,
+    size_t cid_len,
+    uint16_t *evicted
+) {
+    return quicvc_conn_table_insert_evictable(table, cid, cid_len, NULL, NULL, evicted);
+}
+
+uint16_t quicvc_conn_table_insert_evictable(
+    quicvc_conn_table_t *table,
+    const uint8_t *cid,
+    size_t cid_len,
+    quicvc_conn_evictable_fn evictable,
+    void *ctx,
+    uint16_t *evicted
+) {
+    *evicted = QUICVC_CONN_NONE;
+    if (cid_len == 0 || cid_len > QUICVC_MAX_CONNECTION_ID_LENGTH) {
+        return QUICVC_CONN_NONE;
+    }
+
+    uint32_t hash = quicvc_conn_hash(cid, cid_len);
+    uint16_t slot = table->index[quicvc_conn_probe(table, cid, cid_len, hash)];
+    if (slot != QUICVC_CONN_NONE) {
+        quicvc_conn_touch(table, slot);
+        return slot;
+    }
+
+    if (table->free_slots == QUICVC_CONN_NONE) {
+        uint16_t victim = table->oldest;
+        while (victim != QUICVC_CONN_NONE && evictable && !evictable(victim, ctx)) {
+            victim = table->entries[victim].newer;
+        }
+        if (victim == QUICVC_CONN_NONE) {
+            return QUICVC_CONN_NONE;
+        }
+        *evicted = victim;
+        quicvc_conn_table_remove(table, victim);
+    }
+    slot = table->free_slots;
+    quicvc_conn_entry_t *e = &table->entries[slot];
+    table->free_slots = e->older;
+
+    memcpy(e->cid, cid, cid_len);
+    e->cid_len = (uint8_t)cid_len;
+    e->hash = hash;
+    e->in_use = true;
+    table->index[quicvc_conn_probe(table, cid, cid_len, hash)] = slot;
+    quicvc_conn_push_newest(table, slot);
+    table->count++;
+    return slot;
+}
+
+uint16_t quicvc_conn_table_oldest(const quicvc_conn_table_t *table) {
+    return table->oldest;
+}
+
+static void quicvc_timer_list_init(quicvc_timer_link_t *head) {
+    head->next = head;
+    head->prev = head;
+}
+
+// Move every timer of 'from' to the empty list 'to'
+static void quicvc_timer_list_take(quicvc_timer_link_t *from, quicvc_timer_link_t *to) {
+    if (from->next == from) {
+        quicvc_timer_list_init(to);
+        return;
+    }
+    to->next = from->next;
+    to->prev = from->prev;
+    to->next->prev = to;
+    to->prev->next = to;
+    quicvc_timer_list_init(from);
+}
+
+void quicvc_timer_wheel_init(quicvc_timer_wheel_t *wheel, uint64_t now_us, uint64_t tick_us) {
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->tick_us = tick_us > 0 ? tick_us : 1;
+    wheel->now = now_us / wheel->tick_us;
+    for (size_t level = 0; level < QUICVC_TIMER_LEVELS; level++) {
+        for (size_t slot = 0; slot < QUICVC_TIMER_SLOTS; slot++) {
+            quicvc_timer_list_init(&wheel->slots[level][slot]);
+        }
+    }
+}
+
+void quicvc_timer_init(quicvc_timer_t *timer, quicvc_timer_fn fire, void *ctx) {
+    memset(timer, 0, sizeof(*timer));
+    timer->fire = fire;
+    timer->ctx = ctx;
+}
+
+// Link a timer into the slot for its expiry, relative to the next tick
+// to run. Slots that were already passed this round are only reached
+// again a full round later, which is exactly when such a timer is due to
+// move down.
+static void quicvc_timer_place(quicvc_timer_wheel_t *wheel, quicvc_timer_t *timer) {
+    uint64_t expires = timer->expires < wheel->now ? wheel->now : timer->expires;
+    uint64_t delta = expires - wheel->now;
+    unsigned level = 0;
+    while (level + 1 < QUICVC_TIMER_LEVELS &&
+           delta >= 1ull << (QUICVC_TIMER_SLOT_BITS * (level + 1))) {
+        level++;
+    }
+    if (delta >> (QUICVC_TIMER_SLOT_BITS * QUICVC_TIMER_LEVELS)) {
+        expires = wheel->now + (1ull << (QUICVC_TIMER_SLOT_BITS * QUICVC_TIMER_LEVELS)) - 1;
+    }
+
+    size_t slot = (size_t)(expires >> (QUICVC_TIMER_SLOT_BITS * level)) & (QUICVC_TIMER_SLOTS - 1);
+    quicvc_timer_link_t *head = &wheel->slots[level][slot];
+    timer->link.next = head;
+    timer->link.prev = head->prev;
+    head->prev->next = &timer->link;
+    head->prev = &timer->link;
+    wheel->occupied[level] |= 1ull << slot;
+    timer->level = (uint8_t)level;
+    timer->slot = (uint8_t)slot;
+}
+
+static void quicvc_timer_unlink(quicvc_timer_wheel_t *wheel, quicvc_timer_t *timer) {
+    timer->link.prev->next = timer->link.next;
+    timer->link.next->prev = timer->link.prev;
+    quicvc_timer_link_t *head = &wheel->slots[timer->level][timer->slot];
+    if (head->next == head) {
+        wheel->occupied[timer->level] &= ~(1ull << timer->slot);
+    }
+}
+
+void quicvc_timer_schedule(quicvc_timer_wheel_t *wheel, quicvc_timer_t *timer, uint64_t deadline_us) {
+    if (timer->pending) {
+        quicvc_timer_unlink(wheel, timer);
+    } else {
+        timer->pending = true;
+        wheel->pending++;
+    }
+    // Round up, so a timer never fires before its deadline
+    timer->expires = deadline_us / wheel->tick_us + (deadline_us % wheel->tick_us != 0);
+    quicvc_timer_place(wheel, timer);
+}
+
+void quicvc_timer_cancel(quicvc_timer_wheel_t *wheel, quicvc_timer_t *timer) {
+    if (timer->pending) {
+        quicvc_timer_unlink(wheel, timer);
+        timer->pending = false;
+        wheel->pending--;
+    }
+}
+
+// Move the slots that 'tick' reaches on the upper levels down
+static void quicvc_timer_cascade(quicvc_timer_wheel_t *wheel, uint64_t tick) {
+    for (unsigned level = 1; level < QUICVC_TIMER_LEVELS; level++) {
+        size_t slot = (size_t)(tick >> (QUICVC_TIMER_SLOT_BITS * level)) & (QUICVC_TIMER_SLOTS - 1);
+        quicvc_timer_link_t moving;
+        quicvc_timer_list_take(&wheel->slots[level][slot], &moving);
+        wheel->occupied[level] &= ~(1ull << slot);
+        while (moving.next != &moving) {
+            quicvc_timer_t *timer = (quicvc_timer_t *)moving.next;
+            moving.next = timer->link.next;
+            moving.next->prev = &moving;
+            quicvc_timer_place(wheel, timer);
+        }
+        if (slot != 0) {
+            break;
+        }
+    }
+}
+
+size_t quicvc_timer_wheel_advance(quicvc_timer_wheel_t *wheel, uint64_t now_us) {
+    uint64_t target = now_us / wheel->tick_us;
+    size_t fired = 0;
+
+    while (wheel->now <= target) {
+        uint64_t tick = wheel->now;
+        size_t slot = (size_t)tick & (QUICVC_TIMER_SLOTS - 1);
+        if (slot == 0) {
+            quicvc_timer_cascade(wheel, tick);
+        }
+
+        // Off the wheel before any callback runs: one that schedules for
+        // this tick lands in the next, and cancelling a timer still in
+        // 'due' just unlinks it from there
+        quicvc_timer_link_t due;
+        quicvc_timer_list_take(&wheel->slots[0][slot], &due);
+        wheel->occupied[0] &= ~(1ull << slot);
+        wheel->now = tick + 1;
+        while (due.next != &due) {
+            quicvc_timer_t *timer = (quicvc_timer_t *)due.next;
+            due.next = timer->link.next;
+            due.next->prev = &due;
+            timer->pending = false;
+            wheel->pending--;
+            fired++;
+            timer->fire(timer, timer->ctx);
+        }
+
+        // Nothing left on level 0 this round: jump to the next cascade
+        size_t next = (size_t)wheel->now & (QUICVC_TIMER_SLOTS - 1);
+        if (next != 0 && (wheel->occupied[0] >> next) == 0) {
+            uint64_t boundary = (wheel->now | (QUICVC_TIMER_SLOTS - 1)) + 1;
+            wheel->now = boundary < target + 1 ? boundary : target + 1;
+        }
+    }
+    return fired;
+}
+
+uint64_t quicvc_timer_wheel_next_deadline(const quicvc_timer_wheel_t *wheel) {
+    uint64_t earliest = QUICVC_TIMER_NONE;
+    for (unsigned level = 0; level < QUICVC_TIMER_LEVELS; level++) {
+        uint64_t occupied = wheel->occupied[level];
+        if (occupied == 0) {
+            continue;
+        }
+        // First slot this level reaches from the next tick on: level 0
+        // runs a slot per tick, the others move one down every 2^shift
+        unsigned shift = QUICVC_TIMER_SLOT_BITS * level;
+        uint64_t round = (wheel->now + (1ull << shift) - 1) >> shift;
+        unsigned start = (unsigned)(round & (QUICVC_TIMER_SLOTS - 1));
+        uint64_t rotated = start ? (occupied >> start) | (occupied << (QUICVC_TIMER_SLOTS - start))
+                                 : occupied;
+        uint64_t tick = (round + (uint64_t)__builtin_ctzll(rotated)) << shift;
+        if (tick < earliest) {
+            earliest = tick;
+        }
+    }
+    return earliest == QUICVC_TIMER_NONE ? QUICVC_TIMER_NONE : earliest * wheel->tick_us;
+}
@@ -39,13 +39,17 @@ extern "C" {
 #define QUICVC_FRAME_PADDING              0x00
 #define QUICVC_FRAME_PING                 0x01
 #define QUICVC_FRAME_ACK                  0x02
+#define QUICVC_FRAME_ACK_ECN              0x03
 #define QUICVC_FRAME_STREAM               0x08
 #define QUICVC_FRAME_CONNECTION_CLOSE     0x1c
+#define QUICVC_FRAME_CONNECTION_CLOSE_APP 0x1d
 
 // QUIC-VC Specific Frame Types (custom extensions)
 #define QUICVC_FRAME_VC_INIT      0x10  // Replaces CRYPTO+TLS ClientHello
 #define QUICVC_FRAME_VC_RESPONSE  0x11  // Replaces CRYPTO+TLS ServerHello
 #define QUICVC_FRAME_VC_ACK       0x12  // VC handshake acknowledgment
+#define QUICVC_FRAME_VC_TICKET    0x13  // Resumption ticket for 0-RTT
+#define QUICVC_FRAME_VC_PERF      0x14  // Latency report (empty body: query)
 #define QUICVC_FRAME_DISCOVERY    0x01  // Device discovery (uses PING semantics)
 #define QUICVC_FRAME_HEARTBEAT    0x20  // Keep-alive heartbeat
 
@@ -58,6 +62,19 @@ extern "C" {
 #define QUICVC_MAX_PACKET_SIZE           1200
 #define QUICVC_MAX_CONNECTION_ID_LENGTH  20
 #define QUICVC_DEFAULT_CONNECTION_ID_LENGTH 8
+#define QUICVC_MAX_PACKET_NUMBER_LENGTH  4
+#define QUICVC_MAX_SHORT_HEADER_SIZE     (1 + QUICVC_MAX_CONNECTION_ID_LENGTH + QUICVC_MAX_PACKET_NUMBER_LENGTH)
+#define QUICVC_AEAD_TAG_LENGTH           16
+#define QUICVC_TICKET_ID_LENGTH          16  // VC_TICKET ID, used as the 0-RTT DCID
+#define QUICVC_KEY_SHARE_LENGTH          32  // X25519 public key, hex in VC_INIT/VC_RESPONSE "key"
+
+// ACK Generation
+#define QUICVC_ACK_WINDOW_SIZE           64  // Recent packet numbers tracked as a bitmap
+#define QUICVC_ACK_MAX_RANGES            16  // Older ranges kept below the window
+#define QUICVC_DEFAULT_ACK_DELAY_EXPONENT 3
+
+// Replay Protection
+#define QUICVC_REPLAY_WINDOW_SIZE        64  // Packet numbers below the largest still accepted
 
 // Variable-Length Integer Limits (from RFC 9000)
 #define QUICVC_VARINT_1_BYTE_MAX  63
@@ -102,6 +119,19 @@ quicvc_varint_result_t quicvc_decode_varint(const uint8_t *data, size_t data_len
  */
 uint8_t quicvc_get_varint_size(uint64_t value);
 
+/**
+ * Decode 'count' consecutive variable-length integers into 'out'
+ * Uses one unaligned big-endian word load per value while at least
+ * 8 bytes remain, falling back to quicvc_decode_varint for the tail.
+ * Returns the total number of bytes read, or 0 if the buffer ends early
+ */
+size_t quicvc_decode_varints(
+    const uint8_t *data,
+    size_t data_len,
+    uint64_t *out,
+    size_t count
+);
+
 /**
  * STREAM Frame Parser (RFC 9000 Section 19.8)
  *
@@ -155,6 +185,979 @@ size_t quicvc_serialize_stream_frame(
     size_t out_size
 );
 
+/**
+ * Scatter-gather STREAM serialization
+ *
+ * Only the frame header (type, stream ID, offset, length) is written; the
+ * stream data is referenced, not copied, so sendmsg() or a streaming AEAD
+ * can read it where the caller keeps it. Field names follow struct iovec.
+ */
+
+#define QUICVC_MAX_STREAM_HEADER_SIZE 25  // Type + three 8-byte varints
+
+typedef struct {
+    const uint8_t *iov_base;
+    size_t iov_len;
+} quicvc_iovec_t;
+
+/**
+ * Write the STREAM frame header for 'frame' (everything but the data)
+ * Returns number of bytes written, or 0 on error
+ */
+size_t quicvc_write_stream_frame_header(
+    const quicvc_stream_frame_t *frame,
+    uint8_t *out,
+    size_t out_size
+);
+
+/**
+ * Serialize a STREAM frame as iovecs: iov[0] is the header written to
+ * 'header_out', iov[1] (if there is data) points at frame->data
+ * Returns the number of iovec entries used, or 0 on error
+ */
+size_t quicvc_serialize_stream_frame_iov(
+    const quicvc_stream_frame_t *frame,
+    uint8_t *header_out,
+    size_t header_size,
+    quicvc_iovec_t *iov,
+    size_t iov_count
+);
+
+/**
+ * STREAM Reassembly (RFC 9000 Section 2.2)
+ *
+ * Turns STREAM frames arriving in any order into in-order delivery.
+ * Stream offset o lives at buffer[o % capacity] of a caller-provided
+ * ring, so a device can hand in a static pool and a gateway a large
+ * heap window; data more than 'capacity' bytes past what has been
+ * delivered is refused. Received-but-undelivered bytes are a sorted list
+ * of at most QUICVC_REASSEMBLY_MAX_RANGES ranges; bytes already held are
+ * skipped, not compared, when retransmissions overlap. Contiguous data
+ * goes to 'deliver' as soon as it exists (in up to two pieces when the
+ * ring wraps); a frame that starts at the delivery point with nothing
+ * buffered is delivered straight from the frame without touching the ring.
+ */
+
+#define QUICVC_REASSEMBLY_MAX_RANGES 8
+#define QUICVC_STREAM_SIZE_UNKNOWN   UINT64_MAX
+
+typedef enum {
+    QUICVC_REASSEMBLY_OK = 0,
+    QUICVC_REASSEMBLY_DUPLICATE,            // Nothing new; already held or delivered
+    QUICVC_REASSEMBLY_OVER_BUDGET,          // Beyond delivered + capacity; resend later
+    QUICVC_REASSEMBLY_TOO_FRAGMENTED,       // Would need another range; resend later
+    QUICVC_REASSEMBLY_FINAL_SIZE_ERROR,     // Conflicts with FIN (FINAL_SIZE_ERROR)
+} quicvc_reassembly_status_t;
+
+typedef void (*quicvc_stream_deliver_fn)(const uint8_t *data, size_t len, bool fin, void *ctx);
+
+typedef struct {
+    uint64_t start;             // First stream offset held
+    uint64_t end;               // One past the last
+} quicvc_stream_range_t;
+
+typedef struct {
+    uint8_t *buffer;
+    size_t capacity;
+    uint64_t delivered;         // Stream offset of the next byte to deliver
+    uint64_t highest;           // Largest end offset seen
+    uint64_t final_size;        // QUICVC_STREAM_SIZE_UNKNOWN until FIN
+    bool fin_delivered;
+    quicvc_stream_range_t ranges[QUICVC_REASSEMBLY_MAX_RANGES];
+    uint8_t range_count;
+    quicvc_stream_deliver_fn deliver;
+    void *deliver_ctx;
+} quicvc_reassembly_t;
+
+/**
+ * Initialise reassembly for one stream over 'buffer' of 'capacity' (> 0) bytes
+ */
+void quicvc_reassembly_init(
+    quicvc_reassembly_t *reassembly,
+    uint8_t *buffer,
+    size_t capacity,
+    quicvc_stream_deliver_fn deliver,
+    void *deliver_ctx
+);
+
+/**
+ * Add the data of one STREAM frame and deliver whatever became contiguous
+ */
+quicvc_reassembly_status_t quicvc_reassembly_insert(
+    quicvc_reassembly_t *reassembly,
+    uint64_t offset,
+    const uint8_t *data,
+    size_t len,
+    bool fin
+);
+
+/**
+ * True once every byte up to the FIN has been delivered
+ */
+bool quicvc_reassembly_is_complete(const quicvc_reassembly_t *reassembly);
+
+/**
+ * Packet Header Codec (RFC 9000 Section 17)
+ *
+ * Long header:
+ *   Flags (1) = 1 | 1 | Type (2) | Reserved (2) | PN Length (2)
+ *   Version (4)
+ *   DCID Length (1), DCID (0..20)
+ *   SCID Length (1), SCID (0..20)
+ *   [Token Length (i), Token (..)]   (INITIAL only)
+ *   Length (i)                        (packet number + protected payload)
+ *   Packet Number (1..4)
+ *
+ * Short header:
+ *   Flags (1) = 0 | 1 | Spin | Reserved (2) | Key Phase | PN Length (2)
+ *   DCID (length known to the receiver)
+ *   Packet Number (1..4)
+ *
+ * Parsed headers are views: CID and token pointers refer into the datagram.
+ * The writers emit only the header, so frames can be serialized straight
+ * after it and sealed in place. The long header Length field is always
+ * written as a 2-byte varint so the header size is known before the payload.
+ */
+
+typedef struct {
+    bool is_long;
+    uint8_t packet_type;        // QUICVC_PACKET_TYPE_* (ONE_RTT for short headers)
+    uint32_t version;           // Long header only
+    const uint8_t *dcid;
+    uint8_t dcid_len;
+    const uint8_t *scid;        // Long header only
+    uint8_t scid_len;
+    const uint8_t *token;       // INITIAL only
+    size_t token_len;
+    uint64_t packet_number;     // Truncated value as carried on the wire
+    uint8_t packet_number_len;  // 1-4 bytes
+    bool spin_bit;              // Short header only
+    bool key_phase;             // Short header only
+    size_t packet_number_offset; // Offset of the packet number in the datagram
+    size_t header_len;          // Header bytes including the packet number
+    const uint8_t *payload;     // Protected payload (frames + AEAD tag)
+    size_t payload_len;
+} quicvc_header_t;
+
+typedef struct {
+    quicvc_header_t header;
+    size_t bytes_consumed;      // Size of this packet; less than the datagram when coalesced
+} quicvc_header_parse_result_t;
+
+/**
+ * Parse a long or short packet header
+ * 'short_dcid_len' is the DCID length to assume for short headers
+ * If bytes_consumed == 0, parsing failed
+ */
+quicvc_header_parse_result_t quicvc_parse_header(
+    const uint8_t *data,
+    size_t data_len,
+    uint8_t short_dcid_len
+);
+
+/**
+ * Get the encoded size of a long/short header
+ */
+size_t quicvc_long_header_size(const quicvc_header_t *header);
+size_t quicvc_short_header_size(const quicvc_header_t *header);
+
+/**
+ * Write a long header for a payload of 'payload_len' bytes
+ * 'payload_len' is the protected size: frames plus QUICVC_AEAD_TAG_LENGTH
+ * Uses packet_type, version, dcid, scid, token, packet_number and
+ * packet_number_len from 'header'
+ * Returns the header size, or 0 on error
+ */
+size_t quicvc_write_long_header(
+    const quicvc_header_t *header,
+    size_t payload_len,
+    uint8_t *out,
+    size_t out_size
+);
+
+/**
+ * Write a short header
+ * Uses dcid, packet_number, packet_number_len, spin_bit and key_phase
+ * Returns the header size, or 0 on error
+ */
+size_t quicvc_write_short_header(
+    const quicvc_header_t *header,
+    uint8_t *out,
+    size_t out_size
+);
+
+/**
+ * Retry (RFC 9000 Sections 8.1 and 17.2.5, RFC 9001 Section 5.8)
+ *
+ * A server that will not spend state on an unvalidated address answers
+ * its INITIAL with a Retry: a new SCID and an address-validation token.
+ * The client repeats the INITIAL to that SCID with the token. A Retry has
+ * no Length or packet number; the token runs up to the integrity tag in
+ * the last QUICVC_RETRY_INTEGRITY_TAG_LENGTH bytes. quicvc_parse_header
+ * returns the token in 'token' and the tag as the payload.
+ *
+ * The tag is AES-128-GCM over the pseudo-packet (original DCID length,
+ * original DCID, Retry without the tag) with the RFC 9001 Section 5.8 key
+ * and nonce; it only guards against corruption and off-path injection.
+ */
+
+#define QUICVC_RETRY_INTEGRITY_TAG_LENGTH 16
+
+/**
+ * Write a Retry packet up to its integrity tag
+ * Uses version, dcid and scid from 'header'
+ * Returns the number of bytes written, after which the tag goes, or 0 on
+ * error or if 'out' has no room for the tag
+ */
+size_t quicvc_write_retry(
+    const quicvc_header_t *header,
+    const uint8_t *token,
+    size_t token_len,
+    uint8_t *out,
+    size_t out_size
+);
+
+/**
+ * Packet Number Encoding (RFC 9000 Section 17.1, Appendix A.2/A.3)
+ *
+ * Packet numbers are sent truncated to 1-4 bytes, big-endian (the same
+ * bytes encodePacketNumber in packet.ts produces). The sender sizes the
+ * field so it covers twice the range of unacknowledged packets; the
+ * receiver recovers the full number from the one it expects next.
+ */
+
+// Largest-acknowledged value to use before the peer has acknowledged anything
+#define QUICVC_PACKET_NUMBER_NONE UINT64_MAX
+
+/**
+ * Get the number of bytes (1-4) needed to send 'packet_number'
+ * 'largest_acked' is QUICVC_PACKET_NUMBER_NONE if nothing has been acknowledged
+ * Returns 0 if more than 2^31 packets are in flight
+ */
+uint8_t quicvc_packet_number_length(uint64_t packet_number, uint64_t largest_acked);
+
+/**
+ * Write 'packet_number' truncated to the size chosen by
+ * quicvc_packet_number_length
+ * Returns the number of bytes written, or 0 on error
+ */
+uint8_t quicvc_encode_packet_number(
+    uint64_t packet_number,
+    uint64_t largest_acked,
+    uint8_t *out,
+    size_t out_size
+);
+
+/**
+ * Reconstruct a full packet number from its truncated wire value
+ * 'expected_pn' is one more than the largest packet number received so far
+ * (0 before anything was received)
+ */
+uint64_t quicvc_decode_packet_number(
+    uint64_t expected_pn,
+    uint64_t truncated_pn,
+    uint8_t packet_number_len
+);
+
+/**
+ * Header Protection (RFC 9001 Section 5.4)
+ *
+ * After a packet is sealed, the sender masks the low bits of the first
+ * byte (Key Phase and PN Length on short headers) and the packet number
+ * with a 5-byte mask. The mask is the first bytes of AES-ECB over a 16-byte
+ * sample of the ciphertext taken 4 bytes after the packet number offset,
+ * under a separate header protection key. The AES step is left to the
+ * platform so masks for several packets can be computed in one batch; these
+ * helpers only locate the sample and apply or remove the mask.
+ *
+ * The packet number offset does not depend on the masked bits, so a
+ * receiver can take packet_number_offset from quicvc_parse_header on the
+ * protected packet, remove protection, then parse the header again.
+ */
+
+#define QUICVC_HP_SAMPLE_LENGTH   16
+#define QUICVC_HP_MASK_LENGTH     5
+#define QUICVC_HP_SAMPLE_OFFSET   4   // Sample starts this far past the packet number offset
+
+/**
+ * Get the header protection sample of a packet whose packet number
+ * starts at 'pn_offset'
+ * Returns NULL if the packet is too short to sample
+ */
+const uint8_t *quicvc_header_protection_sample(
+    const uint8_t *packet,
+    size_t packet_len,
+    size_t pn_offset
+);
+
+/**
+ * Mask the first byte and packet number of a sealed packet in place
+ * 'mask' is QUICVC_HP_MASK_LENGTH bytes
+ * Returns false if the packet is too short
+ */
+bool quicvc_protect_header(
+    uint8_t *packet,
+    size_t packet_len,
+    size_t pn_offset,
+    const uint8_t *mask
+);
+
+/**
+ * Remove header protection in place
+ * Returns the packet number length (1-4), or 0 if the packet is too short
+ */
+uint8_t quicvc_unprotect_header(
+    uint8_t *packet,
+    size_t packet_len,
+    size_t pn_offset,
+    const uint8_t *mask
+);
+
+/**
+ * Packet Protection Batches (RFC 9001 Section 5.3)
+ *
+ * AEAD_AES_256_GCM over whole datagrams in place: the header at
+ * packet[0..header_len) is authenticated as associated data, the payload
+ * behind it is encrypted and the tag follows the ciphertext. Platform
+ * crypto seals or opens an array of these descriptors per call so that
+ * per-call costs (peripheral locks, key loads, context setup) are paid
+ * once per batch instead of once per packet.
+ */
+
+#define QUICVC_AEAD_KEY_LENGTH    32
+#define QUICVC_AEAD_NONCE_LENGTH  12
+
+typedef struct {
+    uint8_t *packet;            // Header, then payload; protected in place
+    size_t header_len;          // Bytes authenticated as associated data
+    size_t payload_len;         // Seal: plaintext at packet[header_len]; open: plaintext out
+    size_t packet_len;          // Seal: datagram out; open: datagram in
+    size_t packet_size;         // Seal: capacity of 'packet'
+    const quicvc_iovec_t *iov;  // Seal: gather the plaintext from here instead (optional)
+    size_t iov_count;
+    uint64_t packet_number;     // Full packet number, for the nonce
+    bool ok;                    // Set per packet by the batch call
+} quicvc_aead_packet_t;
+
+/**
+ * Per-packet nonce: the IV with the packet number XORed into its last
+ * 8 bytes (big-endian, right-aligned)
+ */
+void quicvc_aead_nonce(
+    const uint8_t *iv,
+    uint64_t packet_number,
+    uint8_t *nonce
+);
+
+/**
+ * AEAD backend: one implementation of packet protection per platform
+ * (mbedtls, the ESP32 AES peripheral, OpenSSL on hosts) behind the same
+ * calls, so the connection code and benchmarks do not depend on which
+ * one a target uses. A state holds one direction's key, expanded once at
+ * creation, and its IV.
+ *
+ * Every backend is keyed from the same schedule. For each direction,
+ * named by its sender ("server" or "client"):
+ *   key = SHA-256(session_key || sender || "-send")
+ *   iv  = SHA-256(session_key || sender || "-iv")[0..QUICVC_AEAD_NONCE_LENGTH)
+ * and the nonce of each packet comes from quicvc_aead_nonce.
+ */
+typedef struct {
+    const char *name;
+    void *(*create)(const uint8_t *key, const uint8_t *iv);  // NULL on failure
+    void (*destroy)(void *state);
+    size_t (*seal_batch)(void *state, quicvc_aead_packet_t *packets, size_t count);
+    size_t (*open_batch)(void *state, quicvc_aead_packet_t *packets, size_t count);
+} quicvc_aead_backend_t;
+
+/**
+ * Session Keys
+ *
+ * VC_INIT and VC_RESPONSE each carry a fresh X25519 (RFC 7748) public key
+ * as "key", QUICVC_KEY_SHARE_LENGTH bytes in hex, so nothing an observer
+ * sees on the wire yields the keys. With the shared secret both ends take
+ *   session_key = SHA-256(shared || "quicvc session" || challenge)
+ * which keys 1-RTT packets through the schedule above; the device sends
+ * as "server", the controller as "client".
+ *
+ * A VC_TICKET travels only inside a 1-RTT packet. Both ends bind it to
+ *   resumption = SHA-256(session_key || "quicvc resumption" || ticket_id)
+ * and a 0-RTT packet to DCID ticket_id is sealed, header as AAD, under
+ *   key = SHA-256(resumption || "quicvc 0rtt key")
+ *   iv  = SHA-256(resumption || "quicvc 0rtt iv")[0..QUICVC_AEAD_NONCE_LENGTH)
+ * The resumed connection's session_key is SHA-256(resumption || "quicvc
+ * resumed"); the device answers the 0-RTT packet with a HANDSHAKE sealed
+ * under its 1-RTT keys, whose SCID names the device's CID.
+ */
+
+/**
+ * Replay Window (RFC 9001 Section 9.2)
+ *
+ * Rejects packet numbers that were already opened, or that lie more than
+ * QUICVC_REPLAY_WINDOW_SIZE below the largest one, with a shift and a mask
+ * on the unprotected header, so duplicates from retransmission storms cost
+ * no AEAD work. A packet is recorded only after it authenticated, which
+ * keeps forged packet numbers from advancing the window. Rejections are
+ * counted for connection stats.
+ */
+
+typedef enum {
+    QUICVC_REPLAY_OK = 0,
+    QUICVC_REPLAY_DUPLICATE,    // Already opened
+    QUICVC_REPLAY_TOO_OLD,      // Below the window; cannot tell, so dropped
+} quicvc_replay_status_t;
+
+typedef struct {
+    uint64_t largest;           // Largest packet number opened
+    uint64_t window;            // Bit i set: packet (largest - i) opened
+    bool has_packets;
+    uint64_t dropped_duplicate;
+    uint64_t dropped_too_old;
+} quicvc_replay_window_t;
+
+/**
+ * Reset a window to the empty state, clearing the drop counters
+ */
+void quicvc_replay_window_init(quicvc_replay_window_t *window);
+
+/**
+ * Packet number to pass to quicvc_decode_packet_number
+ */
+uint64_t quicvc_replay_expected_pn(const quicvc_replay_window_t *window);
+
+/**
+ * Check a decoded packet number before opening the packet; a rejection
+ * is added to the matching drop counter
+ */
+quicvc_replay_status_t quicvc_replay_check(quicvc_replay_window_t *window, uint64_t packet_number);
+
+/**
+ * Record a packet number once its packet authenticated
+ */
+void quicvc_replay_update(quicvc_replay_window_t *window, uint64_t packet_number);
+
+/**
+ * Received Packet Tracker (RFC 9000 Section 13.2)
+ *
+ * Records received packet numbers in fixed memory and writes ACK frames
+ * from them. The newest QUICVC_ACK_WINDOW_SIZE packet numbers are a
+ * bitmap relative to 'largest' (bit i = largest - i), which covers the
+ * common in-order and lightly reordered case with a shift and an OR.
+ * Packets that slide out of the window are folded into an ascending list
+ * of closed ranges; when that list is full the oldest range is dropped,
+ * since it has long been acknowledged.
+ */
+
+typedef struct {
+    uint64_t smallest;
+    uint64_t largest;
+} quicvc_pn_range_t;
+
+typedef struct {
+    uint64_t largest;           // Largest packet number received
+    uint64_t window;            // Bit i set: packet (largest - i) received
+    quicvc_pn_range_t ranges[QUICVC_ACK_MAX_RANGES]; // Below the window, ascending
+    uint8_t range_count;
+    bool has_packets;
+    bool ack_pending;           // Packets received since the last ACK frame
+} quicvc_ack_tracker_t;
+
+/**
+ * Reset a tracker to the empty state
+ */
+void quicvc_ack_tracker_init(quicvc_ack_tracker_t *tracker);
+
+/**
+ * Record a received packet number
+ * Returns false if it was already recorded (duplicate)
+ */
+bool quicvc_ack_tracker_record(quicvc_ack_tracker_t *tracker, uint64_t packet_number);
+
+/**
+ * Check whether a packet number has been recorded
+ */
+bool quicvc_ack_tracker_contains(const quicvc_ack_tracker_t *tracker, uint64_t packet_number);
+
+/**
+ * Write an ACK frame for everything recorded
+ * 'ack_delay_us' is scaled by QUICVC_DEFAULT_ACK_DELAY_EXPONENT
+ * Older ranges are left out if 'out' is too small for all of them
+ * Returns the number of bytes written, or 0 if there is nothing to
+ * acknowledge or the buffer cannot hold the first range
+ */
+size_t quicvc_ack_tracker_write_frame(
+    quicvc_ack_tracker_t *tracker,
+    uint64_t ack_delay_us,
+    uint8_t *out,
+    size_t out_size
+);
+
+/**
+ * Frame Iterator (RFC 9000 Section 19 + QUIC-VC frames)
+ *
+ * Walks a decrypted packet payload in place and yields one typed view per
+ * frame. Views point into the payload; nothing is copied or allocated, so
+ * the payload must outlive the frames taken from it.
+ *
+ * QUIC-VC frames (VC_INIT, VC_ACK, VC_TICKET, VC_PERF, HEARTBEAT) use the format
+ * from vc-frames.ts: [type(1)][length(2, big-endian)][body].
+ * A VC_TICKET body is [ticket_id(QUICVC_TICKET_ID_LENGTH)][lifetime_s(4)].
+ * A VC_PERF body is empty (a query) or written by quicvc_perf_write_frame.
+ * VC_RESPONSE carries two such length-prefixed fields:
+ * [type(1)][microdata_len(2)][microdata][response_len(2)][response_json]
+ */
+
+typedef struct {
+    uint64_t largest_acknowledged;
+    uint64_t ack_delay;
+    uint64_t range_count;       // Number of gap/length pairs after first_range
+    uint64_t first_range;
+    const uint8_t *ranges;      // Encoded gap/length varint pairs
+    size_t ranges_len;
+    bool has_ecn;               // ACK_ECN (0x03) - counts follow the ranges
+    uint64_t ecn_counts[3];     // ECT0, ECT1, ECN-CE
+} quicvc_ack_frame_t;
+
+typedef struct {
+    uint64_t error_code;
+    uint64_t frame_type;        // 0 for application close (0x1d)
+    const uint8_t *reason;
+    size_t reason_len;
+    bool is_application;
+} quicvc_close_frame_t;
+
+typedef struct {
+    const uint8_t *body;        // Microdata (VC_INIT), ticket (VC_TICKET), report (VC_PERF) or JSON (VC_ACK, HEARTBEAT)
+    size_t body_len;
+    const uint8_t *response;    // VC_RESPONSE only: response JSON
+    size_t response_len;
+} quicvc_vc_frame_t;
+
+typedef struct {
+    uint8_t type;               // Frame type byte as read from the wire
+    const uint8_t *raw;         // Start of the frame in the payload
+    size_t raw_len;             // Encoded frame size
+    union {
+        size_t padding_len;     // Run of PADDING bytes, coalesced
+        quicvc_ack_frame_t ack;
+        quicvc_stream_frame_t stream;
+        quicvc_close_frame_t close;
+        quicvc_vc_frame_t vc;
+    } u;
+} quicvc_frame_t;
+
+typedef struct {
+    const uint8_t *data;
+    size_t data_len;
+    size_t offset;
+    bool error;                 // Set when a malformed or unknown frame stopped iteration
+} quicvc_frame_iter_t;
+
+/**
+ * Start iterating over the frames in a payload
+ */
+void quicvc_frame_iter_init(
+    quicvc_frame_iter_t *iter,
+    const uint8_t *payload,
+    size_t payload_len
+);
+
+/**
+ * Parse the next frame into 'frame'
+ * Returns false at the end of the payload, or on a malformed or unknown
+ * frame (iter->error is set in that case)
+ */
+bool quicvc_frame_iter_next(quicvc_frame_iter_t *iter, quicvc_frame_t *frame);
+
+/**
+ * Decode up to 'max_pairs' gap/length pairs of an ACK frame into 'out'
+ * (out[2*i] = gap, out[2*i+1] = length)
+ * Returns the number of pairs decoded
+ */
+size_t quicvc_ack_frame_ranges(
+    const quicvc_ack_frame_t *ack,
+    uint64_t *out,
+    size_t max_pairs
+);
+
+/**
+ * Packet Builder
+ *
+ * Queues frames for one connection and hands them to 'flush' as a single
+ * packet payload once the next frame would not fit in 'max_payload'
+ * bytes, or once the oldest queued frame has waited 'max_delay_us'.
+ * The flush callback adds the header (and AEAD) and sends the datagram.
+ * Time is passed in by the caller; the builder never reads a clock.
+ */
+
+typedef void (*quicvc_packet_flush_fn)(const uint8_t *payload, size_t payload_len, void *ctx);
+
+typedef struct {
+    uint8_t payload[QUICVC_MAX_PACKET_SIZE];
+    size_t len;
+    size_t max_payload;         // Packet size minus header and AEAD tag
+    uint64_t max_delay_us;      // 0: flush only on size or explicit flush
+    uint64_t deadline_us;       // Valid while len > 0
+    quicvc_packet_flush_fn flush;
+    void *flush_ctx;
+} quicvc_packet_builder_t;
+
+/**
+ * Initialise a builder; 'max_payload' is capped at QUICVC_MAX_PACKET_SIZE
+ */
+void quicvc_packet_builder_init(
+    quicvc_packet_builder_t *builder,
+    size_t max_payload,
+    uint64_t max_delay_us,
+    quicvc_packet_flush_fn flush,
+    void *flush_ctx
+);
+
+/**
+ * Queue an already encoded frame
+ * Returns false if the frame is larger than an empty packet
+ */
+bool quicvc_packet_builder_add(
+    quicvc_packet_builder_t *builder,
+    const uint8_t *frame,
+    size_t frame_len,
+    uint64_t now_us
+);
+
+/**
+ * Queue a STREAM frame, splitting it across packets if needed
+ * Every piece carries an explicit length; 'frame->has_off' and the FIN
+ * bit are honoured, with later pieces advancing the offset
+ */
+bool quicvc_packet_builder_add_stream(
+    quicvc_packet_builder_t *builder,
+    const quicvc_stream_frame_t *frame,
+    uint64_t now_us
+);
+
+/**
+ * Queue a QUIC-VC frame: [type][length(2)][body]
+ */
+bool quicvc_packet_builder_add_vc_frame(
+    quicvc_packet_builder_t *builder,
+    uint8_t frame_type,
+    const uint8_t *body,
+    size_t body_len,
+    uint64_t now_us
+);
+
+/**
+ * Queue an ACK frame from 'tracker', written straight into the packet
+ */
+bool quicvc_packet_builder_add_ack(
+    quicvc_packet_builder_t *builder,
+    quicvc_ack_tracker_t *tracker,
+    uint64_t ack_delay_us,
+    uint64_t now_us
+);
+
+/**
+ * Hand queued frames to the flush callback now
+ */
+void quicvc_packet_builder_flush(quicvc_packet_builder_t *builder);
+
+/**
+ * Flush if the deadline has passed
+ * Returns true if a packet was flushed
+ */
+bool quicvc_packet_builder_poll(quicvc_packet_builder_t *builder, uint64_t now_us);
+
+/**
+ * Latency Histograms
+ *
+ * Per-operation latencies in CPU cycles (CCOUNT on ESP32, the TSC on x86
+ * hosts) or nanoseconds, in fixed memory: values below 4 have a bucket
+ * each, above that every power of two is split into 4 buckets, so a
+ * percentile is exact to within 25%. Values past 2^32 share the last
+ * bucket. Recording is a count-leading-zeros and an increment.
+ *
+ * A VC_PERF frame reports the summaries; one with an empty body asks the
+ * peer for its report. Body: [cycles_per_us(i)] (0 when values are
+ * nanoseconds) then, per operation with samples,
+ * [op(1)][count(i)][min(i)][avg(i)][p99(i)][max(i)].
+ */
+
+#define QUICVC_PERF_BUCKETS 124
+
+typedef enum {
+    QUICVC_PERF_KEY_DERIVATION = 0,
+    QUICVC_PERF_SEAL,           // Per packet
+    QUICVC_PERF_OPEN,           // Per packet
+    QUICVC_PERF_HANDSHAKE,      // INITIAL received to handshake sent
+    QUICVC_PERF_SEAL_BATCH,     // Per batch of more than one packet
+    QUICVC_PERF_OPEN_BATCH,     // Per batch of more than one packet
+    QUICVC_PERF_OP_COUNT
+} quicvc_perf_op_t;
+
+// Largest VC_PERF frame: every operation listed, every varint 8 bytes
+#define QUICVC_PERF_FRAME_SIZE (3 + 8 + QUICVC_PERF_OP_COUNT * (1 + 5 * 8))
+
+typedef struct {
+    uint32_t buckets[QUICVC_PERF_BUCKETS];
+    uint64_t count;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+} quicvc_perf_histogram_t;
+
+typedef struct {
+    uint64_t count;
+    uint64_t min;
+    uint64_t avg;
+    uint64_t p99;               // Upper bound of the bucket, capped at max
+    uint64_t max;
+} quicvc_perf_summary_t;
+
+/**
+ * Reset a histogram to the empty state
+ */
+void quicvc_perf_init(quicvc_perf_histogram_t *histogram);
+
+/**
+ * Record one latency
+ */
+void quicvc_perf_record(quicvc_perf_histogram_t *histogram, uint64_t value);
+
+/**
+ * Value below which 'percentile' percent (1-100) of samples lie
+ * Returns 0 for an empty histogram
+ */
+uint64_t quicvc_perf_percentile(const quicvc_perf_histogram_t *histogram, unsigned percentile);
+
+/**
+ * Count, min, average, p99 and max; all zero for an empty histogram
+ */
+quicvc_perf_summary_t quicvc_perf_summarize(const quicvc_perf_histogram_t *histogram);
+
+/**
+ * Write a VC_PERF frame for QUICVC_PERF_OP_COUNT histograms indexed by
+ * quicvc_perf_op_t; 'cycles_per_us' is 0 if they hold nanoseconds
+ * Returns the number of bytes written, or 0 if 'out' is too small
+ */
+size_t quicvc_perf_write_frame(
+    const quicvc_perf_histogram_t *histograms,
+    uint32_t cycles_per_us,
+    uint8_t *out,
+    size_t out_size
+);
+
+/**
+ * Report name of an operation ("key derivation", "seal", ...)
+ */
+const char *quicvc_perf_op_name(quicvc_perf_op_t op);
+
+// Longest quicvc_perf_format line with its NUL
+#define QUICVC_PERF_LINE_SIZE 168
+
+/**
+ * Format one operation's summary as a log line:
+ * "seal           n=12 min 900 avg 1000 p99 1250 max 1300 (avg 4 us)",
+ * the microseconds only when 'cycles_per_us' is not 0
+ * Returns the line's length, or 0 for an empty histogram or if 'out' is
+ * too small
+ */
+size_t quicvc_perf_format(
+    const quicvc_perf_histogram_t *histogram,
+    quicvc_perf_op_t op,
+    uint32_t cycles_per_us,
+    char *out,
+    size_t out_size
+);
+
+/**
+ * Connection Table
+ *
+ * Maps connection IDs to connection slots in caller-provided memory, so a
+ * device can serve a few controllers from a static pool and a gateway
+ * thousands of connections. Slots never move: entry i goes with the
+ * caller's own connection state at index i. A lookup hashes the CID into
+ * an open-addressing index of slot numbers and probes linearly. Removal
+ * shifts later probes back rather than leaving tombstones, so lookups
+ * stay short however much the table churns. Slots are also kept in
+ * least-recently-used order. Inserting into a full table evicts the
+ * connection that has gone longest without a lookup, or, with a
+ * predicate, the least recently used one the caller is willing to lose.
+ */
+
+#define QUICVC_CONN_NONE UINT16_MAX
+
+typedef struct {
+    uint8_t cid[QUICVC_MAX_CONNECTION_ID_LENGTH];
+    uint8_t cid_len;
+    bool in_use;
+    uint32_t hash;
+    uint16_t newer;             // LRU neighbours, QUICVC_CONN_NONE at the ends;
+    uint16_t older;             // 'older' also chains the free slots
+} quicvc_conn_entry_t;
+
+typedef struct {
+    quicvc_conn_entry_t *entries;
+    uint16_t *index;            // Slot numbers by hash, QUICVC_CONN_NONE if empty
+    size_t capacity;
+    size_t index_mask;
+    size_t count;
+    uint16_t newest;
+    uint16_t oldest;
+    uint16_t free_slots;
+} quicvc_conn_table_t;
+
+/**
+ * Initialise a table of 'capacity' slots (1-65534) over 'entries' and an
+ * index of 'index_size' slot numbers, a power of two above 'capacity'
+ * (twice 'capacity' keeps probes to one or two)
+ * Returns false if the sizes are out of range
+ */
+bool quicvc_conn_table_init(
+    quicvc_conn_table_t *table,
+    quicvc_conn_entry_t *entries,
+    size_t capacity,
+    uint16_t *index,
+    size_t index_size
+);
+
+/**
+ * Slot of the connection with this CID, now the most recently used
+ * Returns QUICVC_CONN_NONE if there is none
+ */
+uint16_t quicvc_conn_table_find(quicvc_conn_table_t *table, const uint8_t *cid, size_t cid_len);
+
+/**
+ * Slot for a new connection with this CID (or the existing one's), now
+ * the most recently used. When the table is full the least recently used
+ * connection gives up its slot and '*evicted' is set to it, so the caller
+ * can tear down the old state first; otherwise it is QUICVC_CONN_NONE.
+ * Returns QUICVC_CONN_NONE if 'cid_len' is 0 or too long
+ */
+uint16_t quicvc_conn_table_insert(
+    quicvc_conn_table_t *table,
+    const uint8_t *cid,
+    size_t cid_len,
+    uint16_t *evicted
+);
+
+/**
+ * Whether the connection in 'slot' may give up its slot to a new one
+ */
+typedef bool (*quicvc_conn_evictable_fn)(uint16_t slot, void *ctx);
+
+/**
+ * Insert, but when the table is full evict only the least recently used
+ * connection 'evictable' accepts (any, if it is NULL). A server passes a
+ * predicate that spares established sessions still within their idle
+ * timeout, so a burst of new peers cannot displace live controllers.
+ * Returns QUICVC_CONN_NONE without inserting if no slot may be evicted
+ */
+uint16_t quicvc_conn_table_insert_evictable(
+    quicvc_conn_table_t *table,
+    const uint8_t *cid,
+    size_t cid_len,
+    quicvc_conn_evictable_fn evictable,
+    void *ctx,
+    uint16_t *evicted
+);
+
+/**
+ * Free a slot returned by find or insert
+ */
+void quicvc_conn_table_remove(quicvc_conn_table_t *table, uint16_t slot);
+
+/**
+ * Least recently used slot, the place to start an idle sweep (follow
+ * 'newer' from there); QUICVC_CONN_NONE if the table is empty
+ */
+uint16_t quicvc_conn_table_oldest(const quicvc_conn_table_t *table);
+
+/**
+ * Timer Wheel
+ *
+ * Deadlines for every connection (idle timeout, heartbeat, retransmit,
+ * handshake, coalescing) in one hierarchical wheel, so a receive loop can
+ * sleep until the earliest of them rather than polling each connection.
+ * Time is split into ticks of 'tick_us'. Level 0 has a slot per tick for
+ * the next QUICVC_TIMER_SLOTS ticks; each level above covers
+ * QUICVC_TIMER_SLOTS times the span of the one below, and its slots are
+ * moved down a level as time reaches them. Deadlines further out than the
+ * top level sit in its furthest slot until they come into range.
+ * Scheduling and cancelling unlink or link one node; timers live in the
+ * caller's structures, so the wheel allocates nothing. Timers never fire
+ * before their deadline, and at most one tick after it is passed to
+ * quicvc_timer_wheel_advance. Neither wheels nor pending timers may be
+ * moved in memory.
+ */
+
+#define QUICVC_TIMER_SLOT_BITS 6
+#define QUICVC_TIMER_SLOTS     (1u << QUICVC_TIMER_SLOT_BITS)
+#define QUICVC_TIMER_LEVELS    4    // 2^24 ticks: 4.6 hours at 1 ms
+#define QUICVC_TIMER_NONE      UINT64_MAX
+
+typedef struct quicvc_timer_link {
+    struct quicvc_timer_link *next;
+    struct quicvc_timer_link *prev;
+} quicvc_timer_link_t;
+
+typedef struct quicvc_timer quicvc_timer_t;
+typedef void (*quicvc_timer_fn)(quicvc_timer_t *timer, void *ctx);
+
+struct quicvc_timer {
+    quicvc_timer_link_t link;   // First member: a link is its timer
+    uint64_t expires;           // Tick
+    quicvc_timer_fn fire;
+    void *ctx;
+    uint8_t level;
+    uint8_t slot;
+    bool pending;               // Scheduled and not yet fired or cancelled
+};
+
+typedef struct {
+    quicvc_timer_link_t slots[QUICVC_TIMER_LEVELS][QUICVC_TIMER_SLOTS];
+    uint64_t occupied[QUICVC_TIMER_LEVELS];    // Bit per non-empty slot
+    uint64_t now;               // Next tick to run
+    uint64_t tick_us;
+    size_t pending;
+} quicvc_timer_wheel_t;
+
+/**
+ * Initialise a wheel whose clock reads 'now_us', with ticks of 'tick_us'
+ * (1 ms suits connection timers)
+ */
+void quicvc_timer_wheel_init(quicvc_timer_wheel_t *wheel, uint64_t now_us, uint64_t tick_us);
+
+/**
+ * Initialise a timer that calls 'fire' with 'ctx' when it expires
+ */
+void quicvc_timer_init(quicvc_timer_t *timer, quicvc_timer_fn fire, void *ctx);
+
+/**
+ * Schedule 'timer' for 'deadline_us', replacing any earlier schedule
+ * A deadline in a tick the wheel has already run fires on the next tick
+ */
+void quicvc_timer_schedule(quicvc_timer_wheel_t *wheel, quicvc_timer_t *timer, uint64_t deadline_us);
+
+/**
+ * Cancel 'timer' if it is pending
+ */
+void quicvc_timer_cancel(quicvc_timer_wheel_t *wheel, quicvc_timer_t *timer);
+
+/**
+ * Run every timer whose deadline is at or before 'now_us'
+ * Callbacks may schedule and cancel any timer, including their own
+ * Returns the number of timers fired
+ */
+size_t quicvc_timer_wheel_advance(quicvc_timer_wheel_t *wheel, uint64_t now_us);
+
+/**
+ * When to call quicvc_timer_wheel_advance next: the earliest deadline on
+ * the lowest level, or the time the first timer above it moves down a
+ * level if that is sooner; never after the earliest pending deadline
+ * Returns QUICVC_TIMER_NONE if no timer is pending
+ */
+uint64_t quicvc_timer_wheel_next_deadline(const quicvc_timer_wheel_t *wheel);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,481 @@
+/**
+ * QUIC-VC Protocol - Header-only C++ Binding
+ * Auto-generated from @refinio/quicvc-protocol TypeScript definitions
+ * DO NOT EDIT MANUALLY
+ *
+ * Inline constexpr versions of the hot paths in quicvc_protocol.c, so the
+ * host gateway and JSI modules can inline the codec into their own loops.
+ * Wire behaviour matches the C functions of the same name. Requires C++17;
+ * uses std::span under C++20 and a minimal span otherwise.
+ */
+
+#ifndef QUICVC_PROTOCOL_HPP
+#define QUICVC_PROTOCOL_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#if __cplusplus >= 202002L && defined(__has_include)
+#if __has_include(<span>)
+#include <span>
+#define QUICVC_HAS_STD_SPAN 1
+#endif
+#endif
+
+#include "quicvc_protocol.h"
+
+namespace quicvc {
+
+#if defined(QUICVC_HAS_STD_SPAN)
+template <typename T>
+using span = std::span<T>;
+#else
+/**
+ * Minimal stand-in for std::span (pointer + size, no static extent)
+ */
+template <typename T>
+class span {
+public:
+    constexpr span() noexcept = default;
+    constexpr span(T *data, std::size_t size) noexcept : data_(data), size_(size) {}
+
+    template <std::size_t N>
+    constexpr span(T (&array)[N]) noexcept : data_(array), size_(N) {}
+
+    template <typename U, std::size_t N,
+              typename = std::enable_if_t<std::is_convertible_v<U (*)[], T (*)[]>>>
+    constexpr span(std::array<U, N> &array) noexcept : data_(array.data()), size_(N) {}
+
+    template <typename U, std::size_t N,
+              typename = std::enable_if_t<std::is_convertible_v<const U (*)[], T (*)[]>>>
+    constexpr span(const std::array<U, N> &array) noexcept : data_(array.data()), size_(N) {}
+
+    template <typename U, typename = std::enable_if_t<std::is_convertible_v<U (*)[], T (*)[]>>>
+    constexpr span(const span<U> &other) noexcept : data_(other.data()), size_(other.size()) {}
+
+    constexpr T *data() const noexcept { return data_; }
+    constexpr std::size_t size() const noexcept { return size_; }
+    constexpr bool empty() const noexcept { return size_ == 0; }
+    constexpr T &operator[](std::size_t i) const noexcept { return data_[i]; }
+    constexpr T *begin() const noexcept { return data_; }
+    constexpr T *end() const noexcept { return data_ + size_; }
+
+    constexpr span first(std::size_t count) const noexcept { return span(data_, count); }
+    constexpr span subspan(std::size_t offset) const noexcept { return span(data_ + offset, size_ - offset); }
+    constexpr span subspan(std::size_t offset, std::size_t count) const noexcept {
+        return span(data_ + offset, count);
+    }
+
+private:
+    T *data_ = nullptr;
+    std::size_t size_ = 0;
+};
+#endif
+
+using bytes = span<const std::uint8_t>;
+using mutable_bytes = span<std::uint8_t>;
+
+/**
+ * Variable-Length Integers (RFC 9000 Section 16)
+ */
+
+struct varint_result {
+    std::uint64_t value;
+    std::size_t bytes_read;     // 0 if the buffer ends early
+};
+
+constexpr std::size_t varint_size(std::uint64_t value) noexcept {
+    return value <= QUICVC_VARINT_1_BYTE_MAX ? 1
+         : value <= QUICVC_VARINT_2_BYTE_MAX ? 2
+         : value <= QUICVC_VARINT_4_BYTE_MAX ? 4
+         : 8;
+}
+
+template <std::uint64_t Value>
+inline constexpr std::size_t varint_size_v = varint_size(Value);
+
+/**
+ * Encode 'value' into 'out'
+ * Returns the number of bytes written, or 0 if 'out' is too small
+ */
+constexpr std::size_t encode_varint(std::uint64_t value, mutable_bytes out) noexcept {
+    const std::size_t size = varint_size(value);
+    if (out.size() < size) {
+        return 0;
+    }
+
+    // Length prefix in the top two bits: 1/2/4/8 bytes = 0b00/01/10/11
+    const std::uint8_t prefix = size == 1 ? 0x00 : size == 2 ? 0x40 : size == 4 ? 0x80 : 0xC0;
+    for (std::size_t i = 0; i < size; i++) {
+        out[i] = static_cast<std::uint8_t>(value >> (8 * (size - 1 - i)));
+    }
+    out[0] = static_cast<std::uint8_t>(prefix | (out[0] & 0x3F));
+    return size;
+}
+
+constexpr varint_result decode_varint(bytes in) noexcept {
+    if (in.empty()) {
+        return {0, 0};
+    }
+
+    const std::size_t size = std::size_t{1} << (in[0] >> 6);
+    if (in.size() < size) {
+        return {0, 0};
+    }
+
+    std::uint64_t value = in[0] & 0x3F;
+    for (std::size_t i = 1; i < size; i++) {
+        value = (value << 8) | in[i];
+    }
+    return {value, size};
+}
+
+/**
+ * Frame Views (RFC 9000 Section 19 + QUIC-VC frames)
+ *
+ * Views refer into the payload they were parsed from; nothing is copied.
+ */
+
+struct stream_frame_view {
+    std::uint8_t type = 0;
+    std::uint64_t stream_id = 0;
+    std::uint64_t offset = 0;
+    bytes data;
+    bool fin = false;
+    bool has_len = false;
+    bool has_off = false;
+};
+
+struct ack_frame_view {
+    std::uint64_t largest_acknowledged = 0;
+    std::uint64_t ack_delay = 0;
+    std::uint64_t range_count = 0;
+    std::uint64_t first_range = 0;
+    bytes ranges;               // Encoded gap/length varint pairs
+    bool has_ecn = false;
+    std::uint64_t ecn_counts[3] = {0, 0, 0};
+};
+
+struct close_frame_view {
+    std::uint64_t error_code = 0;
+    std::uint64_t frame_type = 0;
+    bool is_application = false;
+    bytes reason;
+};
+
+struct vc_frame_view {
+    bytes body;                 // JSON, or microdata for VC_RESPONSE
+    bytes response;             // VC_RESPONSE only
+};
+
+struct frame_view {
+    std::uint8_t type = 0;
+    bytes raw;
+    std::size_t padding_len = 0;
+    stream_frame_view stream;
+    ack_frame_view ack;
+    close_frame_view close;
+    vc_frame_view vc;
+};
+
+template <typename Frame>
+struct parse_result {
+    Frame frame;
+    std::size_t bytes_consumed; // 0 on failure
+};
+
+constexpr parse_result<stream_frame_view> parse_stream_frame(bytes in) noexcept {
+    parse_result<stream_frame_view> result{{}, 0};
+    stream_frame_view &frame = result.frame;
+
+    if (in.size() < 2 || (in[0] & 0xF8) != QUICVC_FRAME_STREAM) {
+        return result;
+    }
+
+    frame.type = in[0];
+    frame.fin = (in[0] & QUICVC_STREAM_FIN_BIT) != 0;
+    frame.has_len = (in[0] & QUICVC_STREAM_LEN_BIT) != 0;
+    frame.has_off = (in[0] & QUICVC_STREAM_OFF_BIT) != 0;
+    std::size_t offset = 1;
+
+    varint_result v = decode_varint(in.subspan(offset));
+    if (v.bytes_read == 0) return result;
+    frame.stream_id = v.value;
+    offset += v.bytes_read;
+
+    if (frame.has_off) {
+        v = decode_varint(in.subspan(offset));
+        if (v.bytes_read == 0) return result;
+        frame.offset = v.value;
+        offset += v.bytes_read;
+    }
+
+    std::uint64_t length = in.size() - offset;
+    if (frame.has_len) {
+        v = decode_varint(in.subspan(offset));
+        if (v.bytes_read == 0) return result;
+        offset += v.bytes_read;
+        length = v.value;
+        if (length > in.size() - offset) return result;
+    }
+
+    frame.data = in.subspan(offset, static_cast<std::size_t>(length));
+    result.bytes_consumed = offset + static_cast<std::size_t>(length);
+    return result;
+}
+
+namespace detail {
+
+// Read a [length(2)][bytes] QUIC-VC field; returns bytes used or 0
+constexpr std::size_t read_len16_field(bytes in, bytes &field) noexcept {
+    if (in.size() < 2) return 0;
+    const std::size_t len = (std::size_t{in[0]} << 8) | in[1];
+    if (len > in.size() - 2) return 0;
+    field = in.subspan(2, len);
+    return 2 + len;
+}
+
+// Decode 'count' varints in sequence; returns bytes used or 0
+template <std::size_t Count>
+constexpr std::size_t read_varints(bytes in, std::uint64_t (&out)[Count], std::size_t count = Count) noexcept {
+    std::size_t offset = 0;
+    for (std::size_t i = 0; i < count; i++) {
+        const varint_result v = decode_varint(in.subspan(offset));
+        if (v.bytes_read == 0) return 0;
+        out[i] = v.value;
+        offset += v.bytes_read;
+    }
+    return offset;
+}
+
+constexpr std::size_t parse_ack(bytes in, ack_frame_view &ack) noexcept {
+    std::uint64_t fields[4] = {0, 0, 0, 0};
+    std::size_t offset = 1;
+
+    std::size_t read = read_varints(in.subspan(offset), fields);
+    if (read == 0) return 0;
+    offset += read;
+
+    ack.largest_acknowledged = fields[0];
+    ack.ack_delay = fields[1];
+    ack.range_count = fields[2];
+    ack.first_range = fields[3];
+    ack.has_ecn = in[0] == QUICVC_FRAME_ACK_ECN;
+
+    // Each range is at least two bytes; reject counts the payload cannot hold
+    if (ack.range_count > (in.size() - offset) / 2) return 0;
+
+    const std::size_t ranges_start = offset;
+    for (std::uint64_t i = 0; i < ack.range_count * 2; i++) {
+        if (offset >= in.size()) return 0;
+        const std::size_t len = std::size_t{1} << (in[offset] >> 6);
+        if (len > in.size() - offset) return 0;
+        offset += len;
+    }
+    ack.ranges = in.subspan(ranges_start, offset - ranges_start);
+
+    if (ack.has_ecn) {
+        read = read_varints(in.subspan(offset), ack.ecn_counts);
+        if (read == 0) return 0;
+        offset += read;
+    }
+    return offset;
+}
+
+constexpr std::size_t parse_close(bytes in, close_frame_view &close) noexcept {
+    std::uint64_t fields[3] = {0, 0, 0};
+    std::size_t offset = 1;
+
+    // Application close (0x1d) has no frame type field
+    close.is_application = in[0] == QUICVC_FRAME_CONNECTION_CLOSE_APP;
+    const std::size_t count = close.is_application ? 2 : 3;
+
+    const std::size_t read = read_varints(in.subspan(offset), fields, count);
+    if (read == 0) return 0;
+    offset += read;
+
+    close.error_code = fields[0];
+    close.frame_type = close.is_application ? 0 : fields[1];
+    const std::uint64_t reason_len = fields[count - 1];
+    if (reason_len > in.size() - offset) return 0;
+
+    close.reason = in.subspan(offset, static_cast<std::size_t>(reason_len));
+    return offset + static_cast<std::size_t>(reason_len);
+}
+
+} // namespace detail
+
+/**
+ * Single-pass frame reader, the constexpr counterpart of quicvc_frame_iter_t
+ */
+class frame_reader {
+public:
+    constexpr explicit frame_reader(bytes payload) noexcept : payload_(payload) {}
+
+    /**
+     * Parse the next frame into 'frame'
+     * Returns false at the end of the payload or on a malformed or
+     * unknown frame (error() is set in that case)
+     */
+    constexpr bool next(frame_view &frame) noexcept {
+        if (error_ || offset_ >= payload_.size()) {
+            return false;
+        }
+
+        const bytes in = payload_.subspan(offset_);
+        std::size_t consumed = 0;
+
+        frame = frame_view{};
+        frame.type = in[0];
+
+        switch (frame.type) {
+            case QUICVC_FRAME_PADDING:
+                while (consumed < in.size() && in[consumed] == QUICVC_FRAME_PADDING) {
+                    consumed++;
+                }
+                frame.padding_len = consumed;
+                break;
+
+            case QUICVC_FRAME_PING:
+                consumed = 1;
+                break;
+
+            case QUICVC_FRAME_ACK:
+            case QUICVC_FRAME_ACK_ECN:
+                consumed = detail::parse_ack(in, frame.ack);
+                break;
+
+            case QUICVC_FRAME_CONNECTION_CLOSE:
+            case QUICVC_FRAME_CONNECTION_CLOSE_APP:
+                consumed = detail::parse_close(in, frame.close);
+                break;
+
+            case QUICVC_FRAME_VC_INIT:
+            case QUICVC_FRAME_VC_ACK:
+            case QUICVC_FRAME_VC_TICKET:
+            case QUICVC_FRAME_VC_PERF:
+            case QUICVC_FRAME_HEARTBEAT:
+                consumed = detail::read_len16_field(in.subspan(1), frame.vc.body);
+                if (consumed > 0) consumed += 1;
+                break;
+
+            case QUICVC_FRAME_VC_RESPONSE: {
+                const std::size_t md = detail::read_len16_field(in.subspan(1), frame.vc.body);
+                if (md == 0) break;
+                const std::size_t resp = detail::read_len16_field(in.subspan(1 + md), frame.vc.response);
+                if (resp == 0) break;
+                consumed = 1 + md + resp;
+                break;
+            }
+
+            default:
+                if ((frame.type & 0xF8) == QUICVC_FRAME_STREAM) {
+                    const parse_result<stream_frame_view> r = parse_stream_frame(in);
+                    frame.stream = r.frame;
+                    consumed = r.bytes_consumed;
+                }
+                break;
+        }
+
+        if (consumed == 0) {
+            error_ = true;
+            return false;
+        }
+
+        frame.raw = in.first(consumed);
+        offset_ += consumed;
+        return true;
+    }
+
+    constexpr bool error() const noexcept { return error_; }
+    constexpr std::size_t offset() const noexcept { return offset_; }
+
+private:
+    bytes payload_;
+    std::size_t offset_ = 0;
+    bool error_ = false;
+};
+
+/**
+ * Frame Writers
+ *
+ * Runtime writers take a destination span and return the bytes written
+ * (0 if it is too small). The make_* templates size their std::array at
+ * compile time, so fixed frames can be built once as constants.
+ * STREAM frames always carry LEN, and OFF whenever the offset is non-zero.
+ */
+
+constexpr std::size_t stream_frame_size(std::uint64_t stream_id, std::uint64_t offset, std::size_t data_len) noexcept {
+    return 1 + varint_size(stream_id) + (offset > 0 ? varint_size(offset) : 0) + varint_size(data_len) + data_len;
+}
+
+template <std::uint64_t StreamId, std::size_t DataLen, std::uint64_t Offset = 0>
+inline constexpr std::size_t stream_frame_size_v = stream_frame_size(StreamId, Offset, DataLen);
+
+template <std::size_t BodyLen>
+inline constexpr std::size_t vc_frame_size_v = 3 + BodyLen;
+
+constexpr std::size_t write_stream_frame(
+    mutable_bytes out, std::uint64_t stream_id, std::uint64_t offset, bytes data, bool fin = false
+) noexcept {
+    if (out.size() < stream_frame_size(stream_id, offset, data.size())) {
+        return 0;
+    }
+
+    std::uint8_t type = QUICVC_FRAME_STREAM | QUICVC_STREAM_LEN_BIT;
+    if (offset > 0) type |= QUICVC_STREAM_OFF_BIT;
+    if (fin) type |= QUICVC_STREAM_FIN_BIT;
+
+    std::size_t pos = 0;
+    out[pos++] = type;
+    pos += encode_varint(stream_id, out.subspan(pos));
+    if (offset > 0) {
+        pos += encode_varint(offset, out.subspan(pos));
+    }
+    pos += encode_varint(data.size(), out.subspan(pos));
+    for (std::size_t i = 0; i < data.size(); i++) {
+        out[pos++] = data[i];
+    }
+    return pos;
+}
+
+/**
+ * Write a QUIC-VC frame: [type][length(2)][body]
+ */
+constexpr std::size_t write_vc_frame(mutable_bytes out, std::uint8_t type, bytes body) noexcept {
+    if (body.size() > 0xFFFF || out.size() < 3 + body.size()) {
+        return 0;
+    }
+
+    out[0] = type;
+    out[1] = static_cast<std::uint8_t>(body.size() >> 8);
+    out[2] = static_cast<std::uint8_t>(body.size());
+    for (std::size_t i = 0; i < body.size(); i++) {
+        out[3 + i] = body[i];
+    }
+    return 3 + body.size();
+}
+
+template <std::uint64_t StreamId, std::uint64_t Offset = 0, std::size_t N>
+constexpr std::array<std::uint8_t, stream_frame_size_v<StreamId, N, Offset>>
+make_stream_frame(const std::array<std::uint8_t, N> &data, bool fin = false) noexcept {
+    std::array<std::uint8_t, stream_frame_size_v<StreamId, N, Offset>> out{};
+    write_stream_frame(mutable_bytes(out.data(), out.size()), StreamId, Offset,
+                       bytes(data.data(), data.size()), fin);
+    return out;
+}
+
+template <std::uint8_t Type, std::size_t N>
+constexpr std::array<std::uint8_t, vc_frame_size_v<N>>
+make_vc_frame(const std::array<std::uint8_t, N> &body) noexcept {
+    static_assert(N <= 0xFFFF, "QUIC-VC frame body is limited to a 16-bit length");
+    std::array<std::uint8_t, vc_frame_size_v<N>> out{};
+    write_vc_frame(mutable_bytes(out.data(), out.size()), Type, bytes(body.data(), body.size()));
+    return out;
+}
+
+} // namespace quicvc
+
+#endif /* QUICVC_PROTOCOL_HPP */
@@ -0,0 +1,54 @@
+/**
+ * QUIC-VC packet protection benchmark, shared by every target
+ *
+ * Seals and opens batches of same-sized packets through a backend and
+ * reports cycles per payload byte from the platform's cycle counter
+ * (CCOUNT on ESP32, the TSC on x86 hosts), so backends can be compared on
+ * one target and targets against each other.
+ */
+
+#ifndef QUICVC_AEAD_BENCH_H
+#define QUICVC_AEAD_BENCH_H
+
+#include "quicvc_protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint64_t (*quicvc_cycle_counter_fn)(void);
+
+typedef enum {
+    QUICVC_AEAD_BENCH_KEYED,        // One state per direction, keyed once
+    QUICVC_AEAD_BENCH_PER_PACKET,   // Create, seal or open, destroy for every
+                                    // packet: the cost before keyed contexts
+} quicvc_aead_bench_mode_t;
+
+typedef struct {
+    double seal_cycles_per_byte;    // Best round
+    double open_cycles_per_byte;
+} quicvc_aead_bench_result_t;
+
+/**
+ * Time 'rounds' rounds of sealing then opening 'batch' packets of
+ * 'payload_len' bytes (at most QUICVC_MAX_PACKET_SIZE with header and tag)
+ * behind an 11-byte short header. QUICVC_AEAD_BENCH_PER_PACKET keys a new
+ * state for each packet, so the two modes give the before and after of
+ * keeping contexts keyed per connection
+ * Returns false if the backend fails to create, seal or open
+ */
+bool quicvc_aead_bench(
+    const quicvc_aead_backend_t *backend,
+    quicvc_aead_bench_mode_t mode,
+    size_t payload_len,
+    size_t batch,
+    int rounds,
+    quicvc_cycle_counter_fn cycles,
+    quicvc_aead_bench_result_t *result
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // QUICVC_AEAD_BENCH_H
@@ -0,0 +1,227 @@
+/**
+ * QUIC-VC packet protection on mbedtls - software and ESP32 hardware backends
+ */
+
+#include "quicvc_aead_mbedtls.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "mbedtls/gcm.h"
+#include "mbedtls/sha256.h"
+
+#if defined(ESP_PLATFORM) && CONFIG_MBEDTLS_HARDWARE_AES
+#include "esp_heap_caps.h"
+#include "aes/esp_aes.h"
+#endif
+
+// One direction: the GCM context holds the expanded key and GHASH table,
+// so a packet only starts a new nonce
+typedef struct {
+    mbedtls_gcm_context gcm;
+    uint8_t iv[QUICVC_AEAD_NONCE_LENGTH];
+} quicvc_mbedtls_aead_t;
+
+int quicvc_mbedtls_aead_derive(const uint8_t *session_key, const char *sender,
+                               uint8_t *key, uint8_t *iv) {
+    static const char *const suffixes[2] = { "-send", "-iv" };
+    uint8_t digest[2][32];
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    int ret = 0;
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        ret = mbedtls_sha256_starts(&sha, 0);
+        if (ret == 0) ret = mbedtls_sha256_update(&sha, session_key, 32);
+        if (ret == 0) ret = mbedtls_sha256_update(&sha, (const uint8_t *)sender, strlen(sender));
+        if (ret == 0) ret = mbedtls_sha256_update(&sha, (const uint8_t *)suffixes[i], strlen(suffixes[i]));
+        if (ret == 0) ret = mbedtls_sha256_finish(&sha, digest[i]);
+    }
+    mbedtls_sha256_free(&sha);
+    if (ret == 0) {
+        memcpy(key, digest[0], QUICVC_AEAD_KEY_LENGTH);
+        memcpy(iv, digest[1], QUICVC_AEAD_NONCE_LENGTH);
+    }
+    memset(digest, 0, sizeof(digest));
+    return ret;
+}
+
+static bool quicvc_mbedtls_key(quicvc_mbedtls_aead_t *aead, const uint8_t *key, const uint8_t *iv) {
+    mbedtls_gcm_init(&aead->gcm);
+    memcpy(aead->iv, iv, QUICVC_AEAD_NONCE_LENGTH);
+    return mbedtls_gcm_setkey(&aead->gcm, MBEDTLS_CIPHER_ID_AES, key, QUICVC_AEAD_KEY_LENGTH * 8) == 0;
+}
+
+static void quicvc_mbedtls_wipe(quicvc_mbedtls_aead_t *aead) {
+    mbedtls_gcm_free(&aead->gcm);
+    memset(aead, 0, sizeof(*aead));
+}
+
+// Streaming API, so the plaintext can be gathered from an iovec and the
+// tag written right behind the ciphertext
+static bool quicvc_mbedtls_seal(quicvc_mbedtls_aead_t *aead, quicvc_aead_packet_t *p) {
+    quicvc_iovec_t in_place = { NULL, p->payload_len };
+    const quicvc_iovec_t *iov = p->iov;
+    size_t iov_count = p->iov_count;
+    if (!iov) {
+        in_place.iov_base = &p->packet[p->header_len];
+        iov = &in_place;
+        iov_count = 1;
+    }
+
+    size_t plain_len = 0;
+    for (size_t i = 0; i < iov_count; i++) {
+        plain_len += iov[i].iov_len;
+    }
+    if (p->header_len > p->packet_size ||
+        plain_len + QUICVC_AEAD_TAG_LENGTH > p->packet_size - p->header_len) {
+        return false;
+    }
+
+    uint8_t nonce[QUICVC_AEAD_NONCE_LENGTH];
+    quicvc_aead_nonce(aead->iv, p->packet_number, nonce);
+
+    int ret = mbedtls_gcm_starts(&aead->gcm, MBEDTLS_GCM_ENCRYPT, nonce, sizeof(nonce));
+    if (ret == 0) {
+        ret = mbedtls_gcm_update_ad(&aead->gcm, p->packet, p->header_len);
+    }
+    size_t offset = p->header_len;
+    for (size_t i = 0; ret == 0 && i < iov_count; i++) {
+        size_t olen;
+        ret = mbedtls_gcm_update(&aead->gcm, iov[i].iov_base, iov[i].iov_len,
+                                 &p->packet[offset], p->packet_size - offset, &olen);
+        offset += olen;
+    }
+    if (ret == 0) {
+        size_t olen;
+        ret = mbedtls_gcm_finish(&aead->gcm, &p->packet[offset], p->packet_size - offset, &olen,
+                                 &p->packet[p->header_len + plain_len], QUICVC_AEAD_TAG_LENGTH);
+    }
+    if (ret != 0) {
+        return false;
+    }
+
+    p->payload_len = plain_len;
+    p->packet_len = p->header_len + plain_len + QUICVC_AEAD_TAG_LENGTH;
+    return true;
+}
+
+static bool quicvc_mbedtls_open(quicvc_mbedtls_aead_t *aead, quicvc_aead_packet_t *p) {
+    if (p->header_len > p->packet_len || p->packet_len - p->header_len < QUICVC_AEAD_TAG_LENGTH) {
+        return false;
+    }
+    size_t data_len = p->packet_len - p->header_len - QUICVC_AEAD_TAG_LENGTH;
+    uint8_t *payload = &p->packet[p->header_len];
+
+    uint8_t nonce[QUICVC_AEAD_NONCE_LENGTH];
+    quicvc_aead_nonce(aead->iv, p->packet_number, nonce);
+
+    if (mbedtls_gcm_auth_decrypt(&aead->gcm, data_len, nonce, sizeof(nonce),
+                                 p->packet, p->header_len,
+                                 &payload[data_len], QUICVC_AEAD_TAG_LENGTH,
+                                 payload, payload) != 0) {
+        return false;
+    }
+
+    p->payload_len = data_len;
+    return true;
+}
+
+static size_t quicvc_mbedtls_seal_batch(void *state, quicvc_aead_packet_t *packets, size_t count) {
+    size_t sealed = 0;
+    for (size_t i = 0; i < count; i++) {
+        packets[i].ok = quicvc_mbedtls_seal(state, &packets[i]);
+        sealed += packets[i].ok;
+    }
+    return sealed;
+}
+
+static size_t quicvc_mbedtls_open_batch(void *state, quicvc_aead_packet_t *packets, size_t count) {
+    size_t opened = 0;
+    for (size_t i = 0; i < count; i++) {
+        packets[i].ok = quicvc_mbedtls_open(state, &packets[i]);
+        opened += packets[i].ok;
+    }
+    return opened;
+}
+
+static void *quicvc_mbedtls_create(const uint8_t *key, const uint8_t *iv) {
+    quicvc_mbedtls_aead_t *aead = calloc(1, sizeof(*aead));
+    if (aead && !quicvc_mbedtls_key(aead, key, iv)) {
+        quicvc_mbedtls_wipe(aead);
+        free(aead);
+        aead = NULL;
+    }
+    return aead;
+}
+
+static void quicvc_mbedtls_destroy(void *state) {
+    if (state) {
+        quicvc_mbedtls_wipe(state);
+        free(state);
+    }
+}
+
+const quicvc_aead_backend_t quicvc_aead_mbedtls = {
+    .name = "mbedtls",
+    .create = quicvc_mbedtls_create,
+    .destroy = quicvc_mbedtls_destroy,
+    .seal_batch = quicvc_mbedtls_seal_batch,
+    .open_batch = quicvc_mbedtls_open_batch,
+};
+
+#if defined(ESP_PLATFORM) && CONFIG_MBEDTLS_HARDWARE_AES
+
+/**
+ * ESP32 AES peripheral
+ *
+ * The state lives in DMA-capable memory for the AES DMA engines. A batch
+ * holds the peripheral from the first packet to the last: the port still
+ * takes its (recursive) lock around each block, but inside a batch that
+ * is a re-entry rather than a contended acquire and module enable, and no
+ * other task's key is loaded into the peripheral between packets.
+ */
+
+static void *quicvc_esp32_hw_create(const uint8_t *key, const uint8_t *iv) {
+    quicvc_mbedtls_aead_t *aead = heap_caps_aligned_alloc(16, sizeof(*aead),
+                                                          MALLOC_CAP_DMA | MALLOC_CAP_8BIT);
+    if (!aead) {
+        return NULL;
+    }
+    memset(aead, 0, sizeof(*aead));
+    if (!quicvc_mbedtls_key(aead, key, iv)) {
+        quicvc_mbedtls_wipe(aead);
+        heap_caps_free(aead);
+        return NULL;
+    }
+    return aead;
+}
+
+static void quicvc_esp32_hw_destroy(void *state) {
+    if (state) {
+        quicvc_mbedtls_wipe(state);
+        heap_caps_free(state);
+    }
+}
+
+static size_t quicvc_esp32_hw_seal_batch(void *state, quicvc_aead_packet_t *packets, size_t count) {
+    esp_aes_acquire_hardware();
+    size_t sealed = quicvc_mbedtls_seal_batch(state, packets, count);
+    esp_aes_release_hardware();
+    return sealed;
+}
+
+static size_t quicvc_esp32_hw_open_batch(void *state, quicvc_aead_packet_t *packets, size_t count) {
+    esp_aes_acquire_hardware();
+    size_t opened = quicvc_mbedtls_open_batch(state, packets, count);
+    esp_aes_release_hardware();
+    return opened;
+}
+
+const quicvc_aead_backend_t quicvc_aead_esp32_hw = {
+    .name = "esp32-hw",
+    .create = quicvc_esp32_hw_create,
+    .destroy = quicvc_esp32_hw_destroy,
+    .seal_batch = quicvc_esp32_hw_seal_batch,
+    .open_batch = quicvc_esp32_hw_open_batch,
+};
+
+#endif // ESP_PLATFORM && CONFIG_MBEDTLS_HARDWARE_AES
@@ -0,0 +1,47 @@
+/**
+ * QUIC-VC packet protection on mbedtls (3.x)
+ *
+ * Two backends share one implementation:
+ *   quicvc_aead_mbedtls    - plain mbedtls GCM; software AES on hosts
+ *                            (AES-NI when mbedtls is built with it), or
+ *                            whatever AES the ESP-IDF port is configured for
+ *   quicvc_aead_esp32_hw   - ESP-IDF with CONFIG_MBEDTLS_HARDWARE_AES: state
+ *                            in DMA-capable memory and the AES peripheral
+ *                            held for a whole batch
+ *
+ * Both are keyed with quicvc_mbedtls_aead_derive, the schedule documented
+ * at quicvc_aead_backend_t.
+ */
+
+#ifndef QUICVC_AEAD_MBEDTLS_H
+#define QUICVC_AEAD_MBEDTLS_H
+
+#include "quicvc_protocol.h"
+
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern const quicvc_aead_backend_t quicvc_aead_mbedtls;
+
+#if defined(ESP_PLATFORM) && CONFIG_MBEDTLS_HARDWARE_AES
+extern const quicvc_aead_backend_t quicvc_aead_esp32_hw;
+#endif
+
+/**
+ * Derive one direction's key and IV from the session key; 'sender' is
+ * "server" or "client"
+ * Returns 0, or the mbedtls error code
+ */
+int quicvc_mbedtls_aead_derive(const uint8_t *session_key, const char *sender,
+                               uint8_t *key, uint8_t *iv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // QUICVC_AEAD_MBEDTLS_H
@@ -0,0 +1,1356 @@
+/**
+ * QUIC-VC gateway for Linux hosts - epoll, recvmmsg and sendmmsg, with
+ * UDP GSO/GRO where the kernel has them
+ */
+
+#define _GNU_SOURCE
+
+#include "quicvc_gateway.h"
+#include "quicvc_aead_host.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/udp.h>
+#include <sys/epoll.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <openssl/evp.h>
+
+// Linux 4.18 (GSO) and 5.0 (GRO); older headers lack the names
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+#define QUICVC_GATEWAY_CID_LEN       QUICVC_DEFAULT_CONNECTION_ID_LENGTH
+#define QUICVC_GATEWAY_TICK_US       1000
+#define QUICVC_GATEWAY_DATAGRAM_SIZE 1500   // Receive buffers: a full Ethernet frame
+#define QUICVC_GATEWAY_RX_ROUNDS     8      // recvmmsg calls per wakeup before timers run
+#define QUICVC_GATEWAY_TX_DATAGRAMS  (4 * QUICVC_GATEWAY_BATCH)  // Send arena; GSO packs several per message
+#define QUICVC_GATEWAY_GSO_SEGMENTS  64     // UDP_MAX_SEGMENTS before Linux 6.9
+#define QUICVC_GATEWAY_GSO_BYTES     (65535 - 20 - 8)   // IPv4 UDP payload limit
+#define QUICVC_GATEWAY_GRO_SIZE      65535  // Receive buffers with GRO: one coalesced run
+#define QUICVC_GATEWAY_MAX_TOKEN     64
+#define QUICVC_GATEWAY_CHALLENGE_LEN 32     // Hex digits
+#define QUICVC_GATEWAY_SOCKET_BUFFER (4 * 1024 * 1024)
+#define QUICVC_GATEWAY_SERVICE_DISCOVERY 1  // First byte of a presence broadcast
+
+#define QUICVC_GATEWAY_QUIC_SOCKET      0   // epoll_event data
+#define QUICVC_GATEWAY_DISCOVERY_SOCKET 1
+
+typedef enum {
+    DEVICE_FREE = 0,
+    DEVICE_CONNECTING,          // INITIAL sent
+    DEVICE_RESUMING,            // 0-RTT packet sent
+    DEVICE_ESTABLISHED,
+} quicvc_gateway_device_state_t;
+
+typedef struct {
+    quicvc_gateway_t *gateway;
+    quicvc_gateway_device_state_t state;
+    uint32_t generation;        // Bumped on release; events check it afterwards
+    struct sockaddr_in addr;
+    uint8_t scid[QUICVC_GATEWAY_CID_LEN];               // Ours, the DCID of every packet it sends
+    uint8_t dcid[QUICVC_MAX_CONNECTION_ID_LENGTH];      // Random, or the Retry's SCID, until
+    uint8_t dcid_len;                                   // the HANDSHAKE names the device's CID
+    uint8_t token[QUICVC_GATEWAY_MAX_TOKEN];
+    size_t token_len;
+    bool retried;
+    char challenge[QUICVC_GATEWAY_CHALLENGE_LEN + 1];
+    uint8_t key_private[QUICVC_KEY_SHARE_LENGTH];   // Our X25519 key share, until the HANDSHAKE
+    char key_public[2 * QUICVC_KEY_SHARE_LENGTH + 1];
+    uint8_t session_key[32];
+    void *aead_send;            // quicvc_aead_openssl states, once keyed
+    void *aead_recv;
+    uint8_t early_data[QUICVC_GATEWAY_MAX_EARLY_DATA];  // The 0-RTT command, resent after a fallback
+    size_t early_len;
+    uint64_t early_stream;
+    unsigned attempts;          // INITIALs sent
+    uint64_t started_ns;
+    uint64_t packet_number;
+    uint64_t largest_acked;     // QUICVC_PACKET_NUMBER_NONE until the device ACKs
+    quicvc_ack_tracker_t ack_tracker;
+    uint64_t largest_received_us;
+    quicvc_packet_builder_t tx;
+    bool dirty;                 // On the dirty list: frames or an ACK to flush
+    bool ack_pending;           // Written at flush, so one ACK covers a whole batch of receives
+    quicvc_timer_t handshake_timer;
+    quicvc_timer_t idle_timer;
+} quicvc_gateway_device_t;
+
+// A device's VC_TICKET, kept past its connection for quicvc_gateway_resume
+typedef struct {
+    struct sockaddr_in addr;
+    uint8_t id[QUICVC_TICKET_ID_LENGTH];
+    uint8_t resumption[32];
+    uint64_t expires_us;        // 0: free
+} quicvc_gateway_ticket_t;
+
+struct quicvc_gateway {
+    quicvc_gateway_config_t config;
+    int epoll_fd;
+    int quic_fd;
+    int discovery_fd;
+    uint16_t local_port;
+
+    quicvc_gateway_device_t *devices;
+    quicvc_conn_entry_t *entries;
+    uint16_t *index;
+    quicvc_conn_table_t table;
+    quicvc_gateway_ticket_t *tickets;   // max_devices of them
+    uint16_t *dirty;            // Devices with something to flush
+    size_t dirty_count;
+    size_t established;
+    quicvc_timer_wheel_t timers;
+
+    // VC_INIT up to the key share, built once
+    char *vc_init_prefix;
+    size_t vc_init_prefix_len;
+
+    uint8_t random[256];        // getrandom() pool for CIDs and challenges
+    size_t random_left;
+
+    bool gso;                   // UDP_SEGMENT works on quic_fd
+    bool gro;                   // UDP_GRO is on: a receive may hold a run of datagrams
+
+    struct mmsghdr rx_msgs[QUICVC_GATEWAY_BATCH];
+    struct iovec rx_iov[QUICVC_GATEWAY_BATCH];
+    struct sockaddr_in rx_addr[QUICVC_GATEWAY_BATCH];
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } rx_control[QUICVC_GATEWAY_BATCH];
+    uint8_t *rx_buf;            // 'batch' buffers of rx_size bytes
+    size_t rx_size;
+
+    // Datagrams are packed back to back in tx_arena, so a run of them to
+    // one device is already the contiguous buffer UDP_SEGMENT wants: the
+    // message covering it just grows. Each message is one datagram, or
+    // with GSO a run of equal-sized ones whose last may be shorter.
+    struct mmsghdr tx_msgs[QUICVC_GATEWAY_BATCH];
+    struct iovec tx_iov[QUICVC_GATEWAY_BATCH];
+    struct sockaddr_in tx_addr[QUICVC_GATEWAY_BATCH];
+    union {
+        char buf[CMSG_SPACE(sizeof(uint16_t))];
+        struct cmsghdr align;
+    } tx_control[QUICVC_GATEWAY_BATCH];
+    uint16_t tx_segment_size[QUICVC_GATEWAY_BATCH];
+    uint16_t tx_segments[QUICVC_GATEWAY_BATCH];
+    size_t tx_count;            // Messages
+    uint8_t tx_arena[QUICVC_GATEWAY_TX_DATAGRAMS * QUICVC_MAX_PACKET_SIZE];
+    size_t tx_used;
+
+    quicvc_gateway_stats_t stats;
+};
+
+// RFC 9001 Section 5.8 Retry integrity key and nonce
+static const uint8_t retry_integrity_key[16] = {
+    0xbe, 0x0c, 0x69, 0x0b, 0x9f, 0x66, 0x57, 0x5a,
+    0x1d, 0x76, 0x6b, 0x54, 0xe3, 0x68, 0xc8, 0x4e,
+};
+static const uint8_t retry_integrity_nonce[12] = {
+    0x46, 0x15, 0x99, 0xd3, 0x5d, 0x63, 0x2b, 0xf2, 0x23, 0x98, 0x25, 0xbb,
+};
+
+static uint64_t quicvc_gateway_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t quicvc_gateway_now_us(void) {
+    return quicvc_gateway_now_ns() / 1000;
+}
+
+static void quicvc_gateway_random(quicvc_gateway_t *gw, uint8_t *out, size_t len) {
+    while (len > 0) {
+        if (gw->random_left == 0) {
+            ssize_t got = getrandom(gw->random, sizeof(gw->random), 0);
+            gw->random_left = got > 0 ? (size_t)got : 0;
+            continue;
+        }
+        size_t n = len < gw->random_left ? len : gw->random_left;
+        memcpy(out, &gw->random[sizeof(gw->random) - gw->random_left], n);
+        memset(&gw->random[sizeof(gw->random) - gw->random_left], 0, n);
+        gw->random_left -= n;
+        out += n;
+        len -= n;
+    }
+}
+
+static bool quicvc_gateway_same_addr(const struct sockaddr_in *a, const struct sockaddr_in *b) {
+    return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+// 'len' bytes from the 2 * len hex digits at the start of 'hex'
+static bool quicvc_gateway_unhex(const uint8_t *hex, size_t hex_len, uint8_t *out, size_t len) {
+    if (hex_len < 2 * len) {
+        return false;
+    }
+    for (size_t i = 0; i < 2 * len; i++) {
+        uint8_t c = hex[i];
+        uint8_t nibble = c >= '0' && c <= '9' ? c - '0'
+                       : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                       : c >= 'A' && c <= 'F' ? c - 'A' + 10 : 0xff;
+        if (nibble == 0xff) {
+            return false;
+        }
+        out[i / 2] = (uint8_t)(i % 2 ? out[i / 2] | nibble : nibble << 4);
+    }
+    return true;
+}
+
+static void quicvc_gateway_emit(quicvc_gateway_t *gw, const quicvc_gateway_event_t *event) {
+    if (gw->config.on_event) {
+        gw->config.on_event(gw, event, gw->config.ctx);
+    }
+}
+
+// Keys
+
+// 1-RTT packet protection from the session key; we send as "client"
+static bool quicvc_gateway_key(quicvc_gateway_device_t *d) {
+    uint8_t key[QUICVC_AEAD_KEY_LENGTH];
+    uint8_t iv[QUICVC_AEAD_NONCE_LENGTH];
+    bool ok = quicvc_host_aead_derive(d->session_key, "client", key, iv) &&
+              (d->aead_send = quicvc_aead_openssl.create(key, iv)) != NULL &&
+              quicvc_host_aead_derive(d->session_key, "server", key, iv) &&
+              (d->aead_recv = quicvc_aead_openssl.create(key, iv)) != NULL;
+    memset(key, 0, sizeof(key));
+    memset(iv, 0, sizeof(iv));
+    if (!ok) {
+        quicvc_aead_openssl.destroy(d->aead_send);
+        quicvc_aead_openssl.destroy(d->aead_recv);
+        d->aead_send = d->aead_recv = NULL;
+    }
+    return ok;
+}
+
+static void quicvc_gateway_unkey(quicvc_gateway_device_t *d) {
+    quicvc_aead_openssl.destroy(d->aead_send);
+    quicvc_aead_openssl.destroy(d->aead_recv);
+    d->aead_send = d->aead_recv = NULL;
+    memset(d->session_key, 0, sizeof(d->session_key));
+    memset(d->key_private, 0, sizeof(d->key_private));
+}
+
+// Fresh key share and challenge for a full handshake
+static bool quicvc_gateway_key_share(quicvc_gateway_t *gw, quicvc_gateway_device_t *d) {
+    uint8_t public_key[QUICVC_KEY_SHARE_LENGTH];
+    if (!quicvc_host_key_share(d->key_private, public_key)) {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(public_key); i++) {
+        snprintf(&d->key_public[2 * i], 3, "%02x", public_key[i]);
+    }
+    uint8_t challenge[QUICVC_GATEWAY_CHALLENGE_LEN / 2];
+    quicvc_gateway_random(gw, challenge, sizeof(challenge));
+    for (size_t i = 0; i < sizeof(challenge); i++) {
+        snprintf(&d->challenge[2 * i], 3, "%02x", challenge[i]);
+    }
+    return true;
+}
+
+// Open a packet in place, the header as AAD; false if it does not authenticate
+static bool quicvc_gateway_open(void *aead, uint8_t *packet, const quicvc_header_t *hdr,
+                                uint64_t packet_number, size_t *payload_len) {
+    size_t header_len = (size_t)(hdr->payload - packet);
+    quicvc_aead_packet_t p = {
+        .packet = packet,
+        .header_len = header_len,
+        .packet_len = header_len + hdr->payload_len,
+        .packet_number = packet_number,
+    };
+    if (quicvc_aead_openssl.open_batch(aead, &p, 1) != 1) {
+        return false;
+    }
+    *payload_len = p.payload_len;
+    return true;
+}
+
+// Send Path
+
+// A GSO message the kernel will not take (no checksum offload on the
+// route, or a kernel that only knows the option's name): stop using
+// GSO and send its datagrams one by one
+static void quicvc_gateway_send_segments(quicvc_gateway_t *gw, size_t msg) {
+    const uint8_t *data = gw->tx_iov[msg].iov_base;
+    size_t left = gw->tx_iov[msg].iov_len;
+    gw->gso = false;
+    while (left > 0) {
+        size_t len = left < gw->tx_segment_size[msg] ? left : gw->tx_segment_size[msg];
+        gw->stats.send_calls++;
+        if (sendto(gw->quic_fd, data, len, 0, (const struct sockaddr *)&gw->tx_addr[msg],
+                   sizeof(gw->tx_addr[msg])) < 0) {
+            gw->stats.send_errors++;
+        } else {
+            gw->stats.datagrams_sent++;
+            gw->stats.bytes_sent += len;
+        }
+        data += len;
+        left -= len;
+    }
+}
+
+static void quicvc_gateway_send_batch(quicvc_gateway_t *gw) {
+    for (size_t i = 0; i < gw->tx_count; i++) {
+        struct msghdr *hdr = &gw->tx_msgs[i].msg_hdr;
+        if (gw->tx_segments[i] > 1) {
+            struct cmsghdr *cmsg = &gw->tx_control[i].align;
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            memcpy(CMSG_DATA(cmsg), &gw->tx_segment_size[i], sizeof(uint16_t));
+            hdr->msg_control = gw->tx_control[i].buf;
+            hdr->msg_controllen = sizeof(gw->tx_control[i].buf);
+        } else {
+            hdr->msg_control = NULL;
+            hdr->msg_controllen = 0;
+        }
+    }
+
+    size_t sent = 0;
+    while (sent < gw->tx_count) {
+        int n = sendmmsg(gw->quic_fd, &gw->tx_msgs[sent], (unsigned)(gw->tx_count - sent), 0);
+        gw->stats.send_calls++;
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (gw->tx_segments[sent] > 1 && (errno == EIO || errno == EINVAL)) {
+                quicvc_gateway_send_segments(gw, sent++);
+                continue;
+            }
+            // ICMP errors from earlier datagrams surface here; skip the
+            // message that failed and carry on with the rest
+            gw->stats.send_errors += gw->tx_segments[sent];
+            sent++;
+            continue;
+        }
+        for (int i = 0; i < n; i++) {
+            size_t msg = sent + (size_t)i;
+            gw->stats.bytes_sent += gw->tx_msgs[msg].msg_len;
+            gw->stats.datagrams_sent += gw->tx_segments[msg];
+            if (gw->tx_segments[msg] > 1) {
+                gw->stats.gso_datagrams += gw->tx_segments[msg];
+            }
+        }
+        sent += (size_t)n;
+    }
+    gw->tx_count = 0;
+    gw->tx_used = 0;
+}
+
+// Next free send buffer; sends the batch when the arena is full
+static uint8_t *quicvc_gateway_datagram(quicvc_gateway_t *gw) {
+    if (gw->tx_used + QUICVC_MAX_PACKET_SIZE > sizeof(gw->tx_arena)) {
+        quicvc_gateway_send_batch(gw);
+    }
+    return &gw->tx_arena[gw->tx_used];
+}
+
+// Queue the 'len' bytes written at the buffer from quicvc_gateway_datagram.
+// With GSO, a datagram that follows one to the same address joins its
+// message while the run keeps one segment size.
+static void quicvc_gateway_commit(quicvc_gateway_t *gw, const struct sockaddr_in *addr, size_t len) {
+    uint8_t *datagram = &gw->tx_arena[gw->tx_used];
+    if (gw->gso && gw->tx_count > 0) {
+        size_t last = gw->tx_count - 1;
+        struct iovec *iov = &gw->tx_iov[last];
+        size_t segment = gw->tx_segment_size[last];
+        if (gw->tx_addr[last].sin_addr.s_addr == addr->sin_addr.s_addr &&
+            gw->tx_addr[last].sin_port == addr->sin_port &&
+            iov->iov_len % segment == 0 && len <= segment &&
+            iov->iov_len + len <= QUICVC_GATEWAY_GSO_BYTES &&
+            gw->tx_segments[last] < QUICVC_GATEWAY_GSO_SEGMENTS) {
+            iov->iov_len += len;
+            gw->tx_segments[last]++;
+            gw->tx_used += len;
+            return;
+        }
+    }
+    if (gw->tx_count == gw->config.batch) {
+        // Every message is taken: send them, then move this datagram to
+        // the front of the emptied arena
+        quicvc_gateway_send_batch(gw);
+        memmove(gw->tx_arena, datagram, len);
+        datagram = gw->tx_arena;
+    }
+    size_t msg = gw->tx_count++;
+    gw->tx_addr[msg] = *addr;
+    gw->tx_iov[msg] = (struct iovec){ datagram, len };
+    gw->tx_segment_size[msg] = (uint16_t)len;
+    gw->tx_segments[msg] = 1;
+    gw->tx_used += len;
+}
+
+static void quicvc_gateway_mark_dirty(quicvc_gateway_device_t *d) {
+    if (!d->dirty) {
+        d->dirty = true;
+        d->gateway->dirty[d->gateway->dirty_count++] = (uint16_t)(d - d->gateway->devices);
+    }
+}
+
+// Packet builder flush callback: one short header packet
+static void quicvc_gateway_send_packet(const uint8_t *payload, size_t payload_len, void *ctx) {
+    quicvc_gateway_device_t *d = ctx;
+    quicvc_gateway_t *gw = d->gateway;
+    uint8_t *packet = quicvc_gateway_datagram(gw);
+
+    quicvc_header_t hdr = {
+        .dcid = d->dcid,
+        .dcid_len = d->dcid_len,
+        .packet_number = d->packet_number++,
+    };
+    hdr.packet_number_len = quicvc_packet_number_length(hdr.packet_number, d->largest_acked);
+    quicvc_iovec_t plaintext = { payload, payload_len };
+    quicvc_aead_packet_t sealed = {
+        .packet = packet,
+        .header_len = quicvc_write_short_header(&hdr, packet, QUICVC_MAX_PACKET_SIZE),
+        .packet_size = QUICVC_MAX_PACKET_SIZE,
+        .iov = &plaintext,
+        .iov_count = 1,
+        .packet_number = hdr.packet_number,
+    };
+    if (sealed.header_len > 0 && quicvc_aead_openssl.seal_batch(d->aead_send, &sealed, 1) == 1) {
+        quicvc_gateway_commit(gw, &d->addr, sealed.packet_len);
+    }
+}
+
+static void quicvc_gateway_send_initial(quicvc_gateway_t *gw, quicvc_gateway_device_t *d) {
+    // {"type":"VC_INIT","credential":{...},"key":"<hex>","challenge":"<hex>"}
+    static const char challenge_key[] = "\",\"challenge\":\"";
+    size_t json_len = gw->vc_init_prefix_len + 2 * QUICVC_KEY_SHARE_LENGTH +
+                      sizeof(challenge_key) - 1 + QUICVC_GATEWAY_CHALLENGE_LEN + 2;
+    uint8_t *packet = quicvc_gateway_datagram(gw);
+    quicvc_header_t hdr = {
+        .packet_type = QUICVC_PACKET_TYPE_INITIAL,
+        .version = QUICVC_VERSION,
+        .dcid = d->dcid,
+        .dcid_len = d->dcid_len,
+        .scid = d->scid,
+        .scid_len = QUICVC_GATEWAY_CID_LEN,
+        .token = d->token_len > 0 ? d->token : NULL,
+        .token_len = d->token_len,
+        .packet_number = d->packet_number++,
+    };
+    hdr.packet_number_len = quicvc_packet_number_length(hdr.packet_number, QUICVC_PACKET_NUMBER_NONE);
+    size_t offset = quicvc_write_long_header(&hdr, json_len, packet, QUICVC_MAX_PACKET_SIZE);
+    if (offset == 0 || json_len > QUICVC_MAX_PACKET_SIZE - offset) {
+        return;
+    }
+    memcpy(&packet[offset], gw->vc_init_prefix, gw->vc_init_prefix_len);
+    offset += gw->vc_init_prefix_len;
+    memcpy(&packet[offset], d->key_public, 2 * QUICVC_KEY_SHARE_LENGTH);
+    offset += 2 * QUICVC_KEY_SHARE_LENGTH;
+    memcpy(&packet[offset], challenge_key, sizeof(challenge_key) - 1);
+    offset += sizeof(challenge_key) - 1;
+    memcpy(&packet[offset], d->challenge, QUICVC_GATEWAY_CHALLENGE_LEN);
+    offset += QUICVC_GATEWAY_CHALLENGE_LEN;
+    packet[offset++] = '"';
+    packet[offset++] = '}';
+    quicvc_gateway_commit(gw, &d->addr, offset);
+    d->attempts++;
+}
+
+void quicvc_gateway_flush(quicvc_gateway_t *gw) {
+    uint64_t now = gw->dirty_count > 0 ? quicvc_gateway_now_us() : 0;
+    for (size_t i = 0; i < gw->dirty_count; i++) {
+        quicvc_gateway_device_t *d = &gw->devices[gw->dirty[i]];
+        d->dirty = false;
+        if (d->state == DEVICE_ESTABLISHED) {
+            if (d->ack_pending) {
+                d->ack_pending = false;
+                quicvc_packet_builder_add_ack(&d->tx, &d->ack_tracker, now - d->largest_received_us, 0);
+            }
+            quicvc_packet_builder_flush(&d->tx);
+        }
+    }
+    gw->dirty_count = 0;
+    if (gw->tx_count > 0) {
+        quicvc_gateway_send_batch(gw);
+    }
+}
+
+// Connections
+
+// Free a device's slot and report why. The dirty flag survives: the slot
+// may still be on the dirty list, which skips it while it is not
+// established.
+static void quicvc_gateway_release(quicvc_gateway_t *gw, quicvc_gateway_device_t *d,
+                                   quicvc_gateway_close_reason_t reason) {
+    int device = (int)(d - gw->devices);
+    struct sockaddr_in addr = d->addr;
+    if (d->state == DEVICE_ESTABLISHED) {
+        gw->established--;
+    }
+    quicvc_timer_cancel(&gw->timers, &d->handshake_timer);
+    quicvc_timer_cancel(&gw->timers, &d->idle_timer);
+    quicvc_conn_table_remove(&gw->table, (uint16_t)device);
+    quicvc_gateway_unkey(d);
+    d->state = DEVICE_FREE;
+    d->generation++;
+
+    quicvc_gateway_event_t event = {
+        .type = QUICVC_GATEWAY_CLOSED,
+        .device = device,
+        .addr = &addr,
+        .reason = reason,
+    };
+    quicvc_gateway_emit(gw, &event);
+}
+
+// No HANDSHAKE for the 0-RTT packet: start over with a full handshake
+// under fresh keys, on the same slot and CID
+static void quicvc_gateway_fall_back(quicvc_gateway_t *gw, quicvc_gateway_device_t *d) {
+    quicvc_gateway_unkey(d);
+    if (!quicvc_gateway_key_share(gw, d)) {
+        quicvc_gateway_release(gw, d, QUICVC_GATEWAY_HANDSHAKE_TIMEOUT);
+        return;
+    }
+    d->state = DEVICE_CONNECTING;
+    d->dcid_len = QUICVC_GATEWAY_CID_LEN;
+    quicvc_gateway_random(gw, d->dcid, d->dcid_len);
+    gw->stats.resumption_fallbacks++;
+    quicvc_gateway_send_initial(gw, d);
+    quicvc_timer_schedule(&gw->timers, &d->handshake_timer,
+                          quicvc_gateway_now_us() + gw->config.handshake_timeout_us);
+}
+
+static void quicvc_gateway_handshake_timeout(quicvc_timer_t *timer, void *ctx) {
+    quicvc_gateway_device_t *d = ctx;
+    quicvc_gateway_t *gw = d->gateway;
+    if (d->state == DEVICE_RESUMING) {
+        quicvc_gateway_fall_back(gw, d);
+        return;
+    }
+    if (d->attempts >= gw->config.handshake_attempts) {
+        quicvc_gateway_release(gw, d, QUICVC_GATEWAY_HANDSHAKE_TIMEOUT);
+        return;
+    }
+    quicvc_gateway_send_initial(gw, d);
+    gw->stats.handshake_retransmits++;
+    quicvc_timer_schedule(&gw->timers, timer, quicvc_gateway_now_us() +
+                          (gw->config.handshake_timeout_us << (d->attempts - 1)));
+}
+
+static void quicvc_gateway_idle_timeout(quicvc_timer_t *timer, void *ctx) {
+    quicvc_gateway_device_t *d = ctx;
+    (void)timer;
+    quicvc_gateway_release(d->gateway, d, QUICVC_GATEWAY_IDLE_TIMEOUT);
+}
+
+// A slot and a fresh CID of ours for a new connection to 'addr'; NULL if
+// every slot is taken
+static quicvc_gateway_device_t *quicvc_gateway_new_device(quicvc_gateway_t *gw,
+                                                          const struct sockaddr_in *addr) {
+    if (gw->table.count >= gw->config.max_devices) {
+        return NULL;
+    }
+    uint8_t scid[QUICVC_GATEWAY_CID_LEN];
+    do {
+        quicvc_gateway_random(gw, scid, sizeof(scid));
+    } while (quicvc_conn_table_find(&gw->table, scid, sizeof(scid)) != QUICVC_CONN_NONE);
+    uint16_t evicted;
+    uint16_t slot = quicvc_conn_table_insert(&gw->table, scid, sizeof(scid), &evicted);
+    if (slot == QUICVC_CONN_NONE) {
+        return NULL;
+    }
+
+    quicvc_gateway_device_t *d = &gw->devices[slot];
+    uint32_t generation = d->generation;
+    bool dirty = d->dirty;
+    memset(d, 0, sizeof(*d));
+    d->gateway = gw;
+    d->generation = generation;
+    d->dirty = dirty;
+    d->addr = *addr;
+    memcpy(d->scid, scid, sizeof(scid));
+    d->largest_acked = QUICVC_PACKET_NUMBER_NONE;
+    quicvc_ack_tracker_init(&d->ack_tracker);
+    quicvc_packet_builder_init(&d->tx,
+                               QUICVC_MAX_PACKET_SIZE - QUICVC_MAX_SHORT_HEADER_SIZE - QUICVC_AEAD_TAG_LENGTH,
+                               0, quicvc_gateway_send_packet, d);
+    quicvc_timer_init(&d->handshake_timer, quicvc_gateway_handshake_timeout, d);
+    quicvc_timer_init(&d->idle_timer, quicvc_gateway_idle_timeout, d);
+    d->started_ns = quicvc_gateway_now_ns();
+    return d;
+}
+
+// Give back a slot whose handle the caller never got
+static void quicvc_gateway_abandon(quicvc_gateway_t *gw, quicvc_gateway_device_t *d) {
+    quicvc_gateway_unkey(d);
+    quicvc_conn_table_remove(&gw->table, (uint16_t)(d - gw->devices));
+    d->state = DEVICE_FREE;
+}
+
+int quicvc_gateway_connect(quicvc_gateway_t *gw, const struct sockaddr_in *addr) {
+    quicvc_gateway_device_t *d = quicvc_gateway_new_device(gw, addr);
+    if (!d) {
+        return QUICVC_GATEWAY_NONE;
+    }
+    if (!quicvc_gateway_key_share(gw, d)) {
+        quicvc_gateway_abandon(gw, d);
+        return QUICVC_GATEWAY_NONE;
+    }
+    d->state = DEVICE_CONNECTING;
+    d->dcid_len = QUICVC_GATEWAY_CID_LEN;
+    quicvc_gateway_random(gw, d->dcid, d->dcid_len);
+    quicvc_gateway_send_initial(gw, d);
+    quicvc_timer_schedule(&gw->timers, &d->handshake_timer,
+                          d->started_ns / 1000 + gw->config.handshake_timeout_us);
+    return (int)(d - gw->devices);
+}
+
+// The 0-RTT packet: DCID the ticket ID, one STREAM frame sealed under
+// the ticket's 0-RTT key
+static bool quicvc_gateway_send_zero_rtt(quicvc_gateway_t *gw, quicvc_gateway_device_t *d,
+                                         const quicvc_gateway_ticket_t *ticket) {
+    uint8_t key[32];
+    uint8_t iv[32];
+    void *aead = NULL;
+    bool ok = quicvc_host_derive(ticket->resumption, "quicvc 0rtt key", NULL, 0, key) &&
+              quicvc_host_derive(ticket->resumption, "quicvc 0rtt iv", NULL, 0, iv) &&
+              (aead = quicvc_aead_openssl.create(key, iv)) != NULL;
+    memset(key, 0, sizeof(key));
+    memset(iv, 0, sizeof(iv));
+
+    uint8_t *packet = quicvc_gateway_datagram(gw);
+    quicvc_header_t hdr = {
+        .packet_type = QUICVC_PACKET_TYPE_ZERO_RTT,
+        .version = QUICVC_VERSION,
+        .dcid = ticket->id,
+        .dcid_len = QUICVC_TICKET_ID_LENGTH,
+        .scid = d->scid,
+        .scid_len = QUICVC_GATEWAY_CID_LEN,
+        .packet_number = d->packet_number++,
+    };
+    hdr.packet_number_len = quicvc_packet_number_length(hdr.packet_number, QUICVC_PACKET_NUMBER_NONE);
+    uint8_t frame_header[QUICVC_MAX_STREAM_HEADER_SIZE];
+    quicvc_stream_frame_t stream = {
+        .stream_id = d->early_stream,
+        .data = d->early_data,
+        .data_len = d->early_len,
+    };
+    quicvc_iovec_t plaintext[2];
+    size_t iov_count = quicvc_serialize_stream_frame_iov(&stream, frame_header, sizeof(frame_header),
+                                                         plaintext, 2);
+    size_t frame_len = iov_count > 0 ? plaintext[0].iov_len + d->early_len : 0;
+    quicvc_aead_packet_t sealed = {
+        .packet = packet,
+        .header_len = quicvc_write_long_header(&hdr, frame_len + QUICVC_AEAD_TAG_LENGTH,
+                                               packet, QUICVC_MAX_PACKET_SIZE),
+        .packet_size = QUICVC_MAX_PACKET_SIZE,
+        .iov = plaintext,
+        .iov_count = iov_count,
+        .packet_number = hdr.packet_number,
+    };
+    ok = ok && iov_count > 0 && sealed.header_len > 0 &&
+         quicvc_aead_openssl.seal_batch(aead, &sealed, 1) == 1;
+    quicvc_aead_openssl.destroy(aead);
+    if (ok) {
+        quicvc_gateway_commit(gw, &d->addr, sealed.packet_len);
+    }
+    return ok;
+}
+
+int quicvc_gateway_resume(quicvc_gateway_t *gw, const struct sockaddr_in *addr,
+                          uint64_t stream_id, const uint8_t *data, size_t len) {
+    uint64_t now = quicvc_gateway_now_us();
+    quicvc_gateway_ticket_t *ticket = NULL;
+    for (size_t i = 0; i < gw->config.max_devices && len <= QUICVC_GATEWAY_MAX_EARLY_DATA; i++) {
+        if (gw->tickets[i].expires_us > now && quicvc_gateway_same_addr(&gw->tickets[i].addr, addr)) {
+            ticket = &gw->tickets[i];
+            break;
+        }
+    }
+    quicvc_gateway_device_t *d = ticket ? quicvc_gateway_new_device(gw, addr) : NULL;
+    if (!d) {
+        return QUICVC_GATEWAY_NONE;
+    }
+    memcpy(d->early_data, data, len);
+    d->early_len = len;
+    d->early_stream = stream_id;
+    memcpy(d->dcid, ticket->id, QUICVC_TICKET_ID_LENGTH);
+    d->dcid_len = QUICVC_TICKET_ID_LENGTH;
+
+    // Single use: the device forgets it as soon as the packet opens
+    bool ok = quicvc_host_derive(ticket->resumption, "quicvc resumed", NULL, 0, d->session_key) &&
+              quicvc_gateway_key(d) && quicvc_gateway_send_zero_rtt(gw, d, ticket);
+    memset(ticket, 0, sizeof(*ticket));
+    if (!ok) {
+        quicvc_gateway_abandon(gw, d);
+        return QUICVC_GATEWAY_NONE;
+    }
+    d->state = DEVICE_RESUMING;
+    gw->stats.frames_sent++;
+    quicvc_timer_schedule(&gw->timers, &d->handshake_timer, now + gw->config.handshake_timeout_us);
+    return (int)(d - gw->devices);
+}
+
+int quicvc_gateway_find(const quicvc_gateway_t *gw, const struct sockaddr_in *addr) {
+    for (int i = 0; i < gw->config.max_devices; i++) {
+        const quicvc_gateway_device_t *d = &gw->devices[i];
+        if (d->state != DEVICE_FREE && quicvc_gateway_same_addr(&d->addr, addr)) {
+            return i;
+        }
+    }
+    return QUICVC_GATEWAY_NONE;
+}
+
+bool quicvc_gateway_send(quicvc_gateway_t *gw, int device, uint64_t stream_id,
+                         const uint8_t *data, size_t len) {
+    if (device < 0 || device >= gw->config.max_devices ||
+        gw->devices[device].state != DEVICE_ESTABLISHED) {
+        return false;
+    }
+    quicvc_gateway_device_t *d = &gw->devices[device];
+    quicvc_stream_frame_t frame = {
+        .stream_id = stream_id,
+        .data = data,
+        .data_len = len,
+    };
+    if (!quicvc_packet_builder_add_stream(&d->tx, &frame, 0)) {
+        return false;
+    }
+    gw->stats.frames_sent++;
+    quicvc_gateway_mark_dirty(d);
+    return true;
+}
+
+void quicvc_gateway_close(quicvc_gateway_t *gw, int device) {
+    if (device < 0 || device >= gw->config.max_devices ||
+        gw->devices[device].state == DEVICE_FREE) {
+        return;
+    }
+    quicvc_gateway_device_t *d = &gw->devices[device];
+    if (d->state == DEVICE_ESTABLISHED) {
+        // Application CONNECTION_CLOSE, no error, no reason
+        static const uint8_t close_frame[] = { QUICVC_FRAME_CONNECTION_CLOSE_APP, 0x00, 0x00 };
+        quicvc_packet_builder_add(&d->tx, close_frame, sizeof(close_frame), 0);
+        quicvc_packet_builder_flush(&d->tx);
+    }
+    quicvc_gateway_release(gw, d, QUICVC_GATEWAY_CLOSED_LOCALLY);
+}
+
+// Receive Path
+
+// The tag is AES-128-GCM with an empty plaintext over the pseudo-packet:
+// original DCID length, original DCID, then the Retry up to its tag
+static bool quicvc_gateway_retry_valid(const quicvc_gateway_device_t *d, const uint8_t *retry,
+                                       size_t retry_len) {
+    uint8_t pseudo[1 + QUICVC_MAX_CONNECTION_ID_LENGTH + QUICVC_GATEWAY_DATAGRAM_SIZE];
+    if (retry_len < QUICVC_RETRY_INTEGRITY_TAG_LENGTH ||
+        retry_len > QUICVC_GATEWAY_DATAGRAM_SIZE + QUICVC_RETRY_INTEGRITY_TAG_LENGTH) {
+        return false;
+    }
+    size_t body_len = retry_len - QUICVC_RETRY_INTEGRITY_TAG_LENGTH;
+    pseudo[0] = d->dcid_len;
+    memcpy(&pseudo[1], d->dcid, d->dcid_len);
+    memcpy(&pseudo[1 + d->dcid_len], retry, body_len);
+
+    uint8_t tag[QUICVC_RETRY_INTEGRITY_TAG_LENGTH];
+    int len;
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    bool ok = ctx != NULL &&
+        EVP_EncryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, retry_integrity_key,
+                           retry_integrity_nonce) == 1 &&
+        EVP_EncryptUpdate(ctx, NULL, &len, pseudo, (int)(1 + d->dcid_len + body_len)) == 1 &&
+        EVP_EncryptFinal_ex(ctx, tag, &len) == 1 &&
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, sizeof(tag), tag) == 1;
+    EVP_CIPHER_CTX_free(ctx);
+    return ok && memcmp(tag, &retry[body_len], sizeof(tag)) == 0;
+}
+
+// Repeat the INITIAL to the Retry's SCID with its token; one Retry per
+// connection (RFC 9000 Section 17.2.5.2)
+static void quicvc_gateway_handle_retry(quicvc_gateway_t *gw, quicvc_gateway_device_t *d,
+                                        const quicvc_header_t *hdr, const uint8_t *packet,
+                                        size_t packet_len) {
+    if (d->state != DEVICE_CONNECTING || d->retried || hdr->token_len == 0 ||
+        hdr->token_len > sizeof(d->token) || !quicvc_gateway_retry_valid(d, packet, packet_len)) {
+        gw->stats.dropped++;
+        return;
+    }
+    d->retried = true;
+    memcpy(d->token, hdr->token, hdr->token_len);
+    d->token_len = hdr->token_len;
+    memcpy(d->dcid, hdr->scid, hdr->scid_len);
+    d->dcid_len = hdr->scid_len;
+    gw->stats.retries++;
+    quicvc_gateway_send_initial(gw, d);
+}
+
+// A VC_TICKET from an established device: kept, bound to its session
+// key, for quicvc_gateway_resume. One per address; the one closest to
+// expiry makes room.
+static void quicvc_gateway_store_ticket(quicvc_gateway_t *gw, const quicvc_gateway_device_t *d,
+                                        const quicvc_frame_t *frame) {
+    if (frame->u.vc.body_len < QUICVC_TICKET_ID_LENGTH + 4) {
+        return;
+    }
+    const uint8_t *body = frame->u.vc.body;
+    quicvc_gateway_ticket_t *slot = &gw->tickets[0];
+    for (size_t i = 0; i < gw->config.max_devices; i++) {
+        quicvc_gateway_ticket_t *t = &gw->tickets[i];
+        if (t->expires_us != 0 && quicvc_gateway_same_addr(&t->addr, &d->addr)) {
+            slot = t;
+            break;
+        }
+        if (t->expires_us < slot->expires_us) {
+            slot = t;
+        }
+    }
+    uint32_t lifetime = (uint32_t)body[QUICVC_TICKET_ID_LENGTH] << 24 |
+                        (uint32_t)body[QUICVC_TICKET_ID_LENGTH + 1] << 16 |
+                        (uint32_t)body[QUICVC_TICKET_ID_LENGTH + 2] << 8 |
+                        body[QUICVC_TICKET_ID_LENGTH + 3];
+    slot->addr = d->addr;
+    memcpy(slot->id, body, QUICVC_TICKET_ID_LENGTH);
+    if (lifetime == 0 ||
+        !quicvc_host_derive(d->session_key, "quicvc resumption", slot->id, QUICVC_TICKET_ID_LENGTH,
+                            slot->resumption)) {
+        memset(slot, 0, sizeof(*slot));
+        return;
+    }
+    slot->expires_us = quicvc_gateway_now_us() + (uint64_t)lifetime * 1000000;
+}
+
+// Frames of an opened 1-RTT (or resumed HANDSHAKE) payload
+static void quicvc_gateway_handle_frames(quicvc_gateway_t *gw, quicvc_gateway_device_t *d,
+                                         const uint8_t *payload, size_t payload_len) {
+    uint32_t generation = d->generation;
+    int device = (int)(d - gw->devices);
+    bool ack_eliciting = false;
+    quicvc_frame_iter_t iter;
+    quicvc_frame_t frame;
+    quicvc_frame_iter_init(&iter, payload, payload_len);
+    while (quicvc_frame_iter_next(&iter, &frame)) {
+        if (frame.type != QUICVC_FRAME_ACK && frame.type != QUICVC_FRAME_ACK_ECN &&
+            frame.type != QUICVC_FRAME_PADDING) {
+            ack_eliciting = true;
+        }
+        switch (frame.type) {
+            case QUICVC_FRAME_ACK:
+            case QUICVC_FRAME_ACK_ECN:
+                if (d->largest_acked == QUICVC_PACKET_NUMBER_NONE ||
+                    frame.u.ack.largest_acknowledged > d->largest_acked) {
+                    d->largest_acked = frame.u.ack.largest_acknowledged;
+                }
+                break;
+
+            case QUICVC_FRAME_CONNECTION_CLOSE:
+            case QUICVC_FRAME_CONNECTION_CLOSE_APP:
+                quicvc_gateway_release(gw, d, QUICVC_GATEWAY_CLOSED_BY_PEER);
+                return;
+
+            case QUICVC_FRAME_VC_TICKET:
+                quicvc_gateway_store_ticket(gw, d, &frame);
+                break;
+
+            case QUICVC_FRAME_HEARTBEAT:
+            case QUICVC_FRAME_VC_PERF: {
+                quicvc_gateway_event_t event = {
+                    .type = QUICVC_GATEWAY_FRAME,
+                    .device = device,
+                    .addr = &d->addr,
+                    .frame = &frame,
+                };
+                quicvc_gateway_emit(gw, &event);
+                break;
+            }
+
+            default:
+                if ((frame.type & 0xF8) == QUICVC_FRAME_STREAM) {
+                    quicvc_gateway_event_t event = {
+                        .type = QUICVC_GATEWAY_FRAME,
+                        .device = device,
+                        .addr = &d->addr,
+                        .frame = &frame,
+                    };
+                    quicvc_gateway_emit(gw, &event);
+                }
+                break;
+        }
+        // The callback may have closed the connection
+        if (d->generation != generation) {
+            return;
+        }
+    }
+    if (iter.error) {
+        gw->stats.dropped++;
+    }
+    if (ack_eliciting) {
+        d->ack_pending = true;
+        quicvc_gateway_mark_dirty(d);
+    }
+}
+
+static void quicvc_gateway_establish(quicvc_gateway_t *gw, quicvc_gateway_device_t *d,
+                                     const quicvc_header_t *hdr) {
+    memcpy(d->dcid, hdr->scid, hdr->scid_len);
+    d->dcid_len = hdr->scid_len;
+    d->state = DEVICE_ESTABLISHED;
+    gw->established++;
+    quicvc_perf_record(&gw->stats.handshake_ns, quicvc_gateway_now_ns() - d->started_ns);
+    quicvc_timer_cancel(&gw->timers, &d->handshake_timer);
+    quicvc_timer_schedule(&gw->timers, &d->idle_timer,
+                          d->largest_received_us + gw->config.idle_timeout_us);
+
+    quicvc_gateway_event_t event = {
+        .type = QUICVC_GATEWAY_ESTABLISHED,
+        .device = (int)(d - gw->devices),
+        .addr = &d->addr,
+    };
+    quicvc_gateway_emit(gw, &event);
+}
+
+// The session key from the device's key share in the VC_RESPONSE
+static bool quicvc_gateway_agree(quicvc_gateway_device_t *d, const quicvc_header_t *hdr) {
+    static const char key_field[] = "\"key\":\"";
+    const uint8_t *key = memmem(hdr->payload, hdr->payload_len, key_field, sizeof(key_field) - 1);
+    uint8_t peer[QUICVC_KEY_SHARE_LENGTH];
+    uint8_t shared[QUICVC_KEY_SHARE_LENGTH];
+    bool ok = key != NULL;
+    if (ok) {
+        key += sizeof(key_field) - 1;
+        ok = quicvc_gateway_unhex(key, (size_t)(hdr->payload + hdr->payload_len - key), peer, sizeof(peer)) &&
+             quicvc_host_key_exchange(d->key_private, peer, shared) &&
+             quicvc_host_derive(shared, "quicvc session", (const uint8_t *)d->challenge,
+                                QUICVC_GATEWAY_CHALLENGE_LEN, d->session_key) &&
+             quicvc_gateway_key(d);
+    }
+    memset(shared, 0, sizeof(shared));
+    // A forged VC_RESPONSE must not cost us the key share for the real one
+    if (ok) {
+        memset(d->key_private, 0, sizeof(d->key_private));
+    }
+    return ok;
+}
+
+// A full handshake: the HANDSHAKE carries the VC_RESPONSE JSON, which
+// echoes our challenge and holds the device's key share, and names the
+// device's CID for the short headers that follow. Early data a 0-RTT
+// attempt could not deliver goes out now, under the new keys.
+static void quicvc_gateway_handle_handshake(quicvc_gateway_t *gw, quicvc_gateway_device_t *d,
+                                            const quicvc_header_t *hdr) {
+    char expected[sizeof("\"challenge\":\"\"") + QUICVC_GATEWAY_CHALLENGE_LEN];
+    int expected_len = snprintf(expected, sizeof(expected), "\"challenge\":\"%s\"", d->challenge);
+    if (d->state != DEVICE_CONNECTING || hdr->scid_len == 0 ||
+        !memmem(hdr->payload, hdr->payload_len, expected, (size_t)expected_len) ||
+        !quicvc_gateway_agree(d, hdr)) {
+        gw->stats.dropped++;
+        return;
+    }
+    uint64_t packet_number = quicvc_decode_packet_number(0, hdr->packet_number,
+                                                         hdr->packet_number_len);
+    quicvc_ack_tracker_record(&d->ack_tracker, packet_number);
+    d->largest_received_us = quicvc_gateway_now_us();
+    gw->stats.handshakes++;
+    uint32_t generation = d->generation;
+    quicvc_gateway_establish(gw, d, hdr);
+    if (d->generation == generation && d->early_len > 0) {
+        quicvc_stream_frame_t frame = {
+            .stream_id = d->early_stream,
+            .data = d->early_data,
+            .data_len = d->early_len,
+        };
+        if (quicvc_packet_builder_add_stream(&d->tx, &frame, 0)) {
+            quicvc_gateway_mark_dirty(d);
+        }
+        d->early_len = 0;
+    }
+}
+
+// The device's answer to our 0-RTT packet: a HANDSHAKE sealed under the
+// resumed keys, holding its ACK and the next ticket
+static void quicvc_gateway_handle_resumed(quicvc_gateway_t *gw, quicvc_gateway_device_t *d,
+                                          const quicvc_header_t *hdr, uint8_t *packet) {
+    uint64_t packet_number = quicvc_decode_packet_number(0, hdr->packet_number,
+                                                         hdr->packet_number_len);
+    size_t payload_len;
+    if (hdr->scid_len == 0 || !quicvc_gateway_open(d->aead_recv, packet, hdr, packet_number, &payload_len)) {
+        gw->stats.dropped++;
+        return;
+    }
+    quicvc_ack_tracker_record(&d->ack_tracker, packet_number);
+    d->largest_received_us = quicvc_gateway_now_us();
+    d->early_len = 0;
+    gw->stats.resumptions++;
+    uint32_t generation = d->generation;
+    quicvc_gateway_establish(gw, d, hdr);
+    if (d->generation == generation) {
+        quicvc_gateway_handle_frames(gw, d, hdr->payload, payload_len);
+    }
+}
+
+static void quicvc_gateway_handle_protected(quicvc_gateway_t *gw, quicvc_gateway_device_t *d,
+                                            const quicvc_header_t *hdr, uint8_t *packet) {
+    quicvc_ack_tracker_t *tracker = &d->ack_tracker;
+    uint64_t packet_number = quicvc_decode_packet_number(
+        tracker->has_packets ? tracker->largest + 1 : 0,
+        hdr->packet_number, hdr->packet_number_len);
+    // Duplicates cost no AEAD work; only packets that open are recorded
+    size_t payload_len;
+    if (d->state != DEVICE_ESTABLISHED || quicvc_ack_tracker_contains(tracker, packet_number) ||
+        !quicvc_gateway_open(d->aead_recv, packet, hdr, packet_number, &payload_len) ||
+        !quicvc_ack_tracker_record(tracker, packet_number)) {
+        gw->stats.dropped++;
+        return;
+    }
+    uint64_t now = quicvc_gateway_now_us();
+    if (packet_number == tracker->largest) {
+        d->largest_received_us = now;
+    }
+    quicvc_timer_schedule(&gw->timers, &d->idle_timer, now + gw->config.idle_timeout_us);
+    quicvc_gateway_handle_frames(gw, d, hdr->payload, payload_len);
+}
+
+// One datagram; it may hold several coalesced packets
+static void quicvc_gateway_handle_datagram(quicvc_gateway_t *gw, uint8_t *data, size_t len) {
+    size_t offset = 0;
+    while (offset < len) {
+        quicvc_header_parse_result_t parsed =
+            quicvc_parse_header(&data[offset], len - offset, QUICVC_GATEWAY_CID_LEN);
+        if (parsed.bytes_consumed == 0) {
+            gw->stats.dropped++;
+            return;
+        }
+        uint8_t *packet = &data[offset];
+        offset += parsed.bytes_consumed;
+
+        const quicvc_header_t *hdr = &parsed.header;
+        uint16_t slot = hdr->dcid_len != QUICVC_GATEWAY_CID_LEN ? QUICVC_CONN_NONE
+            : quicvc_conn_table_find(&gw->table, hdr->dcid, hdr->dcid_len);
+        if (slot == QUICVC_CONN_NONE) {
+            gw->stats.dropped++;
+            continue;
+        }
+        quicvc_gateway_device_t *d = &gw->devices[slot];
+        if (!hdr->is_long) {
+            quicvc_gateway_handle_protected(gw, d, hdr, packet);
+        } else if (hdr->packet_type == QUICVC_PACKET_TYPE_HANDSHAKE && d->state == DEVICE_RESUMING) {
+            quicvc_gateway_handle_resumed(gw, d, hdr, packet);
+        } else if (hdr->packet_type == QUICVC_PACKET_TYPE_HANDSHAKE) {
+            quicvc_gateway_handle_handshake(gw, d, hdr);
+        } else if (hdr->packet_type == QUICVC_PACKET_TYPE_RETRY) {
+            quicvc_gateway_handle_retry(gw, d, hdr, packet, parsed.bytes_consumed);
+        } else {
+            gw->stats.dropped++;
+        }
+    }
+}
+
+// Segment size of a GRO receive: UDP_GRO control message, or the whole
+// message when the kernel did not coalesce it
+static size_t quicvc_gateway_gro_size(struct msghdr *hdr, size_t len) {
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            int size;
+            memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+            return size > 0 ? (size_t)size : len;
+        }
+    }
+    return len;
+}
+
+static int quicvc_gateway_receive(quicvc_gateway_t *gw) {
+    int handled = 0;
+    for (int round = 0; round < QUICVC_GATEWAY_RX_ROUNDS; round++) {
+        for (size_t i = 0; i < gw->config.batch; i++) {
+            gw->rx_msgs[i].msg_hdr.msg_namelen = sizeof(gw->rx_addr[i]);
+            if (gw->gro) {
+                gw->rx_msgs[i].msg_hdr.msg_controllen = sizeof(gw->rx_control[i].buf);
+            }
+        }
+        int n = recvmmsg(gw->quic_fd, gw->rx_msgs, (unsigned)gw->config.batch, MSG_DONTWAIT, NULL);
+        if (n <= 0) {
+            break;
+        }
+        gw->stats.recv_calls++;
+        for (int i = 0; i < n; i++) {
+            uint8_t *data = &gw->rx_buf[(size_t)i * gw->rx_size];
+            size_t left = gw->rx_msgs[i].msg_len;
+            size_t segment = gw->gro ? quicvc_gateway_gro_size(&gw->rx_msgs[i].msg_hdr, left) : left;
+            gw->stats.bytes_received += left;
+            if (segment < left) {
+                gw->stats.gro_datagrams += (left + segment - 1) / segment;
+            }
+            // A coalesced run is datagrams of 'segment' bytes, the last
+            // possibly shorter, each handled as if read on its own
+            do {
+                size_t len = left < segment ? left : segment;
+                quicvc_gateway_handle_datagram(gw, data, len);
+                gw->stats.datagrams_received++;
+                handled++;
+                data += len;
+                left -= len;
+            } while (left > 0);
+        }
+        if ((size_t)n < gw->config.batch) {
+            break;
+        }
+    }
+    return handled;
+}
+
+// [0x01][HTML with <meta itemprop="id" content="...">]; the device serves
+// QUIC-VC on QUICVC_GATEWAY_DEVICE_PORT at the broadcast's source address
+static void quicvc_gateway_receive_discovery(quicvc_gateway_t *gw) {
+    static const char id_attr[] = "itemprop=\"id\" content=\"";
+    char buffer[QUICVC_GATEWAY_DATAGRAM_SIZE + 1];
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    ssize_t len;
+    while ((len = recvfrom(gw->discovery_fd, buffer, sizeof(buffer) - 1, MSG_DONTWAIT,
+                           (struct sockaddr *)&from, &from_len)) > 0) {
+        from_len = sizeof(from);
+        if (buffer[0] != QUICVC_GATEWAY_SERVICE_DISCOVERY) {
+            continue;
+        }
+        buffer[len] = '\0';
+        char *id = strstr(&buffer[1], id_attr);
+        char *end = id ? strchr(id + sizeof(id_attr) - 1, '"') : NULL;
+        if (!end) {
+            continue;
+        }
+        id += sizeof(id_attr) - 1;
+        *end = '\0';
+
+        from.sin_port = htons(QUICVC_GATEWAY_DEVICE_PORT);
+        quicvc_gateway_event_t event = {
+            .type = QUICVC_GATEWAY_DISCOVERED,
+            .device = QUICVC_GATEWAY_NONE,
+            .addr = &from,
+            .device_id = id,
+        };
+        quicvc_gateway_emit(gw, &event);
+    }
+}
+
+int quicvc_gateway_timeout_ms(const quicvc_gateway_t *gw) {
+    uint64_t next = quicvc_timer_wheel_next_deadline(&gw->timers);
+    if (next == QUICVC_TIMER_NONE) {
+        return -1;
+    }
+    uint64_t now = quicvc_gateway_now_us();
+    if (next <= now) {
+        return 0;
+    }
+    uint64_t ms = (next - now + 999) / 1000;
+    return ms > INT_MAX ? INT_MAX : (int)ms;
+}
+
+int quicvc_gateway_poll(quicvc_gateway_t *gw, int timeout_ms) {
+    // Nothing queued may wait on the sleep
+    quicvc_gateway_flush(gw);
+    int wait = quicvc_gateway_timeout_ms(gw);
+    if (timeout_ms >= 0 && (wait < 0 || timeout_ms < wait)) {
+        wait = timeout_ms;
+    }
+
+    struct epoll_event events[2];
+    int n = epoll_wait(gw->epoll_fd, events, 2, wait);
+    if (n < 0 && errno != EINTR) {
+        return -1;
+    }
+    int handled = 0;
+    for (int i = 0; i < n; i++) {
+        if (events[i].data.u32 == QUICVC_GATEWAY_QUIC_SOCKET) {
+            handled += quicvc_gateway_receive(gw);
+        } else {
+            quicvc_gateway_receive_discovery(gw);
+        }
+    }
+    quicvc_timer_wheel_advance(&gw->timers, quicvc_gateway_now_us());
+    quicvc_gateway_flush(gw);
+    return handled;
+}
+
+// Setup
+
+static int quicvc_gateway_socket(struct in_addr addr, uint16_t port, bool broadcast) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+    if (fd < 0) {
+        return -1;
+    }
+    int one = 1;
+    int buffer = QUICVC_GATEWAY_SOCKET_BUFFER;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buffer, sizeof(buffer));
+    if (broadcast) {
+        // Presence broadcasts reach every listener on the port, so the
+        // app and the gateway can share a host
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+    }
+    struct sockaddr_in local = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr = addr,
+    };
+    if (bind(fd, (struct sockaddr *)&local, sizeof(local)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool quicvc_gateway_watch(quicvc_gateway_t *gw, int fd, uint32_t which) {
+    struct epoll_event event = { .events = EPOLLIN, .data.u32 = which };
+    return epoll_ctl(gw->epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+quicvc_gateway_t *quicvc_gateway_new(const quicvc_gateway_config_t *config) {
+    if (!config->credential_json || config->max_devices == 0 ||
+        config->max_devices >= QUICVC_CONN_NONE || config->batch > QUICVC_GATEWAY_BATCH) {
+        return NULL;
+    }
+    quicvc_gateway_t *gw = calloc(1, sizeof(*gw));
+    if (!gw) {
+        return NULL;
+    }
+    gw->config = *config;
+    gw->epoll_fd = gw->quic_fd = gw->discovery_fd = -1;
+    if (gw->config.batch == 0) gw->config.batch = QUICVC_GATEWAY_BATCH;
+    if (gw->config.handshake_timeout_us == 0) gw->config.handshake_timeout_us = 500000;
+    if (gw->config.handshake_attempts == 0) gw->config.handshake_attempts = 5;
+    if (gw->config.idle_timeout_us == 0) gw->config.idle_timeout_us = 60000000;
+
+    // The VC_INIT has to fit one INITIAL
+    static const char prefix[] = "{\"type\":\"VC_INIT\",\"credential\":%s,\"key\":\"";
+    int prefix_len = snprintf(NULL, 0, prefix, config->credential_json);
+    size_t index_size = 2;
+    while (index_size < 2u * config->max_devices) {
+        index_size <<= 1;
+    }
+    gw->vc_init_prefix = prefix_len > 0 ? malloc((size_t)prefix_len + 1) : NULL;
+    gw->devices = calloc(config->max_devices, sizeof(*gw->devices));
+    gw->entries = calloc(config->max_devices, sizeof(*gw->entries));
+    gw->index = calloc(index_size, sizeof(*gw->index));
+    gw->dirty = calloc(config->max_devices, sizeof(*gw->dirty));
+    gw->tickets = calloc(config->max_devices, sizeof(*gw->tickets));
+    if (!gw->vc_init_prefix || !gw->devices || !gw->entries || !gw->index || !gw->dirty ||
+        !gw->tickets ||
+        (size_t)prefix_len + 2 * QUICVC_KEY_SHARE_LENGTH + QUICVC_GATEWAY_CHALLENGE_LEN + 17 >
+            QUICVC_MAX_PACKET_SIZE - 64 ||
+        !quicvc_conn_table_init(&gw->table, gw->entries, config->max_devices, gw->index, index_size)) {
+        quicvc_gateway_free(gw);
+        return NULL;
+    }
+    snprintf(gw->vc_init_prefix, (size_t)prefix_len + 1, prefix, config->credential_json);
+    gw->vc_init_prefix_len = (size_t)prefix_len;
+    quicvc_timer_wheel_init(&gw->timers, quicvc_gateway_now_us(), QUICVC_GATEWAY_TICK_US);
+    quicvc_perf_init(&gw->stats.handshake_ns);
+
+    gw->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    gw->quic_fd = quicvc_gateway_socket(config->bind_addr, config->local_port, false);
+    if (gw->epoll_fd < 0 || gw->quic_fd < 0 ||
+        !quicvc_gateway_watch(gw, gw->quic_fd, QUICVC_GATEWAY_QUIC_SOCKET)) {
+        quicvc_gateway_free(gw);
+        return NULL;
+    }
+
+    // Offload is per socket and optional: without it every message is one
+    // datagram, as before. GSO is probed by reading the option back; a
+    // route that still cannot segment is caught on the first send.
+    if (!config->no_offload) {
+        int one = 1;
+        int segment = 0;
+        socklen_t segment_len = sizeof(segment);
+        gw->gso = getsockopt(gw->quic_fd, SOL_UDP, UDP_SEGMENT, &segment, &segment_len) == 0;
+        gw->gro = setsockopt(gw->quic_fd, SOL_UDP, UDP_GRO, &one, sizeof(one)) == 0;
+    }
+    gw->rx_size = gw->gro ? QUICVC_GATEWAY_GRO_SIZE : QUICVC_GATEWAY_DATAGRAM_SIZE;
+    gw->rx_buf = malloc(gw->config.batch * gw->rx_size);
+    if (!gw->rx_buf) {
+        quicvc_gateway_free(gw);
+        return NULL;
+    }
+    for (size_t i = 0; i < QUICVC_GATEWAY_BATCH; i++) {
+        gw->rx_iov[i] = (struct iovec){
+            i < gw->config.batch ? &gw->rx_buf[i * gw->rx_size] : NULL,
+            i < gw->config.batch ? gw->rx_size : 0,
+        };
+        gw->rx_msgs[i].msg_hdr = (struct msghdr){
+            .msg_name = &gw->rx_addr[i],
+            .msg_namelen = sizeof(gw->rx_addr[i]),
+            .msg_iov = &gw->rx_iov[i],
+            .msg_iovlen = 1,
+            .msg_control = gw->gro ? gw->rx_control[i].buf : NULL,
+            .msg_controllen = gw->gro ? sizeof(gw->rx_control[i].buf) : 0,
+        };
+        gw->tx_msgs[i].msg_hdr = (struct msghdr){
+            .msg_name = &gw->tx_addr[i],
+            .msg_namelen = sizeof(gw->tx_addr[i]),
+            .msg_iov = &gw->tx_iov[i],
+            .msg_iovlen = 1,
+        };
+    }
+    if (config->discovery_port != 0) {
+        struct in_addr any = { htonl(INADDR_ANY) };
+        gw->discovery_fd = quicvc_gateway_socket(any, config->discovery_port, true);
+        if (gw->discovery_fd < 0 ||
+            !quicvc_gateway_watch(gw, gw->discovery_fd, QUICVC_GATEWAY_DISCOVERY_SOCKET)) {
+            quicvc_gateway_free(gw);
+            return NULL;
+        }
+    }
+
+    struct sockaddr_in local;
+    socklen_t local_len = sizeof(local);
+    getsockname(gw->quic_fd, (struct sockaddr *)&local, &local_len);
+    gw->local_port = ntohs(local.sin_port);
+    return gw;
+}
+
+void quicvc_gateway_free(quicvc_gateway_t *gw) {
+    if (!gw) {
+        return;
+    }
+    if (gw->epoll_fd >= 0) close(gw->epoll_fd);
+    if (gw->quic_fd >= 0) close(gw->quic_fd);
+    if (gw->discovery_fd >= 0) close(gw->discovery_fd);
+    free(gw->vc_init_prefix);
+    for (size_t i = 0; gw->devices && i < gw->config.max_devices; i++) {
+        quicvc_gateway_unkey(&gw->devices[i]);
+    }
+    if (gw->tickets) {
+        memset(gw->tickets, 0, gw->config.max_devices * sizeof(*gw->tickets));
+    }
+    free(gw->tickets);
+    free(gw->devices);
+    free(gw->entries);
+    free(gw->index);
+    free(gw->dirty);
+    free(gw->rx_buf);
+    free(gw);
+}
+
+int quicvc_gateway_fd(const quicvc_gateway_t *gw) {
+    return gw->epoll_fd;
+}
+
+size_t quicvc_gateway_established(const quicvc_gateway_t *gw) {
+    return gw->established;
+}
+
+const quicvc_gateway_stats_t *quicvc_gateway_stats(const quicvc_gateway_t *gw) {
+    return &gw->stats;
+}
+
+uint16_t quicvc_gateway_local_port(const quicvc_gateway_t *gw) {
+    return gw->local_port;
+}
+
+unsigned quicvc_gateway_offload(const quicvc_gateway_t *gw) {
+    return (gw->gso ? QUICVC_GATEWAY_GSO : 0u) | (gw->gro ? QUICVC_GATEWAY_GRO : 0u);
+}
@@ -0,0 +1,220 @@
+/**
+ * QUIC-VC gateway for Linux hosts
+ *
+ * The hub end of the device protocol, for a LAN-side daemon that keeps
+ * connections to hundreds of devices at once. It speaks what the unified
+ * firmware (esp32-unified-with-quicvc.c) serves:
+ *
+ *   49497  Devices broadcast presence: [0x01][DevicePresence HTML]
+ *   49498  QUIC-VC: INITIAL with the VC_INIT JSON, HANDSHAKE with the
+ *          VC_RESPONSE JSON, then short header packets carrying STREAM
+ *          commands, HEARTBEAT, VC_PERF, VC_TICKET and ACK frames; or a
+ *          0-RTT packet with a ticket, answered by a sealed HANDSHAKE
+ *
+ * Every device shares one UDP socket. Datagrams are read with recvmmsg
+ * and written with sendmmsg in batches of up to QUICVC_GATEWAY_BATCH, so
+ * the ACKs and commands produced while handling one batch of receives
+ * leave in one system call. Where the kernel supports UDP segmentation
+ * offload, consecutive datagrams to one device go out as one UDP_SEGMENT
+ * super-buffer (GSO), and UDP_GRO receives are split back into the
+ * datagrams the kernel coalesced; a bulk transfer then costs the stack
+ * one trip per run rather than per datagram. Without it, or with
+ * 'no_offload', every message is one datagram. Connections are found by the CID we gave
+ * the device (the DCID of everything it sends us) in a
+ * quicvc_conn_table_t; handshake retransmits and idle timeouts run on a
+ * quicvc_timer_wheel_t, whose next deadline is the epoll timeout.
+ *
+ * VC_INIT and VC_RESPONSE exchange X25519 key shares, and every packet
+ * after them is sealed with the "openssl" backend of quicvc_aead_host.h
+ * (see "Session Keys" in quicvc_protocol.h). The key exchange keeps
+ * passive observers out; nothing yet ties the device's key share to its
+ * credential. VC_TICKETs are kept by device address past their
+ * connection, so quicvc_gateway_resume can put a command in the first
+ * flight. A Retry is verified and answered. The gateway is
+ * single-threaded: every call for one gateway must come from the same
+ * thread.
+ *
+ * Build with host/quicvc_aead_host.c and link with -lcrypto.
+ */
+
+#ifndef QUICVC_GATEWAY_H
+#define QUICVC_GATEWAY_H
+
+#include <netinet/in.h>
+
+#include "quicvc_protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define QUICVC_GATEWAY_DISCOVERY_PORT 49497
+#define QUICVC_GATEWAY_DEVICE_PORT    49498
+#define QUICVC_GATEWAY_BATCH          32    // Messages per recvmmsg/sendmmsg
+#define QUICVC_GATEWAY_NONE           (-1)
+#define QUICVC_GATEWAY_MAX_EARLY_DATA 1024  // quicvc_gateway_resume data, one 0-RTT packet
+
+// quicvc_gateway_offload
+#define QUICVC_GATEWAY_GSO            0x01  // Runs to one device sent with UDP_SEGMENT
+#define QUICVC_GATEWAY_GRO            0x02  // Coalesced receives split with UDP_GRO
+
+typedef struct quicvc_gateway quicvc_gateway_t;
+
+typedef enum {
+    QUICVC_GATEWAY_DISCOVERED,  // Presence broadcast; 'addr' is the device's QUIC-VC address
+    QUICVC_GATEWAY_ESTABLISHED, // Handshake done or 0-RTT answered; commands may be sent
+    QUICVC_GATEWAY_FRAME,       // STREAM, HEARTBEAT or VC_PERF frame from the device
+    QUICVC_GATEWAY_CLOSED,      // Connection gone; the device handle is free again
+} quicvc_gateway_event_type_t;
+
+typedef enum {
+    QUICVC_GATEWAY_CLOSED_BY_PEER,      // CONNECTION_CLOSE
+    QUICVC_GATEWAY_HANDSHAKE_TIMEOUT,   // No HANDSHAKE after every INITIAL retransmit
+                                        // (and an unanswered 0-RTT packet)
+    QUICVC_GATEWAY_IDLE_TIMEOUT,
+    QUICVC_GATEWAY_CLOSED_LOCALLY,      // quicvc_gateway_close
+} quicvc_gateway_close_reason_t;
+
+typedef struct {
+    quicvc_gateway_event_type_t type;
+    int device;                         // QUICVC_GATEWAY_NONE for DISCOVERED
+    const struct sockaddr_in *addr;
+    const char *device_id;              // DISCOVERED only
+    const quicvc_frame_t *frame;        // FRAME only; valid during the callback
+    quicvc_gateway_close_reason_t reason;  // CLOSED only
+} quicvc_gateway_event_t;
+
+typedef void (*quicvc_gateway_event_fn)(quicvc_gateway_t *gateway,
+                                        const quicvc_gateway_event_t *event, void *ctx);
+
+typedef struct {
+    const char *credential_json;    // Our credential object, sent in VC_INIT; its
+                                    // issuer must be the devices' owner
+    struct in_addr bind_addr;       // INADDR_ANY (zero) for all interfaces
+    uint16_t local_port;            // QUIC-VC source port; 0 for an ephemeral one
+    uint16_t discovery_port;        // Presence broadcasts; 0 to not listen
+    uint16_t max_devices;           // Open connections at once
+    size_t batch;                   // Messages per system call, 1..QUICVC_GATEWAY_BATCH; 0 for the
+                                    // maximum. With offload a message may hold many datagrams
+    bool no_offload;                // Never use UDP GSO/GRO, even where the kernel has them
+    uint64_t handshake_timeout_us;  // First INITIAL retransmit; doubles each time. 0: 500 ms
+    unsigned handshake_attempts;    // INITIALs sent before giving up. 0: 5
+    uint64_t idle_timeout_us;       // 0: 60 s, as on the device
+    quicvc_gateway_event_fn on_event;
+    void *ctx;
+} quicvc_gateway_config_t;
+
+typedef struct {
+    uint64_t datagrams_received;
+    uint64_t datagrams_sent;
+    uint64_t bytes_received;
+    uint64_t bytes_sent;
+    uint64_t recv_calls;            // recvmmsg calls that returned datagrams
+    uint64_t send_calls;            // sendmmsg calls, and sendto after a GSO fallback
+    uint64_t send_errors;           // Datagrams the kernel refused
+    uint64_t gso_datagrams;         // Sent inside UDP_SEGMENT super-buffers
+    uint64_t gro_datagrams;         // Received inside UDP_GRO coalesced runs
+    uint64_t dropped;               // Unparseable, unknown CID or duplicate
+    uint64_t handshakes;            // Completed
+    uint64_t handshake_retransmits;
+    uint64_t retries;               // Retry packets accepted
+    uint64_t resumptions;           // 0-RTT packets the device answered
+    uint64_t resumption_fallbacks;  // Unanswered 0-RTT, redone as a full handshake
+    uint64_t frames_sent;           // STREAM frames queued by quicvc_gateway_send
+    quicvc_perf_histogram_t handshake_ns;  // First INITIAL or 0-RTT packet to HANDSHAKE
+} quicvc_gateway_stats_t;
+
+/**
+ * Create a gateway and bind its sockets
+ * Returns NULL if the configuration is invalid or a socket cannot be set up
+ */
+quicvc_gateway_t *quicvc_gateway_new(const quicvc_gateway_config_t *config);
+
+void quicvc_gateway_free(quicvc_gateway_t *gateway);
+
+/**
+ * The epoll descriptor, readable when quicvc_gateway_poll has work, for
+ * callers that wait on other descriptors as well
+ */
+int quicvc_gateway_fd(const quicvc_gateway_t *gateway);
+
+/**
+ * Milliseconds until the next timer is due, for poll() or epoll_wait()
+ * on quicvc_gateway_fd; -1 if none is pending
+ */
+int quicvc_gateway_timeout_ms(const quicvc_gateway_t *gateway);
+
+/**
+ * Wait up to 'timeout_ms' (-1: until the next timer) for datagrams, then
+ * handle them, run due timers and send everything queued
+ * Returns the number of datagrams handled, or -1 if epoll fails
+ */
+int quicvc_gateway_poll(quicvc_gateway_t *gateway, int timeout_ms);
+
+/**
+ * Start a handshake with the device at 'addr'
+ * Returns the device handle, or QUICVC_GATEWAY_NONE if every slot is taken
+ */
+int quicvc_gateway_connect(quicvc_gateway_t *gateway, const struct sockaddr_in *addr);
+
+/**
+ * Reconnect to the device at 'addr' with the ticket it gave an earlier
+ * connection, sending 'data' (up to QUICVC_GATEWAY_MAX_EARLY_DATA bytes)
+ * on 'stream_id' in the 0-RTT first flight. Tickets are single use. If
+ * the device does not answer within the first handshake timeout (it may
+ * have restarted and forgotten the ticket), the connection falls back to
+ * a full handshake and sends 'data' again once established, so a command
+ * sent this way must be safe to run twice.
+ * Returns the device handle, or QUICVC_GATEWAY_NONE if there is no
+ * ticket for 'addr', 'data' is too long or every slot is taken
+ */
+int quicvc_gateway_resume(quicvc_gateway_t *gateway, const struct sockaddr_in *addr,
+                          uint64_t stream_id, const uint8_t *data, size_t len);
+
+/**
+ * Handle of the open connection to 'addr', or QUICVC_GATEWAY_NONE
+ */
+int quicvc_gateway_find(const quicvc_gateway_t *gateway, const struct sockaddr_in *addr);
+
+/**
+ * Queue 'data' on 'stream_id' of an established connection (commands are
+ * JSON on stream 3). Queued frames share datagrams and go out at the end
+ * of the next quicvc_gateway_poll, or on quicvc_gateway_flush.
+ * Returns false if the device is not established
+ */
+bool quicvc_gateway_send(quicvc_gateway_t *gateway, int device, uint64_t stream_id,
+                         const uint8_t *data, size_t len);
+
+/**
+ * Send every queued frame now
+ */
+void quicvc_gateway_flush(quicvc_gateway_t *gateway);
+
+/**
+ * Send CONNECTION_CLOSE and free the handle; a CLOSED event follows
+ */
+void quicvc_gateway_close(quicvc_gateway_t *gateway, int device);
+
+/**
+ * Established connections
+ */
+size_t quicvc_gateway_established(const quicvc_gateway_t *gateway);
+
+const quicvc_gateway_stats_t *quicvc_gateway_stats(const quicvc_gateway_t *gateway);
+
+/**
+ * Local QUIC-VC port, after binding port 0
+ */
+uint16_t quicvc_gateway_local_port(const quicvc_gateway_t *gateway);
+
+/**
+ * Offload in use: QUICVC_GATEWAY_GSO and QUICVC_GATEWAY_GRO bits. GSO is
+ * dropped for good if the kernel refuses a super-buffer.
+ */
+unsigned quicvc_gateway_offload(const quicvc_gateway_t *gateway);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QUICVC_GATEWAY_H */
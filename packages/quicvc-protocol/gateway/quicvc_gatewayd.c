@@ -0,0 +1,311 @@
+/**
+ * QUIC-VC gateway daemon
+ * Compile with: cc -O2 -Ic-headers -Ihost -Igateway gateway/quicvc_gatewayd.c gateway/quicvc_gateway.c host/quicvc_aead_host.c c-headers/quicvc_protocol.c -lcrypto -o quicvc-gatewayd
+ *
+ *   quicvc-gatewayd -c credential.json [-p port] [-d discovery-port] [-n max-devices]
+ *                   [-s stats-seconds] [-b batch] [-O] [-m] [ip[:port] ...]
+ *
+ * Connects to every device given on the command line and, unless -m
+ * (manual) is set, to every device that broadcasts its presence. Events
+ * are printed one per line on stdout:
+ *
+ *   discovered <id> <ip>:<port>
+ *   established <ip>:<port>
+ *   stream <ip>:<port> <stream-id> <data>
+ *   heartbeat <ip>:<port> <json>
+ *   perf <ip>:<port> <bytes>
+ *   closed <ip>:<port> <reason>
+ *
+ * Each line on stdin is a command: "<ip>[:port] <json>" sends the JSON
+ * on stream 3, "close <ip>[:port]" closes the connection. A command for
+ * a device with no connection goes out as 0-RTT if an earlier connection
+ * left a ticket (and again after a full handshake if the device does not
+ * answer it, so commands should be safe to repeat). Statistics go
+ * to stderr every -s seconds. UDP GSO/GRO are used where the kernel has
+ * them; -O turns them off.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "quicvc_protocol.h"
+#include "quicvc_gateway.h"
+
+#define COMMAND_STREAM   3
+#define MAX_CREDENTIAL   900        // Leaves room for the rest of VC_INIT in one INITIAL
+#define MAX_LINE         2048
+
+static volatile sig_atomic_t stopping;
+static bool manual;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+static const char *address(const struct sockaddr_in *addr) {
+    static char text[INET_ADDRSTRLEN + 8];
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &addr->sin_addr, ip, sizeof(ip));
+    snprintf(text, sizeof(text), "%s:%u", ip, ntohs(addr->sin_port));
+    return text;
+}
+
+static bool parse_address(const char *text, struct sockaddr_in *addr) {
+    char ip[INET_ADDRSTRLEN];
+    const char *colon = strchr(text, ':');
+    size_t len = colon ? (size_t)(colon - text) : strlen(text);
+    if (len >= sizeof(ip)) {
+        return false;
+    }
+    memcpy(ip, text, len);
+    ip[len] = '\0';
+    *addr = (struct sockaddr_in){
+        .sin_family = AF_INET,
+        .sin_port = htons(colon ? (uint16_t)atoi(colon + 1) : QUICVC_GATEWAY_DEVICE_PORT),
+    };
+    return inet_pton(AF_INET, ip, &addr->sin_addr) == 1 && addr->sin_port != 0;
+}
+
+static const char *close_reason(quicvc_gateway_close_reason_t reason) {
+    switch (reason) {
+        case QUICVC_GATEWAY_CLOSED_BY_PEER:     return "peer";
+        case QUICVC_GATEWAY_HANDSHAKE_TIMEOUT:  return "handshake-timeout";
+        case QUICVC_GATEWAY_IDLE_TIMEOUT:       return "idle-timeout";
+        case QUICVC_GATEWAY_CLOSED_LOCALLY:     return "local";
+    }
+    return "unknown";
+}
+
+static void on_event(quicvc_gateway_t *gw, const quicvc_gateway_event_t *event, void *ctx) {
+    (void)ctx;
+    switch (event->type) {
+        case QUICVC_GATEWAY_DISCOVERED:
+            if (quicvc_gateway_find(gw, event->addr) != QUICVC_GATEWAY_NONE) {
+                break;      // Broadcast again while connected
+            }
+            printf("discovered %s %s\n", event->device_id, address(event->addr));
+            if (!manual) {
+                quicvc_gateway_connect(gw, event->addr);
+            }
+            break;
+
+        case QUICVC_GATEWAY_ESTABLISHED:
+            printf("established %s\n", address(event->addr));
+            break;
+
+        case QUICVC_GATEWAY_FRAME: {
+            const quicvc_frame_t *frame = event->frame;
+            if ((frame->type & 0xF8) == QUICVC_FRAME_STREAM) {
+                printf("stream %s %llu %.*s\n", address(event->addr),
+                       (unsigned long long)frame->u.stream.stream_id,
+                       (int)frame->u.stream.data_len, (const char *)frame->u.stream.data);
+            } else if (frame->type == QUICVC_FRAME_HEARTBEAT) {
+                printf("heartbeat %s %.*s\n", address(event->addr),
+                       (int)frame->u.vc.body_len, (const char *)frame->u.vc.body);
+            } else {
+                printf("perf %s %zu\n", address(event->addr), frame->u.vc.body_len);
+            }
+            break;
+        }
+
+        case QUICVC_GATEWAY_CLOSED:
+            printf("closed %s %s\n", address(event->addr), close_reason(event->reason));
+            break;
+    }
+    fflush(stdout);
+}
+
+static void handle_command(quicvc_gateway_t *gw, char *line) {
+    line[strcspn(line, "\r\n")] = '\0';
+    bool close_it = strncmp(line, "close ", 6) == 0;
+    char *target = close_it ? line + 6 : line;
+    char *json = strchr(target, ' ');
+    if (json) {
+        *json++ = '\0';
+    }
+
+    struct sockaddr_in addr;
+    if (!parse_address(target, &addr)) {
+        fprintf(stderr, "quicvc-gatewayd: bad address %s\n", target);
+        return;
+    }
+    int device = quicvc_gateway_find(gw, &addr);
+    if (device == QUICVC_GATEWAY_NONE) {
+        if (close_it || !json ||
+            quicvc_gateway_resume(gw, &addr, COMMAND_STREAM, (const uint8_t *)json,
+                                  strlen(json)) == QUICVC_GATEWAY_NONE) {
+            fprintf(stderr, "quicvc-gatewayd: no connection to %s\n", target);
+        }
+        return;
+    }
+    if (close_it) {
+        quicvc_gateway_close(gw, device);
+    } else if (!json || !quicvc_gateway_send(gw, device, COMMAND_STREAM,
+                                             (const uint8_t *)json, strlen(json))) {
+        fprintf(stderr, "quicvc-gatewayd: %s is not established\n", target);
+    }
+}
+
+static void print_stats(const quicvc_gateway_t *gw) {
+    const quicvc_gateway_stats_t *s = quicvc_gateway_stats(gw);
+    quicvc_perf_summary_t handshake = quicvc_perf_summarize(&s->handshake_ns);
+    fprintf(stderr,
+            "quicvc-gatewayd: %zu established, rx %llu datagrams in %llu calls, "
+            "tx %llu datagrams in %llu calls (%llu errors), %llu by GRO, %llu by GSO, %llu dropped, "
+            "%llu handshakes (%llu retransmits, %llu retries), %llu resumptions (%llu fallbacks) "
+            "p50 %llu us p99 %llu us\n",
+            quicvc_gateway_established(gw),
+            (unsigned long long)s->datagrams_received, (unsigned long long)s->recv_calls,
+            (unsigned long long)s->datagrams_sent, (unsigned long long)s->send_calls,
+            (unsigned long long)s->send_errors, (unsigned long long)s->gro_datagrams,
+            (unsigned long long)s->gso_datagrams, (unsigned long long)s->dropped,
+            (unsigned long long)s->handshakes, (unsigned long long)s->handshake_retransmits,
+            (unsigned long long)s->retries, (unsigned long long)s->resumptions,
+            (unsigned long long)s->resumption_fallbacks,
+            (unsigned long long)(quicvc_perf_percentile(&s->handshake_ns, 50) / 1000),
+            (unsigned long long)(handshake.p99 / 1000));
+}
+
+static char *read_credential(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return NULL;
+    }
+    char *json = calloc(1, MAX_CREDENTIAL + 1);
+    size_t len = json ? fread(json, 1, MAX_CREDENTIAL + 1, f) : 0;
+    fclose(f);
+    if (len == 0 || len > MAX_CREDENTIAL) {
+        free(json);
+        return NULL;
+    }
+    // One line: the JSON goes into VC_INIT as it is
+    while (len > 0 && (json[len - 1] == '\n' || json[len - 1] == '\r')) {
+        json[--len] = '\0';
+    }
+    return json;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: quicvc-gatewayd -c credential.json [-p port] [-d discovery-port] "
+                    "[-n max-devices] [-s stats-seconds] [-b batch] [-O] [-m] [ip[:port] ...]\n");
+}
+
+int main(int argc, char **argv) {
+    quicvc_gateway_config_t config = {
+        .discovery_port = QUICVC_GATEWAY_DISCOVERY_PORT,
+        .max_devices = 256,
+        .on_event = on_event,
+    };
+    const char *credential_path = NULL;
+    unsigned stats_seconds = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:p:d:n:s:b:Om")) != -1) {
+        switch (opt) {
+            case 'c': credential_path = optarg; break;
+            case 'p': config.local_port = (uint16_t)atoi(optarg); break;
+            case 'd': config.discovery_port = (uint16_t)atoi(optarg); break;
+            case 'n': config.max_devices = (uint16_t)atoi(optarg); break;
+            case 's': stats_seconds = (unsigned)atoi(optarg); break;
+            case 'b': config.batch = (size_t)atoi(optarg); break;
+            case 'O': config.no_offload = true; break;
+            case 'm': manual = true; break;
+            default: usage(); return 2;
+        }
+    }
+    if (!credential_path) {
+        usage();
+        return 2;
+    }
+    char *credential = read_credential(credential_path);
+    if (!credential) {
+        fprintf(stderr, "quicvc-gatewayd: cannot read a credential of up to %d bytes from %s\n",
+                MAX_CREDENTIAL, credential_path);
+        return 1;
+    }
+    config.credential_json = credential;
+
+    quicvc_gateway_t *gw = quicvc_gateway_new(&config);
+    if (!gw) {
+        fprintf(stderr, "quicvc-gatewayd: cannot start: %s\n", strerror(errno));
+        free(credential);
+        return 1;
+    }
+    unsigned offload = quicvc_gateway_offload(gw);
+    fprintf(stderr, "quicvc-gatewayd: QUIC-VC on port %u, discovery %s, GSO %s, GRO %s\n",
+            quicvc_gateway_local_port(gw), config.discovery_port ? "on" : "off",
+            (offload & QUICVC_GATEWAY_GSO) ? "on" : "off", (offload & QUICVC_GATEWAY_GRO) ? "on" : "off");
+
+    for (int i = optind; i < argc; i++) {
+        struct sockaddr_in addr;
+        if (!parse_address(argv[i], &addr) || quicvc_gateway_connect(gw, &addr) == QUICVC_GATEWAY_NONE) {
+            fprintf(stderr, "quicvc-gatewayd: cannot connect to %s\n", argv[i]);
+        }
+    }
+
+    struct sigaction sa = { .sa_handler = on_signal };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+
+    struct pollfd fds[2] = {
+        { .fd = quicvc_gateway_fd(gw), .events = POLLIN },
+        { .fd = STDIN_FILENO, .events = POLLIN },
+    };
+    char line[MAX_LINE];
+    size_t line_len = 0;
+    time_t next_stats = time(NULL) + stats_seconds;
+    while (!stopping) {
+        int timeout = quicvc_gateway_timeout_ms(gw);
+        if (stats_seconds && (timeout < 0 || timeout > 1000)) {
+            timeout = 1000;
+        }
+        if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+            break;
+        }
+
+        // Datagrams and timers; the descriptor has been waited on already
+        quicvc_gateway_poll(gw, 0);
+
+        if (fds[1].fd >= 0 && (fds[1].revents & (POLLIN | POLLHUP))) {
+            ssize_t n;
+            while ((n = read(STDIN_FILENO, &line[line_len], sizeof(line) - 1 - line_len)) > 0) {
+                line_len += (size_t)n;
+                char *newline;
+                while ((newline = memchr(line, '\n', line_len)) != NULL) {
+                    *newline = '\0';
+                    handle_command(gw, line);
+                    line_len -= (size_t)(newline + 1 - line);
+                    memmove(line, newline + 1, line_len);
+                }
+                if (line_len == sizeof(line) - 1) {
+                    line_len = 0;       // Over-long line: drop it
+                }
+            }
+            if (n == 0) {
+                fds[1].fd = -1;         // stdin closed; keep serving devices
+            }
+            quicvc_gateway_flush(gw);
+        }
+
+        if (stats_seconds && time(NULL) >= next_stats) {
+            print_stats(gw);
+            next_stats = time(NULL) + stats_seconds;
+        }
+    }
+
+    print_stats(gw);
+    quicvc_gateway_free(gw);
+    free(credential);
+    return 0;
+}
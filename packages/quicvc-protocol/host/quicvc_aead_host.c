@@ -0,0 +1,221 @@
+/**
+ * QUIC-VC packet protection for host builds - OpenSSL backend
+ */
+
+#include "quicvc_aead_host.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+struct quicvc_host_aead {
+    EVP_CIPHER_CTX *seal;   // Both keyed at creation; a packet only
+    EVP_CIPHER_CTX *open;   // sets its nonce
+    uint8_t iv[QUICVC_AEAD_NONCE_LENGTH];
+};
+
+quicvc_host_aead_t *quicvc_host_aead_new(const uint8_t *key, const uint8_t *iv) {
+    quicvc_host_aead_t *aead = calloc(1, sizeof(*aead));
+    if (!aead) {
+        return NULL;
+    }
+    aead->seal = EVP_CIPHER_CTX_new();
+    aead->open = EVP_CIPHER_CTX_new();
+    if (!aead->seal || !aead->open ||
+        EVP_EncryptInit_ex(aead->seal, EVP_aes_256_gcm(), NULL, key, NULL) != 1 ||
+        EVP_DecryptInit_ex(aead->open, EVP_aes_256_gcm(), NULL, key, NULL) != 1) {
+        quicvc_host_aead_free(aead);
+        return NULL;
+    }
+    memcpy(aead->iv, iv, QUICVC_AEAD_NONCE_LENGTH);
+    return aead;
+}
+
+bool quicvc_host_aead_derive(const uint8_t *session_key, const char *sender,
+                             uint8_t *key, uint8_t *iv) {
+    static const char *const suffixes[2] = { "-send", "-iv" };
+    uint8_t digest[2][EVP_MAX_MD_SIZE];
+    EVP_MD_CTX *sha = EVP_MD_CTX_new();
+    bool ok = sha != NULL;
+    for (int i = 0; ok && i < 2; i++) {
+        ok = EVP_DigestInit_ex(sha, EVP_sha256(), NULL) == 1 &&
+             EVP_DigestUpdate(sha, session_key, 32) == 1 &&
+             EVP_DigestUpdate(sha, sender, strlen(sender)) == 1 &&
+             EVP_DigestUpdate(sha, suffixes[i], strlen(suffixes[i])) == 1 &&
+             EVP_DigestFinal_ex(sha, digest[i], NULL) == 1;
+    }
+    EVP_MD_CTX_free(sha);
+    if (!ok) {
+        return false;
+    }
+    memcpy(key, digest[0], QUICVC_AEAD_KEY_LENGTH);
+    memcpy(iv, digest[1], QUICVC_AEAD_NONCE_LENGTH);
+    memset(digest, 0, sizeof(digest));
+    return true;
+}
+
+bool quicvc_host_key_share(uint8_t *private_key, uint8_t *public_key) {
+    size_t len = QUICVC_KEY_SHARE_LENGTH;
+    EVP_PKEY *key = NULL;
+    bool ok = RAND_bytes(private_key, QUICVC_KEY_SHARE_LENGTH) == 1 &&
+              (key = EVP_PKEY_new_raw_private_key(EVP_PKEY_X25519, NULL, private_key,
+                                                  QUICVC_KEY_SHARE_LENGTH)) != NULL &&
+              EVP_PKEY_get_raw_public_key(key, public_key, &len) == 1;
+    EVP_PKEY_free(key);
+    return ok;
+}
+
+bool quicvc_host_key_exchange(const uint8_t *private_key, const uint8_t *peer_public,
+                              uint8_t *shared) {
+    EVP_PKEY *key = EVP_PKEY_new_raw_private_key(EVP_PKEY_X25519, NULL, private_key,
+                                                 QUICVC_KEY_SHARE_LENGTH);
+    EVP_PKEY *peer = EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, NULL, peer_public,
+                                                 QUICVC_KEY_SHARE_LENGTH);
+    EVP_PKEY_CTX *ctx = key ? EVP_PKEY_CTX_new(key, NULL) : NULL;
+    size_t len = 32;
+    bool ok = ctx != NULL && peer != NULL &&
+              EVP_PKEY_derive_init(ctx) == 1 &&
+              EVP_PKEY_derive_set_peer(ctx, peer) == 1 &&
+              EVP_PKEY_derive(ctx, shared, &len) == 1 && len == 32;
+    EVP_PKEY_CTX_free(ctx);
+    EVP_PKEY_free(peer);
+    EVP_PKEY_free(key);
+    return ok;
+}
+
+bool quicvc_host_derive(const uint8_t *secret, const char *label,
+                        const uint8_t *context, size_t context_len, uint8_t *out) {
+    EVP_MD_CTX *sha = EVP_MD_CTX_new();
+    bool ok = sha != NULL &&
+              EVP_DigestInit_ex(sha, EVP_sha256(), NULL) == 1 &&
+              EVP_DigestUpdate(sha, secret, 32) == 1 &&
+              EVP_DigestUpdate(sha, label, strlen(label)) == 1 &&
+              (context_len == 0 || EVP_DigestUpdate(sha, context, context_len) == 1) &&
+              EVP_DigestFinal_ex(sha, out, NULL) == 1;
+    EVP_MD_CTX_free(sha);
+    return ok;
+}
+
+void quicvc_host_aead_free(quicvc_host_aead_t *aead) {
+    if (aead) {
+        EVP_CIPHER_CTX_free(aead->seal);
+        EVP_CIPHER_CTX_free(aead->open);
+        memset(aead->iv, 0, sizeof(aead->iv));
+        free(aead);
+    }
+}
+
+static bool quicvc_host_seal(quicvc_host_aead_t *aead, quicvc_aead_packet_t *p) {
+    quicvc_iovec_t in_place = { NULL, p->payload_len };
+    const quicvc_iovec_t *iov = p->iov;
+    size_t iov_count = p->iov_count;
+    if (!iov) {
+        in_place.iov_base = &p->packet[p->header_len];
+        iov = &in_place;
+        iov_count = 1;
+    }
+
+    size_t plain_len = 0;
+    for (size_t i = 0; i < iov_count; i++) {
+        plain_len += iov[i].iov_len;
+    }
+    if (p->header_len > p->packet_size ||
+        plain_len + QUICVC_AEAD_TAG_LENGTH > p->packet_size - p->header_len) {
+        return false;
+    }
+
+    uint8_t nonce[QUICVC_AEAD_NONCE_LENGTH];
+    quicvc_aead_nonce(aead->iv, p->packet_number, nonce);
+
+    int len;
+    EVP_CIPHER_CTX *ctx = aead->seal;
+    if (EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, nonce) != 1 ||
+        EVP_EncryptUpdate(ctx, NULL, &len, p->packet, (int)p->header_len) != 1) {
+        return false;
+    }
+    size_t offset = p->header_len;
+    for (size_t i = 0; i < iov_count; i++) {
+        if (EVP_EncryptUpdate(ctx, &p->packet[offset], &len,
+                              iov[i].iov_base, (int)iov[i].iov_len) != 1) {
+            return false;
+        }
+        offset += (size_t)len;
+    }
+    if (EVP_EncryptFinal_ex(ctx, &p->packet[offset], &len) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, QUICVC_AEAD_TAG_LENGTH,
+                            &p->packet[p->header_len + plain_len]) != 1) {
+        return false;
+    }
+
+    p->payload_len = plain_len;
+    p->packet_len = p->header_len + plain_len + QUICVC_AEAD_TAG_LENGTH;
+    return true;
+}
+
+static bool quicvc_host_open(quicvc_host_aead_t *aead, quicvc_aead_packet_t *p) {
+    if (p->header_len > p->packet_len || p->packet_len - p->header_len < QUICVC_AEAD_TAG_LENGTH) {
+        return false;
+    }
+    size_t data_len = p->packet_len - p->header_len - QUICVC_AEAD_TAG_LENGTH;
+    uint8_t *payload = &p->packet[p->header_len];
+
+    uint8_t nonce[QUICVC_AEAD_NONCE_LENGTH];
+    quicvc_aead_nonce(aead->iv, p->packet_number, nonce);
+
+    int len;
+    EVP_CIPHER_CTX *ctx = aead->open;
+    if (EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, nonce) != 1 ||
+        EVP_DecryptUpdate(ctx, NULL, &len, p->packet, (int)p->header_len) != 1 ||
+        EVP_DecryptUpdate(ctx, payload, &len, payload, (int)data_len) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, QUICVC_AEAD_TAG_LENGTH,
+                            &payload[data_len]) != 1 ||
+        EVP_DecryptFinal_ex(ctx, &payload[len], &len) != 1) {
+        return false;
+    }
+
+    p->payload_len = data_len;
+    return true;
+}
+
+size_t quicvc_host_seal_batch(quicvc_host_aead_t *aead, quicvc_aead_packet_t *packets, size_t count) {
+    size_t sealed = 0;
+    for (size_t i = 0; i < count; i++) {
+        packets[i].ok = quicvc_host_seal(aead, &packets[i]);
+        sealed += packets[i].ok;
+    }
+    return sealed;
+}
+
+size_t quicvc_host_open_batch(quicvc_host_aead_t *aead, quicvc_aead_packet_t *packets, size_t count) {
+    size_t opened = 0;
+    for (size_t i = 0; i < count; i++) {
+        packets[i].ok = quicvc_host_open(aead, &packets[i]);
+        opened += packets[i].ok;
+    }
+    return opened;
+}
+
+static void *quicvc_openssl_create(const uint8_t *key, const uint8_t *iv) {
+    return quicvc_host_aead_new(key, iv);
+}
+
+static void quicvc_openssl_destroy(void *state) {
+    quicvc_host_aead_free(state);
+}
+
+static size_t quicvc_openssl_seal_batch(void *state, quicvc_aead_packet_t *packets, size_t count) {
+    return quicvc_host_seal_batch(state, packets, count);
+}
+
+static size_t quicvc_openssl_open_batch(void *state, quicvc_aead_packet_t *packets, size_t count) {
+    return quicvc_host_open_batch(state, packets, count);
+}
+
+const quicvc_aead_backend_t quicvc_aead_openssl = {
+    .name = "openssl",
+    .create = quicvc_openssl_create,
+    .destroy = quicvc_openssl_destroy,
+    .seal_batch = quicvc_openssl_seal_batch,
+    .open_batch = quicvc_openssl_open_batch,
+};
@@ -0,0 +1,89 @@
+/**
+ * QUIC-VC packet protection for host builds (gateways, tools, tests)
+ *
+ * Software AEAD_AES_256_GCM on OpenSSL's libcrypto behind the batch
+ * descriptors of quicvc_protocol.h. A context holds one direction's key,
+ * expanded once, and its IV; seal and open reuse that key schedule for
+ * every packet of a batch and only reset the nonce. The same context is
+ * available as the "openssl" quicvc_aead_backend_t, which uses AES-NI
+ * and PCLMULQDQ (or the ARMv8 equivalents) wherever the CPU has them.
+ * The key exchange and labels of the session key schedule (see "Session
+ * Keys" in quicvc_protocol.h) are here too, for the controller end.
+ *
+ * Link with -lcrypto.
+ */
+
+#ifndef QUICVC_AEAD_HOST_H
+#define QUICVC_AEAD_HOST_H
+
+#include "quicvc_protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct quicvc_host_aead quicvc_host_aead_t;
+
+extern const quicvc_aead_backend_t quicvc_aead_openssl;
+
+/**
+ * Derive one direction's key and IV from the session key using the
+ * schedule documented at quicvc_aead_backend_t; 'sender' is "server" or
+ * "client"
+ * Returns false if hashing fails
+ */
+bool quicvc_host_aead_derive(const uint8_t *session_key, const char *sender,
+                             uint8_t *key, uint8_t *iv);
+
+/**
+ * Fresh X25519 key share: a random private key and its public key, each
+ * QUICVC_KEY_SHARE_LENGTH bytes
+ * Returns false if libcrypto fails
+ */
+bool quicvc_host_key_share(uint8_t *private_key, uint8_t *public_key);
+
+/**
+ * X25519 shared secret (32 bytes) of our private key and the peer's
+ * public key
+ * Returns false if the peer's key is invalid (a low-order point)
+ */
+bool quicvc_host_key_exchange(const uint8_t *private_key, const uint8_t *peer_public,
+                              uint8_t *shared);
+
+/**
+ * SHA-256(secret || label || context): one step of the session key
+ * schedule; 'secret' and 'out' are 32 bytes, 'context' may be NULL
+ * Returns false if hashing fails
+ */
+bool quicvc_host_derive(const uint8_t *secret, const char *label,
+                        const uint8_t *context, size_t context_len, uint8_t *out);
+
+/**
+ * Create a context for 'key' (QUICVC_AEAD_KEY_LENGTH bytes) and 'iv'
+ * (QUICVC_AEAD_NONCE_LENGTH bytes)
+ * Returns NULL if libcrypto cannot set up the cipher
+ */
+quicvc_host_aead_t *quicvc_host_aead_new(const uint8_t *key, const uint8_t *iv);
+
+void quicvc_host_aead_free(quicvc_host_aead_t *aead);
+
+/**
+ * Seal 'count' packets in place
+ * Each packet's 'ok' is set and 'packet_len' filled in on success
+ * Returns the number of packets sealed
+ */
+size_t quicvc_host_seal_batch(quicvc_host_aead_t *aead, quicvc_aead_packet_t *packets, size_t count);
+
+/**
+ * Open 'count' packets in place
+ * A packet that fails authentication only clears its own 'ok'; its
+ * payload must not be used
+ * Returns the number of packets that authenticated
+ */
+size_t quicvc_host_open_batch(quicvc_host_aead_t *aead, quicvc_aead_packet_t *packets, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // QUICVC_AEAD_HOST_H
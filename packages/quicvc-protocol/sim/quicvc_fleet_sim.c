@@ -0,0 +1,1210 @@
+/**
+ * ESP32 fleet simulator for loopback load tests
+ * Compile with: cc -O2 -Ic-headers -Ihost sim/quicvc_fleet_sim.c host/quicvc_aead_host.c c-headers/quicvc_protocol.c -lcrypto -o quicvc-fleet-sim
+ *
+ *   quicvc-fleet-sim [-n devices] [-o owner] [-a first-address] [-d discovery-target]
+ *                    [-b presence-ms] [-i heartbeat-ms] [-t seconds] [-s stats-seconds]
+ *
+ * Runs N devices that behave like esp32-unified-with-quicvc.c on the
+ * wire, so DeviceDiscoveryModel, the gateway (gateway/quicvc_gatewayd.c)
+ * or anything else that talks to the boards can be loaded without them.
+ * Every device gets its own loopback address, counting up from
+ * 127.1.0.1, and serves QUIC-VC on the real port 49498; presence
+ * broadcasts ([0x01][DevicePresence HTML], "claimed" by the owner) go
+ * from that address to the discovery target, 127.0.0.1:49497 unless -d
+ * says otherwise, so listeners see one sender per device as on a LAN.
+ *
+ * Each device handles its connections the way the firmware does: the
+ * VC_INIT issuer must be the owner, the reply is the VC_RESPONSE
+ * HANDSHAKE with the device's X25519 key share, followed by a 1-RTT
+ * VC_TICKET, and every packet after it is sealed with the session keys
+ * ("Session Keys" in quicvc_protocol.h). A 0-RTT packet under one of
+ * the device's last 4 tickets is opened, its commands run, and answered
+ * with a sealed HANDSHAKE carrying the next ticket. INITIALs beyond 4 a second
+ * (or that would need an active session's slot) are answered with a
+ * stateless Retry, at most 4 connections are kept
+ * (the least recently used inactive one evicted, new peers refused while
+ * all 4 are active sessions), ack-eliciting packets are ACKed,
+ * HEARTBEAT frames go out on every connection at the heartbeat interval,
+ * led_control commands switch the device's LED, VC_PERF queries are
+ * answered, and connections close after 60 s without traffic. All
+ * devices share one timer wheel and one epoll loop, as the firmware's
+ * connections share quicvc_handler_task.
+ *
+ * Latency, per device and over the fleet:
+ *   rtt        HEARTBEAT sent to the ACK covering it: how quickly the
+ *              controller keeps up with the fleet's traffic
+ *   discovery  First presence broadcast while unconnected to the
+ *              handshake: how long discovery plus connect takes
+ *   seal/open  Sealing one outgoing packet and opening one that
+ *              authenticates, in ns
+ * Heartbeats and their ACKs are sealed like every other 1-RTT packet,
+ * so rtt includes the AEAD work at both ends, and the handshake the
+ * X25519 exchange; seal/open show how much of it is the simulator's.
+ * Fleet totals go to stderr every -s seconds; at the end, one line per
+ * device goes to stdout.
+ *
+ * Build with host/quicvc_aead_host.c and link with -lcrypto (key
+ * exchange, packet protection, Retry tokens and tags).
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/random.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include "quicvc_protocol.h"
+#include "quicvc_aead_host.h"
+
+#define SIM_DISCOVERY_PORT       49497
+#define SIM_QUICVC_PORT          49498
+#define SIM_SERVICE_DISCOVERY    1          // First byte of a presence broadcast
+#define SIM_CID_LEN              QUICVC_DEFAULT_CONNECTION_ID_LENGTH
+
+// Firmware limits and timings (esp32-unified-with-quicvc.c)
+#define SIM_MAX_CONNECTIONS      4
+#define SIM_RX_DATAGRAM_SIZE     QUICVC_MAX_PACKET_SIZE   // quicvc_handler_task's buffer
+#define SIM_CONN_INDEX_SIZE      8
+#define SIM_IDLE_TIMEOUT_US      60000000ull
+#define SIM_TX_COALESCE_US       20000
+#define SIM_RETRY_THRESHOLD      4
+#define SIM_RETRY_TOKEN_LIFETIME_S 10
+#define SIM_RETRY_MAC_LENGTH     16
+#define SIM_RETRY_TOKEN_LENGTH   (4 + SIM_RETRY_MAC_LENGTH)
+#define SIM_MAX_TICKETS          4
+#define SIM_TICKET_LIFETIME_S    (24 * 60 * 60)
+#define SIM_TICKET_FRAME_SIZE    (3 + QUICVC_TICKET_ID_LENGTH + 4)
+#define SIM_FREE_HEAP            182340     // Reported in heartbeats
+
+#define SIM_TIMER_TICK_US        1000
+#define SIM_EPOLL_EVENTS         256
+
+typedef struct sim_device sim_device_t;
+
+typedef struct {
+    uint8_t id[QUICVC_TICKET_ID_LENGTH];    // DCID of the client's 0-RTT packet
+    uint8_t resumption[32];
+    uint64_t expires_us;                    // 0: free
+} sim_ticket_t;
+
+typedef struct {
+    sim_device_t *device;
+    uint8_t dcid[QUICVC_MAX_CONNECTION_ID_LENGTH];  // Peer's CID (from its SCID)
+    uint8_t dcid_len;
+    uint8_t scid[SIM_CID_LEN];                      // Ours, DCID of short headers we receive
+    bool established;
+    bool closing;                   // Peer sent CONNECTION_CLOSE
+    uint8_t session_key[32];
+    void *aead_send;                // quicvc_aead_openssl states, once keyed
+    void *aead_recv;
+    uint64_t packet_number;
+    uint64_t largest_acked;         // QUICVC_PACKET_NUMBER_NONE until the peer ACKs
+    quicvc_ack_tracker_t ack_tracker;
+    uint64_t largest_received_us;
+    struct sockaddr_in peer_addr;
+    quicvc_packet_builder_t tx;
+    quicvc_timer_t idle_timer;
+    uint64_t idle_deadline_us;      // When idle_timer fires
+    quicvc_timer_t heartbeat_timer;
+    quicvc_timer_t flush_timer;
+    uint64_t heartbeat_pn;          // Packet of the last heartbeat, until ACKed
+    uint64_t heartbeat_sent_us;     // 0: none awaiting an ACK
+} sim_connection_t;
+
+typedef struct {
+    uint64_t presence_sent;
+    uint64_t initials;
+    uint64_t retries_sent;
+    uint64_t handshakes;
+    uint64_t resumptions;           // 0-RTT packets opened
+    uint64_t heartbeats_sent;
+    uint64_t packets_received;
+    uint64_t commands;              // led_control commands
+    uint64_t closed_by_peer;
+    uint64_t idle_timeouts;
+} sim_counters_t;
+
+struct sim_device {
+    int fd;
+    struct sockaddr_in addr;
+    char id[24];
+    bool led;
+
+    sim_connection_t connections[SIM_MAX_CONNECTIONS];
+    quicvc_conn_entry_t entries[SIM_MAX_CONNECTIONS];
+    uint16_t index[SIM_CONN_INDEX_SIZE];
+    quicvc_conn_table_t table;
+
+    uint8_t retry_secret[32];
+    sim_ticket_t tickets[SIM_MAX_TICKETS];
+    uint32_t initial_second;
+    uint32_t initial_count;
+
+    quicvc_timer_t presence_timer;
+    uint64_t unconnected_since_us;  // First presence while unconnected; 0 if none
+
+    sim_counters_t counters;
+    quicvc_perf_histogram_t rtt_us;
+    quicvc_perf_histogram_t discovery_us;
+    quicvc_perf_histogram_t perf[QUICVC_PERF_OP_COUNT];    // ns, for VC_PERF
+};
+
+typedef struct {
+    unsigned devices;
+    const char *owner;
+    struct in_addr first_addr;
+    struct sockaddr_in discovery_target;
+    uint64_t presence_interval_us;  // 0: no presence broadcasts
+    uint64_t heartbeat_interval_us;
+    unsigned duration_s;            // 0: until SIGINT or SIGTERM
+    unsigned stats_interval_s;
+} sim_config_t;
+
+static sim_config_t config;
+static sim_device_t *devices;
+static quicvc_timer_wheel_t timers;
+static quicvc_timer_t stats_timer;
+static uint64_t started_us;
+
+// Fleet-wide latency, alongside each device's own
+static quicvc_perf_histogram_t fleet_rtt_us;
+static quicvc_perf_histogram_t fleet_discovery_us;
+static quicvc_perf_histogram_t fleet_seal_ns;
+static quicvc_perf_histogram_t fleet_open_ns;
+
+static volatile sig_atomic_t stopping;
+
+// RFC 9001 Section 5.8 Retry integrity key and nonce
+static const uint8_t retry_integrity_key[16] = {
+    0xbe, 0x0c, 0x69, 0x0b, 0x9f, 0x66, 0x57, 0x5a,
+    0x1d, 0x76, 0x6b, 0x54, 0xe3, 0x68, 0xc8, 0x4e,
+};
+static const uint8_t retry_integrity_nonce[12] = {
+    0x46, 0x15, 0x99, 0xd3, 0x5d, 0x63, 0x2b, 0xf2, 0x23, 0x98, 0x25, 0xbb,
+};
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ull + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void random_bytes(uint8_t *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = getrandom(buf, len, 0);
+        if (n <= 0) continue;
+        buf += n;
+        len -= (size_t)n;
+    }
+}
+
+static uint64_t random_below(uint64_t bound) {
+    uint64_t r;
+    random_bytes((uint8_t *)&r, sizeof(r));
+    return bound ? r % bound : 0;
+}
+
+static void on_signal(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+// Copy the string value of the first "key":"..." in 'json' to 'out'
+static bool json_string(const uint8_t *json, size_t len, const char *key, char *out, size_t out_size) {
+    char pattern[32];
+    int pattern_len = snprintf(pattern, sizeof(pattern), "\"%s\":\"", key);
+    const char *start = memmem(json, len, pattern, (size_t)pattern_len);
+    if (!start) {
+        return false;
+    }
+    start += pattern_len;
+    const char *end = memchr(start, '"', len - (size_t)(start - (const char *)json));
+    if (!end || (size_t)(end - start) >= out_size) {
+        return false;
+    }
+    memcpy(out, start, (size_t)(end - start));
+    out[end - start] = '\0';
+    return true;
+}
+
+// Sending
+
+static void send_datagram(sim_device_t *device, const uint8_t *data, size_t len,
+                          const struct sockaddr_in *to) {
+    sendto(device->fd, data, len, 0, (const struct sockaddr *)to, sizeof(*to));
+}
+
+static void assign_packet_number(sim_connection_t *conn, quicvc_header_t *hdr) {
+    hdr->packet_number = conn->packet_number++;
+    hdr->packet_number_len = quicvc_packet_number_length(hdr->packet_number, conn->largest_acked);
+}
+
+// Seal 'payload' after the 'header_len' bytes of header at 'packet';
+// returns the packet length, or 0
+static size_t seal_packet(sim_connection_t *conn, uint8_t *packet, size_t header_len,
+                          uint64_t packet_number, const uint8_t *payload, size_t payload_len) {
+    uint64_t start = now_ns();
+    quicvc_iovec_t plaintext = { payload, payload_len };
+    quicvc_aead_packet_t sealed = {
+        .packet = packet,
+        .header_len = header_len,
+        .packet_size = QUICVC_MAX_PACKET_SIZE,
+        .iov = &plaintext,
+        .iov_count = 1,
+        .packet_number = packet_number,
+    };
+    if (header_len == 0 || quicvc_aead_openssl.seal_batch(conn->aead_send, &sealed, 1) != 1) {
+        return 0;
+    }
+    uint64_t elapsed = now_ns() - start;
+    quicvc_perf_record(&conn->device->perf[QUICVC_PERF_SEAL], elapsed);
+    quicvc_perf_record(&fleet_seal_ns, elapsed);
+    return sealed.packet_len;
+}
+
+// Packet builder flush callback: one sealed short header packet
+static void send_quicvc_packet(const uint8_t *payload, size_t payload_len, void *ctx) {
+    sim_connection_t *conn = ctx;
+    uint8_t packet[QUICVC_MAX_PACKET_SIZE];
+    quicvc_header_t hdr = {
+        .dcid = conn->dcid,
+        .dcid_len = conn->dcid_len,
+    };
+    assign_packet_number(conn, &hdr);
+    size_t len = seal_packet(conn, packet, quicvc_write_short_header(&hdr, packet, sizeof(packet)),
+                             hdr.packet_number, payload, payload_len);
+    if (len > 0) {
+        send_datagram(conn->device, packet, len, &conn->peer_addr);
+    }
+    quicvc_timer_cancel(&timers, &conn->flush_timer);
+}
+
+static void send_quicvc_ack(sim_connection_t *conn) {
+    uint64_t now = now_us();
+    quicvc_packet_builder_add_ack(&conn->tx, &conn->ack_tracker, now - conn->largest_received_us, now);
+    quicvc_packet_builder_flush(&conn->tx);
+}
+
+// The VC_RESPONSE of a full handshake goes in the clear; the answer to a
+// 0-RTT packet is 'sealed' under the resumed keys
+static void send_quicvc_handshake(sim_connection_t *conn, const uint8_t *payload, size_t payload_len,
+                                  bool sealed) {
+    uint8_t packet[QUICVC_MAX_PACKET_SIZE];
+    quicvc_header_t hdr = {
+        .packet_type = QUICVC_PACKET_TYPE_HANDSHAKE,
+        .version = QUICVC_VERSION,
+        .dcid = conn->dcid,
+        .dcid_len = conn->dcid_len,
+        .scid = conn->scid,
+        .scid_len = SIM_CID_LEN,
+    };
+    assign_packet_number(conn, &hdr);
+    size_t length = payload_len + (sealed ? QUICVC_AEAD_TAG_LENGTH : 0);
+    size_t offset = quicvc_write_long_header(&hdr, length, packet, sizeof(packet));
+    if (offset == 0 || length > sizeof(packet) - offset) {
+        return;
+    }
+    if (sealed) {
+        offset = seal_packet(conn, packet, offset, hdr.packet_number, payload, payload_len);
+    } else {
+        memcpy(&packet[offset], payload, payload_len);
+        offset += payload_len;
+    }
+    if (offset > 0) {
+        send_datagram(conn->device, packet, offset, &conn->peer_addr);
+    }
+}
+
+// Presence
+
+static void on_presence(quicvc_timer_t *timer, void *ctx) {
+    sim_device_t *device = ctx;
+    char packet[512];
+    int len = snprintf(packet, sizeof(packet),
+                       "%c<!DOCTYPE html>\n"
+                       "<html itemscope itemtype=\"https://refinio.one/DevicePresence\">\n"
+                       "<meta itemprop=\"$type$\" content=\"DevicePresence\">\n"
+                       "<meta itemprop=\"id\" content=\"%s\">\n"
+                       "<meta itemprop=\"type\" content=\"ESP32\">\n"
+                       "<meta itemprop=\"status\" content=\"online\">\n"
+                       "<meta itemprop=\"ownership\" content=\"claimed\">\n"
+                       "</html>", SIM_SERVICE_DISCOVERY, device->id);
+    send_datagram(device, (const uint8_t *)packet, (size_t)len, &config.discovery_target);
+    device->counters.presence_sent++;
+
+    uint64_t now = now_us();
+    if (device->table.count == 0 && device->unconnected_since_us == 0) {
+        device->unconnected_since_us = now;
+    }
+    quicvc_timer_schedule(&timers, timer, now + config.presence_interval_us);
+}
+
+// Connections
+
+static void release_connection(sim_connection_t *conn) {
+    sim_device_t *device = conn->device;
+    quicvc_timer_cancel(&timers, &conn->idle_timer);
+    quicvc_timer_cancel(&timers, &conn->heartbeat_timer);
+    quicvc_timer_cancel(&timers, &conn->flush_timer);
+    quicvc_aead_openssl.destroy(conn->aead_send);
+    quicvc_aead_openssl.destroy(conn->aead_recv);
+    memset(conn, 0, sizeof(*conn));
+    conn->device = device;
+}
+
+static void close_connection(sim_connection_t *conn) {
+    sim_device_t *device = conn->device;
+    quicvc_conn_table_remove(&device->table, (uint16_t)(conn - device->connections));
+    release_connection(conn);
+}
+
+static void on_idle_timeout(quicvc_timer_t *timer, void *ctx) {
+    sim_connection_t *conn = ctx;
+    (void)timer;
+    if (!conn->closing) {
+        conn->device->counters.idle_timeouts++;
+    }
+    close_connection(conn);
+}
+
+static void on_heartbeat(quicvc_timer_t *timer, void *ctx) {
+    sim_connection_t *conn = ctx;
+    sim_device_t *device = conn->device;
+    uint64_t now = now_us();
+    char hb[64];
+    int hb_len = snprintf(hb, sizeof(hb), "{\"timestamp\":%llu,\"free_heap\":%d}",
+                          (unsigned long long)((now - started_us) / 1000000), SIM_FREE_HEAP);
+    quicvc_packet_builder_add_vc_frame(&conn->tx, QUICVC_FRAME_HEARTBEAT,
+                                       (const uint8_t *)hb, (size_t)hb_len, now);
+    // The flush below sends the next packet number; an earlier heartbeat
+    // still unACKed is superseded
+    conn->heartbeat_pn = conn->packet_number;
+    conn->heartbeat_sent_us = now;
+    if (conn->ack_tracker.ack_pending) {
+        send_quicvc_ack(conn);
+    } else {
+        quicvc_packet_builder_flush(&conn->tx);
+    }
+    device->counters.heartbeats_sent++;
+    quicvc_timer_schedule(&timers, timer, now + config.heartbeat_interval_us);
+}
+
+static void on_flush_deadline(quicvc_timer_t *timer, void *ctx) {
+    sim_connection_t *conn = ctx;
+    (void)timer;
+    quicvc_packet_builder_flush(&conn->tx);
+}
+
+static void touch_connection(sim_connection_t *conn) {
+    conn->idle_deadline_us = now_us() + SIM_IDLE_TIMEOUT_US;
+    quicvc_timer_schedule(&timers, &conn->idle_timer, conn->idle_deadline_us);
+}
+
+static void start_connection_timers(sim_connection_t *conn) {
+    touch_connection(conn);
+    quicvc_timer_schedule(&timers, &conn->heartbeat_timer, now_us() + config.heartbeat_interval_us);
+}
+
+// An established session within its idle timeout; never displaced by a
+// new peer
+static bool connection_active(const sim_connection_t *conn) {
+    return conn->established && now_us() < conn->idle_deadline_us;
+}
+
+static bool connection_evictable(uint16_t slot, void *ctx) {
+    const sim_device_t *device = ctx;
+    return !connection_active(&device->connections[slot]);
+}
+
+// Whether new_connection() could serve an unvalidated address without
+// touching an active session
+static bool connection_room_for(const sim_device_t *device, const struct sockaddr_in *peer_addr) {
+    bool room = device->table.count < SIM_MAX_CONNECTIONS;
+    for (uint16_t i = 0; i < SIM_MAX_CONNECTIONS; i++) {
+        const sim_connection_t *conn = &device->connections[i];
+        if (!device->entries[i].in_use) {
+            continue;
+        }
+        bool active = connection_active(conn);
+        if (active && conn->peer_addr.sin_addr.s_addr == peer_addr->sin_addr.s_addr &&
+            conn->peer_addr.sin_port == peer_addr->sin_port) {
+            return false;
+        }
+        room |= !active;
+    }
+    return room;
+}
+
+// The same host and port reconnecting replaces its old connection, an
+// active one only once the address is validated; otherwise, with every
+// slot taken, the least recently used inactive one goes. NULL if every
+// slot holds an active session
+static sim_connection_t *new_connection(sim_device_t *device, const quicvc_header_t *hdr,
+                                        const struct sockaddr_in *peer_addr,
+                                        bool address_validated) {
+    for (uint16_t i = 0; i < SIM_MAX_CONNECTIONS; i++) {
+        if (device->entries[i].in_use &&
+            device->connections[i].peer_addr.sin_addr.s_addr == peer_addr->sin_addr.s_addr &&
+            device->connections[i].peer_addr.sin_port == peer_addr->sin_port) {
+            if (!address_validated && connection_active(&device->connections[i])) {
+                return NULL;
+            }
+            close_connection(&device->connections[i]);
+        }
+    }
+
+    uint8_t scid[SIM_CID_LEN];
+    do {
+        random_bytes(scid, sizeof(scid));
+    } while (quicvc_conn_table_find(&device->table, scid, sizeof(scid)) != QUICVC_CONN_NONE);
+    uint16_t evicted;
+    uint16_t slot = quicvc_conn_table_insert_evictable(&device->table, scid, sizeof(scid),
+                                                       connection_evictable, device, &evicted);
+    if (slot == QUICVC_CONN_NONE) {
+        return NULL;
+    }
+    if (evicted != QUICVC_CONN_NONE) {
+        release_connection(&device->connections[evicted]);
+    }
+
+    sim_connection_t *conn = &device->connections[slot];
+    memcpy(conn->scid, scid, sizeof(scid));
+    memcpy(conn->dcid, hdr->scid, hdr->scid_len);
+    conn->dcid_len = hdr->scid_len;
+    conn->peer_addr = *peer_addr;
+    conn->largest_acked = QUICVC_PACKET_NUMBER_NONE;
+    quicvc_ack_tracker_init(&conn->ack_tracker);
+    quicvc_packet_builder_init(&conn->tx,
+                               QUICVC_MAX_PACKET_SIZE - QUICVC_MAX_SHORT_HEADER_SIZE - QUICVC_AEAD_TAG_LENGTH,
+                               SIM_TX_COALESCE_US, send_quicvc_packet, conn);
+    quicvc_timer_init(&conn->idle_timer, on_idle_timeout, conn);
+    quicvc_timer_init(&conn->heartbeat_timer, on_heartbeat, conn);
+    quicvc_timer_init(&conn->flush_timer, on_flush_deadline, conn);
+    return conn;
+}
+
+// Retry
+
+static void retry_token_mac(const sim_device_t *device, const struct sockaddr_in *peer_addr,
+                            const uint8_t *retry_scid, uint32_t issued_at, uint8_t mac[32]) {
+    uint8_t input[4 + 2 + SIM_CID_LEN + 4];
+    memcpy(&input[0], &peer_addr->sin_addr.s_addr, 4);
+    memcpy(&input[4], &peer_addr->sin_port, 2);
+    memcpy(&input[6], retry_scid, SIM_CID_LEN);
+    for (int i = 0; i < 4; i++) {
+        input[6 + SIM_CID_LEN + i] = (uint8_t)(issued_at >> (24 - 8 * i));
+    }
+    unsigned mac_len = 32;
+    HMAC(EVP_sha256(), device->retry_secret, sizeof(device->retry_secret),
+         input, sizeof(input), mac, &mac_len);
+}
+
+static bool validate_retry_token(const sim_device_t *device, const quicvc_header_t *hdr,
+                                 const struct sockaddr_in *peer_addr) {
+    if (hdr->token_len != SIM_RETRY_TOKEN_LENGTH || hdr->dcid_len != SIM_CID_LEN) {
+        return false;
+    }
+    uint32_t issued_at = ((uint32_t)hdr->token[0] << 24) | ((uint32_t)hdr->token[1] << 16) |
+                         ((uint32_t)hdr->token[2] << 8) | hdr->token[3];
+    uint32_t now = (uint32_t)(now_us() / 1000000);
+    if (issued_at > now || now - issued_at > SIM_RETRY_TOKEN_LIFETIME_S) {
+        return false;
+    }
+    uint8_t mac[32];
+    retry_token_mac(device, peer_addr, hdr->dcid, issued_at, mac);
+    uint8_t diff = 0;
+    for (int i = 0; i < SIM_RETRY_MAC_LENGTH; i++) {
+        diff |= mac[i] ^ hdr->token[4 + i];
+    }
+    return diff == 0;
+}
+
+static bool initial_over_threshold(sim_device_t *device) {
+    uint32_t now = (uint32_t)(now_us() / 1000000);
+    if (now != device->initial_second) {
+        device->initial_second = now;
+        device->initial_count = 0;
+    }
+    return ++device->initial_count > SIM_RETRY_THRESHOLD;
+}
+
+static void send_quicvc_retry(sim_device_t *device, const quicvc_header_t *hdr,
+                              const struct sockaddr_in *peer_addr) {
+    uint8_t pseudo[1 + QUICVC_MAX_CONNECTION_ID_LENGTH + 128];
+    size_t prefix = 1 + hdr->dcid_len;
+    pseudo[0] = hdr->dcid_len;
+    memcpy(&pseudo[1], hdr->dcid, hdr->dcid_len);
+
+    uint8_t retry_scid[SIM_CID_LEN];
+    random_bytes(retry_scid, sizeof(retry_scid));
+    uint32_t issued_at = (uint32_t)(now_us() / 1000000);
+    uint8_t token[SIM_RETRY_TOKEN_LENGTH];
+    uint8_t mac[32];
+    for (int i = 0; i < 4; i++) {
+        token[i] = (uint8_t)(issued_at >> (24 - 8 * i));
+    }
+    retry_token_mac(device, peer_addr, retry_scid, issued_at, mac);
+    memcpy(&token[4], mac, SIM_RETRY_MAC_LENGTH);
+
+    quicvc_header_t retry = {
+        .version = QUICVC_VERSION,
+        .dcid = hdr->scid,
+        .dcid_len = hdr->scid_len,
+        .scid = retry_scid,
+        .scid_len = sizeof(retry_scid),
+    };
+    uint8_t *packet = &pseudo[prefix];
+    size_t len = quicvc_write_retry(&retry, token, sizeof(token), packet, sizeof(pseudo) - prefix);
+    if (len == 0) {
+        return;
+    }
+
+    int out_len;
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    bool ok = ctx != NULL &&
+        EVP_EncryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, retry_integrity_key,
+                           retry_integrity_nonce) == 1 &&
+        EVP_EncryptUpdate(ctx, NULL, &out_len, pseudo, (int)(prefix + len)) == 1 &&
+        EVP_EncryptFinal_ex(ctx, &packet[len], &out_len) == 1 &&
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, QUICVC_RETRY_INTEGRITY_TAG_LENGTH,
+                            &packet[len]) == 1;
+    EVP_CIPHER_CTX_free(ctx);
+    if (ok) {
+        send_datagram(device, packet, len + QUICVC_RETRY_INTEGRITY_TAG_LENGTH, peer_addr);
+        device->counters.retries_sent++;
+    }
+}
+
+// Handshake
+
+// 1-RTT states from the session key; the device sends as "server"
+static bool key_connection(sim_connection_t *conn) {
+    uint8_t key[QUICVC_AEAD_KEY_LENGTH];
+    uint8_t iv[QUICVC_AEAD_NONCE_LENGTH];
+    bool ok = quicvc_host_aead_derive(conn->session_key, "server", key, iv) &&
+              (conn->aead_send = quicvc_aead_openssl.create(key, iv)) != NULL &&
+              quicvc_host_aead_derive(conn->session_key, "client", key, iv) &&
+              (conn->aead_recv = quicvc_aead_openssl.create(key, iv)) != NULL;
+    memset(key, 0, sizeof(key));
+    memset(iv, 0, sizeof(iv));
+    return ok;
+}
+
+// Our key share for the VC_RESPONSE, as hex, and the session key from the
+// controller's; false if its key is not a valid X25519 public key
+static bool derive_session_keys(sim_connection_t *conn, const char *peer_key, const char *challenge,
+                                char *public_hex) {
+    uint8_t peer[QUICVC_KEY_SHARE_LENGTH], private_key[QUICVC_KEY_SHARE_LENGTH];
+    uint8_t public_key[QUICVC_KEY_SHARE_LENGTH], shared[QUICVC_KEY_SHARE_LENGTH];
+    for (size_t i = 0; i < sizeof(peer); i++) {
+        unsigned byte;
+        if (sscanf(&peer_key[2 * i], "%2x", &byte) != 1) {
+            return false;
+        }
+        peer[i] = (uint8_t)byte;
+    }
+    bool ok = quicvc_host_key_share(private_key, public_key) &&
+              quicvc_host_key_exchange(private_key, peer, shared) &&
+              quicvc_host_derive(shared, "quicvc session", (const uint8_t *)challenge,
+                                 strlen(challenge), conn->session_key) &&
+              key_connection(conn);
+    memset(private_key, 0, sizeof(private_key));
+    memset(shared, 0, sizeof(shared));
+    for (size_t i = 0; i < sizeof(public_key); i++) {
+        snprintf(&public_hex[2 * i], 3, "%02x", public_key[i]);
+    }
+    return ok;
+}
+
+// Issue a ticket bound to the connection's session key, the oldest making
+// room, and write its VC_TICKET frame:
+// [type][length(2)][ticket_id][lifetime_s(4)]
+static size_t issue_ticket(sim_connection_t *conn, uint8_t *out) {
+    sim_device_t *device = conn->device;
+    uint64_t now = now_us();
+    sim_ticket_t *slot = &device->tickets[0];
+    for (int i = 0; i < SIM_MAX_TICKETS; i++) {
+        if (device->tickets[i].expires_us <= now) {
+            slot = &device->tickets[i];
+            break;
+        }
+        if (device->tickets[i].expires_us < slot->expires_us) {
+            slot = &device->tickets[i];
+        }
+    }
+    random_bytes(slot->id, QUICVC_TICKET_ID_LENGTH);
+    quicvc_host_derive(conn->session_key, "quicvc resumption", slot->id, QUICVC_TICKET_ID_LENGTH,
+                       slot->resumption);
+    slot->expires_us = now + SIM_TICKET_LIFETIME_S * 1000000ull;
+
+    out[0] = QUICVC_FRAME_VC_TICKET;
+    out[1] = 0;
+    out[2] = QUICVC_TICKET_ID_LENGTH + 4;
+    memcpy(&out[3], slot->id, QUICVC_TICKET_ID_LENGTH);
+    for (int i = 0; i < 4; i++) {
+        out[3 + QUICVC_TICKET_ID_LENGTH + i] = (uint8_t)(SIM_TICKET_LIFETIME_S >> (24 - 8 * i));
+    }
+    return SIM_TICKET_FRAME_SIZE;
+}
+
+static void handle_quicvc_initial(sim_device_t *device, const quicvc_header_t *hdr,
+                                  const struct sockaddr_in *peer_addr) {
+    uint64_t start = now_ns();
+    device->counters.initials++;
+
+    bool over_threshold = initial_over_threshold(device);
+    if (hdr->token_len > 0) {
+        if (!validate_retry_token(device, hdr, peer_addr)) {
+            return;
+        }
+    } else if (over_threshold || !connection_room_for(device, peer_addr)) {
+        send_quicvc_retry(device, hdr, peer_addr);
+        return;
+    }
+
+    char issuer[128], challenge[128], key[2 * QUICVC_KEY_SHARE_LENGTH + 1];
+    if (hdr->scid_len == 0 ||
+        !json_string(hdr->payload, hdr->payload_len, "issuer", issuer, sizeof(issuer)) ||
+        !json_string(hdr->payload, hdr->payload_len, "challenge", challenge, sizeof(challenge)) ||
+        !json_string(hdr->payload, hdr->payload_len, "key", key, sizeof(key)) ||
+        strlen(key) != 2 * QUICVC_KEY_SHARE_LENGTH || strcmp(issuer, config.owner) != 0) {
+        return;
+    }
+
+    sim_connection_t *conn = new_connection(device, hdr, peer_addr, hdr->token_len > 0);
+    if (!conn) {
+        return;
+    }
+    uint64_t derive_start = now_ns();
+    char public_key[2 * QUICVC_KEY_SHARE_LENGTH + 1];
+    if (!derive_session_keys(conn, key, challenge, public_key)) {
+        close_connection(conn);
+        return;
+    }
+    quicvc_perf_record(&device->perf[QUICVC_PERF_KEY_DERIVATION], now_ns() - derive_start);
+
+    // What cJSON_PrintUnformatted makes of the firmware's response
+    char response[512];
+    int response_len = snprintf(response, sizeof(response),
+        "{\"type\":\"VC_RESPONSE\",\"credential\":{\"id\":\"%s\",\"issuer\":\"%s\","
+        "\"subject\":\"%s\",\"issued_at\":%u,\"expires_at\":%u,\"proof\":{\"type\":"
+        "\"Ed25519Signature2020\",\"proofValue\":\"hw-crypto-signature\"}},\"challenge\":\"%s\","
+        "\"key\":\"%s\"}",
+        device->id, config.owner, device->id, 1700000000u, 1900000000u, challenge, public_key);
+    if (response_len < 0 || (size_t)response_len >= sizeof(response)) {
+        close_connection(conn);
+        return;
+    }
+    send_quicvc_handshake(conn, (const uint8_t *)response, (size_t)response_len, false);
+    quicvc_perf_record(&device->perf[QUICVC_PERF_HANDSHAKE], now_ns() - start);
+    conn->established = true;
+    start_connection_timers(conn);
+    device->counters.handshakes++;
+
+    uint64_t now = now_us();
+    if (device->unconnected_since_us != 0) {
+        quicvc_perf_record(&device->discovery_us, now - device->unconnected_since_us);
+        quicvc_perf_record(&fleet_discovery_us, now - device->unconnected_since_us);
+        device->unconnected_since_us = 0;
+    }
+
+    // Ticket for the client's next reconnect, in the first 1-RTT packet
+    uint8_t ticket[SIM_TICKET_FRAME_SIZE];
+    quicvc_packet_builder_add(&conn->tx, ticket, issue_ticket(conn, ticket), now);
+    quicvc_packet_builder_flush(&conn->tx);
+}
+
+// Returns true if the packet needs an ACK
+static bool handle_quicvc_protected(sim_connection_t *conn, const uint8_t *payload, size_t len) {
+    sim_device_t *device = conn->device;
+    bool ack_eliciting = false;
+    if (!conn->established) {
+        return false;
+    }
+    touch_connection(conn);
+
+    quicvc_frame_iter_t iter;
+    quicvc_frame_t frame;
+    quicvc_frame_iter_init(&iter, payload, len);
+    while (quicvc_frame_iter_next(&iter, &frame)) {
+        if (frame.type != QUICVC_FRAME_ACK && frame.type != QUICVC_FRAME_ACK_ECN &&
+            frame.type != QUICVC_FRAME_PADDING) {
+            ack_eliciting = true;
+        }
+        switch (frame.type) {
+            case QUICVC_FRAME_ACK:
+            case QUICVC_FRAME_ACK_ECN:
+                if (conn->largest_acked == QUICVC_PACKET_NUMBER_NONE ||
+                    frame.u.ack.largest_acknowledged > conn->largest_acked) {
+                    conn->largest_acked = frame.u.ack.largest_acknowledged;
+                }
+                if (conn->heartbeat_sent_us != 0 &&
+                    frame.u.ack.largest_acknowledged >= conn->heartbeat_pn) {
+                    uint64_t rtt = now_us() - conn->heartbeat_sent_us;
+                    quicvc_perf_record(&device->rtt_us, rtt);
+                    quicvc_perf_record(&fleet_rtt_us, rtt);
+                    conn->heartbeat_sent_us = 0;
+                }
+                break;
+
+            case QUICVC_FRAME_VC_PERF:
+                if (frame.u.vc.body_len == 0) {
+                    // Nanoseconds, reported as cycles of a 1000 MHz clock
+                    uint8_t report[QUICVC_PERF_FRAME_SIZE];
+                    size_t report_len = quicvc_perf_write_frame(device->perf, 1000,
+                                                                report, sizeof(report));
+                    quicvc_packet_builder_add(&conn->tx, report, report_len, now_us());
+                }
+                break;
+
+            case QUICVC_FRAME_CONNECTION_CLOSE:
+            case QUICVC_FRAME_CONNECTION_CLOSE_APP:
+                // Closed on the next tick, once the caller is done with it
+                device->counters.closed_by_peer++;
+                conn->closing = true;
+                quicvc_timer_schedule(&timers, &conn->idle_timer, 0);
+                return false;
+
+            default:
+                if ((frame.type & 0xF8) == QUICVC_FRAME_STREAM && frame.u.stream.data_len > 0) {
+                    char type[32], state[8];
+                    if (json_string(frame.u.stream.data, frame.u.stream.data_len, "type",
+                                    type, sizeof(type)) && strcmp(type, "led_control") == 0 &&
+                        json_string(frame.u.stream.data, frame.u.stream.data_len, "state",
+                                    state, sizeof(state))) {
+                        device->led = strcmp(state, "on") == 0;
+                        device->counters.commands++;
+                    }
+                }
+                break;
+        }
+    }
+    if (conn->tx.len > 0) {
+        quicvc_timer_schedule(&timers, &conn->flush_timer, conn->tx.deadline_us);
+    }
+    return ack_eliciting;
+}
+
+// Open 'packet' in place under 'aead', the header as AAD; false if it
+// does not authenticate
+static bool open_packet(sim_device_t *device, void *aead, uint8_t *packet, const quicvc_header_t *hdr,
+                        uint64_t packet_number, size_t *payload_len) {
+    uint64_t start = now_ns();
+    size_t header_len = (size_t)(hdr->payload - packet);
+    quicvc_aead_packet_t p = {
+        .packet = packet,
+        .header_len = header_len,
+        .packet_len = header_len + hdr->payload_len,
+        .packet_number = packet_number,
+    };
+    if (quicvc_aead_openssl.open_batch(aead, &p, 1) != 1) {
+        return false;
+    }
+    uint64_t elapsed = now_ns() - start;
+    quicvc_perf_record(&device->perf[QUICVC_PERF_OPEN], elapsed);
+    quicvc_perf_record(&fleet_open_ns, elapsed);
+    *payload_len = p.payload_len;
+    return true;
+}
+
+// A 0-RTT packet: the DCID names one of our tickets, which is used up once
+// the packet opens under its 0-RTT key. Its commands run at once; the
+// sealed HANDSHAKE reply ACKs them and carries the next ticket.
+static void handle_quicvc_zero_rtt(sim_device_t *device, const quicvc_header_t *hdr, uint8_t *packet,
+                                   const struct sockaddr_in *peer_addr) {
+    uint64_t now = now_us();
+    sim_ticket_t *ticket = NULL;
+    for (int i = 0; i < SIM_MAX_TICKETS && hdr->dcid_len == QUICVC_TICKET_ID_LENGTH; i++) {
+        if (device->tickets[i].expires_us > now &&
+            memcmp(device->tickets[i].id, hdr->dcid, QUICVC_TICKET_ID_LENGTH) == 0) {
+            ticket = &device->tickets[i];
+            break;
+        }
+    }
+    if (!ticket || hdr->scid_len == 0) {
+        return;
+    }
+    uint8_t key[32], iv[32];
+    quicvc_host_derive(ticket->resumption, "quicvc 0rtt key", NULL, 0, key);
+    quicvc_host_derive(ticket->resumption, "quicvc 0rtt iv", NULL, 0, iv);
+    void *aead = quicvc_aead_openssl.create(key, iv);
+    memset(key, 0, sizeof(key));
+    memset(iv, 0, sizeof(iv));
+    uint64_t packet_number = quicvc_decode_packet_number(0, hdr->packet_number, hdr->packet_number_len);
+    size_t payload_len;
+    bool opened = aead && open_packet(device, aead, packet, hdr, packet_number, &payload_len);
+    quicvc_aead_openssl.destroy(aead);
+    if (!opened) {
+        return;
+    }
+    uint8_t resumption[32];
+    memcpy(resumption, ticket->resumption, sizeof(resumption));
+    memset(ticket, 0, sizeof(*ticket));
+
+    sim_connection_t *conn = new_connection(device, hdr, peer_addr, true);
+    bool keyed = conn && quicvc_host_derive(resumption, "quicvc resumed", NULL, 0, conn->session_key) &&
+                 key_connection(conn);
+    memset(resumption, 0, sizeof(resumption));
+    if (!keyed) {
+        if (conn) {
+            close_connection(conn);
+        }
+        return;
+    }
+    conn->established = true;
+    start_connection_timers(conn);
+    device->counters.resumptions++;
+    quicvc_ack_tracker_record(&conn->ack_tracker, packet_number);
+    conn->largest_received_us = now;
+    handle_quicvc_protected(conn, hdr->payload, payload_len);
+
+    uint8_t frames[64];
+    size_t frames_len = quicvc_ack_tracker_write_frame(&conn->ack_tracker, 0, frames, sizeof(frames));
+    frames_len += issue_ticket(conn, &frames[frames_len]);
+    send_quicvc_handshake(conn, frames, frames_len, true);
+}
+
+static void handle_datagram(sim_device_t *device, uint8_t *data, size_t len,
+                            const struct sockaddr_in *peer_addr) {
+    size_t offset = 0;
+    while (offset < len) {
+        quicvc_header_parse_result_t parsed =
+            quicvc_parse_header(&data[offset], len - offset, SIM_CID_LEN);
+        if (parsed.bytes_consumed == 0) {
+            return;
+        }
+        uint8_t *packet = &data[offset];
+        offset += parsed.bytes_consumed;
+        const quicvc_header_t *hdr = &parsed.header;
+        device->counters.packets_received++;
+
+        if (hdr->is_long) {
+            if (hdr->packet_type == QUICVC_PACKET_TYPE_INITIAL) {
+                handle_quicvc_initial(device, hdr, peer_addr);
+            } else if (hdr->packet_type == QUICVC_PACKET_TYPE_ZERO_RTT) {
+                handle_quicvc_zero_rtt(device, hdr, packet, peer_addr);
+            }
+            continue;
+        }
+        uint16_t slot = hdr->dcid_len != SIM_CID_LEN ? QUICVC_CONN_NONE
+            : quicvc_conn_table_find(&device->table, hdr->dcid, hdr->dcid_len);
+        if (slot == QUICVC_CONN_NONE) {
+            continue;
+        }
+        sim_connection_t *conn = &device->connections[slot];
+        quicvc_ack_tracker_t *tracker = &conn->ack_tracker;
+        uint64_t packet_number = quicvc_decode_packet_number(
+            tracker->has_packets ? tracker->largest + 1 : 0,
+            hdr->packet_number, hdr->packet_number_len);
+        // Duplicates are dropped before the AEAD, and only packets that
+        // open are recorded
+        size_t payload_len;
+        if (!conn->established || quicvc_ack_tracker_contains(tracker, packet_number) ||
+            !open_packet(device, conn->aead_recv, packet, hdr, packet_number, &payload_len) ||
+            !quicvc_ack_tracker_record(tracker, packet_number)) {
+            continue;
+        }
+        if (packet_number == tracker->largest) {
+            conn->largest_received_us = now_us();
+        }
+        if (handle_quicvc_protected(conn, hdr->payload, payload_len)) {
+            send_quicvc_ack(conn);
+        }
+    }
+}
+
+static void receive(sim_device_t *device) {
+    uint8_t buffer[SIM_RX_DATAGRAM_SIZE];
+    struct sockaddr_in peer_addr;
+    for (;;) {
+        socklen_t addr_len = sizeof(peer_addr);
+        ssize_t len = recvfrom(device->fd, buffer, sizeof(buffer), MSG_DONTWAIT,
+                               (struct sockaddr *)&peer_addr, &addr_len);
+        if (len <= 0) {
+            return;
+        }
+        handle_datagram(device, buffer, (size_t)len, &peer_addr);
+    }
+}
+
+// Reports
+
+static sim_counters_t fleet_counters(size_t *connected) {
+    sim_counters_t total = {0};
+    *connected = 0;
+    for (unsigned i = 0; i < config.devices; i++) {
+        const sim_counters_t *c = &devices[i].counters;
+        total.presence_sent += c->presence_sent;
+        total.initials += c->initials;
+        total.retries_sent += c->retries_sent;
+        total.handshakes += c->handshakes;
+        total.resumptions += c->resumptions;
+        total.heartbeats_sent += c->heartbeats_sent;
+        total.packets_received += c->packets_received;
+        total.commands += c->commands;
+        total.closed_by_peer += c->closed_by_peer;
+        total.idle_timeouts += c->idle_timeouts;
+        *connected += devices[i].table.count > 0;
+    }
+    return total;
+}
+
+static void print_fleet(void) {
+    size_t connected;
+    sim_counters_t c = fleet_counters(&connected);
+    quicvc_perf_summary_t rtt = quicvc_perf_summarize(&fleet_rtt_us);
+    quicvc_perf_summary_t discovery = quicvc_perf_summarize(&fleet_discovery_us);
+    quicvc_perf_summary_t seal = quicvc_perf_summarize(&fleet_seal_ns);
+    quicvc_perf_summary_t open = quicvc_perf_summarize(&fleet_open_ns);
+    fprintf(stderr,
+            "quicvc-fleet-sim: %llus %zu/%u connected | presence %llu, INITIAL %llu, Retry %llu, "
+            "handshakes %llu, 0-RTT %llu | rx %llu packets, %llu commands | heartbeats %llu, "
+            "rtt p50 %llu p99 %llu max %llu us | discovery p50 %llu p99 %llu us | "
+            "seal p50 %llu p99 %llu ns, open p50 %llu p99 %llu ns | "
+            "closed %llu by peer, %llu idle\n",
+            (unsigned long long)((now_us() - started_us) / 1000000), connected, config.devices,
+            (unsigned long long)c.presence_sent, (unsigned long long)c.initials,
+            (unsigned long long)c.retries_sent, (unsigned long long)c.handshakes,
+            (unsigned long long)c.resumptions,
+            (unsigned long long)c.packets_received, (unsigned long long)c.commands,
+            (unsigned long long)c.heartbeats_sent,
+            (unsigned long long)quicvc_perf_percentile(&fleet_rtt_us, 50),
+            (unsigned long long)rtt.p99, (unsigned long long)rtt.max,
+            (unsigned long long)quicvc_perf_percentile(&fleet_discovery_us, 50),
+            (unsigned long long)discovery.p99,
+            (unsigned long long)quicvc_perf_percentile(&fleet_seal_ns, 50), (unsigned long long)seal.p99,
+            (unsigned long long)quicvc_perf_percentile(&fleet_open_ns, 50), (unsigned long long)open.p99,
+            (unsigned long long)c.closed_by_peer, (unsigned long long)c.idle_timeouts);
+}
+
+static void on_stats(quicvc_timer_t *timer, void *ctx) {
+    (void)ctx;
+    print_fleet();
+    quicvc_timer_schedule(&timers, timer, now_us() + config.stats_interval_s * 1000000ull);
+}
+
+static void print_devices(void) {
+    printf("%-18s %-15s %5s %10s %10s %10s %3s %10s %10s %10s %12s %11s %11s\n", "device",
+           "address", "conns", "handshakes", "heartbeats", "commands", "led", "rtt_p50_us",
+           "rtt_p99_us", "rtt_max_us", "discovery_us", "seal_p50_ns", "open_p50_ns");
+    for (unsigned i = 0; i < config.devices; i++) {
+        const sim_device_t *d = &devices[i];
+        char addr[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &d->addr.sin_addr, addr, sizeof(addr));
+        quicvc_perf_summary_t rtt = quicvc_perf_summarize(&d->rtt_us);
+        quicvc_perf_summary_t discovery = quicvc_perf_summarize(&d->discovery_us);
+        printf("%-18s %-15s %5zu %10llu %10llu %10llu %3s %10llu %10llu %10llu %12llu %11llu %11llu\n",
+               d->id, addr, d->table.count, (unsigned long long)d->counters.handshakes,
+               (unsigned long long)d->counters.heartbeats_sent,
+               (unsigned long long)d->counters.commands, d->led ? "on" : "off",
+               (unsigned long long)quicvc_perf_percentile(&d->rtt_us, 50),
+               (unsigned long long)rtt.p99, (unsigned long long)rtt.max,
+               (unsigned long long)discovery.avg,
+               (unsigned long long)quicvc_perf_percentile(&d->perf[QUICVC_PERF_SEAL], 50),
+               (unsigned long long)quicvc_perf_percentile(&d->perf[QUICVC_PERF_OPEN], 50));
+    }
+}
+
+// Setup
+
+static bool parse_address(const char *text, uint16_t default_port, struct sockaddr_in *addr) {
+    char ip[INET_ADDRSTRLEN];
+    const char *colon = strchr(text, ':');
+    size_t len = colon ? (size_t)(colon - text) : strlen(text);
+    if (len >= sizeof(ip)) {
+        return false;
+    }
+    memcpy(ip, text, len);
+    ip[len] = '\0';
+    *addr = (struct sockaddr_in){
+        .sin_family = AF_INET,
+        .sin_port = htons(colon ? (uint16_t)atoi(colon + 1) : default_port),
+    };
+    return inet_pton(AF_INET, ip, &addr->sin_addr) == 1 && addr->sin_port != 0;
+}
+
+static bool start_device(sim_device_t *device, unsigned index, int epoll_fd) {
+    uint32_t ip = ntohl(config.first_addr.s_addr) + index;
+    device->addr = (struct sockaddr_in){
+        .sin_family = AF_INET,
+        .sin_port = htons(SIM_QUICVC_PORT),
+        .sin_addr.s_addr = htonl(ip),
+    };
+    snprintf(device->id, sizeof(device->id), "esp32-%012llx", 0x020000000000ull | index);
+    device->fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+    if (device->fd < 0 ||
+        bind(device->fd, (struct sockaddr *)&device->addr, sizeof(device->addr)) < 0) {
+        return false;
+    }
+    struct epoll_event event = { .events = EPOLLIN, .data.u32 = index };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, device->fd, &event) < 0) {
+        return false;
+    }
+
+    quicvc_conn_table_init(&device->table, device->entries, SIM_MAX_CONNECTIONS,
+                           device->index, SIM_CONN_INDEX_SIZE);
+    for (int i = 0; i < SIM_MAX_CONNECTIONS; i++) {
+        device->connections[i].device = device;
+    }
+    random_bytes(device->retry_secret, sizeof(device->retry_secret));
+    quicvc_perf_init(&device->rtt_us);
+    quicvc_perf_init(&device->discovery_us);
+    for (int op = 0; op < QUICVC_PERF_OP_COUNT; op++) {
+        quicvc_perf_init(&device->perf[op]);
+    }
+
+    // First broadcasts spread over one interval, not all in the first tick
+    quicvc_timer_init(&device->presence_timer, on_presence, device);
+    if (config.presence_interval_us) {
+        quicvc_timer_schedule(&timers, &device->presence_timer,
+                              now_us() + random_below(config.presence_interval_us));
+    }
+    return true;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: quicvc-fleet-sim [-n devices] [-o owner] [-a first-address] "
+                    "[-d discovery-target] [-b presence-ms] [-i heartbeat-ms] [-t seconds] "
+                    "[-s stats-seconds]\n");
+}
+
+int main(int argc, char **argv) {
+    config = (sim_config_t){
+        .devices = 1000,
+        .owner = "owner-1",
+        .presence_interval_us = 5000000,
+        .heartbeat_interval_us = 20000000,
+        .stats_interval_s = 5,
+    };
+    inet_pton(AF_INET, "127.1.0.1", &config.first_addr);
+    parse_address("127.0.0.1", SIM_DISCOVERY_PORT, &config.discovery_target);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:o:a:d:b:i:t:s:")) != -1) {
+        switch (opt) {
+            case 'n': config.devices = (unsigned)atoi(optarg); break;
+            case 'o': config.owner = optarg; break;
+            case 'a':
+                if (inet_pton(AF_INET, optarg, &config.first_addr) != 1) {
+                    usage();
+                    return 2;
+                }
+                break;
+            case 'd':
+                if (!parse_address(optarg, SIM_DISCOVERY_PORT, &config.discovery_target)) {
+                    usage();
+                    return 2;
+                }
+                break;
+            case 'b': config.presence_interval_us = strtoull(optarg, NULL, 10) * 1000; break;
+            case 'i': config.heartbeat_interval_us = strtoull(optarg, NULL, 10) * 1000; break;
+            case 't': config.duration_s = (unsigned)atoi(optarg); break;
+            case 's': config.stats_interval_s = (unsigned)atoi(optarg); break;
+            default: usage(); return 2;
+        }
+    }
+    uint32_t first = ntohl(config.first_addr.s_addr);
+    if (config.devices == 0 || config.heartbeat_interval_us == 0 ||
+        (first >> 24) != 127 || ((first + config.devices - 1) >> 24) != 127) {
+        fprintf(stderr, "quicvc-fleet-sim: need at least one device, a heartbeat interval, "
+                        "and addresses inside 127.0.0.0/8\n");
+        return 2;
+    }
+
+    // One socket per device
+    struct rlimit files;
+    getrlimit(RLIMIT_NOFILE, &files);
+    if (files.rlim_cur < config.devices + 16) {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+        if (files.rlim_cur < config.devices + 16) {
+            fprintf(stderr, "quicvc-fleet-sim: %u devices need more than the %llu open files allowed\n",
+                    config.devices, (unsigned long long)files.rlim_cur);
+            return 1;
+        }
+    }
+
+    devices = calloc(config.devices, sizeof(*devices));
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (!devices || epoll_fd < 0) {
+        fprintf(stderr, "quicvc-fleet-sim: out of memory\n");
+        return 1;
+    }
+    started_us = now_us();
+    quicvc_timer_wheel_init(&timers, started_us, SIM_TIMER_TICK_US);
+    quicvc_perf_init(&fleet_rtt_us);
+    quicvc_perf_init(&fleet_discovery_us);
+    quicvc_perf_init(&fleet_seal_ns);
+    quicvc_perf_init(&fleet_open_ns);
+    for (unsigned i = 0; i < config.devices; i++) {
+        if (!start_device(&devices[i], i, epoll_fd)) {
+            char addr[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &devices[i].addr.sin_addr, addr, sizeof(addr));
+            fprintf(stderr, "quicvc-fleet-sim: cannot bind %s:%d: %s\n", addr, SIM_QUICVC_PORT,
+                    strerror(errno));
+            return 1;
+        }
+    }
+    quicvc_timer_init(&stats_timer, on_stats, NULL);
+    if (config.stats_interval_s) {
+        quicvc_timer_schedule(&timers, &stats_timer, started_us + config.stats_interval_s * 1000000ull);
+    }
+
+    char first_text[INET_ADDRSTRLEN], target_text[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &config.first_addr, first_text, sizeof(first_text));
+    inet_ntop(AF_INET, &config.discovery_target.sin_addr, target_text, sizeof(target_text));
+    fprintf(stderr, "quicvc-fleet-sim: %u devices from %s:%d, owner %s, presence to %s:%u\n",
+            config.devices, first_text, SIM_QUICVC_PORT, config.owner, target_text,
+            ntohs(config.discovery_target.sin_port));
+
+    struct sigaction sa = { .sa_handler = on_signal };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    uint64_t end_us = config.duration_s ? started_us + config.duration_s * 1000000ull : 0;
+    struct epoll_event events[SIM_EPOLL_EVENTS];
+    while (!stopping && (end_us == 0 || now_us() < end_us)) {
+        int timeout = -1;
+        uint64_t next = quicvc_timer_wheel_next_deadline(&timers);
+        if (end_us && (next == QUICVC_TIMER_NONE || next > end_us)) {
+            next = end_us;
+        }
+        if (next != QUICVC_TIMER_NONE) {
+            uint64_t now = now_us();
+            timeout = next > now ? (int)((next - now + 999) / 1000) : 0;
+        }
+        int n = epoll_wait(epoll_fd, events, SIM_EPOLL_EVENTS, timeout);
+        for (int i = 0; i < n; i++) {
+            receive(&devices[events[i].data.u32]);
+        }
+        quicvc_timer_wheel_advance(&timers, now_us());
+    }
+
+    print_fleet();
+    print_devices();
+    for (unsigned i = 0; i < config.devices; i++) {
+        close(devices[i].fd);
+    }
+    close(epoll_fd);
+    free(devices);
+    return 0;
+}
@@ -25,6 +25,9 @@ export const PACKET_NUMBER_LENGTH_MASK = 0x03; // Bits 1-0: Packet number length
 export const SPIN_BIT = 0x20;             // Bit 5: Spin bit
 export const KEY_PHASE_BIT = 0x04;        // Bit 2: Key phase
 
+// Retry packets end in an integrity tag instead of a packet number and payload
+export const RETRY_INTEGRITY_TAG_LENGTH = 16;
+
 // Standard QUIC Frame Types (RFC 9000)
 export enum QuicFrameType {
   PADDING = 0x00,
@@ -59,6 +62,8 @@ export enum QuicVCFrameType {
   VC_INIT = 0x10,          // VC handshake initiation
   VC_RESPONSE = 0x11,      // VC handshake response
   VC_ACK = 0x12,           // VC handshake acknowledgment
+  VC_TICKET = 0x13,        // Resumption ticket for 0-RTT
+  VC_PERF = 0x14,          // Latency report (empty body: query)
   DISCOVERY = 0x01,        // Device discovery (reusing PING semantics)
   HEARTBEAT = 0x20,        // Keep-alive heartbeat
 }
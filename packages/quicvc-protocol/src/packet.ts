@@ -10,7 +10,8 @@ import {
   FIXED_BIT,
   PACKET_NUMBER_LENGTH_MASK,
   MAX_CONNECTION_ID_LENGTH,
-  DEFAULT_CONNECTION_ID_LENGTH
+  DEFAULT_CONNECTION_ID_LENGTH,
+  RETRY_INTEGRITY_TAG_LENGTH
 } from './constants';
 import { encodeVarint, decodeVarint } from './varint';
 
@@ -20,7 +21,7 @@ export interface QuicLongHeader {
   version: number;
   dcid: Uint8Array;
   scid: Uint8Array;
-  token?: Uint8Array;  // Only for INITIAL packets
+  token?: Uint8Array;  // INITIAL packets, and the token a RETRY carries
   packetNumber: bigint;
   packetNumberLength: number; // 1-4 bytes
 }
@@ -123,6 +124,50 @@ export function buildLongHeaderPacket(
   return packet;
 }
 
+/**
+ * Build a Retry packet (RFC 9000 Section 17.2.5)
+ * The integrity tag is computed by the caller over the pseudo-packet
+ * (RFC 9001 Section 5.8); the payload of a parsed Retry is that tag
+ */
+export function buildRetryPacket(
+  version: number,
+  dcid: Uint8Array,
+  scid: Uint8Array,
+  token: Uint8Array,
+  integrityTag: Uint8Array
+): Uint8Array {
+  if (dcid.length > MAX_CONNECTION_ID_LENGTH || scid.length > MAX_CONNECTION_ID_LENGTH) {
+    throw new Error('Connection ID too long');
+  }
+  if (integrityTag.length !== RETRY_INTEGRITY_TAG_LENGTH) {
+    throw new Error('Retry integrity tag must be 16 bytes');
+  }
+
+  const packet = new Uint8Array(1 + 4 + 1 + dcid.length + 1 + scid.length +
+                                token.length + integrityTag.length);
+  let offset = 0;
+
+  packet[offset++] = LONG_HEADER_BIT | FIXED_BIT | (QuicPacketType.RETRY << 4);
+  packet[offset++] = (version >> 24) & 0xff;
+  packet[offset++] = (version >> 16) & 0xff;
+  packet[offset++] = (version >> 8) & 0xff;
+  packet[offset++] = version & 0xff;
+
+  packet[offset++] = dcid.length;
+  packet.set(dcid, offset);
+  offset += dcid.length;
+
+  packet[offset++] = scid.length;
+  packet.set(scid, offset);
+  offset += scid.length;
+
+  packet.set(token, offset);
+  offset += token.length;
+  packet.set(integrityTag, offset);
+
+  return packet;
+}
+
 /**
  * Build a QUIC short header packet (1-RTT)
  */
@@ -211,6 +256,28 @@ function parseLongHeader(packet: Uint8Array, firstByte: number): { header: QuicL
   const scid = packet.slice(offset, offset + scidLength);
   offset += scidLength;
 
+  // Retry: the token runs to the integrity tag; no Length or packet number
+  if (packetType === QuicPacketType.RETRY) {
+    if (offset + RETRY_INTEGRITY_TAG_LENGTH > packet.length) {
+      throw new Error('Packet too short for Retry integrity tag');
+    }
+    const tagOffset = packet.length - RETRY_INTEGRITY_TAG_LENGTH;
+    return {
+      header: {
+        type: 'long',
+        packetType,
+        version,
+        dcid,
+        scid,
+        token: packet.slice(offset, tagOffset),
+        packetNumber: 0n,
+        packetNumberLength: 0
+      },
+      headerLength: tagOffset,
+      payload: packet.slice(tagOffset)
+    };
+  }
+
   // Token (INITIAL packets only)
   let token: Uint8Array | undefined;
   if (packetType === QuicPacketType.INITIAL) {
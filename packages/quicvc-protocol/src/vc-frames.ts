@@ -5,6 +5,7 @@
 
 import { QuicVCFrameType, QuicVCErrorCode } from './constants';
 import { QuicFrame } from './frames';
+import { encodeVarint, decodeVarint } from './varint';
 
 /**
  * Device Identity Credential (simplified for QUIC-VC)
@@ -258,6 +259,166 @@ export class VCAckFrame implements QuicFrame {
   }
 }
 
+/**
+ * VC_TICKET Frame - Resumption ticket issued after a completed handshake
+ *
+ * The ticket ID is the destination connection ID of a later ZERO_RTT
+ * packet; both sides derive the early keys from the handshake session
+ * key and the ticket ID. A ticket is accepted once and then discarded.
+ */
+export const VC_TICKET_ID_LENGTH = 16;
+
+export class VCTicketFrame implements QuicFrame {
+  type = QuicVCFrameType.VC_TICKET;
+
+  constructor(
+    public ticketId: Uint8Array,
+    public lifetimeSeconds: number
+  ) {
+    if (ticketId.length !== VC_TICKET_ID_LENGTH) {
+      throw new Error(`VC_TICKET frame: ticket ID must be ${VC_TICKET_ID_LENGTH} bytes`);
+    }
+  }
+
+  serialize(): Uint8Array {
+    const length = VC_TICKET_ID_LENGTH + 4;
+
+    // Frame format: [type(1)][length(2)][ticket_id(16)][lifetime_s(4)]
+    const frame = new Uint8Array(3 + length);
+    frame[0] = this.type;
+    frame[1] = (length >> 8) & 0xff;
+    frame[2] = length & 0xff;
+    frame.set(this.ticketId, 3);
+    new DataView(frame.buffer).setUint32(3 + VC_TICKET_ID_LENGTH, this.lifetimeSeconds >>> 0);
+
+    return frame;
+  }
+
+  static parse(buffer: Uint8Array, offset: number = 0): { frame: VCTicketFrame; bytesRead: number } {
+    let pos = offset;
+
+    // Skip frame type
+    pos++;
+
+    // Read length (2 bytes, big-endian)
+    const length = (buffer[pos] << 8) | buffer[pos + 1];
+    pos += 2;
+
+    if (length < VC_TICKET_ID_LENGTH + 4 || pos + length > buffer.length) {
+      throw new Error('VC_TICKET frame: truncated');
+    }
+
+    const ticketId = buffer.slice(pos, pos + VC_TICKET_ID_LENGTH);
+    const lifetimeSeconds = new DataView(buffer.buffer, buffer.byteOffset)
+      .getUint32(pos + VC_TICKET_ID_LENGTH);
+
+    return {
+      frame: new VCTicketFrame(ticketId, lifetimeSeconds),
+      bytesRead: 3 + length
+    };
+  }
+}
+
+/**
+ * VC_PERF Frame - Per-operation latency report
+ *
+ * Sent with no entries it asks the peer for its report. Values are CPU
+ * cycles when cyclesPerMicrosecond is set, otherwise nanoseconds; p99 is
+ * exact to within 25% (the C side keeps log-linear histograms).
+ */
+export enum VCPerfOperation {
+  KEY_DERIVATION = 0,
+  SEAL = 1,
+  OPEN = 2,
+  HANDSHAKE = 3,
+  SEAL_BATCH = 4,   // Per batch of more than one packet
+  OPEN_BATCH = 5,
+}
+
+export interface VCPerfEntry {
+  operation: VCPerfOperation;
+  count: bigint;
+  min: bigint;
+  avg: bigint;
+  p99: bigint;
+  max: bigint;
+}
+
+export class VCPerfFrame implements QuicFrame {
+  type = QuicVCFrameType.VC_PERF;
+
+  constructor(
+    public cyclesPerMicrosecond: number = 0,
+    public entries: VCPerfEntry[] = [],
+    public isQuery: boolean = false
+  ) {}
+
+  static query(): VCPerfFrame {
+    return new VCPerfFrame(0, [], true);
+  }
+
+  serialize(): Uint8Array {
+    // Frame format: [type(1)][length(2)][cycles_per_us(i)] then per entry
+    // [op(1)][count(i)][min(i)][avg(i)][p99(i)][max(i)]; a query has no body
+    const parts: Uint8Array[] = [];
+    if (!this.isQuery) {
+      parts.push(encodeVarint(this.cyclesPerMicrosecond));
+      for (const e of this.entries) {
+        parts.push(Uint8Array.of(e.operation));
+        for (const v of [e.count, e.min, e.avg, e.p99, e.max]) {
+          parts.push(encodeVarint(v));
+        }
+      }
+    }
+    const length = parts.reduce((n, p) => n + p.length, 0);
+
+    const frame = new Uint8Array(3 + length);
+    frame[0] = this.type;
+    frame[1] = (length >> 8) & 0xff;
+    frame[2] = length & 0xff;
+    let pos = 3;
+    for (const p of parts) {
+      frame.set(p, pos);
+      pos += p.length;
+    }
+    return frame;
+  }
+
+  static parse(buffer: Uint8Array, offset: number = 0): { frame: VCPerfFrame; bytesRead: number } {
+    let pos = offset + 1;
+
+    const length = (buffer[pos] << 8) | buffer[pos + 1];
+    pos += 2;
+    const end = pos + length;
+    if (end > buffer.length) {
+      throw new Error('VC_PERF frame: truncated');
+    }
+    if (length === 0) {
+      return { frame: VCPerfFrame.query(), bytesRead: 3 };
+    }
+
+    const next = (): bigint => {
+      if (pos >= end) throw new Error('VC_PERF frame: truncated');
+      const { value, bytesRead } = decodeVarint(buffer, pos);
+      pos += bytesRead;
+      if (pos > end) throw new Error('VC_PERF frame: truncated');
+      return value;
+    };
+
+    const cyclesPerMicrosecond = Number(next());
+    const entries: VCPerfEntry[] = [];
+    while (pos < end) {
+      const operation = buffer[pos++] as VCPerfOperation;
+      entries.push({ operation, count: next(), min: next(), avg: next(), p99: next(), max: next() });
+    }
+
+    return {
+      frame: new VCPerfFrame(cyclesPerMicrosecond, entries),
+      bytesRead: 3 + length
+    };
+  }
+}
+
 /**
  * DISCOVERY Frame - Device discovery broadcast
  */
@@ -383,6 +544,10 @@ export function parseVCFrame(buffer: Uint8Array, offset: number = 0): { frame: Q
       return VCResponseFrame.parse(buffer, offset);
     case QuicVCFrameType.VC_ACK:
       return VCAckFrame.parse(buffer, offset);
+    case QuicVCFrameType.VC_TICKET:
+      return VCTicketFrame.parse(buffer, offset);
+    case QuicVCFrameType.VC_PERF:
+      return VCPerfFrame.parse(buffer, offset);
     case QuicVCFrameType.DISCOVERY:
       return DiscoveryFrame.parse(buffer, offset);
     case QuicVCFrameType.HEARTBEAT:
@@ -0,0 +1,140 @@
+/**
+ * Host test for the received packet tracker and ACK frame generation
+ * Compile with: cc -Ic-headers test/quicvc_ack_tracker_test.c c-headers/quicvc_protocol.c -o ack-test
+ *
+ * Each case records a packet number sequence, writes the ACK frame,
+ * parses it back through the frame iterator and compares the expanded
+ * ranges (largest first) with the expected ones.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "quicvc_protocol.h"
+
+#define MAX_EXPECTED 8
+
+typedef struct {
+    const char *name;
+    uint64_t packets[24];
+    size_t packet_count;
+    quicvc_pn_range_t expected[MAX_EXPECTED];   // Largest range first
+    size_t expected_count;
+} ack_vector_t;
+
+static const ack_vector_t vectors[] = {
+    { "single", {0}, 1, {{0, 0}}, 1 },
+    { "in order", {0, 1, 2, 3, 4}, 5, {{0, 4}}, 1 },
+    { "one gap", {0, 1, 3, 4}, 4, {{3, 4}, {0, 1}}, 2 },
+    { "reordered fills gap", {0, 2, 3, 1}, 4, {{0, 3}}, 1 },
+    { "duplicates", {5, 5, 6, 6, 5}, 5, {{5, 6}}, 1 },
+    { "jump past window", {0, 1, 2, 200, 201}, 5, {{200, 201}, {0, 2}}, 2 },
+    { "window edge joins list", {10, 11, 74, 75, 9}, 5, {{74, 75}, {9, 11}}, 2 },
+    { "late packet below window", {100, 101, 300, 20}, 4, {{300, 300}, {100, 101}, {20, 20}}, 3 },
+    { "late packet merges range", {100, 101, 300, 99, 102}, 5, {{300, 300}, {99, 102}}, 2 },
+};
+
+// Expand an ACK frame back into ranges, largest first
+static size_t decode_ranges(const uint8_t *frame_bytes, size_t len, quicvc_pn_range_t *out, size_t max) {
+    quicvc_frame_iter_t iter;
+    quicvc_frame_t frame;
+    uint64_t pairs[2 * MAX_EXPECTED];
+
+    quicvc_frame_iter_init(&iter, frame_bytes, len);
+    if (!quicvc_frame_iter_next(&iter, &frame) || frame.type != QUICVC_FRAME_ACK || iter.offset != len) {
+        return 0;
+    }
+
+    size_t pair_count = quicvc_ack_frame_ranges(&frame.u.ack, pairs, MAX_EXPECTED);
+    if (pair_count != frame.u.ack.range_count || pair_count + 1 > max) {
+        return 0;
+    }
+
+    out[0].largest = frame.u.ack.largest_acknowledged;
+    out[0].smallest = out[0].largest - frame.u.ack.first_range;
+    for (size_t i = 0; i < pair_count; i++) {
+        out[i + 1].largest = out[i].smallest - pairs[2 * i] - 2;
+        out[i + 1].smallest = out[i + 1].largest - pairs[2 * i + 1];
+    }
+    return pair_count + 1;
+}
+
+int main(void) {
+    int failures = 0;
+
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+        const ack_vector_t *v = &vectors[i];
+        quicvc_ack_tracker_t tracker;
+        quicvc_pn_range_t got[MAX_EXPECTED];
+        uint8_t frame[64];
+
+        quicvc_ack_tracker_init(&tracker);
+        for (size_t p = 0; p < v->packet_count; p++) {
+            quicvc_ack_tracker_record(&tracker, v->packets[p]);
+        }
+
+        size_t len = quicvc_ack_tracker_write_frame(&tracker, 0, frame, sizeof(frame));
+        size_t count = decode_ranges(frame, len, got, MAX_EXPECTED);
+        bool match = count == v->expected_count && !tracker.ack_pending;
+        for (size_t r = 0; match && r < count; r++) {
+            match = got[r].smallest == v->expected[r].smallest &&
+                    got[r].largest == v->expected[r].largest;
+        }
+        if (!match) {
+            printf("FAIL %s: %zu ranges, want %zu\n", v->name, count, v->expected_count);
+            failures++;
+        }
+    }
+
+    // Duplicates are reported, including ones that left the window
+    quicvc_ack_tracker_t tracker;
+    quicvc_ack_tracker_init(&tracker);
+    quicvc_ack_tracker_record(&tracker, 7);
+    quicvc_ack_tracker_record(&tracker, 500);
+    if (quicvc_ack_tracker_record(&tracker, 7) || quicvc_ack_tracker_record(&tracker, 500) ||
+        !quicvc_ack_tracker_contains(&tracker, 7) || quicvc_ack_tracker_contains(&tracker, 8)) {
+        printf("FAIL duplicate detection\n");
+        failures++;
+    }
+
+    // Ack delay is scaled by the default exponent
+    uint8_t frame[64];
+    quicvc_frame_iter_t iter;
+    quicvc_frame_t parsed;
+    size_t len = quicvc_ack_tracker_write_frame(&tracker, 800, frame, sizeof(frame));
+    quicvc_frame_iter_init(&iter, frame, len);
+    if (!quicvc_frame_iter_next(&iter, &parsed) || parsed.u.ack.ack_delay != 800 >> QUICVC_DEFAULT_ACK_DELAY_EXPONENT) {
+        printf("FAIL ack delay\n");
+        failures++;
+    }
+
+    // Alternating losses: more ranges than fit, older ones are dropped
+    quicvc_ack_tracker_init(&tracker);
+    for (uint64_t pn = 0; pn < 1000; pn += 2) {
+        quicvc_ack_tracker_record(&tracker, pn);
+    }
+    for (size_t size = 0; size <= sizeof(frame); size++) {
+        len = quicvc_ack_tracker_write_frame(&tracker, 0, frame, size);
+        quicvc_frame_iter_init(&iter, frame, len);
+        if (len > size || (len > 0 && (!quicvc_frame_iter_next(&iter, &parsed) || iter.offset != len))) {
+            printf("FAIL truncated frame in %zu bytes\n", size);
+            failures++;
+            break;
+        }
+    }
+    if (tracker.range_count != QUICVC_ACK_MAX_RANGES || !quicvc_ack_tracker_contains(&tracker, 998)) {
+        printf("FAIL bounded range list\n");
+        failures++;
+    }
+
+    // Nothing received, nothing to acknowledge
+    quicvc_ack_tracker_init(&tracker);
+    if (quicvc_ack_tracker_write_frame(&tracker, 0, frame, sizeof(frame)) != 0) {
+        printf("FAIL empty tracker wrote a frame\n");
+        failures++;
+    }
+
+    printf("%s (%d failures)\n", failures ? "FAILED" : "OK", failures);
+    return failures ? 1 : 0;
+}
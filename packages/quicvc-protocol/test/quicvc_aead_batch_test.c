@@ -0,0 +1,226 @@
+/**
+ * Host test for batched packet protection (OpenSSL backend)
+ * Compile with: cc -Ic-headers -Ihost test/quicvc_aead_batch_test.c host/quicvc_aead_host.c c-headers/quicvc_protocol.c -lcrypto -o aead-test
+ * Add -DQUICVC_TEST_MBEDTLS -Icrypto crypto/quicvc_aead_mbedtls.c -lmbedcrypto
+ * to hold the mbedtls backend (mbedtls 3.x) to the same answers.
+ *
+ * The known-answer packet is GCM spec test case 16 (AES-256, 20 bytes
+ * of AAD): its AAD stands in for the header and packet number 0 leaves
+ * the IV as the nonce. A batch must seal and open every packet, and a
+ * tampered packet must fail alone without affecting its neighbours.
+ * The session key exchange is held to the RFC 7748 Section 6.1 X25519
+ * vectors, and must refuse a low-order peer key.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "quicvc_protocol.h"
+#include "quicvc_aead_host.h"
+#ifdef QUICVC_TEST_MBEDTLS
+#include "quicvc_aead_mbedtls.h"
+#endif
+
+#define BATCH 8
+
+static size_t from_hex(const char *hex, uint8_t *out) {
+    size_t len = strlen(hex) / 2;
+    for (size_t i = 0; i < len; i++) {
+        unsigned byte;
+        sscanf(&hex[2 * i], "%2x", &byte);
+        out[i] = (uint8_t)byte;
+    }
+    return len;
+}
+
+int main(void) {
+    int failures = 0;
+    uint8_t key[QUICVC_AEAD_KEY_LENGTH], iv[QUICVC_AEAD_NONCE_LENGTH];
+    from_hex("feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308", key);
+    from_hex("cafebabefacedbaddecaf888", iv);
+
+    // Nonce: packet number XORed into the low bytes only
+    uint8_t nonce[QUICVC_AEAD_NONCE_LENGTH], expected_nonce[QUICVC_AEAD_NONCE_LENGTH];
+    quicvc_aead_nonce(iv, 0x0102030405060708ULL, nonce);
+    from_hex("cafebabefbccd8a9dbccff80", expected_nonce);
+    if (memcmp(nonce, expected_nonce, sizeof(nonce)) != 0) {
+        printf("FAIL nonce\n");
+        failures++;
+    }
+
+    quicvc_host_aead_t *seal = quicvc_host_aead_new(key, iv);
+    quicvc_host_aead_t *open = quicvc_host_aead_new(key, iv);
+    if (!seal || !open) {
+        printf("FAIL context setup\n");
+        return 1;
+    }
+
+    // Known answer
+    uint8_t packet[128], expected[128];
+    size_t header_len = from_hex("feedfacedeadbeeffeedfacedeadbeefabaddad2", packet);
+    size_t payload_len = from_hex("d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d"
+                                  "8a318a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657"
+                                  "ba637b39", &packet[header_len]);
+    size_t expected_len = from_hex("feedfacedeadbeeffeedfacedeadbeefabaddad2"
+                                   "522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd"
+                                   "2555d1aa8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0a"
+                                   "bcc9f662" "76fc6ece0f4e1768cddf8853bb2d551b", expected);
+    quicvc_aead_packet_t kat = {
+        .packet = packet,
+        .header_len = header_len,
+        .payload_len = payload_len,
+        .packet_size = sizeof(packet),
+        .packet_number = 0,
+    };
+    if (quicvc_host_seal_batch(seal, &kat, 1) != 1 || kat.packet_len != expected_len ||
+        memcmp(packet, expected, expected_len) != 0) {
+        printf("FAIL known answer seal\n");
+        failures++;
+    }
+    if (quicvc_host_open_batch(open, &kat, 1) != 1 || kat.payload_len != payload_len ||
+        packet[header_len] != 0xd9 || packet[header_len + payload_len - 1] != 0x39) {
+        printf("FAIL known answer open\n");
+        failures++;
+    }
+
+    // A batch of packets of different sizes, some gathered from an iovec
+    static uint8_t buffers[BATCH][QUICVC_MAX_PACKET_SIZE];
+    static uint8_t plain[BATCH][QUICVC_MAX_PACKET_SIZE];
+    quicvc_aead_packet_t batch[BATCH];
+    quicvc_iovec_t iov[BATCH][2];
+    for (size_t i = 0; i < BATCH; i++) {
+        size_t len = 1 + i * 150;
+        buffers[i][0] = 0x40;
+        memset(&buffers[i][1], 0xA0 + (int)i, 8);
+        for (size_t j = 0; j < len; j++) {
+            plain[i][j] = (uint8_t)(j * 7 + i);
+        }
+        batch[i] = (quicvc_aead_packet_t){
+            .packet = buffers[i],
+            .header_len = 11,
+            .packet_size = QUICVC_MAX_PACKET_SIZE,
+            .packet_number = 1000 + i,
+        };
+        if (i % 2) {
+            iov[i][0] = (quicvc_iovec_t){ plain[i], len / 2 };
+            iov[i][1] = (quicvc_iovec_t){ &plain[i][len / 2], len - len / 2 };
+            batch[i].iov = iov[i];
+            batch[i].iov_count = 2;
+        } else {
+            memcpy(&buffers[i][11], plain[i], len);
+            batch[i].payload_len = len;
+        }
+    }
+    if (quicvc_host_seal_batch(seal, batch, BATCH) != BATCH) {
+        printf("FAIL batch seal\n");
+        failures++;
+    }
+
+    // Tamper with one header: only that packet may fail
+    for (size_t i = 0; i < BATCH; i++) {
+        batch[i].iov = NULL;
+    }
+    buffers[3][5] ^= 1;
+    if (quicvc_host_open_batch(open, batch, BATCH) != BATCH - 1 || batch[3].ok) {
+        printf("FAIL tampered packet accepted or neighbours rejected\n");
+        failures++;
+    }
+    for (size_t i = 0; i < BATCH; i++) {
+        if (i != 3 && (!batch[i].ok || batch[i].payload_len != 1 + i * 150 ||
+                       memcmp(&buffers[i][11], plain[i], batch[i].payload_len) != 0)) {
+            printf("FAIL batch round trip %u\n", (unsigned)i);
+            failures++;
+        }
+    }
+
+    // A packet without room for its tag is refused, not truncated
+    quicvc_aead_packet_t tight = {
+        .packet = buffers[0],
+        .header_len = 11,
+        .payload_len = 20,
+        .packet_size = 11 + 20 + QUICVC_AEAD_TAG_LENGTH - 1,
+    };
+    if (quicvc_host_seal_batch(seal, &tight, 1) != 0 || tight.ok) {
+        printf("FAIL undersized packet sealed\n");
+        failures++;
+    }
+
+#ifdef QUICVC_TEST_MBEDTLS
+    // mbedtls: the same known answer, and each backend opens what the
+    // other sealed
+    void *mbedtls = quicvc_aead_mbedtls.create(key, iv);
+    kat.payload_len = payload_len;
+    if (!mbedtls || quicvc_aead_mbedtls.seal_batch(mbedtls, &kat, 1) != 1 ||
+        kat.packet_len != expected_len || memcmp(packet, expected, expected_len) != 0 ||
+        quicvc_aead_mbedtls.open_batch(mbedtls, &kat, 1) != 1 || kat.payload_len != payload_len) {
+        printf("FAIL mbedtls known answer\n");
+        failures++;
+    }
+    for (int direction = 0; mbedtls && direction < 2; direction++) {
+        for (size_t i = 0; i < BATCH; i++) {
+            memcpy(&buffers[i][11], plain[i], 1 + i * 150);
+            batch[i].payload_len = 1 + i * 150;
+            batch[i].packet_number = 2000 + i;
+        }
+        size_t sealed = direction == 0 ? quicvc_host_seal_batch(seal, batch, BATCH)
+                                       : quicvc_aead_mbedtls.seal_batch(mbedtls, batch, BATCH);
+        size_t opened = direction == 0 ? quicvc_aead_mbedtls.open_batch(mbedtls, batch, BATCH)
+                                       : quicvc_host_open_batch(open, batch, BATCH);
+        for (size_t i = 0; i < BATCH && sealed == BATCH && opened == BATCH; i++) {
+            if (batch[i].payload_len != 1 + i * 150 ||
+                memcmp(&buffers[i][11], plain[i], batch[i].payload_len) != 0) {
+                opened = i;
+            }
+        }
+        if (sealed != BATCH || opened != BATCH) {
+            printf("FAIL %s sealed, %s opened: %zu sealed, %zu opened\n",
+                   direction == 0 ? "OpenSSL" : "mbedtls", direction == 0 ? "mbedtls" : "OpenSSL",
+                   sealed, opened);
+            failures++;
+        }
+    }
+    if (mbedtls) {
+        quicvc_aead_mbedtls.destroy(mbedtls);
+    }
+#endif
+
+    quicvc_host_aead_free(seal);
+    quicvc_host_aead_free(open);
+
+    // X25519, both directions of RFC 7748 Section 6.1
+    uint8_t alice_private[QUICVC_KEY_SHARE_LENGTH], alice_public[QUICVC_KEY_SHARE_LENGTH];
+    uint8_t bob_private[QUICVC_KEY_SHARE_LENGTH], bob_public[QUICVC_KEY_SHARE_LENGTH];
+    uint8_t shared[QUICVC_KEY_SHARE_LENGTH], expected_shared[QUICVC_KEY_SHARE_LENGTH];
+    from_hex("77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a", alice_private);
+    from_hex("8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a", alice_public);
+    from_hex("5dab087e624a8a4b79e17f8b83800ee66f3bb1292618b6fd1c2f8b27ff88e0eb", bob_private);
+    from_hex("de9edb7d7b7dc1b4d35b61c2ece435373f8343c85b78674dadfc7e146f882b4f", bob_public);
+    from_hex("4a5d9d5ba4ce2de1728e3bf480350f25e07e21c947d19e3376f09b3c1e161742", expected_shared);
+    if (!quicvc_host_key_exchange(alice_private, bob_public, shared) ||
+        memcmp(shared, expected_shared, sizeof(shared)) != 0) {
+        printf("FAIL X25519 alice\n");
+        failures++;
+    }
+    if (!quicvc_host_key_exchange(bob_private, alice_public, shared) ||
+        memcmp(shared, expected_shared, sizeof(shared)) != 0) {
+        printf("FAIL X25519 bob\n");
+        failures++;
+    }
+    // A fresh share agrees with its peer; the zero point is refused
+    uint8_t zero[QUICVC_KEY_SHARE_LENGTH] = {0};
+    if (!quicvc_host_key_share(alice_private, alice_public) ||
+        !quicvc_host_key_exchange(bob_private, alice_public, shared) ||
+        !quicvc_host_key_exchange(alice_private, bob_public, expected_shared) ||
+        memcmp(shared, expected_shared, sizeof(shared)) != 0) {
+        printf("FAIL X25519 fresh share\n");
+        failures++;
+    }
+    if (quicvc_host_key_exchange(alice_private, zero, shared)) {
+        printf("FAIL X25519 low-order key accepted\n");
+        failures++;
+    }
+
+    printf("%s (%d failures)\n", failures ? "FAILED" : "OK", failures);
+    return failures ? 1 : 0;
+}
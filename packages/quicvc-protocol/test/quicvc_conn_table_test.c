@@ -0,0 +1,273 @@
+/**
+ * Host stress test for the connection table
+ * Compile with: cc -Ic-headers test/quicvc_conn_table_test.c c-headers/quicvc_protocol.c -o conn-table-test
+ *
+ * Runs a few hundred thousand random inserts, lookups and removals over
+ * thousands of connections against a plain reference model that tracks
+ * the CID and last use of every slot. Eviction must pick the model's
+ * least recently used connection, and every live CID must stay findable
+ * after the backward shifts of removal. A device-sized table then takes
+ * a burst of new peers with an eviction predicate, which must leave its
+ * active sessions in place.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "quicvc_protocol.h"
+
+#define CAPACITY   4096
+#define INDEX_SIZE 8192
+#define CID_SPACE  12000        // Distinct CIDs drawn from; about 3x capacity
+#define OPERATIONS 300000
+
+static quicvc_conn_entry_t entries[CAPACITY];
+static uint16_t index_slots[INDEX_SIZE];
+
+// Reference model, by slot
+static uint32_t model_cid[CAPACITY];
+static uint64_t model_used[CAPACITY];
+static bool model_live[CAPACITY];
+
+// Device-sized table for the eviction predicate
+#define DEVICE_CAPACITY   4
+#define DEVICE_INDEX_SIZE 8
+#define BURST             1000
+
+static quicvc_conn_entry_t device_entries[DEVICE_CAPACITY];
+static uint16_t device_index[DEVICE_INDEX_SIZE];
+static bool device_active[DEVICE_CAPACITY];
+
+static bool device_evictable(uint16_t slot, void *ctx) {
+    (void)ctx;
+    return !device_active[slot];
+}
+
+static uint64_t rng = 0x9E3779B97F4A7C15ull;
+
+static uint32_t next_random(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return (uint32_t)rng;
+}
+
+// CIDs of 4 to 20 bytes; some share a prefix with others, to exercise
+// the length check
+static size_t make_cid(uint32_t id, uint8_t *cid) {
+    size_t len = 4 + id % 17;
+    for (size_t i = 0; i < len; i++) {
+        cid[i] = (uint8_t)((id * 2654435761u) >> ((i % 4) * 8)) ^ (uint8_t)i;
+    }
+    return len;
+}
+
+static uint16_t model_find(uint32_t id) {
+    for (uint16_t s = 0; s < CAPACITY; s++) {
+        if (model_live[s] && model_cid[s] == id) return s;
+    }
+    return QUICVC_CONN_NONE;
+}
+
+static uint16_t model_oldest(void) {
+    uint16_t oldest = QUICVC_CONN_NONE;
+    for (uint16_t s = 0; s < CAPACITY; s++) {
+        if (model_live[s] && (oldest == QUICVC_CONN_NONE || model_used[s] < model_used[oldest])) {
+            oldest = s;
+        }
+    }
+    return oldest;
+}
+
+// Walk the LRU list both ways and compare it with the model's live set
+static int check_lru(const quicvc_conn_table_t *table, size_t live) {
+    size_t n = 0;
+    uint64_t last = 0;
+    uint16_t prev = QUICVC_CONN_NONE;
+    for (uint16_t s = quicvc_conn_table_oldest(table); s != QUICVC_CONN_NONE; s = entries[s].newer) {
+        if (!model_live[s] || model_used[s] < last || entries[s].older != prev || ++n > live) {
+            printf("FAIL LRU order at slot %u\n", s);
+            return 1;
+        }
+        last = model_used[s];
+        prev = s;
+    }
+    if (n != live || table->count != live || prev != table->newest) {
+        printf("FAIL LRU holds %zu of %zu connections\n", n, live);
+        return 1;
+    }
+    return 0;
+}
+
+int main(void) {
+    int failures = 0;
+    quicvc_conn_table_t table;
+    uint8_t cid[QUICVC_MAX_CONNECTION_ID_LENGTH];
+
+    // Sizes
+    if (quicvc_conn_table_init(&table, entries, CAPACITY, index_slots, CAPACITY) ||
+        quicvc_conn_table_init(&table, entries, CAPACITY, index_slots, INDEX_SIZE - 1) ||
+        !quicvc_conn_table_init(&table, entries, CAPACITY, index_slots, INDEX_SIZE)) {
+        printf("FAIL init size checks\n");
+        failures++;
+    }
+    uint16_t evicted;
+    if (quicvc_conn_table_insert(&table, cid, 0, &evicted) != QUICVC_CONN_NONE ||
+        quicvc_conn_table_insert(&table, cid, QUICVC_MAX_CONNECTION_ID_LENGTH + 1, &evicted) != QUICVC_CONN_NONE ||
+        quicvc_conn_table_oldest(&table) != QUICVC_CONN_NONE) {
+        printf("FAIL bad CID lengths\n");
+        failures++;
+    }
+
+    size_t live = 0;
+    uint64_t clock = 0, evictions = 0;
+    for (int op = 0; op < OPERATIONS && failures == 0; op++) {
+        uint32_t id = next_random() % CID_SPACE;
+        size_t len = make_cid(id, cid);
+        uint32_t kind = next_random() % 10;
+        clock++;
+
+        if (kind < 5) {
+            // Lookup
+            uint16_t expected = model_find(id);
+            uint16_t slot = quicvc_conn_table_find(&table, cid, len);
+            if (slot != expected) {
+                printf("FAIL op %d: find %u gave slot %u, want %u\n", op, id, slot, expected);
+                failures++;
+            }
+            if (slot != QUICVC_CONN_NONE) model_used[slot] = clock;
+        } else if (kind < 9) {
+            // Insert, evicting the least recently used when full
+            uint16_t existing = model_find(id);
+            uint16_t victim = existing == QUICVC_CONN_NONE && live == CAPACITY
+                ? model_oldest() : QUICVC_CONN_NONE;
+            uint16_t slot = quicvc_conn_table_insert(&table, cid, len, &evicted);
+            if (evicted != victim || (existing != QUICVC_CONN_NONE && slot != existing) ||
+                slot == QUICVC_CONN_NONE) {
+                printf("FAIL op %d: insert %u gave slot %u evicting %u, want %u evicting %u\n",
+                       op, id, slot, evicted, existing, victim);
+                failures++;
+                break;
+            }
+            if (victim != QUICVC_CONN_NONE) {
+                model_live[victim] = false;
+                live--;
+                evictions++;
+            }
+            if (existing == QUICVC_CONN_NONE) {
+                if (model_live[slot]) {
+                    printf("FAIL op %d: insert reused live slot %u\n", op, slot);
+                    failures++;
+                    break;
+                }
+                model_live[slot] = true;
+                model_cid[slot] = id;
+                live++;
+            }
+            model_used[slot] = clock;
+        } else {
+            // Remove
+            uint16_t slot = model_find(id);
+            if (slot != QUICVC_CONN_NONE) {
+                quicvc_conn_table_remove(&table, slot);
+                model_live[slot] = false;
+                live--;
+                if (quicvc_conn_table_find(&table, cid, len) != QUICVC_CONN_NONE) {
+                    printf("FAIL op %d: %u still found after removal\n", op, id);
+                    failures++;
+                }
+            }
+        }
+
+        if (op % 20000 == 0) {
+            failures += check_lru(&table, live);
+        }
+    }
+
+    // Every live connection is still reachable, without touching the LRU
+    // order the model has to agree with
+    failures += check_lru(&table, live);
+    for (uint16_t s = 0; s < CAPACITY && failures == 0; s++) {
+        if (!model_live[s]) continue;
+        size_t len = make_cid(model_cid[s], cid);
+        if (quicvc_conn_table_find(&table, cid, len) != s) {
+            printf("FAIL slot %u unreachable at the end\n", s);
+            failures++;
+        }
+    }
+    if (evictions == 0) {
+        printf("FAIL the table never filled up\n");
+        failures++;
+    }
+
+    // Drain: removing everything leaves an empty index
+    for (uint16_t s = 0; s < CAPACITY; s++) {
+        if (model_live[s]) quicvc_conn_table_remove(&table, s);
+    }
+    size_t occupied = 0;
+    for (size_t i = 0; i < INDEX_SIZE; i++) {
+        occupied += index_slots[i] != QUICVC_CONN_NONE;
+    }
+    if (table.count != 0 || occupied != 0 || quicvc_conn_table_oldest(&table) != QUICVC_CONN_NONE) {
+        printf("FAIL drain left %zu connections, %zu index entries\n", table.count, occupied);
+        failures++;
+    }
+
+    // A burst of new peers against a full device table of active sessions
+    // is refused outright and every session stays reachable
+    quicvc_conn_table_t device;
+    quicvc_conn_table_init(&device, device_entries, DEVICE_CAPACITY, device_index, DEVICE_INDEX_SIZE);
+    for (uint32_t id = 0; id < DEVICE_CAPACITY; id++) {
+        size_t len = make_cid(id, cid);
+        uint16_t slot = quicvc_conn_table_insert_evictable(&device, cid, len, device_evictable,
+                                                           NULL, &evicted);
+        if (slot == QUICVC_CONN_NONE || evicted != QUICVC_CONN_NONE) {
+            printf("FAIL device insert %u\n", id);
+            failures++;
+            break;
+        }
+        device_active[slot] = true;
+    }
+    size_t admitted = 0;
+    for (uint32_t id = CID_SPACE; id < CID_SPACE + BURST; id++) {
+        size_t len = make_cid(id, cid);
+        if (quicvc_conn_table_insert_evictable(&device, cid, len, device_evictable, NULL,
+                                               &evicted) != QUICVC_CONN_NONE ||
+            evicted != QUICVC_CONN_NONE) {
+            admitted++;
+        }
+    }
+    for (uint32_t id = 0; id < DEVICE_CAPACITY; id++) {
+        size_t len = make_cid(id, cid);
+        if (quicvc_conn_table_find(&device, cid, len) == QUICVC_CONN_NONE) {
+            printf("FAIL burst displaced session %u\n", id);
+            failures++;
+        }
+    }
+    if (admitted != 0 || device.count != DEVICE_CAPACITY) {
+        printf("FAIL burst admitted %zu peers over active sessions\n", admitted);
+        failures++;
+    }
+
+    // Once one session goes idle, only its slot is recycled, even though
+    // it is not the least recently used
+    size_t idle_len = make_cid(2, cid);
+    uint16_t idle = quicvc_conn_table_find(&device, cid, idle_len);
+    device_active[idle] = false;
+    size_t len = make_cid(CID_SPACE + BURST, cid);
+    uint16_t slot = quicvc_conn_table_insert_evictable(&device, cid, len, device_evictable, NULL,
+                                                       &evicted);
+    if (slot != idle || evicted != idle) {
+        printf("FAIL new peer took slot %u evicting %u, want idle slot %u\n", slot, evicted, idle);
+        failures++;
+    }
+    idle_len = make_cid(2, cid);
+    if (quicvc_conn_table_find(&device, cid, idle_len) != QUICVC_CONN_NONE) {
+        printf("FAIL idle session still found after eviction\n");
+        failures++;
+    }
+
+    printf("%s (%d failures)\n", failures ? "FAILED" : "OK", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,673 @@
+/**
+ * Host test for the QUIC-VC gateway against a scripted device on loopback
+ * Compile with: cc -Ic-headers -Ihost -Igateway test/quicvc_gateway_test.c gateway/quicvc_gateway.c host/quicvc_aead_host.c c-headers/quicvc_protocol.c -lcrypto -o gateway-test
+ *
+ * The device answers the way the unified firmware does: it drops the
+ * first INITIAL (the gateway must retransmit), answers the second with a
+ * Retry, and the third, which must carry the Retry's token, with the
+ * VC_RESPONSE HANDSHAKE holding its key share and a sealed 1-RTT
+ * VC_TICKET. A Retry with a bad tag and a HANDSHAKE with the wrong
+ * challenge come first and must be ignored. Then a command goes out, a
+ * heartbeat comes back and is ACKed, a tampered and a replayed one are
+ * dropped, a bulk stream and a run of heartbeats cross in UDP GSO/GRO
+ * super-buffers where the kernel has them, and the device closes the
+ * connection. The gateway resumes it with a 0-RTT command under the
+ * ticket, then resumes again to a device that ignores the 0-RTT packet
+ * and must get the command after a full handshake. Last, a connection
+ * times out idle.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include <openssl/evp.h>
+
+#include "quicvc_protocol.h"
+#include "quicvc_aead_host.h"
+#include "quicvc_gateway.h"
+
+#define CREDENTIAL "{\"id\":\"gw\",\"issuer\":\"owner-1\",\"subject\":\"gateway\"}"
+#define WAIT_MS    2000
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+static const uint8_t retry_key[16] = {
+    0xbe, 0x0c, 0x69, 0x0b, 0x9f, 0x66, 0x57, 0x5a,
+    0x1d, 0x76, 0x6b, 0x54, 0xe3, 0x68, 0xc8, 0x4e,
+};
+static const uint8_t retry_nonce[12] = {
+    0x46, 0x15, 0x99, 0xd3, 0x5d, 0x63, 0x2b, 0xf2, 0x23, 0x98, 0x25, 0xbb,
+};
+static const uint8_t device_cid[QUICVC_DEFAULT_CONNECTION_ID_LENGTH] = {
+    0xd0, 0xd1, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7,
+};
+static const uint8_t retry_scid[QUICVC_DEFAULT_CONNECTION_ID_LENGTH] = {
+    0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77,
+};
+static const uint8_t retry_token[20] = { 0x00, 0x00, 0x00, 0x2a, 0x01, 0x02, 0x03 };
+
+static quicvc_gateway_t *gateway;
+static int device_fd;
+static struct sockaddr_in device_addr;
+static struct sockaddr_in gateway_addr;
+static uint64_t device_pn;
+static uint64_t gateway_pn;         // Next packet number expected from the gateway
+static uint8_t gateway_cid[QUICVC_DEFAULT_CONNECTION_ID_LENGTH];    // SCID of the last INITIAL
+
+// The device's end of the session keys
+static uint8_t gateway_key[QUICVC_KEY_SHARE_LENGTH];    // From the last INITIAL
+static uint8_t session_key[32];
+static void *device_send_aead;      // "server"
+static void *device_recv_aead;      // "client"
+static uint8_t ticket_id[QUICVC_TICKET_ID_LENGTH];
+static uint8_t resumption[32];      // Of the last ticket issued
+
+// Events seen, most recent last
+static quicvc_gateway_event_type_t events[64];
+static quicvc_gateway_close_reason_t last_reason;
+static uint8_t last_frame_type;
+static size_t event_count;
+static size_t heartbeats;
+
+static void on_event(quicvc_gateway_t *gw, const quicvc_gateway_event_t *event, void *ctx) {
+    (void)gw;
+    (void)ctx;
+    if (event_count < sizeof(events) / sizeof(events[0])) {
+        events[event_count++] = event->type;
+    }
+    if (event->type == QUICVC_GATEWAY_CLOSED) last_reason = event->reason;
+    if (event->type == QUICVC_GATEWAY_FRAME) last_frame_type = event->frame->type;
+    if (event->type == QUICVC_GATEWAY_FRAME && event->frame->type == QUICVC_FRAME_HEARTBEAT) heartbeats++;
+}
+
+static bool saw(quicvc_gateway_event_type_t type) {
+    for (size_t i = 0; i < event_count; i++) {
+        if (events[i] == type) return true;
+    }
+    return false;
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+// Run the gateway until the device receives a datagram, or for 'ms'
+static ssize_t device_receive(uint8_t *buf, size_t size, uint64_t ms) {
+    uint64_t until = now_ms() + ms;
+    while (now_ms() < until) {
+        quicvc_gateway_poll(gateway, 1);
+        socklen_t len = sizeof(gateway_addr);
+        ssize_t n = recvfrom(device_fd, buf, size, MSG_DONTWAIT,
+                             (struct sockaddr *)&gateway_addr, &len);
+        if (n > 0) return n;
+    }
+    return 0;
+}
+
+static void run_gateway(uint64_t ms) {
+    uint64_t until = now_ms() + ms;
+    while (now_ms() < until) quicvc_gateway_poll(gateway, 1);
+}
+
+static void device_send(const uint8_t *buf, size_t len) {
+    sendto(device_fd, buf, len, 0, (struct sockaddr *)&gateway_addr, sizeof(gateway_addr));
+}
+
+// 'count' datagrams of 'segment' bytes in one UDP_SEGMENT send; one by
+// one if the kernel refuses it
+static void device_send_segments(const uint8_t *buf, size_t segment, size_t count) {
+    uint16_t size = (uint16_t)segment;
+    union {
+        char buf[CMSG_SPACE(sizeof(uint16_t))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = { (void *)buf, segment * count };
+    struct msghdr msg = {
+        .msg_name = &gateway_addr,
+        .msg_namelen = sizeof(gateway_addr),
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(size));
+    memcpy(CMSG_DATA(cmsg), &size, sizeof(size));
+    if (sendmsg(device_fd, &msg, 0) < 0) {
+        for (size_t i = 0; i < count; i++) device_send(&buf[i * segment], segment);
+    }
+}
+
+static size_t write_retry(const quicvc_header_t *initial, bool corrupt, uint8_t *out) {
+    uint8_t pseudo[256];
+    size_t prefix = 1 + initial->dcid_len;
+    pseudo[0] = initial->dcid_len;
+    memcpy(&pseudo[1], initial->dcid, initial->dcid_len);
+    quicvc_header_t retry = {
+        .version = QUICVC_VERSION,
+        .dcid = initial->scid,
+        .dcid_len = initial->scid_len,
+        .scid = retry_scid,
+        .scid_len = sizeof(retry_scid),
+    };
+    size_t len = quicvc_write_retry(&retry, retry_token, sizeof(retry_token),
+                                    &pseudo[prefix], sizeof(pseudo) - prefix);
+    int out_len;
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    EVP_EncryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, retry_key, retry_nonce);
+    EVP_EncryptUpdate(ctx, NULL, &out_len, pseudo, (int)(prefix + len));
+    EVP_EncryptFinal_ex(ctx, &pseudo[prefix + len], &out_len);
+    EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, QUICVC_RETRY_INTEGRITY_TAG_LENGTH,
+                        &pseudo[prefix + len]);
+    EVP_CIPHER_CTX_free(ctx);
+    if (corrupt) pseudo[prefix + len - 1] ^= 0x01;     // Last token byte
+    memcpy(out, &pseudo[prefix], len + QUICVC_RETRY_INTEGRITY_TAG_LENGTH);
+    return len + QUICVC_RETRY_INTEGRITY_TAG_LENGTH;
+}
+
+static void unhex(const char *hex, uint8_t *out, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        unsigned byte = 0;
+        sscanf(&hex[2 * i], "%2x", &byte);
+        out[i] = (uint8_t)byte;
+    }
+}
+
+// New 1-RTT states from session_key
+static void device_key(void) {
+    uint8_t key[QUICVC_AEAD_KEY_LENGTH], iv[QUICVC_AEAD_NONCE_LENGTH];
+    quicvc_aead_openssl.destroy(device_send_aead);
+    quicvc_aead_openssl.destroy(device_recv_aead);
+    quicvc_host_aead_derive(session_key, "server", key, iv);
+    device_send_aead = quicvc_aead_openssl.create(key, iv);
+    quicvc_host_aead_derive(session_key, "client", key, iv);
+    device_recv_aead = quicvc_aead_openssl.create(key, iv);
+}
+
+// Write 'hdr' and the sealed 'frames' at 'out'; long or short header
+static size_t seal(void *aead, const quicvc_header_t *hdr, bool is_long,
+                   const uint8_t *frames, size_t frames_len, uint8_t *out) {
+    quicvc_iovec_t iov = { frames, frames_len };
+    quicvc_aead_packet_t p = {
+        .packet = out,
+        .header_len = is_long
+            ? quicvc_write_long_header(hdr, frames_len + QUICVC_AEAD_TAG_LENGTH, out, 600)
+            : quicvc_write_short_header(hdr, out, 600),
+        .packet_size = 600,
+        .iov = &iov,
+        .iov_count = 1,
+        .packet_number = hdr->packet_number,
+    };
+    quicvc_aead_openssl.seal_batch(aead, &p, 1);
+    return p.packet_len;
+}
+
+// A VC_TICKET frame for a new ticket, bound to session_key
+static size_t write_ticket(uint8_t *out) {
+    ticket_id[0]++;
+    out[0] = QUICVC_FRAME_VC_TICKET;
+    out[1] = 0x00;
+    out[2] = QUICVC_TICKET_ID_LENGTH + 4;
+    memcpy(&out[3], ticket_id, sizeof(ticket_id));
+    static const uint8_t lifetime[4] = { 0x00, 0x00, 0x0e, 0x10 };     // One hour
+    memcpy(&out[3 + sizeof(ticket_id)], lifetime, sizeof(lifetime));
+    quicvc_host_derive(session_key, "quicvc resumption", ticket_id, sizeof(ticket_id), resumption);
+    return 3 + sizeof(ticket_id) + sizeof(lifetime);
+}
+
+// VC_RESPONSE echoing 'challenge' with a fresh key share, coalesced with
+// a sealed 1-RTT VC_TICKET. The session is keyed only for the right
+// challenge.
+static size_t write_handshake(const quicvc_header_t *initial, const char *challenge, uint8_t *out) {
+    uint8_t private_key[QUICVC_KEY_SHARE_LENGTH], public_key[QUICVC_KEY_SHARE_LENGTH];
+    char public_hex[2 * QUICVC_KEY_SHARE_LENGTH + 1];
+    quicvc_host_key_share(private_key, public_key);
+    for (size_t i = 0; i < sizeof(public_key); i++) {
+        snprintf(&public_hex[2 * i], 3, "%02x", public_key[i]);
+    }
+    uint8_t shared[QUICVC_KEY_SHARE_LENGTH];
+    quicvc_host_key_exchange(private_key, gateway_key, shared);
+    quicvc_host_derive(shared, "quicvc session", (const uint8_t *)challenge, 32, session_key);
+    device_key();
+
+    char json[256];
+    int json_len = snprintf(json, sizeof(json),
+                            "{\"type\":\"VC_RESPONSE\",\"credential\":{\"id\":\"esp32-1\","
+                            "\"issuer\":\"owner-1\"},\"challenge\":\"%s\",\"key\":\"%s\"}",
+                            challenge, public_hex);
+    quicvc_header_t hdr = {
+        .packet_type = QUICVC_PACKET_TYPE_HANDSHAKE,
+        .version = QUICVC_VERSION,
+        .dcid = initial->scid,
+        .dcid_len = initial->scid_len,
+        .scid = device_cid,
+        .scid_len = sizeof(device_cid),
+        .packet_number = device_pn++,
+        .packet_number_len = 1,
+    };
+    size_t len = quicvc_write_long_header(&hdr, (size_t)json_len, out, 600);
+    memcpy(&out[len], json, (size_t)json_len);
+    len += (size_t)json_len;
+
+    quicvc_header_t short_hdr = {
+        .dcid = initial->scid,
+        .dcid_len = initial->scid_len,
+        .packet_number = device_pn++,
+        .packet_number_len = 1,
+    };
+    uint8_t ticket[32];
+    size_t ticket_len = write_ticket(ticket);
+    return len + seal(device_send_aead, &short_hdr, false, ticket, ticket_len, &out[len]);
+}
+
+static size_t write_short(const uint8_t *frames, size_t frames_len, uint8_t *out) {
+    quicvc_header_t hdr = {
+        .dcid = gateway_cid,
+        .dcid_len = QUICVC_DEFAULT_CONNECTION_ID_LENGTH,
+        .packet_number = device_pn++,
+        .packet_number_len = 2,
+    };
+    return seal(device_send_aead, &hdr, false, frames, frames_len, out);
+}
+
+// Open the gateway's packet in 'buf' with 'aead'; its plaintext is then
+// hdr->payload, hdr->payload_len bytes
+static bool open_packet(void *aead, uint8_t *buf, size_t len, quicvc_header_t *hdr) {
+    quicvc_header_parse_result_t parsed = quicvc_parse_header(buf, len, sizeof(device_cid));
+    if (parsed.bytes_consumed == 0) return false;
+    *hdr = parsed.header;
+    uint64_t packet_number = quicvc_decode_packet_number(gateway_pn, hdr->packet_number,
+                                                         hdr->packet_number_len);
+    quicvc_aead_packet_t p = {
+        .packet = buf,
+        .header_len = (size_t)(hdr->payload - buf),
+        .packet_len = (size_t)(hdr->payload - buf) + hdr->payload_len,
+        .packet_number = packet_number,
+    };
+    if (quicvc_aead_openssl.open_batch(aead, &p, 1) != 1) return false;
+    hdr->payload_len = p.payload_len;
+    gateway_pn = packet_number + 1;
+    return true;
+}
+
+// Receive and open the next 1-RTT packet; false on silence or a bad tag
+static bool receive_short(uint8_t *buf, quicvc_header_t *hdr, uint64_t ms) {
+    ssize_t n = device_receive(buf, 1500, ms);
+    return n > 0 && open_packet(device_recv_aead, buf, (size_t)n, hdr) && !hdr->is_long &&
+           memcmp(hdr->dcid, device_cid, sizeof(device_cid)) == 0;
+}
+
+// First frame of 'hdr' is an ACK up to 'largest'
+static bool is_ack(const quicvc_header_t *hdr, uint64_t largest, uint64_t first_range) {
+    quicvc_frame_iter_t iter;
+    quicvc_frame_t frame;
+    quicvc_frame_iter_init(&iter, hdr->payload, hdr->payload_len);
+    return quicvc_frame_iter_next(&iter, &frame) && frame.type == QUICVC_FRAME_ACK &&
+           frame.u.ack.largest_acknowledged == largest && frame.u.ack.first_range >= first_range;
+}
+
+// 'hdr' carries 'command' on stream 3
+static bool has_command(const quicvc_header_t *hdr, const char *command) {
+    quicvc_frame_iter_t iter;
+    quicvc_frame_t frame;
+    quicvc_frame_iter_init(&iter, hdr->payload, hdr->payload_len);
+    while (quicvc_frame_iter_next(&iter, &frame)) {
+        if ((frame.type & 0xF8) == QUICVC_FRAME_STREAM && frame.u.stream.stream_id == 3 &&
+            frame.u.stream.data_len == strlen(command) &&
+            memcmp(frame.u.stream.data, command, strlen(command)) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Receive the next INITIAL, returning its header (into 'buf'), challenge
+// and key share
+static bool receive_initial(uint8_t *buf, quicvc_header_t *hdr, char *challenge) {
+    ssize_t n = device_receive(buf, 1500, WAIT_MS);
+    if (n <= 0) return false;
+    quicvc_header_parse_result_t parsed = quicvc_parse_header(buf, (size_t)n, sizeof(device_cid));
+    if (parsed.bytes_consumed == 0 || !parsed.header.is_long ||
+        parsed.header.packet_type != QUICVC_PACKET_TYPE_INITIAL) {
+        return false;
+    }
+    *hdr = parsed.header;
+    if (hdr->scid_len != sizeof(gateway_cid)) return false;
+    memcpy(gateway_cid, hdr->scid, sizeof(gateway_cid));
+    gateway_pn = quicvc_decode_packet_number(0, hdr->packet_number, hdr->packet_number_len) + 1;
+    const char *c = memmem(hdr->payload, hdr->payload_len, "\"challenge\":\"", 13);
+    const char *k = memmem(hdr->payload, hdr->payload_len, "\"key\":\"", 7);
+    if (!c || !k || !memmem(hdr->payload, hdr->payload_len, "\"issuer\":\"owner-1\"", 18)) return false;
+    memcpy(challenge, c + 13, 32);
+    challenge[32] = '\0';
+    unhex(k + 7, gateway_key, sizeof(gateway_key));
+    return true;
+}
+
+// Receive the 0-RTT packet and open it with the last ticket; its SCID
+// becomes gateway_cid
+static bool receive_zero_rtt(uint8_t *buf, quicvc_header_t *hdr) {
+    ssize_t n = device_receive(buf, 1500, WAIT_MS);
+    quicvc_header_parse_result_t parsed = quicvc_parse_header(buf, n > 0 ? (size_t)n : 0, sizeof(device_cid));
+    if (parsed.bytes_consumed == 0 || !parsed.header.is_long ||
+        parsed.header.packet_type != QUICVC_PACKET_TYPE_ZERO_RTT ||
+        parsed.header.dcid_len != sizeof(ticket_id) ||
+        memcmp(parsed.header.dcid, ticket_id, sizeof(ticket_id)) != 0 ||
+        parsed.header.scid_len != sizeof(gateway_cid)) {
+        return false;
+    }
+    memcpy(gateway_cid, parsed.header.scid, sizeof(gateway_cid));
+    uint8_t key[32], iv[32];
+    quicvc_host_derive(resumption, "quicvc 0rtt key", NULL, 0, key);
+    quicvc_host_derive(resumption, "quicvc 0rtt iv", NULL, 0, iv);
+    void *aead = quicvc_aead_openssl.create(key, iv);
+    gateway_pn = 0;
+    bool ok = open_packet(aead, buf, (size_t)n, hdr);
+    quicvc_aead_openssl.destroy(aead);
+    return ok;
+}
+
+int main(void) {
+    int failures = 0;
+    uint8_t buf[1500], out[1500];
+    char challenge[33];
+    quicvc_header_t initial;
+
+    device_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    device_addr = (struct sockaddr_in){ .sin_family = AF_INET };
+    device_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(device_addr);
+    bind(device_fd, (struct sockaddr *)&device_addr, sizeof(device_addr));
+    getsockname(device_fd, (struct sockaddr *)&device_addr, &addr_len);
+
+    quicvc_gateway_config_t config = {
+        .credential_json = CREDENTIAL,
+        .max_devices = 4,
+        .handshake_timeout_us = 50000,
+        .idle_timeout_us = 300000,
+        .on_event = on_event,
+    };
+    config.bind_addr.s_addr = htonl(INADDR_LOOPBACK);
+    gateway = quicvc_gateway_new(&config);
+    if (!gateway) {
+        printf("FAIL gateway did not start\n");
+        return 1;
+    }
+
+    // Handshake: drop, bad Retry, Retry, wrong challenge, HANDSHAKE
+    int device = quicvc_gateway_connect(gateway, &device_addr);
+    if (device == QUICVC_GATEWAY_NONE || !receive_initial(buf, &initial, challenge) ||
+        initial.token_len != 0) {
+        printf("FAIL first INITIAL\n");
+        failures++;
+    }
+    if (!receive_initial(buf, &initial, challenge) ||
+        quicvc_gateway_stats(gateway)->handshake_retransmits != 1) {
+        printf("FAIL INITIAL not retransmitted\n");
+        failures++;
+    }
+    device_send(out, write_retry(&initial, true, out));
+    device_send(out, write_retry(&initial, false, out));
+    if (!receive_initial(buf, &initial, challenge) || quicvc_gateway_stats(gateway)->retries != 1 ||
+        initial.token_len != sizeof(retry_token) || memcmp(initial.token, retry_token, sizeof(retry_token)) ||
+        initial.dcid_len != sizeof(retry_scid) || memcmp(initial.dcid, retry_scid, sizeof(retry_scid))) {
+        printf("FAIL INITIAL after Retry: %llu retries, token %zu bytes\n",
+               (unsigned long long)quicvc_gateway_stats(gateway)->retries, initial.token_len);
+        failures++;
+    }
+    device_send(out, write_handshake(&initial, "00000000000000000000000000000000", out));
+    run_gateway(10);
+    if (saw(QUICVC_GATEWAY_ESTABLISHED)) {
+        printf("FAIL established with the wrong challenge\n");
+        failures++;
+    }
+    device_pn = 0;
+    device_send(out, write_handshake(&initial, challenge, out));
+    run_gateway(10);
+    if (!saw(QUICVC_GATEWAY_ESTABLISHED) || quicvc_gateway_established(gateway) != 1 ||
+        quicvc_gateway_find(gateway, &device_addr) != device ||
+        quicvc_gateway_stats(gateway)->handshake_ns.count != 1) {
+        printf("FAIL handshake did not complete\n");
+        failures++;
+    }
+
+    // The ticket packet is ACKed, sealed in a short header to the device's CID
+    quicvc_header_t hdr;
+    if (!receive_short(buf, &hdr, WAIT_MS) || !is_ack(&hdr, 1, 0)) {
+        printf("FAIL ticket packet not ACKed\n");
+        failures++;
+    }
+
+    // Command: STREAM on stream 3
+    static const char command[] = "{\"type\":\"led_control\",\"state\":\"on\"}";
+    if (!quicvc_gateway_send(gateway, device, 3, (const uint8_t *)command, sizeof(command) - 1)) {
+        printf("FAIL send refused\n");
+        failures++;
+    }
+    if (!receive_short(buf, &hdr, WAIT_MS) || !has_command(&hdr, command)) {
+        printf("FAIL command not delivered\n");
+        failures++;
+    }
+
+    // Heartbeat: a FRAME event and an ACK for it
+    static const uint8_t heartbeat[] = { QUICVC_FRAME_HEARTBEAT, 0x00, 0x02, '{', '}' };
+    uint64_t heartbeat_pn = device_pn;
+    device_send(out, write_short(heartbeat, sizeof(heartbeat), out));
+    bool got_ack = receive_short(buf, &hdr, WAIT_MS) && is_ack(&hdr, heartbeat_pn, 0);
+    if (last_frame_type != QUICVC_FRAME_HEARTBEAT || !got_ack) {
+        printf("FAIL heartbeat: frame 0x%02x, ACK %d\n", last_frame_type, got_ack);
+        failures++;
+    }
+
+    // A tampered heartbeat fails its tag and is dropped unACKed
+    uint64_t dropped = quicvc_gateway_stats(gateway)->dropped;
+    size_t len = write_short(heartbeat, sizeof(heartbeat), out);
+    out[len - 1] ^= 0x01;
+    device_send(out, len);
+    if (device_receive(buf, sizeof(buf), 50) != 0 ||
+        quicvc_gateway_stats(gateway)->dropped != dropped + 1) {
+        printf("FAIL tampered packet was handled\n");
+        failures++;
+    }
+
+    // A replayed heartbeat is dropped and not ACKed again
+    dropped = quicvc_gateway_stats(gateway)->dropped;
+    device_pn = heartbeat_pn;
+    device_send(out, write_short(heartbeat, sizeof(heartbeat), out));
+    if (device_receive(buf, sizeof(buf), 50) != 0 ||
+        quicvc_gateway_stats(gateway)->dropped != dropped + 1) {
+        printf("FAIL duplicate packet was handled\n");
+        failures++;
+    }
+
+    // Bulk: a stream too long for one packet arrives whole and in order,
+    // its full-sized packets in one GSO super-buffer when offload is on.
+    // Full-sized means past the old 1 KB firmware receive buffer but no
+    // larger than QUICVC_MAX_PACKET_SIZE, which the firmware now receives
+    static uint8_t bulk[4000];
+    for (size_t i = 0; i < sizeof(bulk); i++) bulk[i] = (uint8_t)i;
+    uint64_t bulk_offset = 0;
+    size_t bulk_datagrams = 0;
+    size_t largest_datagram = 0;
+    ssize_t n;
+    quicvc_gateway_send(gateway, device, 5, bulk, sizeof(bulk));
+    while (bulk_offset < sizeof(bulk) && (n = device_receive(buf, sizeof(buf), WAIT_MS)) > 0) {
+        if ((size_t)n > largest_datagram) largest_datagram = (size_t)n;
+        bool opened = open_packet(device_recv_aead, buf, (size_t)n, &hdr);
+        quicvc_frame_iter_t iter;
+        quicvc_frame_t frame;
+        quicvc_frame_iter_init(&iter, hdr.payload, hdr.payload_len);
+        while (opened && quicvc_frame_iter_next(&iter, &frame)) {
+            if ((frame.type & 0xF8) == QUICVC_FRAME_STREAM && frame.u.stream.stream_id == 5 &&
+                frame.u.stream.offset == bulk_offset &&
+                frame.u.stream.data_len <= sizeof(bulk) - bulk_offset &&
+                memcmp(frame.u.stream.data, &bulk[bulk_offset], frame.u.stream.data_len) == 0) {
+                bulk_offset += frame.u.stream.data_len;
+            }
+        }
+        bulk_datagrams++;
+    }
+    uint64_t gso_datagrams = quicvc_gateway_stats(gateway)->gso_datagrams;
+    if (bulk_offset != sizeof(bulk) || bulk_datagrams < 4 ||
+        largest_datagram <= 1024 || largest_datagram > QUICVC_MAX_PACKET_SIZE ||
+        ((quicvc_gateway_offload(gateway) & QUICVC_GATEWAY_GSO) && gso_datagrams < bulk_datagrams - 1)) {
+        printf("FAIL bulk stream: %llu bytes in %zu datagrams (largest %zu), %llu by GSO\n",
+               (unsigned long long)bulk_offset, bulk_datagrams, largest_datagram,
+               (unsigned long long)gso_datagrams);
+        failures++;
+    }
+
+    // GRO: three heartbeats sent as one super-buffer are three packets,
+    // and all three are ACKed
+    size_t segment = write_short(heartbeat, sizeof(heartbeat), out);
+    write_short(heartbeat, sizeof(heartbeat), &out[segment]);
+    write_short(heartbeat, sizeof(heartbeat), &out[2 * segment]);
+    uint64_t gro_datagrams = quicvc_gateway_stats(gateway)->gro_datagrams;
+    heartbeats = 0;
+    device_send_segments(out, segment, 3);
+    got_ack = receive_short(buf, &hdr, WAIT_MS) && is_ack(&hdr, device_pn - 1, 2);
+    run_gateway(10);
+    if (heartbeats != 3 || !got_ack ||
+        ((quicvc_gateway_offload(gateway) & QUICVC_GATEWAY_GRO) &&
+         quicvc_gateway_stats(gateway)->gro_datagrams != gro_datagrams + 3)) {
+        printf("FAIL coalesced heartbeats: %zu frames, ACK %d, %llu by GRO\n", heartbeats, got_ack,
+               (unsigned long long)(quicvc_gateway_stats(gateway)->gro_datagrams - gro_datagrams));
+        failures++;
+    }
+
+    // Device closes the connection
+    static const uint8_t close_frame[] = { QUICVC_FRAME_CONNECTION_CLOSE_APP, 0x00, 0x00 };
+    device_send(out, write_short(close_frame, sizeof(close_frame), out));
+    run_gateway(10);
+    if (quicvc_gateway_established(gateway) != 0 || last_reason != QUICVC_GATEWAY_CLOSED_BY_PEER ||
+        quicvc_gateway_send(gateway, device, 3, (const uint8_t *)command, 1)) {
+        printf("FAIL close by peer\n");
+        failures++;
+    }
+
+    // 0-RTT: the command rides the first packet under the ticket, and the
+    // device's sealed HANDSHAKE (ACK and the next ticket) establishes
+    event_count = 0;
+    static const char early[] = "{\"type\":\"led_control\",\"state\":\"off\"}";
+    device = quicvc_gateway_resume(gateway, &device_addr, 3, (const uint8_t *)early, sizeof(early) - 1);
+    if (device == QUICVC_GATEWAY_NONE || !receive_zero_rtt(buf, &hdr) || !has_command(&hdr, early)) {
+        printf("FAIL 0-RTT command not delivered\n");
+        failures++;
+    }
+    if (quicvc_gateway_resume(gateway, &device_addr, 3, (const uint8_t *)early, 1) != QUICVC_GATEWAY_NONE) {
+        printf("FAIL ticket used twice\n");
+        failures++;
+    }
+    quicvc_host_derive(resumption, "quicvc resumed", NULL, 0, session_key);
+    device_key();
+    device_pn = 0;
+    uint8_t frames[64] = { QUICVC_FRAME_ACK, 0x00, 0x00, 0x00, 0x00 };     // Largest 0, no delay
+    size_t frames_len = 5 + write_ticket(&frames[5]);
+    quicvc_header_t resumed = {
+        .packet_type = QUICVC_PACKET_TYPE_HANDSHAKE,
+        .version = QUICVC_VERSION,
+        .dcid = gateway_cid,
+        .dcid_len = sizeof(gateway_cid),
+        .scid = device_cid,
+        .scid_len = sizeof(device_cid),
+        .packet_number = device_pn++,
+        .packet_number_len = 1,
+    };
+    device_send(out, seal(device_send_aead, &resumed, true, frames, frames_len, out));
+    if (!receive_short(buf, &hdr, WAIT_MS) || !is_ack(&hdr, 0, 0) || !saw(QUICVC_GATEWAY_ESTABLISHED) ||
+        quicvc_gateway_stats(gateway)->resumptions != 1 || quicvc_gateway_find(gateway, &device_addr) != device) {
+        printf("FAIL 0-RTT resumption: %llu resumptions\n",
+               (unsigned long long)quicvc_gateway_stats(gateway)->resumptions);
+        failures++;
+    }
+    device_send(out, write_short(close_frame, sizeof(close_frame), out));
+    run_gateway(10);
+
+    // A device that lost the ticket ignores the 0-RTT packet: after one
+    // handshake timeout the gateway redoes the handshake and sends the
+    // command under the new keys
+    device = quicvc_gateway_resume(gateway, &device_addr, 3, (const uint8_t *)early, sizeof(early) - 1);
+    if (device == QUICVC_GATEWAY_NONE || !receive_zero_rtt(buf, &hdr) ||
+        !receive_initial(buf, &initial, challenge) ||
+        quicvc_gateway_stats(gateway)->resumption_fallbacks != 1) {
+        printf("FAIL no fallback from 0-RTT\n");
+        failures++;
+    }
+    device_pn = 0;
+    device_send(out, write_handshake(&initial, challenge, out));
+    bool got_early = false;
+    for (int i = 0; i < 3 && !got_early && receive_short(buf, &hdr, WAIT_MS); i++) {
+        got_early = has_command(&hdr, early);
+    }
+    if (!got_early || quicvc_gateway_established(gateway) != 1) {
+        printf("FAIL early data not resent after fallback\n");
+        failures++;
+    }
+    device_send(out, write_short(close_frame, sizeof(close_frame), out));
+    run_gateway(10);
+
+    // Second connection: handshake on the first INITIAL, then silence
+    device_pn = 0;
+    event_count = 0;
+    device = quicvc_gateway_connect(gateway, &device_addr);
+    if (!receive_initial(buf, &initial, challenge)) {
+        printf("FAIL second INITIAL\n");
+        failures++;
+    }
+    device_send(out, write_handshake(&initial, challenge, out));
+    device_receive(buf, sizeof(buf), 100);  // ACK of the handshake packets
+    uint64_t idle_from = now_ms();
+    while (!saw(QUICVC_GATEWAY_CLOSED) && now_ms() - idle_from < WAIT_MS) {
+        quicvc_gateway_poll(gateway, -1);
+    }
+    uint64_t idle_ms = now_ms() - idle_from;
+    if (!saw(QUICVC_GATEWAY_ESTABLISHED) || last_reason != QUICVC_GATEWAY_IDLE_TIMEOUT ||
+        idle_ms < 250 || idle_ms > 600 || quicvc_gateway_established(gateway) != 0) {
+        printf("FAIL idle timeout after %llu ms, reason %d\n", (unsigned long long)idle_ms, last_reason);
+        failures++;
+    }
+
+    // No device: the handshake gives up after every retransmit
+    event_count = 0;
+    struct sockaddr_in nowhere = device_addr;
+    nowhere.sin_port = htons(9);
+    if (quicvc_gateway_connect(gateway, &nowhere) == QUICVC_GATEWAY_NONE) {
+        printf("FAIL connect with free slots\n");
+        failures++;
+    }
+    uint64_t start = now_ms();
+    while (!saw(QUICVC_GATEWAY_CLOSED) && now_ms() - start < 5000) {
+        quicvc_gateway_poll(gateway, -1);
+    }
+    if (last_reason != QUICVC_GATEWAY_HANDSHAKE_TIMEOUT || quicvc_gateway_timeout_ms(gateway) != -1) {
+        printf("FAIL handshake timeout: reason %d\n", last_reason);
+        failures++;
+    }
+
+    // Every slot taken
+    for (int i = 0; i < 4; i++) quicvc_gateway_connect(gateway, &nowhere);
+    if (quicvc_gateway_connect(gateway, &nowhere) != QUICVC_GATEWAY_NONE) {
+        printf("FAIL connect beyond max_devices\n");
+        failures++;
+    }
+
+    quicvc_gateway_free(gateway);
+    quicvc_aead_openssl.destroy(device_send_aead);
+    quicvc_aead_openssl.destroy(device_recv_aead);
+    close(device_fd);
+    printf("%s (%d failures)\n", failures ? "FAILED" : "OK", failures);
+    return failures ? 1 : 0;
+}
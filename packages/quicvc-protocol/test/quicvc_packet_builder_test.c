@@ -0,0 +1,130 @@
+/**
+ * Host test for the coalescing packet builder
+ * Compile with: cc -Ic-headers test/quicvc_packet_builder_test.c c-headers/quicvc_protocol.c -o builder-test
+ *
+ * Flushed payloads are parsed back with the frame iterator; STREAM pieces
+ * must reassemble to the original data at the right offsets.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "quicvc_protocol.h"
+
+#define MAX_PAYLOAD 200
+
+typedef struct {
+    int packets;
+    int frames;
+    int heartbeats;
+    int acks;
+    int fins;
+    bool malformed;
+    size_t largest_packet;
+    uint8_t stream[4096];
+    size_t stream_end;
+} capture_t;
+
+static void capture_flush(const uint8_t *payload, size_t payload_len, void *ctx) {
+    capture_t *cap = ctx;
+    quicvc_frame_iter_t iter;
+    quicvc_frame_t frame;
+
+    cap->packets++;
+    if (payload_len > cap->largest_packet) {
+        cap->largest_packet = payload_len;
+    }
+
+    quicvc_frame_iter_init(&iter, payload, payload_len);
+    while (quicvc_frame_iter_next(&iter, &frame)) {
+        cap->frames++;
+        if (frame.type == QUICVC_FRAME_HEARTBEAT) {
+            cap->heartbeats++;
+        } else if (frame.type == QUICVC_FRAME_ACK) {
+            cap->acks++;
+        } else if ((frame.type & 0xF8) == QUICVC_FRAME_STREAM) {
+            const quicvc_stream_frame_t *s = &frame.u.stream;
+            if (s->offset + s->data_len <= sizeof(cap->stream)) {
+                memcpy(&cap->stream[s->offset], s->data, s->data_len);
+                if (s->offset + s->data_len > cap->stream_end) {
+                    cap->stream_end = s->offset + s->data_len;
+                }
+            }
+            cap->fins += s->has_fin;
+        }
+    }
+    cap->malformed |= iter.error || iter.offset != payload_len;
+}
+
+int main(void) {
+    int failures = 0;
+    capture_t cap;
+    quicvc_packet_builder_t builder;
+    uint8_t data[3000];
+
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)(i * 7 + 3);
+    }
+
+    // Small frames share one packet until flushed
+    memset(&cap, 0, sizeof(cap));
+    quicvc_packet_builder_init(&builder, MAX_PAYLOAD, 0, capture_flush, &cap);
+    quicvc_packet_builder_add_vc_frame(&builder, QUICVC_FRAME_HEARTBEAT, (const uint8_t *)"{}", 2, 0);
+    quicvc_stream_frame_t small = { .stream_id = 4, .data = data, .data_len = 40 };
+    quicvc_packet_builder_add_stream(&builder, &small, 0);
+    quicvc_ack_tracker_t tracker;
+    quicvc_ack_tracker_init(&tracker);
+    quicvc_ack_tracker_record(&tracker, 3);
+    quicvc_packet_builder_add_ack(&builder, &tracker, 0, 0);
+    if (cap.packets != 0) {
+        printf("FAIL flushed before size or deadline\n");
+        failures++;
+    }
+    quicvc_packet_builder_flush(&builder);
+    if (cap.packets != 1 || cap.frames != 3 || cap.heartbeats != 1 || cap.acks != 1 || cap.malformed) {
+        printf("FAIL coalesce: %d packets %d frames\n", cap.packets, cap.frames);
+        failures++;
+    }
+
+    // Large STREAM data is split at packet boundaries and reassembles
+    memset(&cap, 0, sizeof(cap));
+    quicvc_packet_builder_init(&builder, MAX_PAYLOAD, 0, capture_flush, &cap);
+    quicvc_stream_frame_t large = { .stream_id = 8, .data = data, .data_len = sizeof(data), .has_fin = true };
+    if (!quicvc_packet_builder_add_stream(&builder, &large, 0)) {
+        printf("FAIL add large stream\n");
+        failures++;
+    }
+    quicvc_packet_builder_flush(&builder);
+    if (cap.malformed || cap.largest_packet > MAX_PAYLOAD || cap.fins != 1 ||
+        cap.stream_end != sizeof(data) || memcmp(cap.stream, data, sizeof(data)) != 0) {
+        printf("FAIL split stream: %d packets, end %zu\n", cap.packets, cap.stream_end);
+        failures++;
+    }
+    if (cap.packets > (int)(sizeof(data) / (MAX_PAYLOAD - 8)) + 1) {
+        printf("FAIL split stream used %d packets\n", cap.packets);
+        failures++;
+    }
+
+    // Deadline flushes on poll, not before
+    memset(&cap, 0, sizeof(cap));
+    quicvc_packet_builder_init(&builder, MAX_PAYLOAD, 5000, capture_flush, &cap);
+    quicvc_packet_builder_add_vc_frame(&builder, QUICVC_FRAME_HEARTBEAT, NULL, 0, 1000);
+    quicvc_packet_builder_add_vc_frame(&builder, QUICVC_FRAME_HEARTBEAT, NULL, 0, 4000);
+    if (quicvc_packet_builder_poll(&builder, 5999) || !quicvc_packet_builder_poll(&builder, 6000) ||
+        cap.packets != 1 || cap.heartbeats != 2 || quicvc_packet_builder_poll(&builder, 99999)) {
+        printf("FAIL deadline\n");
+        failures++;
+    }
+
+    // Frames larger than a packet are refused
+    uint8_t big[MAX_PAYLOAD + 1] = {0};
+    if (quicvc_packet_builder_add(&builder, big, sizeof(big), 0) ||
+        quicvc_packet_builder_add_vc_frame(&builder, QUICVC_FRAME_HEARTBEAT, big, MAX_PAYLOAD - 2, 0)) {
+        printf("FAIL oversized frame accepted\n");
+        failures++;
+    }
+
+    printf("%s (%d failures)\n", failures ? "FAILED" : "OK", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,214 @@
+/**
+ * Host test for packet number truncation and reconstruction
+ * Compile with: cc -Ic-headers test/quicvc_packet_number_test.c c-headers/quicvc_protocol.c -o pn-test
+ * Run from the package directory, or pass the vectors file as the argument
+ *
+ * The vectors are in test/vectors/packet_number.json, which
+ * test/packet_number_vectors.ts checks against encodePacketNumber and
+ * parsePacketHeader in src/packet.ts, so both codecs are held to the same
+ * bytes. The sizing and reconstruction cases are the RFC 9000 Appendix
+ * A.2/A.3 examples plus window edges.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "quicvc_protocol.h"
+
+#define VECTORS_PATH "test/vectors/packet_number.json"
+
+static char *read_file(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *data = size >= 0 ? malloc((size_t)size + 1) : NULL;
+    if (data && fread(data, 1, (size_t)size, f) != (size_t)size) {
+        free(data);
+        data = NULL;
+    }
+    if (data) {
+        data[size] = '\0';
+    }
+    fclose(f);
+    return data;
+}
+
+// Just enough JSON for the vectors file: arrays of flat objects whose
+// values are strings, integers or null
+
+// Objects of the array under 'name', one per call: '*cursor' starts at
+// NULL and the object spans [*start, *end). False after the last one
+static bool next_vector(const char *json, const char *name, const char **cursor,
+                        const char **start, const char **end) {
+    if (!*cursor) {
+        char key[32];
+        snprintf(key, sizeof(key), "\"%s\"", name);
+        const char *p = strstr(json, key);
+        p = p ? strchr(p, '[') : NULL;
+        if (!p) {
+            return false;
+        }
+        *cursor = p + 1;
+    }
+    const char *open = strpbrk(*cursor, "{]");
+    if (!open || *open == ']') {
+        return false;
+    }
+    const char *close = strchr(open, '}');
+    if (!close) {
+        return false;
+    }
+    *start = open;
+    *end = close;
+    *cursor = close + 1;
+    return true;
+}
+
+// Value of 'name' in an object as text, without quotes; "null" for null
+static bool vector_field(const char *start, const char *end, const char *name,
+                         char *out, size_t out_size) {
+    char key[32];
+    snprintf(key, sizeof(key), "\"%s\"", name);
+    const char *p = strstr(start, key);
+    if (!p || p >= end) {
+        return false;
+    }
+    p = strchr(p + strlen(key), ':');
+    if (!p || p >= end) {
+        return false;
+    }
+    p++;
+    while (*p == ' ') p++;
+    const char *stop;
+    if (*p == '"') {
+        stop = strchr(++p, '"');
+    } else {
+        stop = p + strcspn(p, ",} \n");
+    }
+    if (!stop || stop > end || (size_t)(stop - p) >= out_size) {
+        return false;
+    }
+    memcpy(out, p, (size_t)(stop - p));
+    out[stop - p] = '\0';
+    return true;
+}
+
+static bool vector_u64(const char *start, const char *end, const char *name, uint64_t *value) {
+    char text[32];
+    if (!vector_field(start, end, name, text, sizeof(text))) {
+        return false;
+    }
+    *value = strcmp(text, "null") == 0 ? QUICVC_PACKET_NUMBER_NONE : strtoull(text, NULL, 0);
+    return true;
+}
+
+static bool vector_bytes(const char *start, const char *end, const char *name,
+                         uint8_t *out, size_t out_size, size_t *len) {
+    char hex[2 * 8 + 1];
+    if (!vector_field(start, end, name, hex, sizeof(hex)) || strlen(hex) % 2 != 0 ||
+        strlen(hex) / 2 > out_size) {
+        return false;
+    }
+    *len = strlen(hex) / 2;
+    for (size_t i = 0; i < *len; i++) {
+        char byte[3] = { hex[2 * i], hex[2 * i + 1], '\0' };
+        out[i] = (uint8_t)strtoul(byte, NULL, 16);
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    int failures = 0;
+    const char *path = argc > 1 ? argv[1] : VECTORS_PATH;
+    char *json = read_file(path);
+    if (!json) {
+        printf("FAIL cannot read %s\n", path);
+        printf("FAILED (1 failures)\n");
+        return 1;
+    }
+
+    const char *cursor = NULL, *start, *end;
+    size_t encode_count = 0;
+    while (next_vector(json, "encode", &cursor, &start, &end)) {
+        uint64_t packet_number, largest_acked, length;
+        uint8_t bytes[4];
+        size_t bytes_len;
+        if (!vector_u64(start, end, "packet_number", &packet_number) ||
+            !vector_u64(start, end, "largest_acked", &largest_acked) ||
+            !vector_u64(start, end, "length", &length) ||
+            !vector_bytes(start, end, "bytes", bytes, sizeof(bytes), &bytes_len) ||
+            bytes_len != length) {
+            printf("FAIL malformed encode vector %zu\n", encode_count);
+            failures++;
+            break;
+        }
+        encode_count++;
+
+        uint8_t out[4] = {0};
+        uint8_t len = quicvc_packet_number_length(packet_number, largest_acked);
+        uint8_t written = quicvc_encode_packet_number(packet_number, largest_acked, out, sizeof(out));
+
+        if (len != length || written != length || memcmp(out, bytes, length) != 0) {
+            printf("FAIL encode pn=0x%llx acked=0x%llx: length %u, wrote %u\n",
+                   (unsigned long long)packet_number, (unsigned long long)largest_acked,
+                   len, written);
+            failures++;
+        }
+    }
+
+    cursor = NULL;
+    size_t decode_count = 0;
+    while (next_vector(json, "decode", &cursor, &start, &end)) {
+        uint64_t expected_pn, truncated_pn, length, packet_number;
+        if (!vector_u64(start, end, "expected_pn", &expected_pn) ||
+            !vector_u64(start, end, "truncated_pn", &truncated_pn) ||
+            !vector_u64(start, end, "length", &length) ||
+            !vector_u64(start, end, "packet_number", &packet_number)) {
+            printf("FAIL malformed decode vector %zu\n", decode_count);
+            failures++;
+            break;
+        }
+        decode_count++;
+
+        uint64_t pn = quicvc_decode_packet_number(expected_pn, truncated_pn, (uint8_t)length);
+        if (pn != packet_number) {
+            printf("FAIL decode expected=0x%llx truncated=0x%llx: got 0x%llx, want 0x%llx\n",
+                   (unsigned long long)expected_pn, (unsigned long long)truncated_pn,
+                   (unsigned long long)pn, (unsigned long long)packet_number);
+            failures++;
+        }
+    }
+    free(json);
+
+    if (encode_count == 0 || decode_count == 0) {
+        printf("FAIL %s holds %zu encode and %zu decode vectors\n", path, encode_count, decode_count);
+        failures++;
+    }
+
+    // Round trip: whatever the sender picks, the receiver recovers it
+    for (uint64_t acked = 0; acked < 70000; acked += 997) {
+        for (uint64_t pn = acked + 1; pn < acked + 40000; pn += 13) {
+            uint8_t out[4];
+            uint8_t len = quicvc_encode_packet_number(pn, acked, out, sizeof(out));
+            uint64_t truncated = 0;
+            for (uint8_t b = 0; b < len; b++) {
+                truncated = (truncated << 8) | out[b];
+            }
+            if (quicvc_decode_packet_number(acked + 1, truncated, len) != pn) {
+                printf("FAIL round trip pn=%llu acked=%llu\n",
+                       (unsigned long long)pn, (unsigned long long)acked);
+                failures++;
+                break;
+            }
+        }
+    }
+
+    printf("%s (%d failures)\n", failures ? "FAILED" : "OK", failures);
+    return failures ? 1 : 0;
+}
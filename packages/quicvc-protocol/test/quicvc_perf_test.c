@@ -0,0 +1,145 @@
+/**
+ * Host test for latency histograms and the VC_PERF frame
+ * Compile with: cc -Ic-headers test/quicvc_perf_test.c c-headers/quicvc_protocol.c -o perf-test
+ *
+ * Percentiles must bound the exact value from above within the 25%
+ * bucket width; the frame is read back through the frame iterator, and
+ * report lines are checked character for character.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "quicvc_protocol.h"
+
+static int check_percentile(const quicvc_perf_histogram_t *h, unsigned pct, uint64_t exact) {
+    uint64_t got = quicvc_perf_percentile(h, pct);
+    if (got < exact || got > exact + exact / 4) {
+        printf("FAIL p%u: got %llu, exact %llu\n", pct,
+               (unsigned long long)got, (unsigned long long)exact);
+        return 1;
+    }
+    return 0;
+}
+
+int main(void) {
+    int failures = 0;
+    quicvc_perf_histogram_t h;
+
+    // Empty
+    quicvc_perf_init(&h);
+    quicvc_perf_summary_t s = quicvc_perf_summarize(&h);
+    if (s.count || s.min || s.avg || s.p99 || s.max || quicvc_perf_percentile(&h, 50)) {
+        printf("FAIL empty histogram\n");
+        failures++;
+    }
+
+    // Small values are exact
+    for (uint64_t v = 0; v < 4; v++) quicvc_perf_record(&h, v);
+    if (quicvc_perf_percentile(&h, 50) != 1 || quicvc_perf_percentile(&h, 100) != 3) {
+        printf("FAIL small values: p50 %llu, p100 %llu\n",
+               (unsigned long long)quicvc_perf_percentile(&h, 50),
+               (unsigned long long)quicvc_perf_percentile(&h, 100));
+        failures++;
+    }
+
+    // 1..10000 cycles, uniform
+    quicvc_perf_init(&h);
+    for (uint64_t v = 1; v <= 10000; v++) quicvc_perf_record(&h, v * 10);
+    failures += check_percentile(&h, 50, 50000);
+    failures += check_percentile(&h, 90, 90000);
+    failures += check_percentile(&h, 99, 99000);
+    s = quicvc_perf_summarize(&h);
+    if (s.count != 10000 || s.min != 10 || s.avg != 50005 || s.max != 100000 ||
+        s.p99 < 99000 || s.p99 > s.max) {
+        printf("FAIL summary: count %llu min %llu avg %llu p99 %llu max %llu\n",
+               (unsigned long long)s.count, (unsigned long long)s.min,
+               (unsigned long long)s.avg, (unsigned long long)s.p99, (unsigned long long)s.max);
+        failures++;
+    }
+
+    // One slow outlier among fast samples shows at p100, not p99
+    quicvc_perf_init(&h);
+    for (int i = 0; i < 199; i++) quicvc_perf_record(&h, 2000);
+    quicvc_perf_record(&h, 5000000000ull);  // Past 2^32: last bucket
+    if (quicvc_perf_percentile(&h, 99) > 2500 || quicvc_perf_percentile(&h, 100) != 5000000000ull) {
+        printf("FAIL outlier: p99 %llu, p100 %llu\n",
+               (unsigned long long)quicvc_perf_percentile(&h, 99),
+               (unsigned long long)quicvc_perf_percentile(&h, 100));
+        failures++;
+    }
+
+    // VC_PERF frame: only operations with samples are listed
+    quicvc_perf_histogram_t ops[QUICVC_PERF_OP_COUNT];
+    for (size_t i = 0; i < QUICVC_PERF_OP_COUNT; i++) quicvc_perf_init(&ops[i]);
+    quicvc_perf_record(&ops[QUICVC_PERF_SEAL], 1200);
+    quicvc_perf_record(&ops[QUICVC_PERF_SEAL], 1400);
+    quicvc_perf_record(&ops[QUICVC_PERF_HANDSHAKE], 48000000);
+
+    uint8_t frame[128];
+    size_t len = quicvc_perf_write_frame(ops, 240, frame, sizeof(frame));
+    quicvc_frame_iter_t iter;
+    quicvc_frame_t f;
+    quicvc_frame_iter_init(&iter, frame, len);
+    if (len == 0 || !quicvc_frame_iter_next(&iter, &f) || f.type != QUICVC_FRAME_VC_PERF ||
+        f.u.vc.body_len != len - 3) {
+        printf("FAIL frame: %zu bytes did not read back\n", len);
+        failures++;
+    } else {
+        const uint8_t *p = f.u.vc.body;
+        size_t left = f.u.vc.body_len;
+        uint64_t values[1 + 2 * 6];
+        size_t n = 0;
+        while (left > 0 && n < sizeof(values) / sizeof(values[0])) {
+            // Operation bytes sit before each group of five varints
+            if (n == 1 || n == 7) {
+                values[n++] = *p++;
+                left--;
+                continue;
+            }
+            quicvc_varint_result_t r = quicvc_decode_varint(p, left);
+            if (r.bytes_read == 0) break;
+            values[n++] = r.value;
+            p += r.bytes_read;
+            left -= r.bytes_read;
+        }
+        const uint64_t expected[] = {
+            240,
+            QUICVC_PERF_SEAL, 2, 1200, 1300, 1400, 1400,
+            QUICVC_PERF_HANDSHAKE, 1, 48000000, 48000000, 48000000, 48000000,
+        };
+        if (left != 0 || n != 13 || memcmp(values, expected, sizeof(expected)) != 0) {
+            printf("FAIL frame body: %zu values, %zu bytes left\n", n, left);
+            failures++;
+        }
+    }
+
+    // Too small a buffer
+    if (quicvc_perf_write_frame(ops, 240, frame, len - 1) != 0) {
+        printf("FAIL frame into a short buffer\n");
+        failures++;
+    }
+
+    // Report lines: empty operations give none, microseconds only with a
+    // clock rate, and a short buffer gives no partial line
+    char line[128];
+    static const char seal_line[] = "seal           n=2 min 1200 avg 1300 p99 1400 max 1400 (avg 5 us)";
+    if (quicvc_perf_format(&ops[QUICVC_PERF_OPEN], QUICVC_PERF_OPEN, 240, line, sizeof(line)) != 0 ||
+        quicvc_perf_format(&ops[QUICVC_PERF_SEAL], QUICVC_PERF_SEAL, 240, line, sizeof(line)) !=
+            sizeof(seal_line) - 1 || strcmp(line, seal_line) != 0 ||
+        quicvc_perf_format(&ops[QUICVC_PERF_SEAL], QUICVC_PERF_SEAL, 0, line, sizeof(line)) !=
+            sizeof(seal_line) - 1 - strlen(" (avg 5 us)") ||
+        quicvc_perf_format(&ops[QUICVC_PERF_SEAL], QUICVC_PERF_SEAL, 240, line, sizeof(seal_line) - 1) != 0) {
+        printf("FAIL report line: \"%s\"\n", line);
+        failures++;
+    }
+    if (strcmp(quicvc_perf_op_name(QUICVC_PERF_OPEN_BATCH), "open batch") != 0 ||
+        strcmp(quicvc_perf_op_name(QUICVC_PERF_OP_COUNT), "unknown") != 0) {
+        printf("FAIL operation names\n");
+        failures++;
+    }
+
+    printf("%s (%d failures)\n", failures ? "FAILED" : "OK", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,129 @@
+/**
+ * Host test for the header-only C++ binding
+ * Compile with: cc -c -Ic-headers c-headers/quicvc_protocol.c &&
+ *     c++ -std=c++17 -Ic-headers test/quicvc_protocol_hpp_test.cpp quicvc_protocol.o -o hpp-test
+ *
+ * The constexpr codec is checked at compile time with static_assert and at
+ * run time against the C implementation on random inputs.
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include "quicvc_protocol.hpp"
+
+namespace {
+
+// Compile-time: varint round trip and sizes
+constexpr std::uint64_t decode_encoded(std::uint64_t value) {
+    std::array<std::uint8_t, 8> buf{};
+    const std::size_t n = quicvc::encode_varint(value, quicvc::mutable_bytes(buf.data(), buf.size()));
+    return quicvc::decode_varint(quicvc::bytes(buf.data(), n)).value;
+}
+
+static_assert(quicvc::varint_size_v<63> == 1 && quicvc::varint_size_v<64> == 2, "varint sizes");
+static_assert(quicvc::varint_size_v<16384> == 4 && quicvc::varint_size_v<1073741824> == 8, "varint sizes");
+static_assert(decode_encoded(494878333) == 494878333, "varint round trip");
+static_assert(decode_encoded(151288809941952652ull) == 151288809941952652ull, "varint round trip");
+
+// Compile-time: a STREAM frame built and parsed back as a constant
+constexpr std::array<std::uint8_t, 5> kBody = {'h', 'e', 'l', 'l', 'o'};
+constexpr auto kStream = quicvc::make_stream_frame<4, 100>(kBody, true);
+static_assert(kStream.size() == 1 + 1 + 2 + 1 + 5, "stream frame size at compile time");
+
+constexpr bool reads_back() {
+    quicvc::frame_reader reader(quicvc::bytes(kStream.data(), kStream.size()));
+    quicvc::frame_view frame;
+    return reader.next(frame) && frame.stream.stream_id == 4 && frame.stream.offset == 100 &&
+           frame.stream.fin && frame.stream.data.size() == 5 && frame.stream.data[4] == 'o' &&
+           !reader.next(frame) && !reader.error();
+}
+static_assert(reads_back(), "constexpr frame reader");
+
+constexpr auto kHeartbeat = quicvc::make_vc_frame<QUICVC_FRAME_HEARTBEAT>(kBody);
+static_assert(kHeartbeat.size() == 8 && kHeartbeat[0] == QUICVC_FRAME_HEARTBEAT && kHeartbeat[2] == 5,
+              "vc frame at compile time");
+
+std::uint64_t rng_state = 0x2545F4914F6CDD1Dull;
+
+std::uint64_t rng() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+} // namespace
+
+int main() {
+    int failures = 0;
+
+    // Varints against the C codec
+    for (int i = 0; i < 200000; i++) {
+        const std::uint64_t value = rng() >> (2 + rng() % 62);
+        std::uint8_t a[8], b[8];
+        const std::size_t na = quicvc::encode_varint(value, quicvc::mutable_bytes(a, sizeof(a)));
+        const std::size_t nb = quicvc_encode_varint(value, b, sizeof(b));
+        const quicvc::varint_result ra = quicvc::decode_varint(quicvc::bytes(a, na));
+        if (na != nb || std::memcmp(a, b, na) != 0 || ra.value != value || ra.bytes_read != na) {
+            std::printf("FAIL varint %llu\n", static_cast<unsigned long long>(value));
+            failures++;
+            break;
+        }
+    }
+
+    // Frame reader against quicvc_frame_iter_t on random and valid payloads
+    for (int i = 0; i < 20000; i++) {
+        std::uint8_t payload[256];
+        std::size_t len = 0;
+
+        // Mix well-formed frames with random tails
+        while (len < 200) {
+            std::uint8_t body[40];
+            const std::size_t body_len = rng() % sizeof(body);
+            for (std::size_t j = 0; j < body_len; j++) body[j] = static_cast<std::uint8_t>(rng());
+            const quicvc::mutable_bytes out(payload + len, sizeof(payload) - len);
+            switch (rng() % 4) {
+                case 0: len += quicvc::write_stream_frame(out, rng() % 1000, rng() % 70000,
+                                                          quicvc::bytes(body, body_len), rng() & 1); break;
+                case 1: len += quicvc::write_vc_frame(out, QUICVC_FRAME_HEARTBEAT, quicvc::bytes(body, body_len)); break;
+                case 2: payload[len++] = QUICVC_FRAME_PING; break;
+                default: payload[len++] = static_cast<std::uint8_t>(rng()); break;
+            }
+        }
+
+        quicvc::frame_reader reader(quicvc::bytes(payload, len));
+        quicvc_frame_iter_t iter;
+        quicvc_frame_iter_init(&iter, payload, len);
+        quicvc::frame_view a;
+        quicvc_frame_t b;
+
+        for (;;) {
+            const bool more_a = reader.next(a);
+            const bool more_b = quicvc_frame_iter_next(&iter, &b);
+            if (more_a != more_b || reader.error() != iter.error || reader.offset() != iter.offset) {
+                std::printf("FAIL reader diverged at offset %zu\n", reader.offset());
+                failures++;
+                break;
+            }
+            if (!more_a) break;
+            bool same = a.type == b.type && a.raw.size() == b.raw_len;
+            if (same && (a.type & 0xF8) == QUICVC_FRAME_STREAM) {
+                same = a.stream.stream_id == b.u.stream.stream_id && a.stream.offset == b.u.stream.offset &&
+                       a.stream.data.size() == b.u.stream.data_len && a.stream.fin == b.u.stream.has_fin;
+            } else if (same && a.type == QUICVC_FRAME_ACK) {
+                same = a.ack.largest_acknowledged == b.u.ack.largest_acknowledged &&
+                       a.ack.range_count == b.u.ack.range_count && a.ack.ranges.size() == b.u.ack.ranges_len;
+            }
+            if (!same) {
+                std::printf("FAIL frame 0x%02x differs\n", a.type);
+                failures++;
+                break;
+            }
+        }
+        if (failures) break;
+    }
+
+    std::printf("%s (%d failures)\n", failures ? "FAILED" : "OK", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,156 @@
+/**
+ * Host test for STREAM reassembly
+ * Compile with: cc -Ic-headers test/quicvc_reassembly_test.c c-headers/quicvc_protocol.c -o reassembly-test
+ *
+ * A stream is cut into random segments and fed in shuffled order with
+ * duplicates and overlapping retransmissions through a ring smaller than
+ * the stream. Refused segments are resent later, as a peer would after
+ * loss. Delivered bytes must equal the original, in order, with one FIN.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "quicvc_protocol.h"
+
+#define STREAM_SIZE 60000
+#define MAX_SEGMENTS 8192
+
+typedef struct {
+    uint8_t data[STREAM_SIZE];
+    size_t len;
+    int fins;
+    bool data_after_fin;
+} sink_t;
+
+typedef struct {
+    uint64_t offset;
+    size_t len;
+} segment_t;
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)rng_state;
+}
+
+static void sink_deliver(const uint8_t *data, size_t len, bool fin, void *ctx) {
+    sink_t *sink = ctx;
+    if (sink->fins > 0 && len > 0) {
+        sink->data_after_fin = true;
+    }
+    if (len > 0 && sink->len + len <= sizeof(sink->data)) {
+        memcpy(&sink->data[sink->len], data, len);
+    }
+    sink->len += len;
+    sink->fins += fin;
+}
+
+int main(void) {
+    int failures = 0;
+    static uint8_t stream[STREAM_SIZE];
+    static segment_t pending[MAX_SEGMENTS];
+    static sink_t sink;
+
+    for (size_t i = 0; i < sizeof(stream); i++) {
+        stream[i] = (uint8_t)rng();
+    }
+
+    static const size_t capacities[] = { 1500, 4096, 65536 };
+    for (size_t c = 0; c < sizeof(capacities) / sizeof(capacities[0]); c++) {
+        for (int trial = 0; trial < 20; trial++) {
+            static uint8_t ring[65536];
+            quicvc_reassembly_t r;
+            size_t count = 0;
+
+            memset(&sink, 0, sizeof(sink));
+            quicvc_reassembly_init(&r, ring, capacities[c], sink_deliver, &sink);
+
+            // Segments of 1..600 bytes covering the stream, plus overlaps
+            for (uint64_t off = 0; off < STREAM_SIZE && count < MAX_SEGMENTS - 1; ) {
+                size_t len = 1 + rng() % 600;
+                if (off + len > STREAM_SIZE) len = STREAM_SIZE - off;
+                pending[count++] = (segment_t){ off, len };
+                if (rng() % 4 == 0 && count < MAX_SEGMENTS - 1) {
+                    uint64_t o = off > 300 ? off - rng() % 300 : 0;
+                    pending[count++] = (segment_t){ o, (size_t)(off + len - o) };
+                }
+                off += len;
+            }
+
+            // Deliver in windows of shuffled segments; resend what was refused
+            size_t head = 0;
+            int rounds = 0;
+            while (head < count && rounds++ < 100000) {
+                size_t window = 16;
+                if (head + window > count) window = count - head;
+                size_t pick = head + rng() % window;
+                segment_t seg = pending[pick];
+                pending[pick] = pending[head];
+                pending[head] = seg;
+
+                quicvc_reassembly_status_t status = quicvc_reassembly_insert(
+                    &r, seg.offset, &stream[seg.offset], seg.len, seg.offset + seg.len == STREAM_SIZE);
+                if (status == QUICVC_REASSEMBLY_FINAL_SIZE_ERROR) {
+                    printf("FAIL unexpected final size error\n");
+                    failures++;
+                    break;
+                }
+                if (status == QUICVC_REASSEMBLY_OVER_BUDGET || status == QUICVC_REASSEMBLY_TOO_FRAGMENTED) {
+                    // Put it back at the end of the window for a later retry
+                    size_t back = head + window - 1;
+                    pending[head] = pending[back];
+                    pending[back] = seg;
+                    continue;
+                }
+                if (rng() % 10 == 0) {
+                    // Stray duplicate of something already delivered
+                    quicvc_reassembly_insert(&r, seg.offset, &stream[seg.offset], seg.len,
+                                             seg.offset + seg.len == STREAM_SIZE);
+                }
+                head++;
+            }
+
+            if (sink.len != STREAM_SIZE || memcmp(sink.data, stream, STREAM_SIZE) != 0 ||
+                sink.fins != 1 || sink.data_after_fin || !quicvc_reassembly_is_complete(&r)) {
+                printf("FAIL capacity %zu trial %d: delivered %zu, fins %d\n",
+                       capacities[c], trial, sink.len, sink.fins);
+                failures++;
+            }
+        }
+    }
+
+    // Final size violations
+    quicvc_reassembly_t r;
+    uint8_t ring[64];
+    memset(&sink, 0, sizeof(sink));
+    quicvc_reassembly_init(&r, ring, sizeof(ring), sink_deliver, &sink);
+    quicvc_reassembly_insert(&r, 10, stream, 10, false);
+    if (quicvc_reassembly_insert(&r, 0, stream, 5, true) != QUICVC_REASSEMBLY_FINAL_SIZE_ERROR ||
+        quicvc_reassembly_insert(&r, 0, stream, 20, true) != QUICVC_REASSEMBLY_OK ||
+        quicvc_reassembly_insert(&r, 20, stream, 1, false) != QUICVC_REASSEMBLY_FINAL_SIZE_ERROR ||
+        quicvc_reassembly_insert(&r, 0, stream, 21, true) != QUICVC_REASSEMBLY_FINAL_SIZE_ERROR) {
+        printf("FAIL final size checks\n");
+        failures++;
+    }
+
+    // Budget and a FIN without data
+    memset(&sink, 0, sizeof(sink));
+    quicvc_reassembly_init(&r, ring, sizeof(ring), sink_deliver, &sink);
+    if (quicvc_reassembly_insert(&r, 60, stream, 5, false) != QUICVC_REASSEMBLY_OVER_BUDGET ||
+        quicvc_reassembly_insert(&r, 0, stream, 64, false) != QUICVC_REASSEMBLY_OK ||
+        quicvc_reassembly_insert(&r, 0, stream, 64, false) != QUICVC_REASSEMBLY_DUPLICATE ||
+        quicvc_reassembly_insert(&r, 64, NULL, 0, true) != QUICVC_REASSEMBLY_OK ||
+        sink.fins != 1 || sink.len != 64) {
+        printf("FAIL budget / empty FIN\n");
+        failures++;
+    }
+
+    printf("%s (%d failures)\n", failures ? "FAILED" : "OK", failures);
+    return failures ? 1 : 0;
+}
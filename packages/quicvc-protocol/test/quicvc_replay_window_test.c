@@ -0,0 +1,84 @@
+/**
+ * Host test for the replay window
+ * Compile with: cc -Ic-headers test/quicvc_replay_window_test.c c-headers/quicvc_protocol.c -o replay-test
+ *
+ * Each step checks a packet number and, when the check passes and the
+ * step says the packet authenticated, records it; the final drop counters
+ * must match the rejections along the way.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "quicvc_protocol.h"
+
+typedef struct {
+    uint64_t packet_number;
+    bool authenticates;         // Record after a passing check
+    quicvc_replay_status_t expected;
+} replay_step_t;
+
+static const replay_step_t steps[] = {
+    { 0,   true,  QUICVC_REPLAY_OK },
+    { 0,   true,  QUICVC_REPLAY_DUPLICATE },
+    { 2,   true,  QUICVC_REPLAY_OK },
+    { 1,   true,  QUICVC_REPLAY_OK },          // Reordered into the gap
+    { 1,   true,  QUICVC_REPLAY_DUPLICATE },
+    { 9,   false, QUICVC_REPLAY_OK },          // Forged: never recorded
+    { 9,   true,  QUICVC_REPLAY_OK },          // So the real one still opens
+    { 9,   true,  QUICVC_REPLAY_DUPLICATE },
+    { 72,  true,  QUICVC_REPLAY_OK },          // Window now 9..72
+    { 8,   true,  QUICVC_REPLAY_TOO_OLD },
+    { 9,   true,  QUICVC_REPLAY_DUPLICATE },   // Oldest slot still held
+    { 10,  true,  QUICVC_REPLAY_OK },
+    { 500, true,  QUICVC_REPLAY_OK },          // Jump clears the window
+    { 72,  true,  QUICVC_REPLAY_TOO_OLD },
+    { 499, true,  QUICVC_REPLAY_OK },
+    { 500, true,  QUICVC_REPLAY_DUPLICATE },
+};
+
+int main(void) {
+    int failures = 0;
+    uint64_t duplicates = 0, too_old = 0;
+
+    quicvc_replay_window_t window;
+    quicvc_replay_window_init(&window);
+    if (quicvc_replay_expected_pn(&window) != 0) {
+        printf("FAIL empty window expects %llu\n",
+               (unsigned long long)quicvc_replay_expected_pn(&window));
+        failures++;
+    }
+
+    for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+        const replay_step_t *s = &steps[i];
+        quicvc_replay_status_t status = quicvc_replay_check(&window, s->packet_number);
+
+        if (status != s->expected) {
+            printf("FAIL step %zu pn=%llu: status %d, want %d\n", i,
+                   (unsigned long long)s->packet_number, status, s->expected);
+            failures++;
+        }
+        duplicates += s->expected == QUICVC_REPLAY_DUPLICATE;
+        too_old += s->expected == QUICVC_REPLAY_TOO_OLD;
+        if (status == QUICVC_REPLAY_OK && s->authenticates) {
+            quicvc_replay_update(&window, s->packet_number);
+        }
+    }
+
+    if (window.dropped_duplicate != duplicates || window.dropped_too_old != too_old) {
+        printf("FAIL drop counters: %llu duplicate, %llu too old; want %llu, %llu\n",
+               (unsigned long long)window.dropped_duplicate,
+               (unsigned long long)window.dropped_too_old,
+               (unsigned long long)duplicates, (unsigned long long)too_old);
+        failures++;
+    }
+    if (quicvc_replay_expected_pn(&window) != 501) {
+        printf("FAIL expected pn %llu, want 501\n",
+               (unsigned long long)quicvc_replay_expected_pn(&window));
+        failures++;
+    }
+
+    printf("%s (%d failures)\n", failures ? "FAILED" : "OK", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,95 @@
+/**
+ * Host test for Retry packets
+ * Compile with: cc -Ic-headers test/quicvc_retry_test.c c-headers/quicvc_protocol.c -o retry-test
+ *
+ * The expected bytes are what buildRetryPacket in src/packet.ts produces
+ * for the same fields; the parser must hand back the token and tag and
+ * consume the whole datagram.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "quicvc_protocol.h"
+
+static const uint8_t dcid[] = { 0xc1, 0xc2, 0xc3, 0xc4 };
+static const uint8_t scid[] = { 0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58 };
+static const uint8_t token[] = { 0x00, 0x00, 0x00, 0x2a, 0x7e, 0x7e };
+
+static const uint8_t expected[] = {
+    0xf0,                                       // Long header, RETRY
+    0x00, 0x00, 0x00, 0x01,                     // Version
+    0x04, 0xc1, 0xc2, 0xc3, 0xc4,               // DCID
+    0x08, 0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,  // SCID
+    0x00, 0x00, 0x00, 0x2a, 0x7e, 0x7e,         // Token
+};
+
+int main(void) {
+    int failures = 0;
+    quicvc_header_t hdr = {
+        .packet_type = QUICVC_PACKET_TYPE_RETRY,
+        .version = 0x00000001,
+        .dcid = dcid,
+        .dcid_len = sizeof(dcid),
+        .scid = scid,
+        .scid_len = sizeof(scid),
+    };
+
+    uint8_t packet[64];
+    size_t len = quicvc_write_retry(&hdr, token, sizeof(token), packet, sizeof(packet));
+    if (len != sizeof(expected) || memcmp(packet, expected, sizeof(expected)) != 0) {
+        printf("FAIL write: %zu bytes, want %zu\n", len, sizeof(expected));
+        failures++;
+    }
+    for (size_t i = 0; i < QUICVC_RETRY_INTEGRITY_TAG_LENGTH; i++) {
+        packet[len + i] = (uint8_t)(0xa0 + i);
+    }
+    size_t packet_len = len + QUICVC_RETRY_INTEGRITY_TAG_LENGTH;
+
+    quicvc_header_parse_result_t parsed = quicvc_parse_header(packet, packet_len, 8);
+    const quicvc_header_t *p = &parsed.header;
+    if (parsed.bytes_consumed != packet_len || !p->is_long ||
+        p->packet_type != QUICVC_PACKET_TYPE_RETRY || p->version != 1) {
+        printf("FAIL parse: consumed %zu of %zu, type %u\n",
+               parsed.bytes_consumed, packet_len, p->packet_type);
+        failures++;
+    } else if (p->dcid_len != sizeof(dcid) || memcmp(p->dcid, dcid, sizeof(dcid)) != 0 ||
+               p->scid_len != sizeof(scid) || memcmp(p->scid, scid, sizeof(scid)) != 0) {
+        printf("FAIL parse: connection IDs differ\n");
+        failures++;
+    } else if (p->token_len != sizeof(token) || memcmp(p->token, token, sizeof(token)) != 0) {
+        printf("FAIL parse: token of %zu bytes, want %zu\n", p->token_len, sizeof(token));
+        failures++;
+    } else if (p->header_len != len || p->payload != &packet[len] ||
+               p->payload_len != QUICVC_RETRY_INTEGRITY_TAG_LENGTH) {
+        printf("FAIL parse: tag at %zu (%zu bytes), want %zu\n",
+               p->header_len, p->payload_len, len);
+        failures++;
+    }
+
+    // No room for the tag; a datagram too short to hold one
+    if (quicvc_write_retry(&hdr, token, sizeof(token), packet,
+                           len + QUICVC_RETRY_INTEGRITY_TAG_LENGTH - 1) != 0) {
+        printf("FAIL write without room for the tag\n");
+        failures++;
+    }
+    if (quicvc_parse_header(packet, len + QUICVC_RETRY_INTEGRITY_TAG_LENGTH - sizeof(token) - 1, 8)
+            .bytes_consumed != 0) {
+        printf("FAIL parse without a full tag\n");
+        failures++;
+    }
+
+    // A Retry without a token still parses
+    len = quicvc_write_retry(&hdr, NULL, 0, packet, sizeof(packet));
+    memset(&packet[len], 0, QUICVC_RETRY_INTEGRITY_TAG_LENGTH);
+    parsed = quicvc_parse_header(packet, len + QUICVC_RETRY_INTEGRITY_TAG_LENGTH, 8);
+    if (parsed.bytes_consumed != len + QUICVC_RETRY_INTEGRITY_TAG_LENGTH ||
+        parsed.header.token != NULL || parsed.header.token_len != 0) {
+        printf("FAIL tokenless Retry\n");
+        failures++;
+    }
+
+    printf("%s (%d failures)\n", failures ? "FAILED" : "OK", failures);
+    return failures ? 1 : 0;
+}
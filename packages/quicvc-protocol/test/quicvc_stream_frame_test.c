@@ -0,0 +1,75 @@
+/**
+ * Host test for scatter-gather STREAM serialization
+ * Compile with: cc -Ic-headers test/quicvc_stream_frame_test.c c-headers/quicvc_protocol.c -o stream-test
+ *
+ * The iovec form, concatenated, must match quicvc_serialize_stream_frame
+ * byte for byte and reference the caller's data rather than a copy.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "quicvc_protocol.h"
+
+int main(void) {
+    int failures = 0;
+    static uint8_t data[20000];
+    static const size_t lengths[] = { 0, 1, 63, 64, 16383, 16384, sizeof(data) };
+    static const uint64_t values[] = { 0, 63, 16383, 1073741823, 4611686018427387903ull };
+
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)(i ^ (i >> 8));
+    }
+
+    for (unsigned flags = 0; flags < 8; flags++) {
+        for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+            for (size_t v = 0; v < sizeof(values) / sizeof(values[0]); v++) {
+                quicvc_stream_frame_t frame = {
+                    .stream_id = values[v],
+                    .offset = values[sizeof(values) / sizeof(values[0]) - 1 - v],
+                    .data = lengths[l] ? data : NULL,
+                    .data_len = lengths[l],
+                    .has_fin = flags & QUICVC_STREAM_FIN_BIT,
+                    .has_len = flags & QUICVC_STREAM_LEN_BIT,
+                    .has_off = flags & QUICVC_STREAM_OFF_BIT,
+                };
+                static uint8_t copied[sizeof(data) + QUICVC_MAX_STREAM_HEADER_SIZE];
+                static uint8_t gathered[sizeof(data) + QUICVC_MAX_STREAM_HEADER_SIZE];
+                uint8_t header[QUICVC_MAX_STREAM_HEADER_SIZE];
+                quicvc_iovec_t iov[2];
+
+                size_t copied_len = quicvc_serialize_stream_frame(&frame, copied, sizeof(copied));
+                size_t count = quicvc_serialize_stream_frame_iov(&frame, header, sizeof(header), iov, 2);
+
+                size_t gathered_len = 0;
+                for (size_t i = 0; i < count; i++) {
+                    memcpy(&gathered[gathered_len], iov[i].iov_base, iov[i].iov_len);
+                    gathered_len += iov[i].iov_len;
+                }
+
+                bool ok = copied_len > 0 && count == (lengths[l] ? 2u : 1u) &&
+                          gathered_len == copied_len && memcmp(copied, gathered, copied_len) == 0 &&
+                          (count < 2 || iov[1].iov_base == data);
+                if (!ok) {
+                    printf("FAIL flags=%u len=%zu id=%llu\n", flags, lengths[l],
+                           (unsigned long long)values[v]);
+                    failures++;
+                }
+            }
+        }
+    }
+
+    // Too little room for the header or the iovecs
+    quicvc_stream_frame_t frame = { .stream_id = 16384, .data = data, .data_len = 10, .has_len = true };
+    uint8_t header[QUICVC_MAX_STREAM_HEADER_SIZE];
+    quicvc_iovec_t iov[2];
+    if (quicvc_serialize_stream_frame_iov(&frame, header, 4, iov, 2) != 0 ||
+        quicvc_serialize_stream_frame_iov(&frame, header, sizeof(header), iov, 1) != 0) {
+        printf("FAIL short buffers accepted\n");
+        failures++;
+    }
+
+    printf("%s (%d failures)\n", failures ? "FAILED" : "OK", failures);
+    return failures ? 1 : 0;
+}
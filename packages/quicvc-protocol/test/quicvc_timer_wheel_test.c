@@ -0,0 +1,195 @@
+/**
+ * Host test for the timer wheel
+ * Compile with: cc -Ic-headers test/quicvc_timer_wheel_test.c c-headers/quicvc_protocol.c -o timer-wheel-test
+ *
+ * Random schedules, cancels and clock jumps over deadlines from a few
+ * ticks to beyond the top level's span. After every advance, exactly the
+ * timers whose deadline, rounded up to a tick, has been reached must have
+ * fired; next_deadline must be after the clock and never later than the
+ * earliest of the rest, and sleeping from one to the next must drain the
+ * wheel in a bounded number of wakeups. Some callbacks re-arm themselves
+ * or cancel another timer, as heartbeats and idle timeouts do.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "quicvc_protocol.h"
+
+#define TIMERS     512
+#define TICK_US    1000
+#define OPERATIONS 20000
+
+typedef struct {
+    quicvc_timer_t timer;
+    uint64_t deadline_us;       // Model: valid while armed
+    bool armed;
+    uint64_t fired;
+    uint64_t period_us;         // Re-arm from the callback if non-zero
+    int cancels;                // Timer to cancel from the callback, or -1
+} test_timer_t;
+
+static test_timer_t timers[TIMERS];
+static quicvc_timer_wheel_t wheel;
+static uint64_t clock_us;
+static int failures;
+
+static uint64_t rng = 0x2545F4914F6CDD1Dull;
+
+static uint64_t next_random(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static uint64_t due_us(const test_timer_t *t) {
+    return (t->deadline_us + TICK_US - 1) / TICK_US * TICK_US;
+}
+
+static void on_fire(quicvc_timer_t *timer, void *ctx) {
+    test_timer_t *t = ctx;
+    if (&t->timer != timer || !t->armed || due_us(t) > clock_us) {
+        printf("FAIL timer %d fired at %llu, due %llu\n", (int)(t - timers),
+               (unsigned long long)clock_us, (unsigned long long)due_us(t));
+        failures++;
+    }
+    t->armed = false;
+    t->fired++;
+
+    if (t->period_us) {
+        t->deadline_us = clock_us + t->period_us;
+        t->armed = true;
+        quicvc_timer_schedule(&wheel, &t->timer, t->deadline_us);
+    }
+    if (t->cancels >= 0) {
+        quicvc_timer_cancel(&wheel, &timers[t->cancels].timer);
+        timers[t->cancels].armed = false;
+    }
+}
+
+// Ticks up to the clock have run, so an overdue timer is due on the next
+static uint64_t model_deadline(uint64_t deadline_us) {
+    uint64_t next_tick_us = (clock_us / TICK_US + 1) * TICK_US;
+    return deadline_us > next_tick_us ? deadline_us : next_tick_us;
+}
+
+// Deadlines on every level, past the top level's span and in the past
+static uint64_t random_deadline(void) {
+    switch (next_random() % 6) {
+        case 0: return clock_us - next_random() % (5 * TICK_US);
+        case 1: return clock_us + next_random() % (64 * TICK_US);
+        case 2: return clock_us + next_random() % (4096ull * TICK_US);
+        case 3: return clock_us + next_random() % (262144ull * TICK_US);
+        case 4: return clock_us + next_random() % (16777216ull * TICK_US);
+        default: return clock_us + 16777216ull * TICK_US + next_random() % (1ull << 35);
+    }
+}
+
+// Every timer whose tick has been reached has fired; none other has
+static void check_model(const char *when) {
+    uint64_t earliest = QUICVC_TIMER_NONE;
+    size_t armed = 0;
+    for (int i = 0; i < TIMERS; i++) {
+        const test_timer_t *t = &timers[i];
+        if (t->armed != t->timer.pending || (t->armed && due_us(t) <= clock_us)) {
+            printf("FAIL %s: timer %d armed %d pending %d due %llu at %llu\n", when, i,
+                   t->armed, t->timer.pending, (unsigned long long)due_us(t),
+                   (unsigned long long)clock_us);
+            failures++;
+            return;
+        }
+        if (t->armed) {
+            armed++;
+            if (due_us(t) < earliest) earliest = due_us(t);
+        }
+    }
+
+    uint64_t next = quicvc_timer_wheel_next_deadline(&wheel);
+    if (wheel.pending != armed || next > earliest || (next != QUICVC_TIMER_NONE && next <= clock_us) ||
+        (earliest == QUICVC_TIMER_NONE) != (next == QUICVC_TIMER_NONE)) {
+        printf("FAIL %s: next deadline %llu, earliest due %llu, %zu pending of %zu\n", when,
+               (unsigned long long)next, (unsigned long long)earliest, wheel.pending, armed);
+        failures++;
+    }
+}
+
+int main(void) {
+    clock_us = 1700000000ull * 1000000ull + 123;     // Not tick aligned
+    quicvc_timer_wheel_init(&wheel, clock_us, TICK_US);
+    if (quicvc_timer_wheel_next_deadline(&wheel) != QUICVC_TIMER_NONE ||
+        quicvc_timer_wheel_advance(&wheel, clock_us + 1000000) != 0) {
+        printf("FAIL empty wheel\n");
+        failures++;
+    }
+    clock_us += 1000000;
+
+    for (int i = 0; i < TIMERS; i++) {
+        quicvc_timer_init(&timers[i].timer, on_fire, &timers[i]);
+        timers[i].cancels = -1;
+        if (i % 16 == 0) timers[i].period_us = (1 + i % 7) * 20000000ull;   // Heartbeats
+        if (i % 16 == 1) timers[i].cancels = i + 1;
+    }
+
+    for (int op = 0; op < OPERATIONS && failures == 0; op++) {
+        test_timer_t *t = &timers[next_random() % TIMERS];
+        switch (next_random() % 8) {
+            case 0: case 1: case 2: {
+                // (Re)schedule
+                uint64_t deadline_us = random_deadline();
+                t->deadline_us = model_deadline(deadline_us);
+                t->armed = true;
+                quicvc_timer_schedule(&wheel, &t->timer, deadline_us);
+                break;
+            }
+            case 3:
+                quicvc_timer_cancel(&wheel, &t->timer);
+                t->armed = false;
+                break;
+            case 4: case 5:
+                // A short step, as between packets
+                clock_us += next_random() % (3 * TICK_US);
+                quicvc_timer_wheel_advance(&wheel, clock_us);
+                break;
+            case 6: {
+                // Sleep until the reported deadline, as a receive loop does
+                uint64_t next = quicvc_timer_wheel_next_deadline(&wheel);
+                if (next != QUICVC_TIMER_NONE && next > clock_us) clock_us = next;
+                quicvc_timer_wheel_advance(&wheel, clock_us);
+                break;
+            }
+            default:
+                // A long stall
+                clock_us += next_random() % (1ull << 33);
+                quicvc_timer_wheel_advance(&wheel, clock_us);
+                break;
+        }
+        check_model("random");
+    }
+
+    // Drain by sleeping from deadline to deadline; each timer takes at
+    // most one wakeup per level
+    for (int i = 0; i < TIMERS; i++) {
+        timers[i].period_us = 0;
+    }
+    size_t wakeups = 0, pending = wheel.pending;
+    uint64_t fired_before = 0, fired_after = 0;
+    for (int i = 0; i < TIMERS; i++) fired_before += timers[i].fired;
+    uint64_t next;
+    while (failures == 0 && (next = quicvc_timer_wheel_next_deadline(&wheel)) != QUICVC_TIMER_NONE) {
+        if (next > clock_us) clock_us = next;
+        quicvc_timer_wheel_advance(&wheel, clock_us);
+        check_model("drain");
+        wakeups++;
+    }
+    for (int i = 0; i < TIMERS; i++) fired_after += timers[i].fired;
+    if (wheel.pending != 0 || fired_after - fired_before > pending ||
+        wakeups > pending * (QUICVC_TIMER_LEVELS + 1)) {
+        printf("FAIL drain: %zu wakeups for %zu timers, %zu left\n", wakeups, pending, wheel.pending);
+        failures++;
+    }
+
+    printf("%s (%d failures)\n", failures ? "FAILED" : "OK", failures);
+    return failures ? 1 : 0;
+}